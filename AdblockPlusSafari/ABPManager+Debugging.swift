@@ -49,3 +49,49 @@ extension ABPManager {
             })
     }
 }
+
+// Pipeline tracing, see PipelineTrace.h.
+extension ABPManager {
+    /// Record events in the buffer shared with the content blocker extension.
+    func openSharedPipelineTrace() {
+        guard let container = FileManager.default.containerURL(forSecurityApplicationGroupIdentifier: adblockPlus.group()) else { return }
+        PipelineTraceOpenSharedBuffer(container.appendingPathComponent(PipelineTraceSharedBufferName,
+                                                                       isDirectory: false).path)
+    }
+
+    /// Export the traced events of the app and the extension, oldest first. Times and durations
+    /// are in milliseconds, times are relative to the monotonic clock. Stages sums up the spans
+    /// by name, to see which stage dominates.
+    /// - Returns: JSON data or nil if it could not be made.
+    func pipelineTraceJSON() -> Data? {
+        var events = [PipelineTraceEvent](repeating: PipelineTraceEvent(),
+                                          count: Int(PipelineTraceCapacity))
+        var overwritten: UInt64 = 0
+        let count = PipelineTraceCopyEvents(&events,
+                                            events.count,
+                                            &overwritten)
+        var stages = [String: [String: Double]]()
+        let objects = events.prefix(count).map { event -> [String: Any] in
+            var copy = event
+            let name = String(cString: &copy.name.0)
+            let duration = Double(event.duration) / 1e6
+            if event.kind == PipelineTraceKindSpan.rawValue {
+                var stage = stages[name] ?? ["count": 0, "total": 0, "max": 0]
+                stage["count", default: 0] += 1
+                stage["total", default: 0] += duration
+                stage["max"] = max(stage["max"] ?? 0, duration)
+                stages[name] = stage
+            }
+            return ["name": name,
+                    "kind": event.kind == PipelineTraceKindSpan.rawValue ? "span" : "counter",
+                    "time": Double(event.time) / 1e6,
+                    "duration": duration,
+                    "value": event.value,
+                    "process": event.process]
+        }
+        return try? JSONSerialization.data(withJSONObject: ["events": objects,
+                                                            "stages": stages,
+                                                            "overwritten": overwritten],
+                                           options: [])
+    }
+}
@@ -21,47 +21,29 @@ import libadblockplus_ios
 extension ABPManager {
     /// During the transition to Swift, filter lists stored as Objective-C model objects will be
     /// converted to Swift model structs. If a filter list cannot be converted, it will not be
-    /// visible to Swift.
+    /// visible to Swift. The lists are held decoded in the registry.
     func filterLists() -> [libadblockplus_ios.FilterList] {
-        var result = [libadblockplus_ios.FilterList]()
-        for key in adblockPlus.filterLists.keys {
-            let converted = FilterList(named: key,
-                                       fromDictionary: adblockPlus.filterLists[key])
-            if converted != nil {
-                result.append(converted!)
-            }
-        }
-        return result
+        return filterListRegistry.filterLists
     }
 
-    /// Write the filter lists back to Objective-C.
+    /// Write the filter lists back to Objective-C. The registry writes them on the main queue,
+    /// together with other changes made until then.
     /// - Parameter lists: The lists to be saved.
     func saveFilterLists(_ lists: [libadblockplus_ios.FilterList]) {
-        var converted = [String: [String: Any]]()
-        for list in lists {
-            if let name = list.name {
-                converted[name] = list.toDictionary()
-            }
-        }
-        DispatchQueue.main.async {
-            self.adblockPlus.filterLists = converted
-        }
+        filterListRegistry.replaceAll(lists)
     }
 
     /// Remove a filter list and save the results to the Objective-C side.
     func removeFilterList(_ name: String?) {
-        guard name != nil else { return }
-        saveFilterLists(filterLists().filter { $0.name != name })
+        guard let uwName = name else { return }
+        filterListRegistry.remove(named: uwName)
     }
 
     /// Set updating on all filter lists to be false.
     func setNotUpdating(forNames names: [FilterListName]) {
-        let lists = filterLists()
-        var newLists = [libadblockplus_ios.FilterList]()
-        for var list in lists {
-            list.updating = false
-            newLists.append(list)
+        for list in filterLists() {
+            guard let name = list.name else { continue }
+            filterListRegistry.update(named: name) { $0.updating = false }
         }
-        saveFilterLists(newLists)
     }
 }
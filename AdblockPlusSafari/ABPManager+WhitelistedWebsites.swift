@@ -25,14 +25,43 @@ extension ABPManager {
     /// - returns: True if whitelisting succeeded, otherwise False
     @objc
     func whiteList(withWebsite website: NSString) -> Bool {
-        guard let name = website.whitelistedHostname(), name.count > 0 else { return false }
-        var websites = ABPManager.sharedInstance().adblockPlus.whitelistedWebsites
-        if websites.contains(name) {
-            return false
+        return !whiteList(websites: [website as String]).isEmpty
+    }
+
+    /// Add websites to the user's whitelist. The whitelist is stored and the content blocker
+    /// is reloaded once, however many websites are added.
+    /// - Parameter websites: Hostnames or addresses of websites.
+    /// - Returns: Added hostnames. Websites that are already covered by the whitelist, or by
+    ///   another website of the same call, are not added.
+    func whiteList(websites: [String]) -> [String] {
+        let hostnames = websites.compactMap { hostname(forWebsite: $0) }
+        var index = currentWhitelistIndex()
+        let added = index.insert(contentsOf: hostnames)
+        if !added.isEmpty {
+            storeWhitelist(index)
         }
-        websites.append(name.lowercased().trimmingCharacters(in: .whitespaces))
-        ABPManager.sharedInstance().adblockPlus.whitelistedWebsites = websites
-        return true
+        return added
+    }
+
+    /// Remove websites from the user's whitelist, storing it and reloading the content blocker
+    /// once.
+    /// - Parameter websites: Hostnames or addresses of websites.
+    /// - Returns: Removed hostnames.
+    func removeFromWhitelist(websites: [String]) -> [String] {
+        let hostnames = websites.compactMap { hostname(forWebsite: $0) }
+        var index = currentWhitelistIndex()
+        let removed = index.remove(contentsOf: hostnames)
+        if !removed.isEmpty {
+            storeWhitelist(index)
+        }
+        return removed
+    }
+
+    /// - Parameter website: Hostname or address of a website.
+    /// - Returns: True if the website or one of its parent domains is whitelisted.
+    func isWhitelisted(website: String) -> Bool {
+        guard let hostname = hostname(forWebsite: website) else { return false }
+        return currentWhitelistIndex().covers(hostname)
     }
 
     /// Return websites that have been added to the whitelist from the URL Session tasks.
@@ -61,6 +90,30 @@ extension ABPManager {
         }.observeOn(SerialDispatchQueueScheduler(qos: .userInitiated))
     }
 
+    /// - Returns: The normalized hostname, in lower case, see HostnameNormalizer.h.
+    private func hostname(forWebsite website: String) -> String? {
+        guard let hostname = (website as NSString).whitelistedHostname(), !hostname.isEmpty else { return nil }
+        return hostname
+    }
+
+    private func currentWhitelistIndex() -> WhitelistedHostnameSet {
+        if let uwIndex = whitelistIndex {
+            return uwIndex
+        }
+        // Websites whitelisted before hostnames were lowercased may be stored in mixed case.
+        let index = WhitelistedHostnameSet(adblockPlus.whitelistedWebsites.map { $0.lowercased() })
+        whitelistIndex = index
+        return index
+    }
+
+    /// Write the whitelist. Setting it persists it and reloads the content blocker.
+    private func storeWhitelist(_ index: WhitelistedHostnameSet) {
+        whitelistIndex = index
+        isStoringWhitelist = true
+        adblockPlus.whitelistedWebsites = index.hostnames
+        isStoringWhitelist = false
+    }
+
     /// Extract the name of the whitelisted website from a URL.
     private func website(fromURL url: URL?) -> String? {
         let components = url?.query?.components(separatedBy: "&") ?? []
@@ -26,6 +26,7 @@ enum ABPState: String {
     case lastActivity
     case performingActivityTest
     case reloading
+    case whitelistedWebsites
 }
 
 /// Shared instance that contains the active Adblock Plus instance. This class
@@ -45,6 +46,20 @@ class ABPManager: NSObject {
         }
     }
 
+    /// Filter lists of adblockPlus, decoded once and indexed for the Swift side.
+    lazy var filterListRegistry: FilterListRegistry = FilterListRegistry(source: { [weak self] in
+        return self?.adblockPlus?.filterLists ?? [:]
+    }, writeBack: { [weak self] lists in
+        self?.adblockPlus?.filterLists = lists
+    })
+
+    /// Index of the whitelisted websites of adblockPlus, built when first needed and again after
+    /// the whitelist was changed elsewhere.
+    var whitelistIndex: WhitelistedHostnameSet?
+
+    /// Set while the whitelist is written from whitelistIndex.
+    var isStoringWhitelist = false
+
     /// This is a unique token (Int) that identifies a request to run in the background.
     var backgroundTaskIdentifier: UIBackgroundTaskIdentifier? {
         /// End the existing task before setting a new one.
@@ -90,6 +105,7 @@ class ABPManager: NSObject {
         setupApplicationState()
         defer {
             adblockPlus = AdblockPlusExtras(abpManager: self)
+            openSharedPipelineTrace()
             filterListsUpdater = FilterListsUpdater(abpManager: self)
         }
     }
@@ -158,6 +174,8 @@ class ABPManager: NSObject {
     /// Begin background tasks if filter lists are reloading.
     func handleDidEnterBackground() {
         inBackground.value = true
+        // Write pending settings before the app is suspended, the extension reads them.
+        try? adblockPlus.settings.commit()
         if !adblockPlus.reloading {
             return
         }
@@ -172,12 +190,12 @@ class ABPManager: NSObject {
     func handleEventsForBackgroundURLSession(identifier: String,
                                              completion: @escaping () -> Void) {
         whitelistedHostnames(forSessionID: identifier)
+            .observeOn(MainScheduler.instance)
             .subscribe(onNext: { hostnames in
-                hostnames.forEach {
-                    _ = self.whiteList(withWebsite: $0 as NSString)
-                    // Whitelisting failures are not handled at this time as a failure
-                    // would be unlikely and also self-evident.
-                }
+                // The whitelist is stored and the content blocker is reloaded once for all websites.
+                // Whitelisting failures are not handled at this time as a failure
+                // would be unlikely and also self-evident.
+                _ = self.whiteList(websites: hostnames)
             }, onCompleted: {
                 self.handleDidEnterBackground()
                 completion()
@@ -192,7 +210,8 @@ class ABPManager: NSObject {
     private func setupKVO() {
         bag = DisposeBag()
         var subs = [reloadingSubscription,
-                    filterListsSubscription]
+                    filterListsSubscription,
+                    whitelistedWebsitesSubscription]
         #if DEBUG_KVO
         subs += [activatedSubscription,
                  lastActivitySubscription,
@@ -257,6 +276,7 @@ class ABPManager: NSObject {
                            ABPState.filterLists.rawValue,
                            options: [.initial, .new])
             .subscribe(onNext: { filterLists in
+                self.filterListRegistry.sourceDidChange()
                 guard filterLists != nil else {
                     return
                 }
@@ -264,6 +284,19 @@ class ABPManager: NSObject {
             })
     }
 
+    /// Subscription of changes of the whitelist, for instance websites deleted in the settings.
+    private func whitelistedWebsitesSubscription() -> Disposable {
+        return adblockPlus.rx
+            .observeWeakly(NSArray.self,
+                           ABPState.whitelistedWebsites.rawValue,
+                           options: [.new])
+            .subscribe(onNext: { _ in
+                if !self.isStoringWhitelist {
+                    self.whitelistIndex = nil
+                }
+            })
+    }
+
     /// Check last update of filter lists.
     private func checkFilterList() {
         if adblockPlus.updating {
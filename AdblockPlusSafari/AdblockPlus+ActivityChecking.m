@@ -22,7 +22,8 @@
 /// Update the activated flag with the stored value.
 - (void)checkActivatedFlag
 {
-    BOOL activated = [self.adblockPlusDetails boolForKey:AdblockPlusActivated];
+    [self.settings reload];
+    BOOL activated = [self.settings boolForKey:AdblockPlusActivated];
     if (self.activated != activated) {
         self.activated = activated;
     }
@@ -59,6 +60,8 @@
     __weak __typeof(self) wSelf = self;
     NSDate *lastActivity = wSelf.lastActivity;
     wSelf.performingActivityTest = YES;
+    // The extension has to see the test in the stored settings.
+    [self.settings commit:nil];
     [manager reloadWithIdentifier:self.contentBlockerIdentifier
                 completionHandler:^(NSError *error) {
                     dispatch_async(dispatch_get_main_queue(), ^{
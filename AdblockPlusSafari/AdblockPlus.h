@@ -17,6 +17,8 @@
 
 #import <Foundation/Foundation.h>
 
+#import "AdblockPlusSettings.h"
+
 extern NSString *_Nonnull DefaultFilterListName;
 extern NSString *_Nonnull DefaultFilterListPlusExceptionRulesName;
 extern NSString *_Nonnull CustomFilterListName;
@@ -30,15 +32,21 @@ typedef NS_ENUM(NSUInteger, AdblockPlusFilterListType) {
 };
 
 typedef NS_ENUM(NSUInteger, AdblockPlusErrorCode) {
-    AdblockPlusErrorCodeActivityTest = 10
+    AdblockPlusErrorCodeActivityTest = 10,
+    // A parser needed more memory than its limit, see FilterListAllocator.h.
+    AdblockPlusErrorCodeMemoryLimit = 11
 };
 
 @interface AdblockPlus : NSObject
 
 @property (nonatomic, strong, readonly) NSString *__nonnull bundleName;
 
+/// Legacy storage of the settings. They are imported from here when no settings are stored yet.
 @property (nonatomic, strong, readonly) NSUserDefaults *__nonnull adblockPlusDetails;
 
+/// Settings shared with the extensions. Changes are committed in batches, see synchronize.
+@property (nonatomic, strong, readonly) AdblockPlusSettings *__nonnull settings;
+
 - (NSString *__nonnull)group;
 
 - (NSString *__nonnull)backgroundSessionConfigurationIdentifier;
@@ -67,8 +75,18 @@ typedef NS_ENUM(NSUInteger, AdblockPlusErrorCode) {
 
 - (NSString *__nonnull)activeFilterListName;
 
+/// Name of the list the given list is stored as an overlay of, nil if it is stored completely.
+/// easylist+exceptionrules repeats almost all of easylist, only the difference is kept while both
+/// are downloaded.
+- (NSString *__nullable)baseFilterListNameForFilterListName:(NSString *__nonnull)filterListName;
+
+/// The active filter list, preceded by its base if the base is downloaded. All of them are
+/// updated together, the active list is composed from them.
+- (NSArray<NSString *> *__nonnull)activeFilterListNames;
+
 @property (nonatomic) BOOL performingActivityTest;
 
+/// Commits changed settings and reads those committed by the extensions.
 - (void)synchronize;
 
 @end
@@ -46,6 +46,8 @@ static NSString *AdblockPlusSafariActionExtension = @"AdblockPlusSafariActionExt
 
 @property (nonatomic, strong) NSString *bundleName;
 
+- (NSURL *)settingsURL;
+
 @end
 
 @implementation AdblockPlus
@@ -72,25 +74,37 @@ static NSString *AdblockPlusSafariActionExtension = @"AdblockPlusSafariActionExt
         /// Above code duplicated in libadblockplus-ios.
 
         _adblockPlusDetails = [[NSUserDefaults alloc] initWithSuiteName:self.group];
-        [_adblockPlusDetails registerDefaults:
-                                 @{ AdblockPlusEnabled : @YES,
-                                     AdblockPlusAcceptableAdsEnabled : @YES,
-                                     AdblockPlusActivated : @NO,
-                                     AdblockPlusDefaultFilterListEnabled : @YES,
-                                     AdblockPlusInstalledVersion : @0,
-                                     AdblockPlusDownloadedVersion : @1,
-                                     AdblockPlusWhitelistedWebsites : @[] }];
-
-        _enabled = [_adblockPlusDetails boolForKey:AdblockPlusEnabled];
-        _acceptableAdsEnabled = [_adblockPlusDetails boolForKey:AdblockPlusAcceptableAdsEnabled];
-        _activated = [_adblockPlusDetails boolForKey:AdblockPlusActivated];
-        _defaultFilterListEnabled = [_adblockPlusDetails boolForKey:AdblockPlusDefaultFilterListEnabled];
-        _filterLists = [_adblockPlusDetails objectForKey:AdblockPlusFilterListsVersion2];
-        _installedVersion = [_adblockPlusDetails integerForKey:AdblockPlusInstalledVersion];
-        _downloadedVersion = [_adblockPlusDetails integerForKey:AdblockPlusDownloadedVersion];
-        _whitelistedWebsites = [_adblockPlusDetails objectForKey:AdblockPlusWhitelistedWebsites];
-        _lastActivity = [_adblockPlusDetails objectForKey:AdblockPlusLastActivity];
-        _performingActivityTest = [_adblockPlusDetails boolForKey:AdblockPlusPerformingActivityTest];
+        _settings = [[AdblockPlusSettings alloc] initWithURL:self.settingsURL
+                                              legacyDefaults:_adblockPlusDetails
+                                                migratedKeys:@[ AdblockPlusEnabled,
+                                                                AdblockPlusAcceptableAdsEnabled,
+                                                                AdblockPlusActivated,
+                                                                AdblockPlusDefaultFilterListEnabled,
+                                                                AdblockPlusFilterListsVersion2,
+                                                                AdblockPlusInstalledVersion,
+                                                                AdblockPlusDownloadedVersion,
+                                                                AdblockPlusWhitelistedWebsites,
+                                                                AdblockPlusLastActivity,
+                                                                AdblockPlusPerformingActivityTest ]];
+        [_settings registerDefaults:
+                       @{ AdblockPlusEnabled : @YES,
+                           AdblockPlusAcceptableAdsEnabled : @YES,
+                           AdblockPlusActivated : @NO,
+                           AdblockPlusDefaultFilterListEnabled : @YES,
+                           AdblockPlusInstalledVersion : @0,
+                           AdblockPlusDownloadedVersion : @1,
+                           AdblockPlusWhitelistedWebsites : @[] }];
+
+        _enabled = [_settings boolForKey:AdblockPlusEnabled];
+        _acceptableAdsEnabled = [_settings boolForKey:AdblockPlusAcceptableAdsEnabled];
+        _activated = [_settings boolForKey:AdblockPlusActivated];
+        _defaultFilterListEnabled = [_settings boolForKey:AdblockPlusDefaultFilterListEnabled];
+        _filterLists = [_settings objectForKey:AdblockPlusFilterListsVersion2];
+        _installedVersion = [_settings integerForKey:AdblockPlusInstalledVersion];
+        _downloadedVersion = [_settings integerForKey:AdblockPlusDownloadedVersion];
+        _whitelistedWebsites = [_settings objectForKey:AdblockPlusWhitelistedWebsites];
+        _lastActivity = [_settings objectForKey:AdblockPlusLastActivity];
+        _performingActivityTest = [_settings boolForKey:AdblockPlusPerformingActivityTest];
 
         if (!_filterLists) {
             // Load default filter lists
@@ -146,72 +160,62 @@ static NSString *AdblockPlusSafariActionExtension = @"AdblockPlusSafariActionExt
 - (void)setEnabled:(BOOL)enabled
 {
     _enabled = enabled;
-    [_adblockPlusDetails setBool:enabled forKey:AdblockPlusEnabled];
-    [_adblockPlusDetails synchronize];
+    [_settings setBool:enabled forKey:AdblockPlusEnabled];
 }
 
 - (void)setAcceptableAdsEnabled:(BOOL)acceptableAdsEnabled
 {
     _acceptableAdsEnabled = acceptableAdsEnabled;
-    [_adblockPlusDetails setBool:acceptableAdsEnabled forKey:AdblockPlusAcceptableAdsEnabled];
-    [_adblockPlusDetails synchronize];
+    [_settings setBool:acceptableAdsEnabled forKey:AdblockPlusAcceptableAdsEnabled];
 }
 
 - (void)setActivated:(BOOL)activated
 {
     _activated = activated;
-    [_adblockPlusDetails setBool:activated forKey:AdblockPlusActivated];
-    [_adblockPlusDetails synchronize];
+    [_settings setBool:activated forKey:AdblockPlusActivated];
 }
 
 - (void)setDefaultFilterListEnabled:(BOOL)defaultFilterListEnabled
 {
     _defaultFilterListEnabled = defaultFilterListEnabled;
-    [_adblockPlusDetails setBool:defaultFilterListEnabled forKey:AdblockPlusDefaultFilterListEnabled];
-    [_adblockPlusDetails synchronize];
+    [_settings setBool:defaultFilterListEnabled forKey:AdblockPlusDefaultFilterListEnabled];
 }
 
 - (void)setLastActivity:(NSDate *)lastActivity
 {
     _lastActivity = lastActivity;
-    [_adblockPlusDetails setObject:lastActivity forKey:AdblockPlusLastActivity];
-    [_adblockPlusDetails synchronize];
+    [_settings setObject:lastActivity forKey:AdblockPlusLastActivity];
 }
 
 /// Called from AdblockPlusExtras when updating filter lists.
 - (void)setFilterLists:(NSDictionary<NSString *, NSDictionary<NSString *, NSObject *> *> *)filterLists
 {
     _filterLists = filterLists;
-    [_adblockPlusDetails setObject:filterLists forKey:AdblockPlusFilterListsVersion2];
-    [_adblockPlusDetails synchronize];
+    [_settings setObject:filterLists forKey:AdblockPlusFilterListsVersion2];
 }
 
 - (void)setInstalledVersion:(NSInteger)installedVersion
 {
     _installedVersion = installedVersion;
-    [_adblockPlusDetails setInteger:installedVersion forKey:AdblockPlusInstalledVersion];
-    [_adblockPlusDetails synchronize];
+    [_settings setInteger:installedVersion forKey:AdblockPlusInstalledVersion];
 }
 
 - (void)setDownloadedVersion:(NSInteger)downloadedVersion
 {
     _downloadedVersion = downloadedVersion;
-    [_adblockPlusDetails setInteger:downloadedVersion forKey:AdblockPlusDownloadedVersion];
-    [_adblockPlusDetails synchronize];
+    [_settings setInteger:downloadedVersion forKey:AdblockPlusDownloadedVersion];
 }
 
 - (void)setWhitelistedWebsites:(NSArray<NSString *> *)whitelistedWebsites
 {
     _whitelistedWebsites = whitelistedWebsites;
-    [_adblockPlusDetails setObject:whitelistedWebsites forKey:AdblockPlusWhitelistedWebsites];
-    [_adblockPlusDetails synchronize];
+    [_settings setObject:whitelistedWebsites forKey:AdblockPlusWhitelistedWebsites];
 }
 
 - (void)setPerformingActivityTest:(BOOL)performingActivityTest
 {
     _performingActivityTest = performingActivityTest;
-    [_adblockPlusDetails setBool:performingActivityTest forKey:AdblockPlusPerformingActivityTest];
-    [_adblockPlusDetails synchronize];
+    [_settings setBool:performingActivityTest forKey:AdblockPlusPerformingActivityTest];
 }
 
 #pragma mark -
@@ -243,11 +247,43 @@ static NSString *AdblockPlusSafariActionExtension = @"AdblockPlusSafariActionExt
     return DefaultFilterListName;
 }
 
+- (NSString *__nullable)baseFilterListNameForFilterListName:(NSString *__nonnull)filterListName
+{
+    if ([filterListName isEqualToString:DefaultFilterListPlusExceptionRulesName]) {
+        return DefaultFilterListName;
+    }
+    return nil;
+}
+
+- (NSArray<NSString *> *__nonnull)activeFilterListNames
+{
+    NSString *filterListName = self.activeFilterListName;
+    NSString *baseName = [self baseFilterListNameForFilterListName:filterListName];
+    if (baseName && [self.filterLists[baseName] downloaded]) {
+        return @[ baseName, filterListName ];
+    }
+    return @[ filterListName ];
+}
+
+- (NSURL *)settingsURL
+{
+    NSFileManager *fileManager = [NSFileManager defaultManager];
+    NSURL *url = [fileManager containerURLForSecurityApplicationGroupIdentifier:self.group];
+    if (!url) {
+        url = [fileManager URLsForDirectory:NSApplicationSupportDirectory inDomains:NSUserDomainMask].firstObject;
+    }
+    return [url URLByAppendingPathComponent:@"AdblockPlusSettings.plist" isDirectory:NO];
+}
+
 - (void)synchronize
 {
-    [self.adblockPlusDetails synchronize];
+    NSError *error;
+    if (![self.settings commit:&error]) {
+        NSLog(@"Committing settings failed: %@", error);
+    }
+    [self.settings reload];
     [self willChangeValueForKey:@"lastActivity"];
-    _lastActivity = [self.adblockPlusDetails objectForKey:AdblockPlusLastActivity];
+    _lastActivity = [self.settings objectForKey:AdblockPlusLastActivity];
     [self didChangeValueForKey:@"lastActivity"];
 }
 
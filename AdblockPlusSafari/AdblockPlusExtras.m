@@ -16,6 +16,7 @@
  */
 
 #import "AdblockPlusExtras.h"
+#import "AdblockPlus+Extension.h"
 
 @import SafariServices;
 #import "AdblockPlusSafari-Swift.h"
@@ -90,8 +91,9 @@ static NSString *AdblockPlusNeedsDisplayErrorDialog = @"AdblockPlusNeedsDisplayE
     [self didChangeValueForKey:@"lastUpdate"];
     BOOL updating = self.updating;
     BOOL anyLastUpdateFailed = self.anyLastUpdateFailed;
-    if (self.installedVersion < self.downloadedVersion && wasUpdating && !updating) {
-        // Force content blocker to load newer version of filter list
+    if (self.installedVersion < self.downloadedVersion && wasUpdating && !updating
+        && !self.abpManager.filterListsUpdater.updatingBatch) {
+        // Force content blocker to load newer version of filter list, a batch reloads it when it ends
         [safariCB reloadContentBlockerWithCompletion:nil];
     }
     if (hasAnyLastUpdateFailed != anyLastUpdateFailed) {
@@ -102,14 +104,16 @@ static NSString *AdblockPlusNeedsDisplayErrorDialog = @"AdblockPlusNeedsDisplayE
 - (void)setWhitelistedWebsites:(NSArray<NSString *> *)whitelistedWebsites
 {
     super.whitelistedWebsites = whitelistedWebsites;
-    [safariCB reloadContentBlockerWithCompletion:nil];
+    // Merge before reloading, the content blocker extension then only picks up the cached list.
+    [self prepareActiveFilterListWithWhitelistedWebsites:^(NSURL *url) {
+        [self->safariCB reloadContentBlockerWithCompletion:nil];
+    }];
 }
 
 - (void)setNeedsDisplayErrorDialog:(BOOL)needsDisplayErrorDialog
 {
     _needsDisplayErrorDialog = needsDisplayErrorDialog;
-    [self.adblockPlusDetails setBool:needsDisplayErrorDialog forKey:AdblockPlusNeedsDisplayErrorDialog];
-    [self.adblockPlusDetails synchronize];
+    [self.settings setBool:needsDisplayErrorDialog forKey:AdblockPlusNeedsDisplayErrorDialog];
 }
 
 #pragma mark - Enable/Disable switch
@@ -122,12 +126,12 @@ static NSString *AdblockPlusNeedsDisplayErrorDialog = @"AdblockPlusNeedsDisplayE
 
 #pragma mark - Updating
 
-/// Calls the Swift implementation. Only the active filter list is requested to be updated. Here,
-/// the active filter list is obtained from the Objective-C side.
+/// Calls the Swift implementation. Only the active filter list and its base are requested to be
+/// updated. Here, the active filter lists are obtained from the Objective-C side.
 - (void)updateActiveFilterLists:(BOOL)userTriggered
 {
     [[[ABPManager sharedInstance] filterListsUpdater]
-                  updateFilterListsWithNames:@[self.activeFilterListName]
+                  updateFilterListsWithNames:self.activeFilterListNames
                                userTriggered:userTriggered
                                   completion:nil];
 }
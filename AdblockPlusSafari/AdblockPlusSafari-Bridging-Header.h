@@ -15,9 +15,17 @@
  * along with Adblock Plus.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#import <CommonCrypto/CommonDigest.h>
+
 #import "AdblockPlus+ActivityChecking.h"
+#import "AdblockPlus+Extension.h"
 #import "AdblockPlusExtras.h"
 #import "Appearance.h"
+#import "FilterListComposer.h"
+#import "FilterListConverter.h"
+#import "FilterListDecompressor.h"
 #import "FilterListSwiftBridge.h"
+#import "FilterListValidator.h"
 #import "NSString+AdblockPlus.h"
+#import "PipelineTrace.h"
 #import "RootController.h"
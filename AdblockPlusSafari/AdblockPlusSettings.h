@@ -0,0 +1,76 @@
+/*
+ * This file is part of Adblock Plus <https://adblockplus.org/>,
+ * Copyright (C) 2006-present eyeo GmbH
+ *
+ * Adblock Plus is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * Adblock Plus is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Adblock Plus.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#import <Foundation/Foundation.h>
+
+/// Settings shared between the app and its extensions.
+///
+/// Values are held in memory. Setting a value marks its key as changed and schedules a commit,
+/// changes made in quick succession are written together. Pending changes are committed at once
+/// when the app or the host of an extension resigns active, enters the background or terminates. A commit takes a lock shared by all
+/// processes, applies the changed keys to the latest stored snapshot, writes the result with the
+/// next generation number to a journal file and renames the journal over the settings file.
+/// Readers therefore always see a complete snapshot. A journal left behind by an interrupted
+/// commit is rolled forward or discarded the next time the settings are opened.
+@interface AdblockPlusSettings : NSObject
+
+/// Delay between the first uncommitted change and the scheduled commit. Defaults to one second.
+@property (nonatomic) NSTimeInterval commitDelay;
+
+/// Generation of the snapshot that was read or written last.
+@property (nonatomic, readonly) NSUInteger generation;
+
+/// Number of snapshots written by this instance.
+@property (nonatomic, readonly) NSUInteger writeCount;
+
+/// Number of bytes written by this instance.
+@property (nonatomic, readonly) NSUInteger writtenBytes;
+
+/// True if there are changes that are not committed yet.
+@property (nonatomic, readonly) BOOL hasChanges;
+
+/// If nothing is stored at url yet, the values of migratedKeys are imported from legacyDefaults.
+- (instancetype __nonnull)initWithURL:(NSURL *__nonnull)url
+                       legacyDefaults:(NSUserDefaults *__nullable)legacyDefaults
+                         migratedKeys:(NSArray<NSString *> *__nullable)migratedKeys NS_DESIGNATED_INITIALIZER;
+
+- (instancetype __nonnull)init NS_UNAVAILABLE;
+
+/// Values returned for keys that are not stored. They are never written.
+- (void)registerDefaults:(NSDictionary<NSString *, id> *__nonnull)defaults;
+
+- (id __nullable)objectForKey:(NSString *__nonnull)key;
+
+- (BOOL)boolForKey:(NSString *__nonnull)key;
+
+- (NSInteger)integerForKey:(NSString *__nonnull)key;
+
+/// Setting nil removes the stored value.
+- (void)setObject:(id __nullable)object forKey:(NSString *__nonnull)key;
+
+- (void)setBool:(BOOL)value forKey:(NSString *__nonnull)key;
+
+- (void)setInteger:(NSInteger)value forKey:(NSString *__nonnull)key;
+
+/// Writes the uncommitted changes now. Nothing is written if there are none.
+- (BOOL)commit:(NSError *__nullable *__nullable)error;
+
+/// Reads the stored snapshot if another process committed since it was read last. Uncommitted
+/// changes keep their values.
+- (void)reload;
+
+@end
@@ -0,0 +1,398 @@
+/*
+ * This file is part of Adblock Plus <https://adblockplus.org/>,
+ * Copyright (C) 2006-present eyeo GmbH
+ *
+ * Adblock Plus is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * Adblock Plus is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Adblock Plus.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#import "AdblockPlusSettings.h"
+
+#import <UIKit/UIKit.h>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static NSString *AdblockPlusSettingsGeneration = @"generation";
+static NSString *AdblockPlusSettingsValues = @"values";
+
+@implementation AdblockPlusSettings
+{
+    NSString *_path;
+    NSString *_journalPath;
+    NSString *_lockPath;
+    NSDictionary<NSString *, id> *_registeredDefaults;
+    NSMutableDictionary<NSString *, id> *_values;
+    NSMutableSet<NSString *> *_dirtyKeys;
+    BOOL _commitScheduled;
+
+    /// Identity of the settings file read last. Every commit replaces the file.
+    ino_t _fileInode;
+    off_t _fileSize;
+    struct timespec _fileModified;
+}
+
+- (instancetype)initWithURL:(NSURL *)url
+             legacyDefaults:(NSUserDefaults *)legacyDefaults
+               migratedKeys:(NSArray<NSString *> *)migratedKeys
+{
+    if (self = [super init]) {
+        _path = url.path;
+        _journalPath = [_path stringByAppendingString:@".journal"];
+        _lockPath = [_path stringByAppendingString:@".lock"];
+        _commitDelay = 1.0;
+        _registeredDefaults = @{};
+        _values = [NSMutableDictionary dictionary];
+        _dirtyKeys = [NSMutableSet set];
+
+        [[NSFileManager defaultManager] createDirectoryAtPath:[_path stringByDeletingLastPathComponent]
+                                  withIntermediateDirectories:YES
+                                                   attributes:nil
+                                                        error:nil];
+        if ([[NSFileManager defaultManager] fileExistsAtPath:_journalPath]) {
+            [self recoverJournal];
+        }
+        if (![self readSnapshot]) {
+            for (NSString *key in migratedKeys) {
+                id value = [legacyDefaults objectForKey:key];
+                if (value) {
+                    _values[key] = value;
+                    [_dirtyKeys addObject:key];
+                }
+            }
+            [self commit:nil];
+        }
+
+        // A suspended process does not run its scheduled commit and may be killed without notice.
+        NSNotificationCenter *center = [NSNotificationCenter defaultCenter];
+        for (NSString *name in @[ UIApplicationWillResignActiveNotification,
+                                  UIApplicationDidEnterBackgroundNotification,
+                                  UIApplicationWillTerminateNotification,
+                                  NSExtensionHostWillResignActiveNotification,
+                                  NSExtensionHostDidEnterBackgroundNotification ]) {
+            [center addObserver:self selector:@selector(commitBeforeSuspension:) name:name object:nil];
+        }
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    [[NSNotificationCenter defaultCenter] removeObserver:self];
+    [self commit:nil];
+}
+
+#pragma mark - Values
+
+- (void)registerDefaults:(NSDictionary<NSString *, id> *)defaults
+{
+    @synchronized(self) {
+        NSMutableDictionary *registeredDefaults = [_registeredDefaults mutableCopy];
+        [registeredDefaults addEntriesFromDictionary:defaults];
+        _registeredDefaults = registeredDefaults;
+    }
+}
+
+- (id)objectForKey:(NSString *)key
+{
+    @synchronized(self) {
+        return _values[key] ?: _registeredDefaults[key];
+    }
+}
+
+- (BOOL)boolForKey:(NSString *)key
+{
+    id value = [self objectForKey:key];
+    return [value respondsToSelector:@selector(boolValue)] ? [value boolValue] : NO;
+}
+
+- (NSInteger)integerForKey:(NSString *)key
+{
+    id value = [self objectForKey:key];
+    return [value respondsToSelector:@selector(integerValue)] ? [value integerValue] : 0;
+}
+
+- (void)setObject:(id)object forKey:(NSString *)key
+{
+    @synchronized(self) {
+        id current = _values[key];
+        if (current == object || [current isEqual:object]) {
+            return;
+        }
+        if (object) {
+            _values[key] = [object copy];
+        } else {
+            [_values removeObjectForKey:key];
+        }
+        [_dirtyKeys addObject:key];
+        [self scheduleCommit];
+    }
+}
+
+- (void)setBool:(BOOL)value forKey:(NSString *)key
+{
+    [self setObject:@(value) forKey:key];
+}
+
+- (void)setInteger:(NSInteger)value forKey:(NSString *)key
+{
+    [self setObject:@(value) forKey:key];
+}
+
+- (BOOL)hasChanges
+{
+    @synchronized(self) {
+        return _dirtyKeys.count > 0;
+    }
+}
+
+#pragma mark - Committing
+
+- (BOOL)commit:(NSError **)error
+{
+    @synchronized(self) {
+        if (_dirtyKeys.count == 0) {
+            return YES;
+        }
+        int lock = [self lock:error];
+        if (lock < 0) {
+            return NO;
+        }
+
+        // Another process may have committed since the snapshot was read, only the changed keys
+        // are applied to the stored values.
+        NSDictionary *stored = [self snapshotAtPath:_path];
+        NSUInteger generation = [stored[AdblockPlusSettingsGeneration] unsignedIntegerValue] + 1;
+        NSMutableDictionary *values = [stored[AdblockPlusSettingsValues] mutableCopy] ?: [NSMutableDictionary dictionary];
+        for (NSString *key in _dirtyKeys) {
+            id value = _values[key];
+            if (value) {
+                values[key] = value;
+            } else {
+                [values removeObjectForKey:key];
+            }
+        }
+
+        NSData *data = [NSPropertyListSerialization dataWithPropertyList:@{ AdblockPlusSettingsGeneration : @(generation),
+                                                                            AdblockPlusSettingsValues : values }
+                                                                  format:NSPropertyListBinaryFormat_v1_0
+                                                                 options:0
+                                                                   error:error];
+        BOOL written = data != nil && [self writeData:data toPath:_journalPath error:error];
+        if (written && rename(_journalPath.fileSystemRepresentation, _path.fileSystemRepresentation) != 0) {
+            [self setPOSIXError:error];
+            written = NO;
+        }
+        if (written) {
+            [self rememberFileIdentity];
+        } else {
+            unlink(_journalPath.fileSystemRepresentation);
+        }
+        [self unlock:lock];
+        if (!written) {
+            return NO;
+        }
+
+        _generation = generation;
+        _writeCount += 1;
+        _writtenBytes += data.length;
+        [_values setDictionary:values];
+        [_dirtyKeys removeAllObjects];
+        return YES;
+    }
+}
+
+- (void)reload
+{
+    @synchronized(self) {
+        struct stat info;
+        if (stat(_path.fileSystemRepresentation, &info) != 0
+            || (info.st_ino == _fileInode
+                && info.st_size == _fileSize
+                && info.st_mtimespec.tv_sec == _fileModified.tv_sec
+                && info.st_mtimespec.tv_nsec == _fileModified.tv_nsec)) {
+            return;
+        }
+        [self readSnapshot];
+    }
+}
+
+#pragma mark - Private
+
+- (void)scheduleCommit
+{
+    if (_commitScheduled) {
+        return;
+    }
+    _commitScheduled = YES;
+    __weak __typeof(self) wSelf = self;
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(self.commitDelay * NSEC_PER_SEC)),
+                   dispatch_get_global_queue(QOS_CLASS_UTILITY, 0), ^{
+                       [wSelf commitScheduledChanges];
+                   });
+}
+
+- (void)commitScheduledChanges
+{
+    @synchronized(self) {
+        _commitScheduled = NO;
+        NSError *error;
+        if (![self commit:&error]) {
+            NSLog(@"Committing settings failed: %@", error);
+        }
+    }
+}
+
+- (void)commitBeforeSuspension:(NSNotification *)notification
+{
+    NSError *error;
+    if (![self commit:&error]) {
+        NSLog(@"Committing settings failed: %@", error);
+    }
+}
+
+/// Replaces the values with the stored snapshot, keeping the uncommitted changes.
+- (BOOL)readSnapshot
+{
+    [self rememberFileIdentity];
+    NSDictionary *stored = [self snapshotAtPath:_path];
+    if (!stored) {
+        return NO;
+    }
+    NSMutableDictionary *values = [stored[AdblockPlusSettingsValues] mutableCopy];
+    for (NSString *key in _dirtyKeys) {
+        id value = _values[key];
+        if (value) {
+            values[key] = value;
+        } else {
+            [values removeObjectForKey:key];
+        }
+    }
+    [_values setDictionary:values];
+    _generation = [stored[AdblockPlusSettingsGeneration] unsignedIntegerValue];
+    return YES;
+}
+
+- (NSDictionary *)snapshotAtPath:(NSString *)path
+{
+    NSData *data = [NSData dataWithContentsOfFile:path];
+    if (!data) {
+        return nil;
+    }
+    NSDictionary *snapshot = [NSPropertyListSerialization propertyListWithData:data
+                                                                       options:NSPropertyListImmutable
+                                                                        format:NULL
+                                                                         error:nil];
+    if (![snapshot isKindOfClass:[NSDictionary class]]
+        || ![snapshot[AdblockPlusSettingsGeneration] isKindOfClass:[NSNumber class]]
+        || ![snapshot[AdblockPlusSettingsValues] isKindOfClass:[NSDictionary class]]) {
+        return nil;
+    }
+    return snapshot;
+}
+
+/// A journal is left behind if a commit was interrupted before renaming it. A complete journal
+/// newer than the settings file is the result of that commit.
+- (void)recoverJournal
+{
+    int lock = [self lock:nil];
+    if (lock < 0) {
+        return;
+    }
+    NSDictionary *journal = [self snapshotAtPath:_journalPath];
+    NSDictionary *stored = [self snapshotAtPath:_path];
+    if (!journal
+        || [journal[AdblockPlusSettingsGeneration] unsignedIntegerValue] <= [stored[AdblockPlusSettingsGeneration] unsignedIntegerValue]
+        || rename(_journalPath.fileSystemRepresentation, _path.fileSystemRepresentation) != 0) {
+        unlink(_journalPath.fileSystemRepresentation);
+    }
+    [self unlock:lock];
+}
+
+- (void)rememberFileIdentity
+{
+    struct stat info;
+    if (stat(_path.fileSystemRepresentation, &info) != 0) {
+        memset(&info, 0, sizeof(info));
+    }
+    _fileInode = info.st_ino;
+    _fileSize = info.st_size;
+    _fileModified = info.st_mtimespec;
+}
+
+- (BOOL)writeData:(NSData *)data toPath:(NSString *)path error:(NSError **)error
+{
+    int file = open(path.fileSystemRepresentation, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (file < 0) {
+        [self setPOSIXError:error];
+        return NO;
+    }
+    const uint8_t *bytes = data.bytes;
+    NSUInteger offset = 0;
+    while (offset < data.length) {
+        ssize_t written = write(file, bytes + offset, data.length - offset);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            [self setPOSIXError:error];
+            close(file);
+            return NO;
+        }
+        offset += (NSUInteger)written;
+    }
+    if (fsync(file) != 0) {
+        [self setPOSIXError:error];
+        close(file);
+        return NO;
+    }
+    if (close(file) != 0) {
+        [self setPOSIXError:error];
+        return NO;
+    }
+    return YES;
+}
+
+/// Serializes commits of all processes sharing the settings.
+- (int)lock:(NSError **)error
+{
+    int file = open(_lockPath.fileSystemRepresentation, O_RDWR | O_CREAT, 0644);
+    if (file < 0) {
+        [self setPOSIXError:error];
+        return -1;
+    }
+    while (flock(file, LOCK_EX) != 0) {
+        if (errno != EINTR) {
+            [self setPOSIXError:error];
+            close(file);
+            return -1;
+        }
+    }
+    return file;
+}
+
+- (void)unlock:(int)file
+{
+    flock(file, LOCK_UN);
+    close(file);
+}
+
+- (void)setPOSIXError:(NSError **)error
+{
+    if (error != NULL) {
+        *error = [NSError errorWithDomain:NSPOSIXErrorDomain code:errno userInfo:nil];
+    }
+}
+
+@end
@@ -23,7 +23,13 @@ class ContentBlockerManager: NSObject,
                              ContentBlockerManagerProtocol {
     func reload(withIdentifier identifier: String,
                 completionHandler: ((Error?) -> Void)? = nil) {
-        SFContentBlockerManager.reloadContentBlocker(withIdentifier: identifier,
-                                                     completionHandler: completionHandler)
+        let start = PipelineTraceNow()
+        SFContentBlockerManager.reloadContentBlocker(withIdentifier: identifier) { error in
+            // The value is the error code, 0 if the content blocker was reloaded.
+            PipelineTraceSpan("reload",
+                              start,
+                              Int64((error as NSError?)?.code ?? 0))
+            completionHandler?(error)
+        }
     }
 }
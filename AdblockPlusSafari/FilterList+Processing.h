@@ -24,7 +24,25 @@ extern const NSTimeInterval DefaultFilterListsUpdateInterval;
 + (BOOL)parseExpiresString:(NSString *__nonnull)expires
                         to:(NSTimeInterval *__nonnull)output;
 
+/// Validates the filter list in a single streaming pass. Version, expires, source versions,
+/// rule count and the SHA-256 of the content are set on the receiver.
 - (BOOL)parseFilterListFromURL:(NSURL *__nonnull)input
                          error:(NSError *__nullable *__nonnull)error;
 
+/// Same as parseFilterListFromURL:error:, additionally writing the compiled form of the list to
+/// compiled, see CompiledFilterList.h. Lists that cannot be compiled are still accepted, an existing
+/// compiled file is removed then.
+- (BOOL)parseFilterListFromURL:(NSURL *__nonnull)input
+                compilingToURL:(NSURL *__nullable)compiled
+                         error:(NSError *__nullable *__nonnull)error;
+
+/// Sets version, expires, rule count and content hash from the header of a compiled list, without
+/// reading the JSON. Fails if the compiled list does not belong to the current JSON at source.
+- (BOOL)readCompiledFilterListFromURL:(NSURL *__nonnull)compiled
+                   forFilterListAtURL:(NSURL *__nonnull)source;
+
+/// Writes the values collected by parseFilterListFromURL:error: as a small JSON file.
+- (BOOL)writeMetadataToURL:(NSURL *__nonnull)output
+                     error:(NSError *__nullable *__nonnull)error;
+
 @end
@@ -18,6 +18,10 @@
 #import "FilterList+Processing.h"
 
 #import "AdblockPlus.h"
+#import "CompiledFilterList.h"
+#import "FilterListAllocator.h"
+
+#import <CommonCrypto/CommonDigest.h>
 
 #include <yajl_dynamic/yajl_parse.h>
 #include <yajl_dynamic/yajl_gen.h>
@@ -25,6 +29,15 @@
 // Update filter list every 5 days
 const NSTimeInterval DefaultFilterListsUpdateInterval = 3600 * 24 * 5;
 
+typedef NS_ENUM(NSUInteger, AdblockPlusProcessingKey) {
+    AdblockPlusProcessingKeyOther,
+    AdblockPlusProcessingKeyVersion,
+    AdblockPlusProcessingKeyExpires,
+    AdblockPlusProcessingKeyRules,
+    AdblockPlusProcessingKeySources,
+    AdblockPlusProcessingKeyURL
+};
+
 @interface AdblockPlusProcessingContext : NSObject
 
 @property NSUInteger mapLevel;
@@ -35,12 +48,39 @@ const NSTimeInterval DefaultFilterListsUpdateInterval = 3600 * 24 * 5;
 @property NSString *version;
 @property NSString *expires;
 @property AdblockPlusFilterListType filterListType;
+// Last map key seen, values are attributed to it.
+@property AdblockPlusProcessingKey currentKey;
+@property BOOL rulesArrayOpen;
+@property BOOL sourcesArrayOpen;
+@property NSUInteger ruleCount;
+@property NSMutableArray<NSDictionary<NSString *, NSString *> *> *sourceVersions;
 
 @end
 
 @implementation AdblockPlusProcessingContext
 @end
 
+static AdblockPlusProcessingKey processingKey(const unsigned char *string, size_t stringLength)
+{
+    static const struct {
+        const char *name;
+        AdblockPlusProcessingKey key;
+    } keys[] = {
+        { "version", AdblockPlusProcessingKeyVersion },
+        { "expires", AdblockPlusProcessingKeyExpires },
+        { "rules", AdblockPlusProcessingKeyRules },
+        { "sources", AdblockPlusProcessingKeySources },
+        { "url", AdblockPlusProcessingKeyURL }
+    };
+
+    for (size_t i = 0; i < sizeof(keys) / sizeof(keys[0]); i++) {
+        if (strlen(keys[i].name) == stringLength && memcmp(keys[i].name, string, stringLength) == 0) {
+            return keys[i].key;
+        }
+    }
+    return AdblockPlusProcessingKeyOther;
+}
+
 static int processNull(void *ctx)
 {
     return YES;
@@ -60,16 +100,30 @@ static int processString(void *ctx, const unsigned char *string, size_t stringLe
 {
     AdblockPlusProcessingContext *context = (__bridge AdblockPlusProcessingContext *)ctx;
 
-    if (context.mapLevel == 1 && context.filterListType == AdblockPlusFilterListTypeVersion2) {
-        const char *terminatedString = strndup((const char *)string, stringLength);
-        NSString *value = [NSString stringWithCString:terminatedString encoding:NSASCIIStringEncoding];
-        if (context.versionKeyFound && !context.version) {
-            context.version = value;
+    if (context.filterListType != AdblockPlusFilterListTypeVersion2) {
+        return YES;
+    }
+
+    if (context.mapLevel == 1 && context.arrayLevel == 0) {
+        if (context.currentKey == AdblockPlusProcessingKeyVersion && !context.version) {
+            context.version = [[NSString alloc] initWithBytes:string length:stringLength encoding:NSASCIIStringEncoding];
+        }
+        if (context.currentKey == AdblockPlusProcessingKeyExpires && !context.expires) {
+            context.expires = [[NSString alloc] initWithBytes:string length:stringLength encoding:NSASCIIStringEncoding];
         }
-        if (context.expiresKeyFound && !context.expires) {
-            context.expires = value;
+    } else if (context.mapLevel == 2 && context.arrayLevel == 1 && context.sourcesArrayOpen) {
+        NSString *key = nil;
+        if (context.currentKey == AdblockPlusProcessingKeyURL) {
+            key = @"url";
+        } else if (context.currentKey == AdblockPlusProcessingKeyVersion) {
+            key = @"version";
+        }
+        NSString *value = [[NSString alloc] initWithBytes:string length:stringLength encoding:NSUTF8StringEncoding];
+        if (key && value) {
+            NSMutableDictionary *source = [context.sourceVersions.lastObject mutableCopy];
+            source[key] = value;
+            [context.sourceVersions replaceObjectAtIndex:context.sourceVersions.count - 1 withObject:source];
         }
-        free((char *)terminatedString);
     }
 
     return YES;
@@ -79,16 +133,27 @@ static int processMapKey(void *ctx, const unsigned char *string, size_t stringLe
 {
     AdblockPlusProcessingContext *context = (__bridge AdblockPlusProcessingContext *)ctx;
 
-    if (context.mapLevel == 1 && context.filterListType == AdblockPlusFilterListTypeVersion2) {
-        if (strncmp((const char *)string, "version", stringLength) == 0) {
-            context.versionKeyFound = YES;
-        }
-        if (strncmp((const char *)string, "expires", stringLength) == 0) {
-            context.expiresKeyFound = YES;
-        }
-        if (strncmp((const char *)string, "rules", stringLength) == 0) {
-            context.rulesKeyFound = YES;
+    if (context.filterListType != AdblockPlusFilterListTypeVersion2) {
+        return YES;
+    }
+
+    if (context.mapLevel == 1 && context.arrayLevel == 0) {
+        context.currentKey = processingKey(string, stringLength);
+        switch (context.currentKey) {
+            case AdblockPlusProcessingKeyVersion:
+                context.versionKeyFound = YES;
+                break;
+            case AdblockPlusProcessingKeyExpires:
+                context.expiresKeyFound = YES;
+                break;
+            case AdblockPlusProcessingKeyRules:
+                context.rulesKeyFound = YES;
+                break;
+            default:
+                break;
         }
+    } else if (context.mapLevel == 2 && context.arrayLevel == 1 && context.sourcesArrayOpen) {
+        context.currentKey = processingKey(string, stringLength);
     }
 
     return YES;
@@ -97,6 +162,17 @@ static int processMapKey(void *ctx, const unsigned char *string, size_t stringLe
 static int processStartMap(void *ctx)
 {
     AdblockPlusProcessingContext *context = (__bridge AdblockPlusProcessingContext *)ctx;
+
+    // Every element of the top level array (v1) or of the rules array (v2) is a rule.
+    if (context.arrayLevel == 1) {
+        if ((context.mapLevel == 0 && context.filterListType == AdblockPlusFilterListTypeVersion1)
+            || (context.mapLevel == 1 && context.rulesArrayOpen)) {
+            context.ruleCount += 1;
+        } else if (context.mapLevel == 1 && context.sourcesArrayOpen) {
+            [context.sourceVersions addObject:@{}];
+        }
+    }
+
     context.mapLevel += 1;
 
     if (context.mapLevel == 1 && context.arrayLevel == 0) {
@@ -116,6 +192,12 @@ static int processEndMap(void *ctx)
 static int processStartArray(void *ctx)
 {
     AdblockPlusProcessingContext *context = (__bridge AdblockPlusProcessingContext *)ctx;
+
+    if (context.mapLevel == 1 && context.arrayLevel == 0) {
+        context.rulesArrayOpen = context.currentKey == AdblockPlusProcessingKeyRules;
+        context.sourcesArrayOpen = context.currentKey == AdblockPlusProcessingKeySources;
+    }
+
     context.arrayLevel += 1;
 
     if (context.mapLevel == 0 && context.arrayLevel == 1) {
@@ -129,6 +211,12 @@ static int processEndArray(void *ctx)
 {
     AdblockPlusProcessingContext *context = (__bridge AdblockPlusProcessingContext *)ctx;
     context.arrayLevel -= 1;
+
+    if (context.mapLevel == 1 && context.arrayLevel == 0) {
+        context.rulesArrayOpen = NO;
+        context.sourcesArrayOpen = NO;
+    }
+
     return YES;
 }
 
@@ -183,42 +271,90 @@ static yajl_callbacks callbacks = {
                            userInfo:@{ NSLocalizedDescriptionKey : errorString }];
 }
 
+// Get error for a parser that exceeded the limit of its allocator
++ (NSError *)createMemoryLimitError:(FilterListAllocator *)allocator
+{
+    FilterListAllocatorStatistics statistics = FilterListAllocatorGetStatistics(allocator);
+    NSString *description = [NSString stringWithFormat:@"Memory limit of %zu bytes exceeded, %zu bytes in use",
+                                                       statistics.limit, statistics.currentBytes];
+    return [NSError errorWithDomain:AdblockPlusErrorDomain
+                               code:AdblockPlusErrorCodeMemoryLimit
+                           userInfo:@{ NSLocalizedDescriptionKey : description }];
+}
+
+- (BOOL)parseFilterListFromURL:(NSURL *__nonnull)input
+                         error:(NSError *__nullable *__nonnull)error
+{
+    return [self parseFilterListFromURL:input compilingToURL:nil error:error];
+}
+
 - (BOOL)parseFilterListFromURL:(NSURL *__nonnull)input
+                compilingToURL:(NSURL *__nullable)compiled
                          error:(NSError *__nullable *__nonnull)error
 {
     NSInputStream *inputStream = [NSInputStream inputStreamWithURL:input];
 
     yajl_handle hand = NULL;
+    FilterListAllocator *allocator = FilterListAllocatorCreate(FilterListAllocatorDefaultLimit);
     AdblockPlusProcessingContext *context = [[AdblockPlusProcessingContext alloc] init];
+    context.sourceVersions = [NSMutableArray array];
     void *contentPointer = (void *)CFBridgingRetain(context);
 
+    // The content hash is computed from the same reads that feed the parser.
+    CC_SHA256_CTX hashContext;
+    CC_SHA256_Init(&hashContext);
+
+    // The compiled list is built from the same reads as well. Lists it cannot represent are only validated.
+    CompiledFilterListCompiler *compiler = compiled ? CompiledFilterListCompilerCreate() : NULL;
+
+    // Read json file
+    const NSUInteger inputBufferLength = 64 * 1024;
+    uint8_t *inputBuffer = malloc(inputBufferLength);
+    BOOL parsed = NO;
+
     @try {
         [inputStream open];
 
-        hand = yajl_alloc(&callbacks, NULL, contentPointer);
+        if (!allocator) {
+            *error = [NSError errorWithDomain:NSPOSIXErrorDomain code:ENOMEM userInfo:nil];
+            return NO;
+        }
+        hand = yajl_alloc(&callbacks, FilterListAllocatorGetFunctions(allocator), contentPointer);
         yajl_config(hand, yajl_allow_comments, 0);
         yajl_config(hand, yajl_dont_validate_strings, 1);
 
-        // Read json file
-        const NSUInteger inputBufferLength = 256;
-        uint8_t inputBuffer[inputBufferLength];
-        NSInteger read;
+        NSInteger read = 0;
 
-        while ((read = [inputStream read:inputBuffer maxLength:inputBufferLength])) {
+        while (inputBuffer && (read = [inputStream read:inputBuffer maxLength:inputBufferLength]) > 0) {
+            CC_SHA256_Update(&hashContext, inputBuffer, (CC_LONG)read);
+            if (compiler && !CompiledFilterListCompilerParse(compiler, inputBuffer, read)) {
+                CompiledFilterListCompilerFree(compiler);
+                compiler = NULL;
+            }
 
             yajl_status status = yajl_parse(hand, inputBuffer, read);
+            if (FilterListAllocatorIsLimitExceeded(allocator)) {
+                *error = [[self class] createMemoryLimitError:allocator];
+                return NO;
+            }
             if (status != yajl_status_ok) {
                 *error = [[self class] createParserError:hand];
                 return NO;
             }
         }
 
+        if (!inputBuffer || read < 0) {
+            *error = inputStream.streamError ?: [NSError errorWithDomain:NSPOSIXErrorDomain code:ENOMEM userInfo:nil];
+            return NO;
+        }
+
         // Close parser
         yajl_status status = yajl_complete_parse(hand);
         if (status != yajl_status_ok) {
             *error = [[self class] createParserError:hand];
             return NO;
         }
+        parsed = YES;
     }
     @catch (NSException *exception) {
         *error = [NSError errorWithDomain:AdblockPlusErrorDomain
@@ -227,15 +363,45 @@ static yajl_callbacks callbacks = {
         return NO;
     }
     @finally {
+        free(inputBuffer);
+        if (!parsed) {
+            CompiledFilterListCompilerFree(compiler);
+            compiler = NULL;
+        }
         CFBridgingRelease(contentPointer);
         [inputStream close];
-        yajl_free(hand);
+        if (hand) {
+            yajl_free(hand);
+        }
+        FilterListAllocatorFree(allocator);
+    }
+
+    unsigned char digest[CC_SHA256_DIGEST_LENGTH];
+    CC_SHA256_Final(digest, &hashContext);
+    if (compiled) {
+        BOOL written = compiler && CompiledFilterListCompilerFinish(compiler,
+                                                                    compiled.fileSystemRepresentation,
+                                                                    input.fileSystemRepresentation,
+                                                                    digest);
+        CompiledFilterListCompilerFree(compiler);
+        if (!written) {
+            // An outdated compiled list would be rejected by readers anyway, but it is of no further use.
+            [[NSFileManager defaultManager] removeItemAtURL:compiled error:nil];
+        }
+    }
+
+    NSMutableString *contentHash = [NSMutableString stringWithCapacity:CC_SHA256_DIGEST_LENGTH * 2];
+    for (NSUInteger i = 0; i < CC_SHA256_DIGEST_LENGTH; i++) {
+        [contentHash appendFormat:@"%02x", digest[i]];
     }
 
     if (context.filterListType == AdblockPlusFilterListTypeVersion1) {
         // Use default values for filter list of version 1
         self.version = nil;
         self.expires = DefaultFilterListsUpdateInterval;
+        self.sourceVersions = nil;
+        self.ruleCount = context.ruleCount;
+        self.contentHash = contentHash;
         return YES;
     }
 
@@ -245,13 +411,64 @@ static yajl_callbacks callbacks = {
     }
 
     NSTimeInterval expires;
-    if (!context.expiresKeyFound || ![[self class] parseExpiresString:context.expires to:&expires]) {
+    if (!context.expiresKeyFound || !context.expires || ![[self class] parseExpiresString:context.expires to:&expires]) {
         expires = DefaultFilterListsUpdateInterval;
     }
 
     self.version = context.version;
     self.expires = expires;
+    self.sourceVersions = context.sourceVersions;
+    self.ruleCount = context.ruleCount;
+    self.contentHash = contentHash;
+    return YES;
+}
+
+- (BOOL)readCompiledFilterListFromURL:(NSURL *__nonnull)compiled
+                   forFilterListAtURL:(NSURL *__nonnull)source
+{
+    CompiledFilterList *list = CompiledFilterListOpen(compiled.fileSystemRepresentation, source.fileSystemRepresentation, NULL);
+    if (!list) {
+        return NO;
+    }
+
+    CompiledFilterListString version = CompiledFilterListGetVersion(list);
+    CompiledFilterListString expires = CompiledFilterListGetExpires(list);
+    const uint8_t *digest = CompiledFilterListGetSHA256(list);
+    NSMutableString *contentHash = [NSMutableString stringWithCapacity:CC_SHA256_DIGEST_LENGTH * 2];
+    for (NSUInteger i = 0; i < CC_SHA256_DIGEST_LENGTH; i++) {
+        [contentHash appendFormat:@"%02x", digest[i]];
+    }
+
+    NSTimeInterval expiresInterval = DefaultFilterListsUpdateInterval;
+    if (expires.bytes) {
+        NSString *expiresString = [[NSString alloc] initWithBytes:expires.bytes length:expires.length encoding:NSASCIIStringEncoding];
+        if (!expiresString || ![[self class] parseExpiresString:expiresString to:&expiresInterval]) {
+            expiresInterval = DefaultFilterListsUpdateInterval;
+        }
+    }
+
+    self.version = version.bytes ? [[NSString alloc] initWithBytes:version.bytes length:version.length encoding:NSASCIIStringEncoding] : nil;
+    self.expires = expiresInterval;
+    self.ruleCount = CompiledFilterListGetRuleCount(list);
+    self.contentHash = contentHash;
+    CompiledFilterListClose(list);
     return YES;
 }
 
+- (BOOL)writeMetadataToURL:(NSURL *__nonnull)output
+                     error:(NSError *__nullable *__nonnull)error
+{
+    NSMutableDictionary *metadata = [NSMutableDictionary dictionary];
+    [metadata setValue:self.version forKey:@"version"];
+    [metadata setValue:@(self.expires) forKey:@"expires"];
+    [metadata setValue:self.sourceVersions forKey:@"sources"];
+    [metadata setValue:@(self.ruleCount) forKey:@"ruleCount"];
+    [metadata setValue:self.contentHash forKey:@"sha256"];
+    // The rules of an overlay are only complete together with those of its base.
+    [metadata setValue:self.overlayBaseName forKey:@"base"];
+
+    NSData *data = [NSJSONSerialization dataWithJSONObject:metadata options:0 error:error];
+    return data && [data writeToURL:output options:NSDataWritingAtomic error:error];
+}
+
 @end
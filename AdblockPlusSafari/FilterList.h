@@ -39,6 +39,18 @@
 @property (nonatomic) NSTimeInterval expires;
 @property (nonatomic) NSUInteger downloadCount;
 
+// Filled while processing a downloaded filter list.
+@property (nonatomic) NSUInteger ruleCount;
+@property (nonatomic, strong, nullable) NSArray<NSDictionary<NSString *, NSString *> *> *sourceVersions;
+@property (nonatomic, strong, nullable) NSString *contentHash;
+
+// Validators of the last download, sent with conditional requests.
+@property (nonatomic, strong, nullable) NSString *entityTag;
+@property (nonatomic, strong, nullable) NSString *lastModified;
+
+// Set if the stored list leaves out the rules of this list, it is composed with it before use.
+@property (nonatomic, strong, nullable) NSString *overlayBaseName;
+
 - (instancetype __nullable)initWithDictionary:(NSDictionary *__nullable)dictionary;
 
 - (NSDictionary *__nonnull)dictionary;
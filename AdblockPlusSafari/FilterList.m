@@ -110,7 +110,7 @@
         return;
     }
 
-    if ([@[ @"taskIdentifier", @"expires", @"updatingGroupIdentifier" ] containsObject:key]) {
+    if ([@[ @"taskIdentifier", @"expires", @"updatingGroupIdentifier", @"ruleCount" ] containsObject:key]) {
         [self setValue:@0 forKey:key];
         return;
     }
@@ -0,0 +1,1282 @@
+/*
+ * This file is part of Adblock Plus <https://adblockplus.org/>,
+ * Copyright (C) 2006-present eyeo GmbH
+ *
+ * Adblock Plus is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * Adblock Plus is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Adblock Plus.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "FilterListConverter.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+const FilterListConverterOptions FilterListConverterDefaultOptions = {
+    1024 * 1024,
+    0
+};
+
+// Parts are not made smaller than this, threads are not worth it for short lists.
+#define MinimumPartLength (64 * 1024)
+#define MaximumThreadCount 8
+#define MaximumDomainCount 256
+
+// Any character that cannot be part of a host or path segment, the ^ of the filter syntax.
+static const char separator[] = "[^-_.%A-Za-z0-9]";
+
+typedef enum {
+    ResourceTypeImage = 1 << 0,
+    ResourceTypeStyleSheet = 1 << 1,
+    ResourceTypeScript = 1 << 2,
+    ResourceTypeFont = 1 << 3,
+    ResourceTypeMedia = 1 << 4,
+    ResourceTypeRaw = 1 << 5,
+    ResourceTypeSVGDocument = 1 << 6,
+    ResourceTypeDocument = 1 << 7,
+    ResourceTypePopup = 1 << 8,
+    // Documents and popups are only matched when a filter asks for them.
+    ResourceTypeDefault = (1 << 7) - 1
+} ResourceType;
+
+static const char *const resourceTypeNames[] = {
+    "image", "style-sheet", "script", "font", "media", "raw", "svg-document", "document", "popup"
+};
+
+typedef struct
+{
+    const char *name;
+    ResourceType types;
+} OptionType;
+
+static const OptionType optionTypes[] = {
+    { "image", ResourceTypeImage },
+    { "stylesheet", ResourceTypeStyleSheet },
+    { "script", ResourceTypeScript },
+    { "font", ResourceTypeFont },
+    { "media", ResourceTypeMedia },
+    { "object", ResourceTypeMedia },
+    { "xmlhttprequest", ResourceTypeRaw },
+    { "object-subrequest", ResourceTypeRaw },
+    { "ping", ResourceTypeRaw },
+    { "websocket", ResourceTypeRaw },
+    { "webrtc", ResourceTypeRaw },
+    { "other", ResourceTypeRaw },
+    { "subdocument", ResourceTypeDocument },
+    { "popup", ResourceTypePopup }
+};
+
+typedef struct
+{
+    char *bytes;
+    size_t length;
+    size_t capacity;
+    bool failed;
+} Buffer;
+
+// Rules are written in sections, as an exception only lifts the rules before it. Page exceptions
+// for element hiding, $generichide and $elemhide, follow the hiding rules they lift and precede
+// the blocking rules, which only request exceptions follow.
+typedef enum {
+    SectionGenericHiding,
+    SectionGenericHidingExceptions,
+    SectionHiding,
+    SectionHidingExceptions,
+    SectionBlocking,
+    SectionExceptions,
+    SectionCount
+} Section;
+
+// The domains of all hiding exceptions, domains#@#selector, of a selector. Content blockers cannot
+// lift a single selector, so the exceptions are folded into the hiding rules of the selector.
+typedef struct
+{
+    char *selector;
+    size_t selectorLength;
+    // Lower case domains, each followed by a comma.
+    Buffer domains;
+    // An exception without domains lifts the selector on all pages.
+    bool everywhere;
+} HidingException;
+
+// Hiding exceptions by selector, in open addressing. They are collected before the conversion and
+// only read while parts are converted.
+typedef struct
+{
+    HidingException *entries;
+    size_t capacity;
+    size_t count;
+    bool failed;
+} HidingExceptions;
+
+typedef struct
+{
+    const char *start;
+    const char *end;
+    const HidingExceptions *hidingExceptions;
+    // Rules of each section, each preceded by a comma.
+    Buffer sections[SectionCount];
+    size_t lineCount;
+    size_t ruleCount;
+    size_t exceptionCount;
+    size_t unsupportedFilterCount;
+} Part;
+
+typedef struct
+{
+    const char *start;
+    size_t length;
+} Range;
+
+static void setError(FilterListMergerError *error, FilterListMergerStatus status, int systemError, const char *format, ...)
+{
+    if (!error) {
+        return;
+    }
+
+    error->status = status;
+    error->systemError = systemError;
+
+    va_list arguments;
+    va_start(arguments, format);
+    vsnprintf(error->message, sizeof(error->message), format, arguments);
+    va_end(arguments);
+}
+
+#pragma mark - Output
+
+static void append(Buffer *buffer, const char *bytes, size_t length)
+{
+    if (buffer->failed) {
+        return;
+    }
+    if (buffer->length + length > buffer->capacity) {
+        size_t capacity = buffer->capacity ? buffer->capacity : 4096;
+        while (capacity < buffer->length + length) {
+            capacity *= 2;
+        }
+        char *bytes = realloc(buffer->bytes, capacity);
+        if (!bytes) {
+            buffer->failed = true;
+            return;
+        }
+        buffer->bytes = bytes;
+        buffer->capacity = capacity;
+    }
+    memcpy(buffer->bytes + buffer->length, bytes, length);
+    buffer->length += length;
+}
+
+static void appendCString(Buffer *buffer, const char *string)
+{
+    append(buffer, string, strlen(string));
+}
+
+static void appendJSONString(Buffer *buffer, const char *string, size_t length)
+{
+    append(buffer, "\"", 1);
+    size_t start = 0;
+    for (size_t i = 0; i < length; i++) {
+        unsigned char character = (unsigned char)string[i];
+        if (character != '"' && character != '\\' && character >= 0x20) {
+            continue;
+        }
+        append(buffer, string + start, i - start);
+        char escaped[8];
+        snprintf(escaped, sizeof(escaped), character >= 0x20 ? "\\%c" : "\\u%04x", character);
+        appendCString(buffer, escaped);
+        start = i + 1;
+    }
+    append(buffer, string + start, length - start);
+    append(buffer, "\"", 1);
+}
+
+static bool writeAll(int fd, const char *bytes, size_t length, FilterListMergerError *error)
+{
+    while (length > 0) {
+        ssize_t written = write(fd, bytes, length);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            setError(error, FilterListMergerStatusWriteError, errno, "Writing of converted filter list has failed: %s", strerror(errno));
+            return false;
+        }
+        bytes += written;
+        length -= (size_t)written;
+    }
+    return true;
+}
+
+#pragma mark - Filters
+
+static bool isSpace(char character)
+{
+    return character == ' ' || character == '\t' || character == '\r';
+}
+
+static bool hasPrefix(const char *string, size_t length, const char *prefix)
+{
+    size_t prefixLength = strlen(prefix);
+    return length >= prefixLength && strncasecmp(string, prefix, prefixLength) == 0;
+}
+
+static bool equalName(Range range, const char *name)
+{
+    return range.length == strlen(name) && strncasecmp(range.start, name, range.length) == 0;
+}
+
+static bool isHostCharacter(char character)
+{
+    return (character >= 'a' && character <= 'z') || (character >= '0' && character <= '9') || character == '-' || character == '.';
+}
+
+// Splits a list of domains, those starting with ~ are excluded. Domains are lowercased into
+// storage, content blockers only accept lower case ASCII.
+static bool parseDomains(const char *string,
+                         size_t length,
+                         char delimiter,
+                         char *storage,
+                         Range *included,
+                         size_t *includedCount,
+                         Range *excluded,
+                         size_t *excludedCount)
+{
+    *includedCount = 0;
+    *excludedCount = 0;
+    size_t start = 0;
+    for (size_t i = 0; i <= length; i++) {
+        if (i < length && string[i] != delimiter) {
+            char character = string[i];
+            storage[i] = character >= 'A' && character <= 'Z' ? (char)(character + 'a' - 'A') : character;
+            continue;
+        }
+        bool exclude = start < i && string[start] == '~';
+        Range domain = { storage + start + (exclude ? 1 : 0), i - start - (exclude ? 1 : 0) };
+        start = i + 1;
+        if (domain.length == 0) {
+            continue;
+        }
+        for (size_t j = 0; j < domain.length; j++) {
+            if (!isHostCharacter(domain.start[j])) {
+                return false;
+            }
+        }
+        size_t *count = exclude ? excludedCount : includedCount;
+        if (*count == MaximumDomainCount) {
+            return false;
+        }
+        (exclude ? excluded : included)[(*count)++] = domain;
+    }
+    return true;
+}
+
+// Content blockers do not allow both lists in one trigger.
+static bool appendDomains(Buffer *buffer, const Range *included, size_t includedCount, const Range *excluded, size_t excludedCount)
+{
+    if (includedCount > 0 && excludedCount > 0) {
+        return false;
+    }
+    const Range *domains = includedCount > 0 ? included : excluded;
+    size_t count = includedCount > 0 ? includedCount : excludedCount;
+    if (count == 0) {
+        return true;
+    }
+
+    appendCString(buffer, includedCount > 0 ? ",\"if-domain\":[" : ",\"unless-domain\":[");
+    for (size_t i = 0; i < count; i++) {
+        // The * prefix extends the domain to its subdomains, as in the filter syntax.
+        appendCString(buffer, i > 0 ? ",\"*" : "\"*");
+        append(buffer, domains[i].start, domains[i].length);
+        append(buffer, "\"", 1);
+    }
+    append(buffer, "]", 1);
+    return true;
+}
+
+// Converts the pattern of a blocking filter to a url-filter regular expression.
+static bool appendURLFilter(Buffer *buffer, const char *pattern, size_t length)
+{
+    bool hostAnchored = hasPrefix(pattern, length, "||");
+    bool startAnchored = !hostAnchored && length > 0 && pattern[0] == '|';
+    size_t start = hostAnchored ? 2 : (startAnchored ? 1 : 0);
+    bool endAnchored = length > start && pattern[length - 1] == '|';
+    size_t end = endAnchored ? length - 1 : length;
+
+    // Leading and trailing wildcards do not change what matches.
+    while (start < end && pattern[start] == '*' && !hostAnchored && !startAnchored) {
+        start += 1;
+    }
+    while (end > start && pattern[end - 1] == '*' && !endAnchored) {
+        end -= 1;
+    }
+
+    append(buffer, "\"", 1);
+    if (hostAnchored) {
+        // The scheme and any subdomains, the backslash is escaped for JSON.
+        appendCString(buffer, "^[^:]+:(//)?([^/]+\\\\.)?");
+    } else if (startAnchored) {
+        append(buffer, "^", 1);
+    }
+    if (start == end && !hostAnchored && !startAnchored && !endAnchored) {
+        appendCString(buffer, ".*");
+    }
+
+    for (size_t i = start; i < end; i++) {
+        char character = pattern[i];
+        if ((unsigned char)character >= 0x80 || (unsigned char)character < 0x20) {
+            return false;
+        }
+        switch (character) {
+        case '*':
+            if (i == start || pattern[i - 1] != '*') {
+                appendCString(buffer, ".*");
+            }
+            break;
+        case '^':
+            if (i == end - 1 && !endAnchored) {
+                // At the end the separator may also be the end of the address.
+                append(buffer, "(", 1);
+                appendCString(buffer, separator);
+                appendCString(buffer, ".*)?$");
+                endAnchored = false;
+                append(buffer, "\"", 1);
+                return true;
+            }
+            appendCString(buffer, separator);
+            break;
+        case '.':
+        case '+':
+        case '?':
+        case '$':
+        case '(':
+        case ')':
+        case '[':
+        case ']':
+        case '{':
+        case '}':
+        case '|':
+            appendCString(buffer, "\\\\");
+            append(buffer, &character, 1);
+            break;
+        case '\\':
+            appendCString(buffer, "\\\\\\\\");
+            break;
+        case '"':
+            appendCString(buffer, "\\\"");
+            break;
+        default:
+            append(buffer, &character, 1);
+            break;
+        }
+    }
+    if (endAnchored) {
+        append(buffer, "$", 1);
+    }
+    append(buffer, "\"", 1);
+    return true;
+}
+
+#pragma mark - Hiding Exceptions
+
+static size_t hashSelector(const char *selector, size_t length)
+{
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ (unsigned char)selector[i]) * 16777619u;
+    }
+    return hash;
+}
+
+// Returns the entry of the selector, or the empty entry where it belongs.
+static HidingException *hidingExceptionSlot(const HidingExceptions *exceptions, const char *selector, size_t length)
+{
+    size_t mask = exceptions->capacity - 1;
+    for (size_t i = hashSelector(selector, length) & mask;; i = (i + 1) & mask) {
+        HidingException *entry = &exceptions->entries[i];
+        if (!entry->selector || (entry->selectorLength == length && memcmp(entry->selector, selector, length) == 0)) {
+            return entry;
+        }
+    }
+}
+
+static const HidingException *findHidingException(const HidingExceptions *exceptions, const char *selector, size_t length)
+{
+    if (exceptions->count == 0) {
+        return NULL;
+    }
+    const HidingException *entry = hidingExceptionSlot(exceptions, selector, length);
+    return entry->selector ? entry : NULL;
+}
+
+static bool growHidingExceptions(HidingExceptions *exceptions)
+{
+    size_t capacity = exceptions->capacity ? exceptions->capacity * 2 : 64;
+    HidingException *entries = calloc(capacity, sizeof(*entries));
+    if (!entries) {
+        return false;
+    }
+    HidingExceptions grown = { entries, capacity, exceptions->count, false };
+    for (size_t i = 0; i < exceptions->capacity; i++) {
+        HidingException *entry = &exceptions->entries[i];
+        if (entry->selector) {
+            *hidingExceptionSlot(&grown, entry->selector, entry->selectorLength) = *entry;
+        }
+    }
+    free(exceptions->entries);
+    *exceptions = grown;
+    return true;
+}
+
+static void freeHidingExceptions(HidingExceptions *exceptions)
+{
+    for (size_t i = 0; i < exceptions->capacity; i++) {
+        free(exceptions->entries[i].selector);
+        free(exceptions->entries[i].domains.bytes);
+    }
+    free(exceptions->entries);
+}
+
+// Adds a hiding exception, domains#@#selector. Returns false for exceptions that cannot be folded,
+// those with excluded domains. Running out of memory is marked in the table.
+static bool addHidingException(HidingExceptions *exceptions, const char *domains, size_t domainsLength, const char *selector, size_t selectorLength)
+{
+    char storage[1024];
+    Range included[MaximumDomainCount];
+    Range excluded[MaximumDomainCount];
+    size_t includedCount, excludedCount;
+    if (selectorLength == 0 || domainsLength > sizeof(storage)
+        || !parseDomains(domains, domainsLength, ',', storage, included, &includedCount, excluded, &excludedCount)
+        || excludedCount > 0) {
+        return false;
+    }
+    if (exceptions->failed) {
+        return true;
+    }
+    if ((exceptions->count + 1) * 2 > exceptions->capacity && !growHidingExceptions(exceptions)) {
+        exceptions->failed = true;
+        return true;
+    }
+
+    HidingException *entry = hidingExceptionSlot(exceptions, selector, selectorLength);
+    if (!entry->selector) {
+        entry->selector = malloc(selectorLength);
+        if (!entry->selector) {
+            exceptions->failed = true;
+            return true;
+        }
+        memcpy(entry->selector, selector, selectorLength);
+        entry->selectorLength = selectorLength;
+        exceptions->count += 1;
+    }
+    entry->everywhere = entry->everywhere || includedCount == 0;
+    for (size_t i = 0; i < includedCount; i++) {
+        append(&entry->domains, included[i].start, included[i].length);
+        append(&entry->domains, ",", 1);
+    }
+    exceptions->failed = entry->domains.failed;
+    return true;
+}
+
+// Returns true if the exception lifts its selector on the domain, which is the case on the domains
+// of the exception and their subdomains.
+static bool isLiftedOnDomain(const HidingException *exception, Range domain)
+{
+    const char *start = exception->domains.bytes;
+    const char *end = start + exception->domains.length;
+    while (start < end) {
+        const char *comma = memchr(start, ',', (size_t)(end - start));
+        size_t length = (size_t)(comma - start);
+        if (domain.length >= length && memcmp(domain.start + domain.length - length, start, length) == 0
+            && (domain.length == length || domain.start[domain.length - length - 1] == '.')) {
+            return true;
+        }
+        start = comma + 1;
+    }
+    return false;
+}
+
+// Adds the domains of the exception to the unless-domain list the trigger ends with, or starts one.
+static void appendUnlessDomains(Buffer *buffer, const HidingException *exception, bool hasList)
+{
+    if (hasList) {
+        // Reopens the list.
+        buffer->length -= buffer->failed ? 0 : 1;
+    } else {
+        appendCString(buffer, ",\"unless-domain\":[");
+    }
+    bool first = !hasList;
+    const char *start = exception->domains.bytes;
+    const char *end = start + exception->domains.length;
+    while (start < end) {
+        const char *comma = memchr(start, ',', (size_t)(end - start));
+        appendCString(buffer, first ? "\"*" : ",\"*");
+        append(buffer, start, (size_t)(comma - start));
+        append(buffer, "\"", 1);
+        first = false;
+        start = comma + 1;
+    }
+    append(buffer, "]", 1);
+}
+
+#pragma mark - Conversion
+
+// Converts an element hiding filter, domains##selector. Hiding exceptions of the selector are
+// folded in: rules are dropped on the domains they lift and generic rules get the domains as
+// unless-domain. An exception on a subdomain of an included domain cannot be expressed, triggers
+// do not take both lists, so the rule is kept there.
+static bool convertHidingFilter(Part *part, const char *domains, size_t domainsLength, const char *selector, size_t selectorLength)
+{
+    if (selectorLength == 0) {
+        return false;
+    }
+
+    char storage[1024];
+    Range included[MaximumDomainCount];
+    Range excluded[MaximumDomainCount];
+    size_t includedCount, excludedCount;
+    if (domainsLength > sizeof(storage)
+        || !parseDomains(domains, domainsLength, ',', storage, included, &includedCount, excluded, &excludedCount)
+        || (includedCount > 0 && excludedCount > 0)) {
+        return false;
+    }
+
+    const HidingException *hidingException = findHidingException(part->hidingExceptions, selector, selectorLength);
+    if (hidingException) {
+        if (hidingException->everywhere) {
+            return true;
+        }
+        size_t keptCount = 0;
+        for (size_t i = 0; i < includedCount; i++) {
+            if (!isLiftedOnDomain(hidingException, included[i])) {
+                included[keptCount++] = included[i];
+            }
+        }
+        if (includedCount > 0 && keptCount == 0) {
+            return true;
+        }
+        includedCount = keptCount;
+    }
+
+    // Generic rules are those without included domains, as $generichide takes them.
+    Buffer *buffer = &part->sections[includedCount > 0 ? SectionHiding : SectionGenericHiding];
+    appendCString(buffer, ",\n{\"trigger\":{\"url-filter\":\"^https?://\"");
+    appendDomains(buffer, included, includedCount, excluded, excludedCount);
+    if (hidingException && includedCount == 0) {
+        appendUnlessDomains(buffer, hidingException, excludedCount > 0);
+    }
+    appendCString(buffer, "},\"action\":{\"type\":\"css-display-none\",\"selector\":");
+    appendJSONString(buffer, selector, selectorLength);
+    appendCString(buffer, "}}");
+    part->ruleCount += 1;
+    return true;
+}
+
+// Converts a blocking filter or its exception, [@@]pattern[$options].
+static bool convertRequestFilter(Part *part, const char *filter, size_t length)
+{
+    bool exception = hasPrefix(filter, length, "@@");
+    if (exception) {
+        filter += 2;
+        length -= 2;
+    }
+
+    // Options follow the last $, unless it is part of the pattern.
+    size_t patternLength = length;
+    for (size_t i = length; i > 0; i--) {
+        if (filter[i - 1] == '$') {
+            char next = i < length ? filter[i] : '\0';
+            if ((next >= 'a' && next <= 'z') || (next >= 'A' && next <= 'Z') || next == '~' || next == '_') {
+                patternLength = i - 1;
+            }
+            break;
+        }
+    }
+
+    // Regular expression filters use syntax content blockers do not support.
+    if (patternLength > 2 && filter[0] == '/' && filter[patternLength - 1] == '/') {
+        return false;
+    }
+
+    ResourceType types = 0;
+    ResourceType excludedTypes = 0;
+    bool thirdParty = false;
+    bool firstParty = false;
+    bool matchCase = false;
+    bool document = false;
+    bool elemhide = false;
+    bool generichide = false;
+    char storage[1024];
+    Range included[MaximumDomainCount];
+    Range excluded[MaximumDomainCount];
+    size_t includedCount = 0;
+    size_t excludedCount = 0;
+
+    size_t start = patternLength + 1;
+    while (start < length) {
+        size_t end = start;
+        while (end < length && filter[end] != ',') {
+            end += 1;
+        }
+        bool negated = filter[start] == '~';
+        Range name = { filter + start + (negated ? 1 : 0), end - start - (negated ? 1 : 0) };
+        const char *value = memchr(name.start, '=', name.length);
+        if (value) {
+            name.length = (size_t)(value - name.start);
+            value += 1;
+        }
+        start = end + 1;
+
+        if (equalName(name, "domain") && value && !negated) {
+            size_t valueLength = (size_t)(filter + end - value);
+            if (valueLength > sizeof(storage)
+                || !parseDomains(value, valueLength, '|', storage, included, &includedCount, excluded, &excludedCount)) {
+                return false;
+            }
+            continue;
+        }
+        if (value) {
+            return false;
+        }
+        if (equalName(name, "third-party")) {
+            *(negated ? &firstParty : &thirdParty) = true;
+            continue;
+        }
+        if (equalName(name, "match-case") && !negated) {
+            matchCase = true;
+            continue;
+        }
+        if (equalName(name, "document") && !negated) {
+            document = true;
+            continue;
+        }
+        if (equalName(name, "elemhide") && !negated) {
+            elemhide = true;
+            continue;
+        }
+        if (equalName(name, "generichide") && !negated) {
+            generichide = true;
+            continue;
+        }
+        if (equalName(name, "collapse")) {
+            continue;
+        }
+        bool known = false;
+        for (size_t i = 0; i < sizeof(optionTypes) / sizeof(optionTypes[0]) && !known; i++) {
+            if (equalName(name, optionTypes[i].name)) {
+                *(negated ? &excludedTypes : &types) |= optionTypes[i].types;
+                known = true;
+            }
+        }
+        // csp, rewrite, sitekey and the like.
+        if (!known) {
+            return false;
+        }
+    }
+
+    if (types == 0) {
+        types = ResourceTypeDefault;
+    }
+    types &= ~excludedTypes;
+    bool page = document || elemhide || generichide;
+    if ((types == 0 && !page) || (thirdParty && firstParty)) {
+        return false;
+    }
+
+    // Page exceptions: $document lifts all rules, $elemhide the hiding rules and $generichide the
+    // generic hiding rules.
+    Section section = exception ? SectionExceptions : SectionBlocking;
+    if (page && !document) {
+        section = elemhide ? SectionHidingExceptions : SectionGenericHidingExceptions;
+    }
+    Buffer *buffer = &part->sections[section];
+    size_t mark = buffer->length;
+    appendCString(buffer, ",\n{\"trigger\":{\"url-filter\":");
+
+    if (page) {
+        // The exception applies to whole pages on a host, ||host^$document, $elemhide or $generichide.
+        if (!exception || includedCount > 0 || excludedCount > 0 || !hasPrefix(filter, patternLength, "||")) {
+            buffer->length = mark;
+            return false;
+        }
+        size_t hostLength = patternLength - 2;
+        while (hostLength > 0 && (filter[2 + hostLength - 1] == '^' || filter[2 + hostLength - 1] == '|')) {
+            hostLength -= 1;
+        }
+        if (!parseDomains(filter + 2, hostLength, ',', storage, included, &includedCount, excluded, &excludedCount)
+            || includedCount != 1 || excludedCount != 0) {
+            buffer->length = mark;
+            return false;
+        }
+        appendCString(buffer, "\".*\"");
+        appendDomains(buffer, included, includedCount, excluded, excludedCount);
+    } else {
+        if (!appendURLFilter(buffer, filter, patternLength) || !appendDomains(buffer, included, includedCount, excluded, excludedCount)) {
+            buffer->length = mark;
+            return false;
+        }
+        if (matchCase) {
+            appendCString(buffer, ",\"url-filter-is-case-sensitive\":true");
+        }
+        if (thirdParty || firstParty) {
+            appendCString(buffer, thirdParty ? ",\"load-type\":[\"third-party\"]" : ",\"load-type\":[\"first-party\"]");
+        }
+        appendCString(buffer, ",\"resource-type\":[");
+        bool first = true;
+        for (size_t i = 0; i < sizeof(resourceTypeNames) / sizeof(resourceTypeNames[0]); i++) {
+            if (types & (1 << i)) {
+                appendCString(buffer, first ? "\"" : ",\"");
+                appendCString(buffer, resourceTypeNames[i]);
+                append(buffer, "\"", 1);
+                first = false;
+            }
+        }
+        append(buffer, "]", 1);
+    }
+
+    appendCString(buffer, exception ? "},\"action\":{\"type\":\"ignore-previous-rules\"}}" : "},\"action\":{\"type\":\"block\"}}");
+    *(exception ? &part->exceptionCount : &part->ruleCount) += 1;
+    return true;
+}
+
+// Strips the spaces around a line. Returns false for empty lines, comments and the
+// [Adblock Plus 2.0] header.
+static bool trimLine(const char **line, size_t *length)
+{
+    while (*length > 0 && isSpace((*line)[0])) {
+        *line += 1;
+        *length -= 1;
+    }
+    while (*length > 0 && isSpace((*line)[*length - 1])) {
+        *length -= 1;
+    }
+    return *length > 0 && (*line)[0] != '!' && ((*line)[0] != '[' || (*line)[*length - 1] != ']');
+}
+
+// Returns the offset of the separator of an element hiding filter, ## or #@#, #?# and #$# of
+// hiding exceptions, extended selectors and snippets, or the length for other filters.
+static size_t hidingSeparator(const char *line, size_t length)
+{
+    // Element hiding filters have domains without these characters before the separator.
+    for (size_t i = 0; i < length; i++) {
+        char character = line[i];
+        if (character == '#') {
+            if (i + 1 < length && line[i + 1] == '#') {
+                return i;
+            }
+            if (i + 2 < length && (line[i + 1] == '@' || line[i + 1] == '?' || line[i + 1] == '$') && line[i + 2] == '#') {
+                return i;
+            }
+            break;
+        }
+        if (character == '/' || character == '*' || character == '|' || character == '@' || character == '"' || character == '!') {
+            break;
+        }
+    }
+    return length;
+}
+
+static void convertLine(Part *part, const char *line, size_t length)
+{
+    if (!trimLine(&line, &length)) {
+        return;
+    }
+
+    size_t offset = hidingSeparator(line, length);
+    if (offset < length) {
+        if (line[offset + 1] == '#') {
+            if (!convertHidingFilter(part, line, offset, line + offset + 2, length - offset - 2)) {
+                part->unsupportedFilterCount += 1;
+            }
+        } else if (line[offset + 1] != '@') {
+            // Hiding exceptions were folded in before, extended selectors and snippets are not
+            // supported.
+            part->unsupportedFilterCount += 1;
+        }
+        return;
+    }
+
+    if (!convertRequestFilter(part, line, length)) {
+        part->unsupportedFilterCount += 1;
+    }
+}
+
+static void *convertPart(void *context)
+{
+    Part *part = context;
+    const char *line = part->start;
+    while (line < part->end) {
+        const char *end = memchr(line, '\n', (size_t)(part->end - line));
+        if (!end) {
+            end = part->end;
+        }
+        part->lineCount += 1;
+        convertLine(part, line, (size_t)(end - line));
+        line = end + 1;
+    }
+    return NULL;
+}
+
+#pragma mark - Header
+
+// Copies the value of a "! Key: value" comment.
+static void readHeaderValue(const char *line, size_t length, const char *key, Buffer *value)
+{
+    size_t offset = 1;
+    while (offset < length && isSpace(line[offset])) {
+        offset += 1;
+    }
+    if (!hasPrefix(line + offset, length - offset, key)) {
+        return;
+    }
+    offset += strlen(key);
+    while (offset < length && isSpace(line[offset])) {
+        offset += 1;
+    }
+    if (offset == length || line[offset] != ':') {
+        return;
+    }
+    offset += 1;
+    while (offset < length && isSpace(line[offset])) {
+        offset += 1;
+    }
+    while (length > offset && isSpace(line[length - 1])) {
+        length -= 1;
+    }
+    value->length = 0;
+    appendJSONString(value, line + offset, length - offset);
+}
+
+// Writes the start of the v2 list with the version and expires values of the leading comments.
+static void appendHeader(Buffer *header, const char *bytes, size_t length)
+{
+    Buffer version = { NULL, 0, 0, false };
+    Buffer expires = { NULL, 0, 0, false };
+    const char *line = bytes;
+    while (line < bytes + length) {
+        const char *end = memchr(line, '\n', (size_t)(bytes + length - line));
+        if (!end) {
+            end = bytes + length;
+        }
+        if (line < end && line[0] == '!') {
+            readHeaderValue(line, (size_t)(end - line), "Version", &version);
+            readHeaderValue(line, (size_t)(end - line), "Expires", &expires);
+        } else if (line < end && line[0] != '[' && line[0] != '\r') {
+            break;
+        }
+        line = end + 1;
+    }
+
+    append(header, "{", 1);
+    if (version.length > 0) {
+        appendCString(header, "\"version\":");
+        append(header, version.bytes, version.length);
+        append(header, ",", 1);
+    }
+    if (expires.length > 0) {
+        appendCString(header, "\"expires\":");
+        append(header, expires.bytes, expires.length);
+        append(header, ",", 1);
+    }
+    appendCString(header, "\"rules\":[");
+    header->failed = header->failed || version.failed || expires.failed;
+    free(version.bytes);
+    free(expires.bytes);
+}
+
+#pragma mark - Public
+
+bool FilterListConverterIsFilterText(const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    char start[16];
+    ssize_t length = read(fd, start, sizeof(start));
+    close(fd);
+    if (length <= 0) {
+        return false;
+    }
+
+    // A byte order mark may precede the header.
+    size_t offset = length >= 3 && memcmp(start, "\xef\xbb\xbf", 3) == 0 ? 3 : 0;
+    return hasPrefix(start + offset, (size_t)length - offset, "[Adblock") || start[offset] == '!';
+}
+
+// Converts the parts of a batch, all but the first on their own thread.
+static bool convertParts(Part *parts, size_t partCount)
+{
+    pthread_t threads[MaximumThreadCount];
+    size_t started = 1;
+    for (; started < partCount; started++) {
+        if (pthread_create(&threads[started], NULL, convertPart, &parts[started]) != 0) {
+            break;
+        }
+    }
+    convertPart(&parts[0]);
+    for (size_t i = 1; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    // Parts that could not get a thread are converted here.
+    for (size_t i = started; i < partCount; i++) {
+        convertPart(&parts[i]);
+    }
+
+    for (size_t i = 0; i < partCount; i++) {
+        for (size_t section = 0; section < SectionCount; section++) {
+            if (parts[i].sections[section].failed) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static void splitBatch(Part *parts, size_t partCount, const char *bytes, size_t length)
+{
+    const char *start = bytes;
+    for (size_t i = 0; i < partCount; i++) {
+        const char *end = bytes + length * (i + 1) / partCount;
+        if (i == partCount - 1) {
+            end = bytes + length;
+        } else if (end < start) {
+            end = start;
+        } else {
+            const char *newline = memchr(end, '\n', (size_t)(bytes + length - end));
+            end = newline ? newline + 1 : bytes + length;
+        }
+        parts[i].start = start;
+        parts[i].end = end;
+        for (size_t section = 0; section < SectionCount; section++) {
+            parts[i].sections[section].length = 0;
+        }
+        start = end;
+    }
+}
+
+typedef struct
+{
+    int input;
+    // The first section is written to the output, all others are collected in temporary files and
+    // appended in order after the last batch.
+    int sections[SectionCount];
+    bool sectionsWritten[SectionCount];
+    HidingExceptions hidingExceptions;
+    char *batch;
+    Part parts[MaximumThreadCount];
+    size_t partCount;
+    size_t threadCount;
+    bool headerWritten;
+    FilterListConverterResult result;
+} Conversion;
+
+typedef bool (*BatchHandler)(Conversion *conversion, const char *bytes, size_t length, FilterListMergerError *error);
+
+// Reads the input from the start and passes batches of complete lines to the handler. Lines longer
+// than a batch are skipped and added to skippedLineCount, if given.
+static bool readBatches(Conversion *conversion, size_t batchLength, BatchHandler handler, size_t *skippedLineCount, FilterListMergerError *error)
+{
+    if (lseek(conversion->input, 0, SEEK_SET) != 0) {
+        setError(error, FilterListMergerStatusReadError, errno, "Reading has failed: %s", strerror(errno));
+        return false;
+    }
+
+    size_t filled = 0;
+    bool skippingLine = false;
+    bool endOfFile = false;
+    while (!endOfFile) {
+        while (filled < batchLength) {
+            ssize_t bytesRead = read(conversion->input, conversion->batch + filled, batchLength - filled);
+            if (bytesRead < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                setError(error, FilterListMergerStatusReadError, errno, "Reading has failed: %s", strerror(errno));
+                return false;
+            }
+            if (bytesRead == 0) {
+                endOfFile = true;
+                break;
+            }
+            filled += (size_t)bytesRead;
+        }
+
+        // Only complete lines are converted, the rest is kept for the next batch.
+        size_t start = 0;
+        size_t length = filled;
+        if (!endOfFile) {
+            while (length > 0 && conversion->batch[length - 1] != '\n') {
+                length -= 1;
+            }
+        }
+        if (skippingLine) {
+            const char *newline = memchr(conversion->batch, '\n', length);
+            start = newline ? (size_t)(newline - conversion->batch) + 1 : length;
+            skippingLine = newline == NULL;
+        }
+        if (length == 0 && !endOfFile) {
+            // A line longer than a batch.
+            if (skippedLineCount && !skippingLine) {
+                *skippedLineCount += 1;
+            }
+            skippingLine = true;
+            filled = 0;
+            continue;
+        }
+
+        if (!handler(conversion, conversion->batch + start, length - start, error)) {
+            return false;
+        }
+
+        memmove(conversion->batch, conversion->batch + length, filled - length);
+        filled -= length;
+    }
+    return true;
+}
+
+// Collects the hiding exceptions of a batch, so that they are known before any hiding rule is
+// converted, wherever they are in the list.
+static bool collectHidingExceptions(Conversion *conversion, const char *bytes, size_t length, FilterListMergerError *error)
+{
+    const char *line = bytes;
+    while (line < bytes + length) {
+        const char *end = memchr(line, '\n', (size_t)(bytes + length - line));
+        if (!end) {
+            end = bytes + length;
+        }
+        const char *filter = line;
+        size_t filterLength = (size_t)(end - line);
+        line = end + 1;
+        if (!trimLine(&filter, &filterLength)) {
+            continue;
+        }
+        size_t offset = hidingSeparator(filter, filterLength);
+        if (offset == filterLength || filter[offset + 1] != '@') {
+            continue;
+        }
+        if (addHidingException(&conversion->hidingExceptions, filter, offset, filter + offset + 3, filterLength - offset - 3)) {
+            conversion->result.hidingExceptionCount += 1;
+        } else {
+            conversion->result.unsupportedFilterCount += 1;
+        }
+    }
+    if (conversion->hidingExceptions.failed) {
+        setError(error, FilterListMergerStatusGenerateError, ENOMEM, "Out of memory");
+        return false;
+    }
+    return true;
+}
+
+// Writes the sections of all parts in order. The comma in front of the very first rule is dropped.
+static bool writeParts(Conversion *conversion, FilterListMergerError *error)
+{
+    for (size_t i = 0; i < conversion->partCount; i++) {
+        Part *part = &conversion->parts[i];
+        for (size_t section = 0; section < SectionCount; section++) {
+            Buffer *rules = &part->sections[section];
+            if (rules->length == 0) {
+                continue;
+            }
+            size_t skip = section == SectionGenericHiding && !conversion->sectionsWritten[section] ? 1 : 0;
+            if (!writeAll(conversion->sections[section], rules->bytes + skip, rules->length - skip, error)) {
+                return false;
+            }
+            conversion->sectionsWritten[section] = true;
+        }
+    }
+    return true;
+}
+
+static bool convertBatch(Conversion *conversion, const char *bytes, size_t length, FilterListMergerError *error)
+{
+    if (!conversion->headerWritten) {
+        Buffer header = { NULL, 0, 0, false };
+        appendHeader(&header, bytes, length);
+        if (header.failed) {
+            free(header.bytes);
+            setError(error, FilterListMergerStatusGenerateError, ENOMEM, "Out of memory");
+            return false;
+        }
+        bool written = writeAll(conversion->sections[SectionGenericHiding], header.bytes, header.length, error);
+        free(header.bytes);
+        if (!written) {
+            return false;
+        }
+        conversion->headerWritten = true;
+    }
+
+    size_t partCount = length / MinimumPartLength + 1;
+    conversion->partCount = partCount < conversion->threadCount ? partCount : conversion->threadCount;
+    splitBatch(conversion->parts, conversion->partCount, bytes, length);
+    if (!convertParts(conversion->parts, conversion->partCount)) {
+        setError(error, FilterListMergerStatusGenerateError, ENOMEM, "Out of memory");
+        return false;
+    }
+    return writeParts(conversion, error);
+}
+
+// Appends the sections collected in temporary files to the output.
+static bool appendSections(Conversion *conversion, FilterListMergerError *error)
+{
+    bool first = !conversion->sectionsWritten[SectionGenericHiding];
+    for (size_t section = SectionGenericHiding + 1; section < SectionCount; section++) {
+        if (!conversion->sectionsWritten[section]) {
+            continue;
+        }
+        int fd = conversion->sections[section];
+        if (lseek(fd, 0, SEEK_SET) != 0) {
+            setError(error, FilterListMergerStatusReadError, errno, "Converted rules could not be read: %s", strerror(errno));
+            return false;
+        }
+        for (;;) {
+            ssize_t bytesRead = read(fd, conversion->batch, MinimumPartLength);
+            if (bytesRead < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                setError(error, FilterListMergerStatusReadError, errno, "Converted rules could not be read: %s", strerror(errno));
+                return false;
+            }
+            if (bytesRead == 0) {
+                break;
+            }
+            size_t skip = first ? 1 : 0;
+            if (!writeAll(conversion->sections[SectionGenericHiding], conversion->batch + skip, (size_t)bytesRead - skip, error)) {
+                return false;
+            }
+            first = false;
+        }
+    }
+    return true;
+}
+
+static bool convert(Conversion *conversion, const FilterListConverterOptions *options, FilterListMergerError *error)
+{
+    size_t batchLength = options->batchLength > MinimumPartLength ? options->batchLength : MinimumPartLength;
+    conversion->threadCount = options->threadCount;
+    if (conversion->threadCount == 0) {
+        long processors = sysconf(_SC_NPROCESSORS_ONLN);
+        conversion->threadCount = processors > 0 ? (size_t)processors : 1;
+    }
+    if (conversion->threadCount > MaximumThreadCount) {
+        conversion->threadCount = MaximumThreadCount;
+    }
+
+    conversion->batch = malloc(batchLength);
+    if (!conversion->batch) {
+        setError(error, FilterListMergerStatusReadError, ENOMEM, "Out of memory");
+        return false;
+    }
+
+    // Hiding exceptions may follow the rules they lift, so they are collected in a pass of their own.
+    if (!readBatches(conversion, batchLength, collectHidingExceptions, NULL, error)) {
+        return false;
+    }
+    for (size_t i = 0; i < MaximumThreadCount; i++) {
+        conversion->parts[i].hidingExceptions = &conversion->hidingExceptions;
+    }
+    size_t skippedLineCount = 0;
+    if (!readBatches(conversion, batchLength, convertBatch, &skippedLineCount, error)) {
+        return false;
+    }
+
+    conversion->result.lineCount += skippedLineCount;
+    conversion->result.unsupportedFilterCount += skippedLineCount;
+    for (size_t i = 0; i < MaximumThreadCount; i++) {
+        Part *part = &conversion->parts[i];
+        conversion->result.lineCount += part->lineCount;
+        conversion->result.ruleCount += part->ruleCount + part->exceptionCount;
+        conversion->result.exceptionCount += part->exceptionCount;
+        conversion->result.unsupportedFilterCount += part->unsupportedFilterCount;
+    }
+    if (conversion->result.ruleCount == 0) {
+        setError(error, FilterListMergerStatusParseError, 0, "No filter of %zu lines could be converted", conversion->result.lineCount);
+        return false;
+    }
+
+    return appendSections(conversion, error) && writeAll(conversion->sections[SectionGenericHiding], "\n]}\n", 4, error);
+}
+
+bool FilterListConverterConvertFile(const char *inputPath,
+                                    const char *outputPath,
+                                    const FilterListConverterOptions *options,
+                                    FilterListConverterResult *result,
+                                    FilterListMergerError *error)
+{
+    Conversion conversion;
+    memset(&conversion, 0, sizeof(conversion));
+    for (size_t section = 0; section < SectionCount; section++) {
+        conversion.sections[section] = -1;
+    }
+
+    conversion.input = open(inputPath, O_RDONLY);
+    if (conversion.input < 0) {
+        setError(error, FilterListMergerStatusReadError, errno, "%s: %s", inputPath, strerror(errno));
+        return false;
+    }
+
+    conversion.sections[SectionGenericHiding] = open(outputPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    bool opened = conversion.sections[SectionGenericHiding] >= 0;
+    for (size_t section = SectionGenericHiding + 1; section < SectionCount && opened; section++) {
+        char sectionPath[1024];
+        snprintf(sectionPath, sizeof(sectionPath), "%s.section%zu", outputPath, section);
+        conversion.sections[section] = open(sectionPath, O_RDWR | O_CREAT | O_TRUNC, 0600);
+        opened = conversion.sections[section] >= 0;
+        if (opened) {
+            // The file is only needed while it is open.
+            unlink(sectionPath);
+        }
+    }
+
+    bool converted = false;
+    if (!opened) {
+        setError(error, FilterListMergerStatusWriteError, errno, "%s: %s", outputPath, strerror(errno));
+    } else {
+        converted = convert(&conversion, options ? options : &FilterListConverterDefaultOptions, error);
+    }
+
+    close(conversion.input);
+    for (size_t section = SectionGenericHiding + 1; section < SectionCount; section++) {
+        if (conversion.sections[section] >= 0) {
+            close(conversion.sections[section]);
+        }
+    }
+    int output = conversion.sections[SectionGenericHiding];
+    if (output >= 0 && close(output) != 0 && converted) {
+        setError(error, FilterListMergerStatusWriteError, errno, "%s: %s", outputPath, strerror(errno));
+        converted = false;
+    }
+    if (!converted) {
+        unlink(outputPath);
+    }
+    for (size_t i = 0; i < MaximumThreadCount; i++) {
+        for (size_t section = 0; section < SectionCount; section++) {
+            free(conversion.parts[i].sections[section].bytes);
+        }
+    }
+    freeHidingExceptions(&conversion.hidingExceptions);
+    free(conversion.batch);
+
+    if (result) {
+        *result = conversion.result;
+    }
+    return converted;
+}
@@ -0,0 +1,85 @@
+/*
+ * This file is part of Adblock Plus <https://adblockplus.org/>,
+ * Copyright (C) 2006-present eyeo GmbH
+ *
+ * Adblock Plus is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * Adblock Plus is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Adblock Plus.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FilterListConverter_h
+#define FilterListConverter_h
+
+// Converts filter lists in Adblock Plus filter syntax to v2 content blocker lists, so that any
+// subscription can be used without a conversion server.
+//
+// Supported are element hiding filters with domains and their exceptions, blocking filters and
+// their exceptions with the domain, third-party, match-case and resource type options, and
+// document, elemhide and generichide exceptions. Other filters are counted and skipped.
+//
+// Content blockers cannot lift a single selector, so hiding exceptions, domains#@#selector, are
+// folded into the hiding rules of their selector: generic rules get the domains as unless-domain,
+// domain specific rules lose the lifted domains. Other exceptions become ignore-previous-rules,
+// which lifts all rules before it. Rules are therefore written in sections: generic hiding rules,
+// generichide exceptions, the other hiding rules, elemhide exceptions, blocking rules and the
+// remaining exceptions.
+//
+// The input is read twice, first for the hiding exceptions. For the conversion each batch is split
+// into one part per thread at line boundaries and the parts are converted in parallel. Memory use
+// depends on the batch length and the hiding exceptions, not on the size of the list. All
+// sections but the first are kept in temporary files until the end.
+
+#include "FilterListMerger.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct
+{
+    // Bytes of input converted at once, lines longer than this are skipped.
+    size_t batchLength;
+    // Threads converting a batch, 0 for one per processor.
+    size_t threadCount;
+} FilterListConverterOptions;
+
+extern const FilterListConverterOptions FilterListConverterDefaultOptions;
+
+typedef struct
+{
+    size_t lineCount;
+    // Rules written, exceptions included.
+    size_t ruleCount;
+    size_t exceptionCount;
+    // Hiding exceptions folded into the hiding rules.
+    size_t hidingExceptionCount;
+    // Filters using syntax or options content blockers do not support.
+    size_t unsupportedFilterCount;
+} FilterListConverterResult;
+
+/// Returns true if the file starts like a list in filter syntax, with an [Adblock Plus] header or
+/// a comment.
+bool FilterListConverterIsFilterText(const char *path);
+
+/// Converts the list at inputPath and writes it to outputPath. The version and expires values of
+/// the header comments are kept. Fails if no filter could be converted. options and result may be
+/// NULL.
+bool FilterListConverterConvertFile(const char *inputPath,
+                                    const char *outputPath,
+                                    const FilterListConverterOptions *options,
+                                    FilterListConverterResult *result,
+                                    FilterListMergerError *error);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FilterListConverter_h */
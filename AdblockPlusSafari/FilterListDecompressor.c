@@ -0,0 +1,169 @@
+/*
+ * This file is part of Adblock Plus <https://adblockplus.org/>,
+ * Copyright (C) 2006-present eyeo GmbH
+ *
+ * Adblock Plus is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * Adblock Plus is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Adblock Plus.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "FilterListDecompressor.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+
+static const size_t bufferLength = 64 * 1024;
+
+static void setError(FilterListMergerError *error, FilterListMergerStatus status, int systemError, const char *format, ...)
+{
+    if (!error) {
+        return;
+    }
+
+    error->status = status;
+    error->systemError = systemError;
+
+    va_list arguments;
+    va_start(arguments, format);
+    vsnprintf(error->message, sizeof(error->message), format, arguments);
+    va_end(arguments);
+}
+
+static bool writeAll(int fd, const uint8_t *bytes, size_t length, FilterListMergerError *error)
+{
+    while (length > 0) {
+        ssize_t written = write(fd, bytes, length);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            setError(error, FilterListMergerStatusWriteError, errno, "Writing of inflated filter list has failed: %s", strerror(errno));
+            return false;
+        }
+        bytes += written;
+        length -= (size_t)written;
+    }
+    return true;
+}
+
+bool FilterListDecompressorIsCompressed(const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    uint8_t header[2];
+    ssize_t length = read(fd, header, sizeof(header));
+    close(fd);
+    if (length != sizeof(header)) {
+        return false;
+    }
+
+    // gzip magic, or a zlib header with deflate compression and a valid check value.
+    bool gzip = header[0] == 0x1f && header[1] == 0x8b;
+    bool zlib = (header[0] & 0x0f) == Z_DEFLATED && ((header[0] << 8) | header[1]) % 31 == 0;
+    return gzip || zlib;
+}
+
+bool FilterListDecompressorInflateFile(const char *inputPath,
+                                       const char *outputPath,
+                                       FilterListMergerError *error)
+{
+    if (error) {
+        memset(error, 0, sizeof(*error));
+    }
+
+    int input = open(inputPath, O_RDONLY);
+    if (input < 0) {
+        setError(error, FilterListMergerStatusReadError, errno, "Opening of compressed filter list has failed: %s", strerror(errno));
+        return false;
+    }
+    int output = open(outputPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (output < 0) {
+        setError(error, FilterListMergerStatusWriteError, errno, "Opening of inflated filter list has failed: %s", strerror(errno));
+        close(input);
+        return false;
+    }
+
+    uint8_t *inputBuffer = malloc(bufferLength);
+    uint8_t *outputBuffer = malloc(bufferLength);
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    // 32 enables detection of the gzip and zlib headers.
+    bool initialized = inputBuffer && outputBuffer && inflateInit2(&stream, MAX_WBITS + 32) == Z_OK;
+    bool result = initialized;
+    bool ended = false;
+    if (!initialized) {
+        setError(error, FilterListMergerStatusReadError, ENOMEM, "Inflating of filter list could not be started");
+    }
+
+    while (result) {
+        ssize_t length = read(input, inputBuffer, bufferLength);
+        if (length < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            setError(error, FilterListMergerStatusReadError, errno, "Reading of compressed filter list has failed: %s", strerror(errno));
+            result = false;
+            break;
+        }
+        if (length == 0) {
+            break;
+        }
+
+        stream.next_in = inputBuffer;
+        stream.avail_in = (uInt)length;
+        while (result && stream.avail_in > 0) {
+            if (ended) {
+                // Another gzip member follows.
+                inflateReset(&stream);
+                ended = false;
+            }
+            stream.next_out = outputBuffer;
+            stream.avail_out = (uInt)bufferLength;
+            int status = inflate(&stream, Z_NO_FLUSH);
+            if (status != Z_OK && status != Z_STREAM_END && status != Z_BUF_ERROR) {
+                setError(error, FilterListMergerStatusParseError, 0, "Inflating of filter list has failed: %s", stream.msg ? stream.msg : "invalid data");
+                result = false;
+                break;
+            }
+            ended = status == Z_STREAM_END;
+            result = writeAll(output, outputBuffer, bufferLength - stream.avail_out, error);
+        }
+    }
+
+    if (result && !ended) {
+        setError(error, FilterListMergerStatusParseError, 0, "Compressed filter list is truncated");
+        result = false;
+    }
+
+    if (initialized) {
+        inflateEnd(&stream);
+    }
+    free(inputBuffer);
+    free(outputBuffer);
+    close(input);
+    if (close(output) != 0 && result) {
+        setError(error, FilterListMergerStatusWriteError, errno, "Closing of inflated filter list has failed: %s", strerror(errno));
+        result = false;
+    }
+    if (!result) {
+        unlink(outputPath);
+    }
+    return result;
+}
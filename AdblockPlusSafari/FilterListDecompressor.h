@@ -0,0 +1,43 @@
+/*
+ * This file is part of Adblock Plus <https://adblockplus.org/>,
+ * Copyright (C) 2006-present eyeo GmbH
+ *
+ * Adblock Plus is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * Adblock Plus is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Adblock Plus.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FilterListDecompressor_h
+#define FilterListDecompressor_h
+
+// Inflates filter lists that arrive compressed. Content-Encoding is decoded by NSURLSession, this
+// handles bodies it passes through unchanged, like lists served as gzip files.
+
+#include "FilterListMerger.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/// Returns true if the file starts with the gzip or zlib header.
+bool FilterListDecompressorIsCompressed(const char *path);
+
+/// Inflates a gzip or zlib compressed file to outputPath. Concatenated gzip members are inflated
+/// one after another.
+bool FilterListDecompressorInflateFile(const char *inputPath,
+                                       const char *outputPath,
+                                       FilterListMergerError *error);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FilterListDecompressor_h */
@@ -0,0 +1,275 @@
+/*
+ * This file is part of Adblock Plus <https://adblockplus.org/>,
+ * Copyright (C) 2006-present eyeo GmbH
+ *
+ * Adblock Plus is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * Adblock Plus is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Adblock Plus.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+import libadblockplus_ios
+
+/// Applies a rule level diff to the copy of a filter list as it was downloaded.
+///
+/// A diff is served with `contentType` and has the form of a v2 list:
+///
+///     {"from": "<version of the stored list>", "version": "<new version>", "sha256": "<hex>",
+///      "removed": [<indices of removed rules of the stored list>],
+///      "added": [<indices of the added rules in the resulting list>],
+///      "rules": [<added rules>]}
+///
+/// Both index arrays are ascending. Top level values other than from, sha256, removed and added
+/// replace those of the stored list. sha256 is the digest of the resulting rules array without
+/// whitespace between the rules, `[r0,r1,...]`, every rule written as in complete lists.
+struct FilterListPatcher {
+    static let contentType = "application/vnd.adblockplus.filterlist-diff+json"
+
+    /// - Parameter response: Response of a filter list download.
+    /// - Returns: True if the response body is a diff.
+    static func isDiff(_ response: HTTPURLResponse?) -> Bool {
+        return response?.mimeType == contentType
+    }
+
+    /// Apply a diff to a stored list. The stored list is only replaced if the result matches the
+    /// digest of the diff.
+    /// - Parameters:
+    ///   - diff: File URL of the diff.
+    ///   - base: File URL of the stored list, as it was downloaded.
+    /// - Throws: ABPFilterListError.diffNotApplicable if the diff does not belong to the stored
+    ///   list or the result does not match, ABPFilterListError.invalidData if a file cannot be read.
+    func apply(diff: URL,
+               to base: URL) throws {
+        let patch = try Patch(url: diff)
+        let temporary = base.deletingLastPathComponent()
+            .appendingPathComponent(".\(base.lastPathComponent).patched",
+                                    isDirectory: false)
+        defer { try? FileManager.default.removeItem(at: temporary) }
+
+        let digest = try write(patch: patch,
+                               base: base,
+                               to: temporary)
+        guard digest == patch.sha256.lowercased() else {
+            throw ABPFilterListError.diffNotApplicable
+        }
+        if rename(temporary.path, base.path) != 0 {
+            throw ABPFilterListError.invalidData
+        }
+    }
+
+    // ------------------------------------------------------------
+    // MARK: - Private -
+    // ------------------------------------------------------------
+
+    /// Merge the rules of the stored list with those of the diff.
+    /// - Returns: Hex digest of the resulting rules array.
+    private func write(patch: Patch,
+                       base: URL,
+                       to output: URL) throws -> String {
+        guard let stream = OutputStream(url: output,
+                                        append: false)
+        else {
+            throw ABPFilterListError.invalidData
+        }
+        stream.open()
+        defer { stream.close() }
+        let writer = DigestingWriter(stream: stream)
+
+        let reader = try FilterListRuleReader(url: base)
+        var next = try reader.nextRuleData()
+        guard reader.isVersion2,
+            let version = reader.header.first(where: { $0.key == "version" })?.value,
+            Patch.decodeString(version) == patch.from
+        else {
+            throw ABPFilterListError.diffNotApplicable
+        }
+
+        // Replacements are written in place of the stored values, new values at the end.
+        var replacements = patch.header
+        func writeHeaderEntry(_ entry: (key: String, value: Data),
+                              prefix: String = "",
+                              suffix: String = "") throws {
+            var value = entry.value
+            if let index = replacements.index(where: { $0.key == entry.key }) {
+                value = replacements.remove(at: index).value
+            }
+            try writer.write(Data(prefix.utf8))
+            try writer.write(try JSONEncoder().encode([entry.key]).dropFirst().dropLast())
+            try writer.write(Data(":".utf8))
+            try writer.write(value)
+            try writer.write(Data(suffix.utf8))
+        }
+
+        try writer.write(Data("{".utf8))
+        let leadingHeaderCount = reader.header.count
+        for entry in reader.header {
+            try writeHeaderEntry(entry,
+                                 suffix: ",")
+        }
+        try writer.write(Data("\"rules\":".utf8))
+
+        var baseIndex = 0
+        var removed = patch.removed[...]
+        var added = Array(zip(patch.added, patch.rules))[...]
+        var resultCount = 0
+        writer.startDigest()
+        try writer.write(Data("[".utf8))
+        func writeRule(_ rule: Data) throws {
+            try writer.write(resultCount > 0 ? Data(",".utf8) : Data())
+            try writer.write(rule)
+            resultCount += 1
+        }
+        func writeAddedRules() throws {
+            while let first = added.first, first.0 == resultCount {
+                try writeRule(first.1)
+                added = added.dropFirst()
+            }
+        }
+        while let rule = next {
+            if removed.first == baseIndex {
+                removed = removed.dropFirst()
+            } else {
+                try writeAddedRules()
+                try writeRule(rule)
+            }
+            baseIndex += 1
+            next = try reader.nextRuleData()
+        }
+        try writeAddedRules()
+        try writer.write(Data("]".utf8))
+        let digest = writer.finishDigest()
+        guard removed.isEmpty && added.isEmpty else {
+            throw ABPFilterListError.diffNotApplicable
+        }
+
+        for entry in reader.header[leadingHeaderCount...] {
+            try writeHeaderEntry(entry,
+                                 prefix: ",")
+        }
+        for entry in replacements {
+            try writeHeaderEntry(entry,
+                                 prefix: ",")
+        }
+        try writer.write(Data("}".utf8))
+        try writer.flush()
+        return digest
+    }
+}
+
+/// Contents of a diff.
+private struct Patch {
+    private static let controlKeys = ["from", "sha256", "removed", "added"]
+
+    let from: String
+    let sha256: String
+    let removed: [Int]
+    let added: [Int]
+    let rules: [Data]
+    /// Values replacing those of the stored list.
+    let header: [(key: String, value: Data)]
+
+    init(url: URL) throws {
+        let reader = try FilterListRuleReader(url: url)
+        var rules = [Data]()
+        while let rule = try reader.nextRuleData() {
+            rules.append(rule)
+        }
+        func value(_ key: String) -> Data? {
+            return reader.header.first(where: { $0.key == key })?.value
+        }
+        guard reader.isVersion2,
+            let from = Patch.decodeString(value("from")),
+            let sha256 = Patch.decodeString(value("sha256")),
+            let removed = Patch.decodeIndices(value("removed")),
+            let added = Patch.decodeIndices(value("added")),
+            added.count == rules.count
+        else {
+            throw ABPFilterListError.diffNotApplicable
+        }
+        self.from = from
+        self.sha256 = sha256
+        self.removed = removed
+        self.added = added
+        self.rules = rules
+        header = reader.header.filter { !Patch.controlKeys.contains($0.key) }
+    }
+
+    /// Top level string values are not accepted by JSONDecoder, they are decoded in an array.
+    static func decodeString(_ value: Data?) -> String? {
+        guard let uwValue = value else { return nil }
+        let array = Data("[".utf8) + uwValue + Data("]".utf8)
+        return (try? JSONDecoder().decode([String].self, from: array))?.first
+    }
+
+    /// - Returns: Strictly ascending, non-negative indices or nil.
+    static func decodeIndices(_ value: Data?) -> [Int]? {
+        guard let uwValue = value,
+            let indices = try? JSONDecoder().decode([Int].self, from: uwValue)
+        else {
+            return nil
+        }
+        for (index, element) in indices.enumerated() where element < 0 || (index > 0 && element <= indices[index - 1]) {
+            return nil
+        }
+        return indices
+    }
+}
+
+/// Buffers writes to an output stream and computes the SHA-256 of a part of the output.
+private final class DigestingWriter {
+    private let stream: OutputStream
+    private var buffer = Data()
+    private let bufferLength = 64 * 1024
+    private var context = CC_SHA256_CTX()
+    private var digesting = false
+
+    init(stream: OutputStream) {
+        self.stream = stream
+        buffer.reserveCapacity(bufferLength)
+    }
+
+    func startDigest() {
+        CC_SHA256_Init(&context)
+        digesting = true
+    }
+
+    func finishDigest() -> String {
+        var digest = [UInt8](repeating: 0, count: Int(CC_SHA256_DIGEST_LENGTH))
+        CC_SHA256_Final(&digest, &context)
+        digesting = false
+        return digest.map { String(format: "%02x", $0) }.joined()
+    }
+
+    func write(_ data: Data) throws {
+        if digesting {
+            data.withUnsafeBytes { (bytes: UnsafePointer<UInt8>) -> Void in
+                _ = CC_SHA256_Update(&context, bytes, CC_LONG(data.count))
+            }
+        }
+        buffer.append(data)
+        if buffer.count >= bufferLength {
+            try flush()
+        }
+    }
+
+    func flush() throws {
+        var offset = 0
+        while offset < buffer.count {
+            let written = buffer.withUnsafeBytes { (bytes: UnsafePointer<UInt8>) -> Int in
+                stream.write(bytes + offset, maxLength: buffer.count - offset)
+            }
+            if written <= 0 {
+                throw ABPFilterListError.invalidData
+            }
+            offset += written
+        }
+        buffer.removeAll(keepingCapacity: true)
+    }
+}
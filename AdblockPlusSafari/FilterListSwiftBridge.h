@@ -24,5 +24,12 @@
 - (nonnull instancetype)initWithDictionary:(nonnull NSDictionary *)dictionary;
 - (BOOL)parseFilterListFromURL:(nonnull NSURL *)url
                      withError:(NSError *__nullable *__nullable)error;
+- (BOOL)parseFilterListFromURL:(nonnull NSURL *)url
+                compilingToURL:(nullable NSURL *)compiledURL
+                     withError:(NSError *__nullable *__nullable)error;
+- (BOOL)readCompiledFilterListFromURL:(nonnull NSURL *)compiledURL
+                   forFilterListAtURL:(nonnull NSURL *)url;
+- (BOOL)writeMetadataToURL:(nonnull NSURL *)url
+                 withError:(NSError *__nullable *__nullable)error;
 
 @end
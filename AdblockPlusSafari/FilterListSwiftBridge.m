@@ -33,7 +33,7 @@
     return self;
 }
 
-/// Check the parsability of a filter list.
+/// Check the parsability of a filter list. Metadata found while parsing is set on filterList.
 - (BOOL)parseFilterListFromURL:(nonnull NSURL *)url
                      withError:(NSError *__nullable *__nullable)error
 {
@@ -41,4 +41,30 @@
                                              error:error];
 }
 
+/// Check the parsability of a filter list and write its compiled form in the same pass.
+- (BOOL)parseFilterListFromURL:(nonnull NSURL *)url
+                compilingToURL:(nullable NSURL *)compiledURL
+                     withError:(NSError *__nullable *__nullable)error
+{
+    return [self.filterList parseFilterListFromURL:url
+                                    compilingToURL:compiledURL
+                                             error:error];
+}
+
+/// Set the metadata of a filter list from its compiled form, without parsing the JSON.
+- (BOOL)readCompiledFilterListFromURL:(nonnull NSURL *)compiledURL
+                   forFilterListAtURL:(nonnull NSURL *)url
+{
+    return [self.filterList readCompiledFilterListFromURL:compiledURL
+                                       forFilterListAtURL:url];
+}
+
+/// Write the metadata of the last parsed filter list.
+- (BOOL)writeMetadataToURL:(nonnull NSURL *)url
+                 withError:(NSError *__nullable *__nullable)error
+{
+    return [self.filterList writeMetadataToURL:url
+                                         error:error];
+}
+
 @end
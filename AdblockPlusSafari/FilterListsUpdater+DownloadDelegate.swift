@@ -18,6 +18,18 @@
 import libadblockplus_ios
 import RxSwift
 
+/// Outcome of processing a filter list download.
+/// - stored: A changed list was stored.
+/// - notModified: The stored list is current.
+/// - needsFullDownload: A diff could not be applied, the complete list has to be downloaded.
+/// - failed: The download could not be used.
+enum FilterListDownloadResult {
+    case stored
+    case notModified
+    case needsFullDownload
+    case failed
+}
+
 /// Implementation of URLSessionDownloadDelegate and related support functions.
 extension FilterListsUpdater {
 
@@ -79,22 +91,50 @@ extension FilterListsUpdater {
         if var lastEvent = lastDownloadEvent(taskID: downloadTask.taskIdentifier) {
             lastEvent.didFinishDownloading = true
             downloadEvents[downloadTask.taskIdentifier]?.onNext(lastEvent) // new event
+            if let start = lastEvent.resumeTime {
+                PipelineTraceSpan("download",
+                                  start,
+                                  lastEvent.totalBytesWritten ?? 0)
+            }
         }
 
         let name = filterListNameForTaskTaskIdentifier(taskIdentifier: downloadTask.taskIdentifier)
         guard let uwName = name else { return }
         guard var list = filterList(withName: name) else { return }
         let response = downloadTask.response as? HTTPURLResponse
-        if !validURLResponse(response) {
+        guard let uwDestination = storedFilterListURL(for: list) else { return }
+        switch processDownload(at: location,
+                               response: response,
+                               destination: uwDestination,
+                               filterList: &list) {
+        case .failed:
+            return
+        case .notModified:
+            // The stored list is kept, there is nothing to parse or reload.
+            list.lastUpdateFailed = false
+            list.updating = false
+            list.taskIdentifier = nil
+            replaceFilterList(withName: uwName,
+                              withNewList: list)
+            if var lastEvent = lastDownloadEvent(taskID: downloadTask.taskIdentifier) {
+                lastEvent.notModified = true
+                downloadEvents[downloadTask.taskIdentifier]?.onNext(lastEvent)
+            }
+            return
+        case .needsFullDownload:
+            // The task is not a failure, the complete list is downloaded by the observer of the
+            // download events.
+            list.taskIdentifier = nil
+            replaceFilterList(withName: uwName,
+                              withNewList: list)
+            if var lastEvent = lastDownloadEvent(taskID: downloadTask.taskIdentifier) {
+                lastEvent.needsFullDownload = true
+                downloadEvents[downloadTask.taskIdentifier]?.onNext(lastEvent)
+            }
             return
+        case .stored:
+            break
         }
-        let fileManager = FileManager.default
-        let containerURL = fileManager.containerURL(forSecurityApplicationGroupIdentifier: group())
-        guard let fileName = list.fileName else { return }
-        let destination = containerURL?.appendingPathComponent(fileName,
-                                                               isDirectory: false)
-        moveOrReplaceItem(source: location,
-                          destination: destination)
         list.lastUpdate = Date()
         list.downloaded = true
         list.lastUpdateFailed = false
@@ -102,21 +142,263 @@ extension FilterListsUpdater {
         list.taskIdentifier = nil
         downloadedVersion += 1
 
-        // Test parsing of the filter list and set the version.
-        guard let objcList = list.toDictionary() else { return }
-        let bridge = FilterListSwiftBridge(dictionary: objcList)
-        guard let uwDestination = destination else { return }
-        do {
-            try bridge.parseFilterList(from: uwDestination)
-            try setVersion(url: uwDestination,
-                           filterList: &list)
-        } catch {
-            return
-        }
+        // A list repeating its base is kept as an overlay, the extension composes both again.
+        list.overlayBaseName = storeOverlay(forFilterListNamed: uwName,
+                                            at: uwDestination)
+        // The metadata describes the installed file, which may be the overlay.
+        guard storeMetadata(at: uwDestination,
+                            filterList: &list) else { return }
 
         // Save the modified filter list.
         replaceFilterList(withName: uwName,
                           withNewList: list)
+        // Overlays of this list were taken from its previous rules.
+        storeOverlays(ofBaseNamed: uwName)
+
+        // Filter lists are saved on the main queue, merge after the new state is visible.
+        DispatchQueue.main.async {
+            self.abpManager?.adblockPlus.prepareActiveFilterList(withWhitelistedWebsites: nil)
+        }
+    }
+
+    /// Handle the response of a filter list download. A changed list is stored and installed, the
+    /// validators of the response are recorded on the filter list.
+    /// - Parameters:
+    ///   - location: Local URL of the downloaded body.
+    ///   - response: Response of the download.
+    ///   - destination: Local URL of the list used for content blocking.
+    ///   - filterList: Internal model struct for the list.
+    /// - Returns: What became of the download.
+    func processDownload(at location: URL,
+                         response: HTTPURLResponse?,
+                         destination: URL,
+                         filterList: inout libadblockplus_ios.FilterList) -> FilterListDownloadResult {
+        // Not Modified, the validators of the stored list matched.
+        if response?.statusCode == 304 {
+            setValidators(from: response,
+                          filterList: &filterList)
+            filterList.lastUpdate = Date()
+            return .notModified
+        }
+        if !validURLResponse(response) {
+            return .failed
+        }
+        guard let inflated = decompressedDownload(at: location) else { return .failed }
+        defer {
+            if inflated != location {
+                try? FileManager.default.removeItem(at: inflated)
+            }
+        }
+        guard let body = convertedDownload(at: inflated) else { return .failed }
+        defer {
+            if body != inflated {
+                try? FileManager.default.removeItem(at: body)
+            }
+        }
+        if !storeDownloadedFilterList(at: body,
+                                      response: response,
+                                      destination: destination,
+                                      named: filterList.name ?? "") {
+            return .needsFullDownload
+        }
+        setValidators(from: response,
+                      filterList: &filterList)
+        return .stored
+    }
+
+    /// Inflate a compressed download. Content-Encoding is already decoded by URL sessions, this
+    /// covers lists that are served compressed.
+    /// - Parameter location: Local URL of the downloaded body.
+    /// - Returns: URL of the inflated body, the given URL if it is not compressed or nil if
+    ///   inflating fails.
+    func decompressedDownload(at location: URL) -> URL? {
+        if !FilterListDecompressorIsCompressed(location.path) {
+            return location
+        }
+        let inflated = location.appendingPathExtension("inflated")
+        var error = FilterListMergerError()
+        if !FilterListDecompressorInflateFile(location.path,
+                                              inflated.path,
+                                              &error) {
+            #if DEBUG
+            NSLog("Download not inflated: \(String(cString: &error.message.0))")
+            #endif
+            return nil
+        }
+        return inflated
+    }
+
+    /// Convert a download in filter syntax to a content blocker list, so that subscriptions
+    /// without a converted version can be used.
+    /// - Parameter location: Local URL of the downloaded body.
+    /// - Returns: URL of the converted body, the given URL if it is already a content blocker list
+    ///   or nil if converting fails.
+    func convertedDownload(at location: URL) -> URL? {
+        if !FilterListConverterIsFilterText(location.path) {
+            return location
+        }
+        let converted = location.appendingPathExtension("converted")
+        var result = FilterListConverterResult()
+        var error = FilterListMergerError()
+        let start = PipelineTraceNow()
+        let success = FilterListConverterConvertFile(location.path,
+                                                     converted.path,
+                                                     nil,
+                                                     &result,
+                                                     &error)
+        PipelineTraceSpan("convert",
+                          start,
+                          Int64(result.ruleCount))
+        if !success {
+            #if DEBUG
+            NSLog("Download not converted: \(String(cString: &error.message.0))")
+            #endif
+            return nil
+        }
+        #if DEBUG
+        NSLog("Converted \(result.ruleCount) of \(result.lineCount) lines, \(result.hidingExceptionCount) hiding exceptions folded, "
+            + "\(result.unsupportedFilterCount) filters not supported")
+        #endif
+        return converted
+    }
+
+    /// Keep a downloaded list as the base for later diffs and install the optimized list without
+    /// the rules WebKit would reject.
+    /// - Parameters:
+    ///   - location: Local URL of the download, either a complete list or a diff.
+    ///   - response: Response of the download.
+    ///   - destination: Local URL of the list used for content blocking.
+    ///   - name: Name of the list, used for reporting.
+    /// - Returns: False if the download is a diff that could not be applied. The base is removed
+    ///   in that case, so that the complete list is requested.
+    func storeDownloadedFilterList(at location: URL,
+                                   response: HTTPURLResponse?,
+                                   destination: URL,
+                                   named name: FilterListName) -> Bool {
+        let base = baseURL(forFilterListURL: destination)
+        if FilterListPatcher.isDiff(response) {
+            do {
+                try FilterListPatcher().apply(diff: location,
+                                              to: base)
+            } catch {
+                #if DEBUG
+                NSLog("Diff for \(name) not applied: \(error)")
+                #endif
+                try? FileManager.default.removeItem(at: base)
+                return false
+            }
+        } else {
+            moveOrReplaceItem(source: location,
+                              destination: base)
+        }
+        optimizeFilterList(from: base,
+                           to: destination,
+                           named: name)
+        validateFilterList(at: destination,
+                           named: name)
+        return true
+    }
+
+    /// Replace a stored list by the rules its base does not have. Both are taken as they were
+    /// downloaded, the overlay is then optimized and validated like a complete list. The download
+    /// of the list remains the only complete copy, diffs are applied to it.
+    /// - Parameters:
+    ///   - name: Name of the list.
+    ///   - url: Local URL where the list is saved.
+    /// - Returns: Name of the base if the list is stored as an overlay of it, nil otherwise.
+    func storeOverlay(forFilterListNamed name: FilterListName,
+                      at url: URL) -> FilterListName? {
+        guard let baseName = abpManager?.adblockPlus.baseFilterListName(forFilterListName: name),
+            let baseList = filterList(withName: baseName),
+            baseList.downloaded == true,
+            let baseListURL = storedFilterListURL(for: baseList),
+            FileManager.default.fileExists(atPath: baseListURL.path)
+        else { return nil }
+        let overlayURL = url.deletingLastPathComponent()
+            .appendingPathComponent(".\(url.lastPathComponent).overlay",
+                                    isDirectory: false)
+        defer {
+            try? FileManager.default.removeItem(at: overlayURL)
+        }
+        var result = FilterListComposerResult()
+        var error = FilterListMergerError()
+        if !FilterListComposerWriteOverlay(baseURL(forFilterListURL: baseListURL).path,
+                                           baseURL(forFilterListURL: url).path,
+                                           overlayURL.path,
+                                           &result,
+                                           &error) {
+            #if DEBUG
+            NSLog("\(name) not stored as overlay: \(String(cString: &error.message.0))")
+            #endif
+            return nil
+        }
+        optimizeFilterList(from: overlayURL,
+                           to: url,
+                           named: name)
+        validateFilterList(at: url,
+                           named: name)
+        #if DEBUG
+        NSLog("Stored \(name) as overlay of \(baseName): \(result.ruleCount) rules kept, \(result.duplicateCount) found in the base")
+        #endif
+        return baseName
+    }
+
+    /// Store the lists kept as overlays of a base again, after the base has changed. A list that
+    /// can no longer be stored as an overlay is installed completely.
+    /// - Parameter baseName: Name of the base.
+    func storeOverlays(ofBaseNamed baseName: FilterListName) {
+        for var overlayList in abpManager?.filterListRegistry.filterLists ?? [] {
+            guard let name = overlayList.name,
+                overlayList.downloaded == true,
+                abpManager?.adblockPlus.baseFilterListName(forFilterListName: name) == baseName,
+                let url = storedFilterListURL(for: overlayList),
+                FileManager.default.fileExists(atPath: baseURL(forFilterListURL: url).path)
+            else { continue }
+            let overlayBaseName = storeOverlay(forFilterListNamed: name,
+                                               at: url)
+            if overlayBaseName == nil && overlayList.overlayBaseName != nil {
+                optimizeFilterList(from: baseURL(forFilterListURL: url),
+                                   to: url,
+                                   named: name)
+                validateFilterList(at: url,
+                                   named: name)
+            }
+            overlayList.overlayBaseName = overlayBaseName
+            storeMetadata(at: url,
+                          filterList: &overlayList)
+            replaceFilterList(withName: name,
+                              withNewList: overlayList)
+        }
+    }
+
+    /// Test parsing of an installed list and set its metadata, all in one pass over the file. The
+    /// compiled form and the metadata sidecar are written in the same pass, the extension merges
+    /// from the compiled form.
+    /// - Parameters:
+    ///   - url: Local URL where the list is saved.
+    ///   - filterList: Internal model struct for the list.
+    /// - Returns: False if the list could not be parsed.
+    @discardableResult
+    func storeMetadata(at url: URL,
+                       filterList: inout libadblockplus_ios.FilterList) -> Bool {
+        guard let objcList = filterList.toDictionary() else { return false }
+        let bridge = FilterListSwiftBridge(dictionary: objcList)
+        let parseStart = PipelineTraceNow()
+        do {
+            try bridge.parseFilterList(from: url,
+                                       compilingTo: compiledURL(forFilterListURL: url))
+        } catch {
+            try? FileManager.default.removeItem(at: compiledURL(forFilterListURL: url))
+            return false
+        }
+        PipelineTraceSpan("parse",
+                          parseStart,
+                          Int64(bridge.filterList?.ruleCount ?? 0))
+        setMetadata(from: bridge,
+                    filterList: &filterList)
+        // The sidecar file is informational, a failed write does not invalidate the list.
+        try? bridge.writeMetadata(to: metadataURL(forFilterListURL: url))
+        return true
     }
 
     /// Parse the v2 filter list version and set it on the internal filter list model struct.
@@ -126,14 +408,140 @@ extension FilterListsUpdater {
     /// - Throws: ABP error if parsing fails.
     func setVersion(url: URL,
                     filterList: inout libadblockplus_ios.FilterList) throws {
+        guard let objcList = filterList.toDictionary() else { throw ABPFilterListError.invalidData }
+        let bridge = FilterListSwiftBridge(dictionary: objcList)
+        // A current compiled list holds the metadata in its header.
+        if bridge.readCompiledFilterList(from: compiledURL(forFilterListURL: url),
+                                         forFilterListAt: url) {
+            setMetadata(from: bridge,
+                        filterList: &filterList)
+            return
+        }
         do {
-            let data = try Data(contentsOf: url,
-                                options: .uncached)
-            let json = V2FilterList(with: data)
-            filterList.version = json?.version
+            try bridge.parseFilterList(from: url)
         } catch {
             throw ABPFilterListError.invalidData
         }
+        setMetadata(from: bridge,
+                    filterList: &filterList)
+    }
+
+    /// Copy the values found by the streaming parser to the internal filter list model struct.
+    /// - Parameters:
+    ///   - bridge: Bridge that has parsed the list.
+    ///   - filterList: Internal model struct for the list.
+    func setMetadata(from bridge: FilterListSwiftBridge,
+                     filterList: inout libadblockplus_ios.FilterList) {
+        guard let parsed = bridge.filterList else { return }
+        filterList.version = parsed.version
+        filterList.ruleCount = Int(parsed.ruleCount)
+    }
+
+    /// Merge hiding rules sharing a trigger. The downloaded list is installed unchanged if
+    /// optimizing fails.
+    /// - Parameters:
+    ///   - source: Local URL of the list as it was downloaded, it is left in place.
+    ///   - url: Local URL where the list is saved.
+    ///   - name: Name of the list, used for reporting.
+    /// - Returns: Rule counts before and after optimizing or nil on failure.
+    @discardableResult
+    func optimizeFilterList(from source: URL,
+                            to url: URL,
+                            named name: FilterListName) -> FilterListOptimizationResult? {
+        let optimizedURL = url.deletingLastPathComponent()
+            .appendingPathComponent(".\(url.lastPathComponent).optimized",
+                                    isDirectory: false)
+        do {
+            let result = try FilterListOptimizer().optimize(from: source,
+                                                            to: optimizedURL)
+            moveOrReplaceItem(source: optimizedURL,
+                              destination: url)
+            #if DEBUG
+            NSLog("Optimized \(name): \(result.removedRuleCount) of \(result.inputRuleCount) rules removed, "
+                + "\(result.undecodableRuleCount) copied undecoded")
+            #endif
+            return result
+        } catch {
+            try? FileManager.default.removeItem(at: optimizedURL)
+            try? FileManager.default.removeItem(at: url)
+            try? FileManager.default.copyItem(at: source,
+                                              to: url)
+            return nil
+        }
+    }
+
+    /// Remove the rules WebKit would reject from an installed list, so that a single unsupported
+    /// rule does not keep the whole list from loading. Valid lists are only read.
+    /// - Parameters:
+    ///   - url: Local URL of the list.
+    ///   - name: Name of the list, used for reporting.
+    /// - Returns: Indices of the first removed rules, or nil if the list could not be read.
+    @discardableResult
+    func validateFilterList(at url: URL,
+                            named name: FilterListName) -> [Int]? {
+        let validatedURL = url.deletingLastPathComponent()
+            .appendingPathComponent(".\(url.lastPathComponent).validated",
+                                    isDirectory: false)
+        var result = FilterListValidatorResult()
+        var error = FilterListMergerError()
+        let start = PipelineTraceNow()
+        defer {
+            PipelineTraceSpan("validate",
+                              start,
+                              Int64(result.rejectedRuleCount))
+        }
+        if !FilterListValidatorValidateFile(url.path,
+                                            validatedURL.path,
+                                            &result,
+                                            &error) {
+            #if DEBUG
+            NSLog("\(name) not validated: \(String(cString: &error.message.0))")
+            #endif
+            return nil
+        }
+        // The C array of indices is imported as a tuple, its elements are read from its bytes.
+        let reportedCount = result.reportedRuleCount
+        let removed = withUnsafeBytes(of: &result.reportedRuleIndices) { bytes in
+            (0..<reportedCount).map {
+                bytes.load(fromByteOffset: $0 * MemoryLayout<Int>.stride,
+                           as: Int.self)
+            }
+        }
+        if result.rejectedRuleCount > 0 {
+            moveOrReplaceItem(source: validatedURL,
+                              destination: url)
+            #if DEBUG
+            NSLog("Validated \(name): \(result.rejectedRuleCount) of \(result.ruleCount) rules removed, first ones at \(removed)")
+            #endif
+        }
+        return removed
+    }
+
+    /// - Parameter filterList: A filter list.
+    /// - Returns: Local URL of the list used for content blocking.
+    func storedFilterListURL(for filterList: libadblockplus_ios.FilterList) -> URL? {
+        guard let fileName = filterList.fileName else { return nil }
+        let containerURL = FileManager.default.containerURL(forSecurityApplicationGroupIdentifier: group())
+        return containerURL?.appendingPathComponent(fileName,
+                                                    isDirectory: false)
+    }
+
+    /// - Parameter url: Local URL of a filter list.
+    /// - Returns: URL of the list as it was downloaded, diffs are applied to it.
+    func baseURL(forFilterListURL url: URL) -> URL {
+        return url.appendingPathExtension("base")
+    }
+
+    /// - Parameter url: Local URL of a filter list.
+    /// - Returns: URL of the metadata file stored next to the list.
+    func metadataURL(forFilterListURL url: URL) -> URL {
+        return url.appendingPathExtension("metadata")
+    }
+
+    /// - Parameter url: Local URL of a filter list.
+    /// - Returns: URL of the compiled list stored next to the list.
+    func compiledURL(forFilterListURL url: URL) -> URL {
+        return url.appendingPathExtension("compiled")
     }
 
     // ------------------------------------------------------------
@@ -168,6 +576,29 @@ extension FilterListsUpdater {
         }
     }
 
+    /// Copy ETag and Last-Modified of a response, they are sent with the next download.
+    private func setValidators(from response: HTTPURLResponse?,
+                               filterList: inout libadblockplus_ios.FilterList) {
+        guard let uwResponse = response else { return }
+        if let entityTag = headerValue("ETag", in: uwResponse) {
+            filterList.entityTag = entityTag
+        }
+        if let lastModified = headerValue("Last-Modified", in: uwResponse) {
+            filterList.lastModified = lastModified
+        }
+    }
+
+    /// Header names are case insensitive, allHeaderFields is not.
+    private func headerValue(_ field: String,
+                             in response: HTTPURLResponse) -> String? {
+        for (key, value) in response.allHeaderFields {
+            if let uwKey = key as? String, uwKey.caseInsensitiveCompare(field) == .orderedSame {
+                return value as? String
+            }
+        }
+        return nil
+    }
+
     /// Return true if the status code is valid.
     private func validURLResponse(_ response: HTTPURLResponse?) -> Bool {
         if let uwResponse = response {
@@ -182,50 +613,15 @@ extension FilterListsUpdater {
     /// Replace an existing filter list with a new one.
     internal func replaceFilterList(withName name: String,
                                     withNewList newList: libadblockplus_ios.FilterList) {
-        guard let abpMgr = abpManager else { return }
-        var lists = abpMgr.filterLists()
-        var index = 0
-        var replaceIndex: Int?
-        var cnt = 0
-        for list in lists {
-            if list.name == name {
-                replaceIndex = index
-                cnt += 1
-            }
-            index += 1
-        }
-        assert(cnt == 0 || cnt == 1)
-        if let uwReplaceIndex = replaceIndex {
-            lists[uwReplaceIndex] = newList
-        }
-        abpMgr.saveFilterLists(lists)
+        abpManager?.filterListRegistry.update(named: name) { $0 = newList }
     }
 
-    private func filterList(withName name: String?) -> libadblockplus_ios.FilterList? {
-        guard name != nil else { return nil }
-        guard let uwAbpManager = abpManager else { return nil }
-        let lists: [libadblockplus_ios.FilterList] = uwAbpManager.filterLists()
-        var result: libadblockplus_ios.FilterList?
-        var cnt = 0
-        for list in lists where list.name == name {
-            cnt += 1
-            result = list
-        }
-        assert(cnt == 0 || cnt == 1)
-        return result
+    func filterList(withName name: String?) -> libadblockplus_ios.FilterList? {
+        return abpManager?.filterListRegistry.filterList(named: name)
     }
 
     /// Return the filter list name for a given task identifier.
     private func filterListNameForTaskTaskIdentifier(taskIdentifier: Int) -> FilterListName? {
-        guard let uwAbpManager = abpManager else { return nil }
-        let lists = uwAbpManager.filterLists()
-        var result: FilterListName?
-        var cnt = 0
-        for list in lists where list.taskIdentifier == taskIdentifier {
-            result = list.name
-            cnt += 1
-        }
-        assert(cnt == 0 || cnt == 1)
-        return result
+        return abpManager?.filterListRegistry.filterList(forTaskIdentifier: taskIdentifier)?.name
     }
 }
@@ -32,7 +32,9 @@ extension FilterListsUpdater {
             let filterList = FilterList(named: activeName,
                                         fromDictionary: activeList)
             if filterList?.expired() == true {
-                self.updateFilterLists(withNames: [activeName],
+                // The base of the active list is updated along with it.
+                let names = ABPManager.sharedInstance().adblockPlus.activeFilterListNames()
+                self.updateFilterLists(withNames: names,
                                        userTriggered: false,
                                        completion: { _ in
                     observer.onNext(true)
@@ -31,6 +31,15 @@ extension FilterListsUpdater {
         }
         setLegacySetFilterListsUpdated()
         var newFilterList = update.filterList
+        // Keep the values found while storing the download, the next download is requested with
+        // them.
+        if let stored = filterList(withName: name) {
+            newFilterList.version = stored.version
+            newFilterList.ruleCount = stored.ruleCount
+            newFilterList.entityTag = stored.entityTag
+            newFilterList.lastModified = stored.lastModified
+            newFilterList.overlayBaseName = stored.overlayBaseName
+        }
         newFilterList.taskIdentifier = update.task.taskIdentifier
         newFilterList.updating = false
         newFilterList.updatingGroupIdentifier = self.updatingGroupIdentifier
@@ -51,6 +51,10 @@ class FilterListsUpdater: AdblockPlusShared,
     /// See updateFilterLists:withNames:userTriggered.
     @objc var updatingGroupIdentifier = 0
 
+    /// True while a batch started by updateFilterLists(withNames:userTriggered:completion:) runs.
+    /// The batch reloads the content blocker once when it ends.
+    @objc private(set) var updatingBatch = false
+
     /// Handles reloading of the content blocker.
     var cbManager: ContentBlockerManagerProtocol!
 
@@ -68,6 +72,9 @@ class FilterListsUpdater: AdblockPlusShared,
     /// Performs content blocking operations.
     var safariCB: SafariContentBlocker!
 
+    /// Number of filter lists downloaded at the same time.
+    var maxConcurrentDownloads = GlobalConstants.maxConcurrentFilterListDownloads
+
     /// Construct a FilterListUpdater. Process running tasks and add a reloading observer.
     /// - Parameter abpManager: Because the ABPManager initializes an instance of this class in
     /// its init, the shared instance of ABPManager cannot be used within the init of this class
@@ -80,6 +87,21 @@ class FilterListsUpdater: AdblockPlusShared,
                                         performingActivityTestSetter: setLegacyPerformingActivityTest)
         super.init()
         cbManager = ContentBlockerManager()
+        // The scheduler is shared with every other reloader of the content blocker, this is its
+        // only reloader and its only willReload hook.
+        safariCB.reloadScheduler.reloader = { [weak self] identifier, completion in
+            guard let cbManager = self?.cbManager else {
+                completion(ABPContentBlockerError.reloaderUnavailable)
+                return
+            }
+            cbManager.reload(withIdentifier: identifier,
+                             completionHandler: completion)
+        }
+        safariCB.reloadScheduler.willReload = { [weak self] in
+            // The updater keeps its own settings, the extension reads both.
+            try? self?.abpManager?.adblockPlus?.settings.commit()
+            try? self?.settings.commit()
+        }
         self.abpManager = abpManager
         backgroundSession = newBackgroundSession()
         removeUpdatingGroupID()
@@ -105,13 +127,11 @@ class FilterListsUpdater: AdblockPlusShared,
 
     /// Remove the updating state key from a filter list.
     private func removeUpdatingGroupID() {
-        let lists = abpManager.filterLists()
-        var newLists = [libadblockplus_ios.FilterList]()
-        for var list in lists {
-            list.updatingGroupIdentifier = nil
-            newLists.append(list)
+        guard let registry = abpManager?.filterListRegistry else { return }
+        for list in registry.filterLists {
+            guard let name = list.name else { continue }
+            registry.update(named: name) { $0.updatingGroupIdentifier = nil }
         }
-        abpManager.saveFilterLists(newLists)
     }
 
     /// Update the download tasks for all filter lists. If there is a task to complete, save it as
@@ -119,51 +139,51 @@ class FilterListsUpdater: AdblockPlusShared,
     /// identifier, it will be cancelled.
     private func processRunningTasks() {
         backgroundSession.getAllTasks(completionHandler: { tasks in
-            guard let lists = self.abpManager?.filterLists() else { return }
-            var listsToRemoveUpdatingFrom = [FilterListName]()
-            for list in lists where list.name != nil {
-                listsToRemoveUpdatingFrom.append(list.name!)
+            guard let registry = self.abpManager?.filterListRegistry else { return }
+            var listsToRemoveUpdatingFrom = Set<FilterListName>()
+            for list in registry.filterLists where list.name != nil {
+                listsToRemoveUpdatingFrom.insert(list.name!)
             }
 
             // Remove filter lists whose tasks are still running.
             for task in tasks {
-                var found = false
-                var listIndex = 0
-                for list in lists {
-                    if let url = task.originalRequest?.url?.absoluteString {
-                        if url == list.source &&
-                           task.taskIdentifier == list.taskIdentifier {
-                            self.downloadTasksByID[task.taskIdentifier] = task
-                            var nameIndex = 0
-                            for name in listsToRemoveUpdatingFrom {
-                                if name == list.name {
-                                    listsToRemoveUpdatingFrom.remove(at: nameIndex)
-                                    break
-                                }
-                                nameIndex += 1
-                            }
-                        } else {
-                            // If a task was interrupted, then it is cancelled here. This handles
-                            // the case where the app crashes or is forced to quit during a download
-                            // task. The user receives an alert and is able to redo what had
-                            // previously failed.
-                            task.cancel()
-                        }
-                        found = true
-                        break
-                    }
-                    listIndex += 1
-                } // End for list
-                if !found {
+                if let list = registry.filterList(forTaskIdentifier: task.taskIdentifier),
+                   let name = list.name,
+                   self.isDownloadTask(task, of: list) {
+                    self.downloadTasksByID[task.taskIdentifier] = task
+                    listsToRemoveUpdatingFrom.remove(name)
+                } else {
+                    // If a task was interrupted, then it is cancelled here. This handles
+                    // the case where the app crashes or is forced to quit during a download
+                    // task. The user receives an alert and is able to redo what had
+                    // previously failed.
                     task.cancel()
                 }
-            } // End for task
+            }
 
             // Set updating to false for lists that don't have tasks.
-            self.abpManager?.setNotUpdating(forNames: listsToRemoveUpdatingFrom)
+            self.abpManager?.setNotUpdating(forNames: Array(listsToRemoveUpdatingFrom))
         })
     }
 
+    /// Download URLs carry the download data as query items, only the rest has to match the
+    /// source of the list.
+    /// - Returns: True if the task downloads the filter list.
+    private func isDownloadTask(_ task: URLSessionTask,
+                                of filterList: libadblockplus_ios.FilterList) -> Bool {
+        guard let taskURL = task.originalRequest?.url,
+              var taskComponents = URLComponents(url: taskURL,
+                                                 resolvingAgainstBaseURL: false),
+              let source = filterList.source,
+              var sourceComponents = URLComponents(string: source)
+        else {
+            return false
+        }
+        taskComponents.query = nil
+        sourceComponents.query = nil
+        return taskComponents.url == sourceComponents.url
+    }
+
     /// Time limit for a download operation.
     /// - Returns: Time interval according to background state.
     func downloadLimit() -> TimeInterval {
@@ -176,21 +196,18 @@ class FilterListsUpdater: AdblockPlusShared,
 
     /// A filter list download task is created. An entry in the download tasks dictionary is
     /// created for the task.
-    /// - Parameter filterList: A filter List struct.
+    /// - Parameters:
+    ///   - filterList: A filter List struct.
+    ///   - reusingStoredList: Ask for a diff or only for a changed list if the stored list can be
+    ///   used for it.
     /// - Returns: The download task.
-    func filterListDownload(for filterList: libadblockplus_ios.FilterList) -> Observable<URLSessionDownloadTask> {
+    func filterListDownload(for filterList: libadblockplus_ios.FilterList,
+                            reusingStoredList: Bool = true) -> Observable<URLSessionDownloadTask> {
         return Observable.create { observer in
-            guard let urlString = filterList.source,
-                  let url = URL(string: urlString),
-                  var components = URLComponents(string: url.absoluteString)
-            else {
-                observer.onError(ABPDownloadTaskError.failedToMakeDownloadTask)
-                return Disposables.create()
-            }
-            components.queryItems = FilterListDownloadData(with: filterList).queryItems
-            components.encodePlusSign()
-            if let newURL = components.url {
-                let task = self.backgroundSession.downloadTask(with: newURL)
+            if let request = self.downloadRequest(for: filterList,
+                                                  acceptingDiff: reusingStoredList && self.hasDiffBase(for: filterList),
+                                                  conditional: reusingStoredList && self.hasStoredFilterList(filterList)) {
+                let task = self.backgroundSession.downloadTask(with: request)
                 self.downloadTasksByID[task.taskIdentifier] = task
                 observer.onNext(task)
                 observer.onCompleted()
@@ -201,6 +218,90 @@ class FilterListsUpdater: AdblockPlusShared,
         }
     }
 
+    /// - Parameters:
+    ///   - filterList: A filter List struct.
+    ///   - acceptingDiff: Ask for a diff against the stored version.
+    ///   - conditional: Send the validators of the stored list, the server answers with 304 if
+    ///   the list has not changed.
+    /// - Returns: Request for the list or nil if the source is invalid.
+    func downloadRequest(for filterList: libadblockplus_ios.FilterList,
+                         acceptingDiff: Bool,
+                         conditional: Bool) -> URLRequest? {
+        guard let url = downloadURL(for: filterList,
+                                    acceptingDiff: acceptingDiff)
+        else {
+            return nil
+        }
+        // Validators are handled here, a cached response must not answer them.
+        var request = URLRequest(url: url,
+                                 cachePolicy: .reloadIgnoringLocalCacheData)
+        if conditional {
+            request.setValue(filterList.entityTag,
+                             forHTTPHeaderField: "If-None-Match")
+            request.setValue(filterList.lastModified,
+                             forHTTPHeaderField: "If-Modified-Since")
+        }
+        return request
+    }
+
+    /// - Parameters:
+    ///   - filterList: A filter List struct.
+    ///   - acceptingDiff: Ask for a diff against the stored version.
+    /// - Returns: URL of the list including the download data or nil if the source is invalid.
+    func downloadURL(for filterList: libadblockplus_ios.FilterList,
+                     acceptingDiff: Bool) -> URL? {
+        guard let urlString = filterList.source,
+              let url = URL(string: urlString),
+              var components = URLComponents(string: url.absoluteString)
+        else {
+            return nil
+        }
+        components.queryItems = FilterListDownloadData(with: filterList,
+                                                       acceptingDiff: acceptingDiff).queryItems
+        components.encodePlusSign()
+        return components.url
+    }
+
+    /// - Parameter filterList: A filter List struct.
+    /// - Returns: True if a diff can be applied to the stored list.
+    func hasDiffBase(for filterList: libadblockplus_ios.FilterList) -> Bool {
+        guard filterList.version != nil,
+              let url = storedFilterListURL(for: filterList)
+        else {
+            return false
+        }
+        return FileManager.default.fileExists(atPath: baseURL(forFilterListURL: url).path)
+    }
+
+    /// - Parameter filterList: A filter List struct.
+    /// - Returns: True if the list used for content blocking is stored, a 304 response keeps it.
+    func hasStoredFilterList(_ filterList: libadblockplus_ios.FilterList) -> Bool {
+        guard filterList.downloaded == true,
+              let url = storedFilterListURL(for: filterList)
+        else {
+            return false
+        }
+        return FileManager.default.fileExists(atPath: url.path)
+    }
+
+    /// Record the download task on the stored filter list, the download delegate finds the list
+    /// by it.
+    /// - Parameters:
+    ///   - task: A download task.
+    ///   - name: Filter list name.
+    func trackDownloadTask(_ task: URLSessionDownloadTask,
+                           forFilterListNamed name: FilterListName?) {
+        guard let uwName = name,
+              var list = filterList(withName: uwName)
+        else {
+            return
+        }
+        list.taskIdentifier = task.taskIdentifier
+        list.updating = true
+        replaceFilterList(withName: uwName,
+                          withNewList: list)
+    }
+
     // ------------------------------------------------------------
     // MARK: - Filter Lists -
     // ------------------------------------------------------------
@@ -219,39 +320,97 @@ class FilterListsUpdater: AdblockPlusShared,
         })
     }
 
-    /// Tasks are started here and observed for completion. Download operations are limited by the
-    /// download limit. The observable is disposed when the limit is exceeded.
+    /// Tasks are started here, when the returned observable is subscribed, and observed for
+    /// completion. The content blocker is not reloaded, see downloadBatch(_:timeout:wait:).
     /// - Parameter update: A filter list update model struct.
     /// - Returns: The update that was completed.
-    func updateWait(for update: FilterListUpdate) -> Observable<FilterListUpdate> {
-        let taskID = update.task.taskIdentifier
-        self.downloadEvents[taskID] = BehaviorSubject<DownloadEvent>(value: DownloadEvent())
-        update.task.resume()
-
-        // The subscribe is wrapped in an Observable to use timeout()
+    func downloadWait(for update: FilterListUpdate) -> Observable<FilterListUpdate> {
         return Observable.create { observer in
-            return self.downloadEvents[taskID]!
+            let taskID = update.task.taskIdentifier
+            var event = DownloadEvent()
+            event.resumeTime = PipelineTraceNow()
+            let subject = BehaviorSubject<DownloadEvent>(value: event)
+            self.downloadEvents[taskID] = subject
+            update.task.resume()
+
+            let fullDownload = SerialDisposable()
+            let events = subject
                 .filter { event -> Bool in
                     return event.didFinishDownloading == true &&
                            event.errorWritten == true
-                }.subscribe(onNext: { _ in
-                    self.safariCB.reloadContentBlocker { error in
-                        if error == nil {
-                            observer.onNext(update)
-                            observer.onCompleted()
-                        } else {
-                            observer.onError(error!)
-                        }
+                }.subscribe(onNext: { event in
+                    // A diff that could not be applied is replaced by the complete list.
+                    if event.needsFullDownload == true {
+                        fullDownload.disposable = self.fullDownloadUpdate(replacing: update)
+                            .flatMap { fullUpdate -> Observable<FilterListUpdate> in
+                                return self.downloadWait(for: fullUpdate)
+                            }.subscribe(observer)
+                        return
                     }
+                    observer.onNext(update)
+                    observer.onCompleted()
                 }, onDisposed: {
                     self.cleanupUpdate(update)
                 })
-        }.timeout(downloadLimit(),
-                  scheduler: MainScheduler.asyncInstance)
+            return Disposables.create(events, fullDownload)
+        }
+    }
+
+    /// Run downloads concurrently, at most maxConcurrentDownloads at a time. A download that fails
+    /// or exceeds the timeout does not affect the others.
+    /// - Parameters:
+    ///   - updates: Updates whose tasks are not started.
+    ///   - timeout: Time limit for each download, counted from its start.
+    ///   - wait: Starts a download and emits its update when it is complete.
+    /// - Returns: The completed updates and the first error, emitted when all downloads have ended.
+    func downloadBatch(_ updates: Observable<FilterListUpdate>,
+                       timeout: TimeInterval,
+                       wait: @escaping (FilterListUpdate) -> Observable<FilterListUpdate>)
+        -> Observable<(updates: [FilterListUpdate], error: Error?)> {
+        return Observable.deferred {
+            var firstError: Error?
+            return updates
+                .map { update -> Observable<FilterListUpdate> in
+                    return wait(update)
+                        .timeout(timeout,
+                                 scheduler: MainScheduler.asyncInstance)
+                        .catchError { error -> Observable<FilterListUpdate> in
+                            firstError = firstError ?? error
+                            return Observable.empty()
+                        }
+                }.merge(maxConcurrent: self.maxConcurrentDownloads)
+                .toArray()
+                .map { completed -> (updates: [FilterListUpdate], error: Error?) in
+                    return (updates: completed, error: firstError)
+                }
+        }
+    }
+
+    /// - Parameter updates: Completed updates.
+    /// - Returns: True if a list was stored, a reload is needed for it.
+    func hasChangedFilterList(_ updates: [FilterListUpdate]) -> Bool {
+        return updates.contains { update -> Bool in
+            return lastDownloadEvent(taskID: update.task.taskIdentifier)?.notModified != true
+        }
+    }
+
+    /// Make an update downloading the complete list.
+    /// - Parameter update: An update whose diff could not be applied.
+    /// - Returns: Stream of the new update, its task is not started.
+    func fullDownloadUpdate(replacing update: FilterListUpdate) -> Observable<FilterListUpdate> {
+        return filterListDownload(for: update.filterList,
+                                  reusingStoredList: false).map { task -> FilterListUpdate in
+            self.trackDownloadTask(task,
+                                   forFilterListNamed: update.filterList.name)
+            return FilterListUpdate(filterList: update.filterList,
+                                    task: task,
+                                    userTriggered: update.userTriggered)
+        }
     }
 
     /// Update filter lists with statuses of tasks running while the app is in the background.
-    /// Update should only occur if the filter list is considered to be expired.
+    /// Update should only occur if the filter list is considered to be expired. Lists are
+    /// downloaded concurrently and the content blocker is reloaded once for all of them.
     /// - Parameters:
     ///   - names: Array of filter list names.
     ///   - userTriggered: True if initiated by a user.
@@ -262,21 +421,52 @@ class FilterListsUpdater: AdblockPlusShared,
                            userTriggered: Bool,
                            completion: ((Error?) -> Void)? = nil) {
         downloadBag = DisposeBag()
-        updateMake(with: names,
-                   userTriggered: userTriggered)
-            .concatMap { update -> Observable<FilterListUpdate> in
-                return self.updateWait(for: update)
-            }.subscribe(onNext: { update in
-                do {
-                    try self.internallyUpdate(with: update)
-                } catch {
-                    // Internal state will be corrupt if an error occurs with the internal update. This is not
-                    // a fatal condition as the state is continually updated as filter lists expire.
+        updatingBatch = true
+        let updates = updateMake(with: names,
+                                 userTriggered: userTriggered)
+        downloadBatch(updates,
+                      timeout: downloadLimit(),
+                      wait: { update -> Observable<FilterListUpdate> in
+            return self.downloadWait(for: update)
+        }).subscribe(onNext: { batch in
+            // Unchanged lists leave the content blocker as it is.
+            if self.hasChangedFilterList(batch.updates) {
+                self.safariCB.reloadContentBlocker { error in
+                    self.finishBatch(batch.updates,
+                                     error: error ?? batch.error,
+                                     completion: completion)
                 }
-                completion?(nil)
-            }, onError: { error in
-                completion?(error)
-            }).disposed(by: downloadBag)
+            } else {
+                self.finishBatch(batch.updates,
+                                 error: batch.error,
+                                 completion: completion)
+            }
+        }, onError: { error in
+            self.updatingBatch = false
+            completion?(error)
+        }).disposed(by: downloadBag)
+    }
+
+    /// Write the completed updates back to the Objective-C side.
+    /// - Parameters:
+    ///   - updates: Completed updates.
+    ///   - error: Error of the batch, if any.
+    ///   - completion: Closure passed to updateFilterLists(withNames:userTriggered:completion:).
+    private func finishBatch(_ updates: [FilterListUpdate],
+                             error: Error?,
+                             completion: ((Error?) -> Void)?) {
+        for update in updates {
+            do {
+                try internallyUpdate(with: update)
+            } catch {
+                // Internal state will be corrupt if an error occurs with the internal update. This is not
+                // a fatal condition as the state is continually updated as filter lists expire.
+            }
+        }
+        // Changes written back now are covered by the reload of the batch.
+        abpManager?.filterListRegistry.flush()
+        updatingBatch = false
+        completion?(error)
     }
 
     /// This is the private function for downloading an updated filter list. The last update date is
@@ -290,8 +480,8 @@ class FilterListsUpdater: AdblockPlusShared,
         self.updatingGroupIdentifier += 1
         // Make a filter list that exists on the Objective-C side.
         let listsKey = "AdblockPlusFilterListsVersion2"
-        let details = ABPManager.sharedInstance().adblockPlus.adblockPlusDetails
-        let root = details.value(forKey: listsKey) as? [String: Any]
+        let settings = ABPManager.sharedInstance().adblockPlus.settings
+        let root = settings.object(forKey: listsKey) as? [String: Any]
         guard var filterList = FilterList(matching: name,
                                           root: root)
         else {
@@ -302,6 +492,8 @@ class FilterListsUpdater: AdblockPlusShared,
         }
         filterList.lastUpdate = Date()
         return self.filterListDownload(for: filterList).flatMap { task -> Observable<FilterListUpdate> in
+            self.trackDownloadTask(task,
+                                   forFilterListNamed: name)
             let update = FilterListUpdate(filterList: filterList,
                                           task: task,
                                           userTriggered: userTriggered)
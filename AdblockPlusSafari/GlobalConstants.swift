@@ -24,6 +24,9 @@ struct GlobalConstants {
     /// Time limit for foreground operations.
     static let foregroundOperationLimit: TimeInterval = 10 * backgroundOperationLimit
 
+    /// Number of filter lists downloaded at the same time.
+    static let maxConcurrentFilterListDownloads = 3
+
     /// The number of times to try an immediate reload if an error is encountered.
     static let contentBlockerReloadRetryCount = 3
 
@@ -0,0 +1,457 @@
+/*
+ * This file is part of Adblock Plus <https://adblockplus.org/>,
+ * Copyright (C) 2006-present eyeo GmbH
+ *
+ * Adblock Plus is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * Adblock Plus is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Adblock Plus.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "HostnameNormalizer.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+typedef struct
+{
+    char *bytes;
+    size_t capacity;
+    size_t length;
+} Output;
+
+static void put(Output *output, char c)
+{
+    if (output->length + 1 < output->capacity) {
+        output->bytes[output->length] = c;
+    }
+    output->length++;
+}
+
+static size_t finish(Output *output)
+{
+    if (output->capacity > 0) {
+        output->bytes[output->length < output->capacity ? output->length : output->capacity - 1] = '\0';
+    }
+    return output->length;
+}
+
+#pragma mark - Trimming
+
+/// Length of the whitespace or newline character starting at bytes, 0 if there is none.
+static size_t whitespaceLength(const uint8_t *bytes, size_t length)
+{
+    if (length >= 1 && (bytes[0] == ' ' || (bytes[0] >= '\t' && bytes[0] <= '\r'))) {
+        return 1;
+    }
+    if (length >= 2 && bytes[0] == 0xc2 && (bytes[1] == 0x85 || bytes[1] == 0xa0)) {
+        return 2;
+    }
+    if (length >= 3) {
+        uint32_t c = ((uint32_t)bytes[0] << 16) | ((uint32_t)bytes[1] << 8) | bytes[2];
+        if (c == 0xe19a80 // U+1680
+            || (c >= 0xe28080 && c <= 0xe2808a) // U+2000 - U+200A
+            || c == 0xe280a8 || c == 0xe280a9 || c == 0xe280af // U+2028, U+2029, U+202F
+            || c == 0xe2819f || c == 0xe38080) { // U+205F, U+3000
+            return 3;
+        }
+    }
+    return 0;
+}
+
+static void trim(const uint8_t **start, const uint8_t **end)
+{
+    size_t length;
+    while (*start < *end && (length = whitespaceLength(*start, (size_t)(*end - *start))) > 0) {
+        *start += length;
+    }
+    bool trimmed = true;
+    while (trimmed && *start < *end) {
+        trimmed = false;
+        for (size_t candidate = 1; candidate <= 3 && candidate <= (size_t)(*end - *start); candidate++) {
+            if (whitespaceLength(*end - candidate, candidate) == candidate) {
+                *end -= candidate;
+                trimmed = true;
+                break;
+            }
+        }
+    }
+}
+
+#pragma mark - Host extraction
+
+static bool hasPrefix(const uint8_t *start, const uint8_t *end, const char *prefix)
+{
+    size_t length = strlen(prefix);
+    if ((size_t)(end - start) < length) {
+        return false;
+    }
+    for (size_t i = 0; i < length; i++) {
+        uint8_t c = start[i];
+        if (c >= 'A' && c <= 'Z') {
+            c += 'a' - 'A';
+        }
+        if (c != (uint8_t)prefix[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/// Narrows the range to the host of an address with an optional http or https scheme.
+static void extractHost(const uint8_t **start, const uint8_t **end)
+{
+    const uint8_t *host = *start;
+    if (hasPrefix(host, *end, "http://")) {
+        host += strlen("http://");
+    } else if (hasPrefix(host, *end, "https://")) {
+        host += strlen("https://");
+    }
+    const uint8_t *hostEnd = host;
+    while (hostEnd < *end && *hostEnd != '/' && *hostEnd != '?' && *hostEnd != '#') {
+        hostEnd++;
+    }
+    for (const uint8_t *p = hostEnd; p > host; p--) {
+        if (p[-1] == '@') {
+            host = p;
+            break;
+        }
+    }
+    for (const uint8_t *p = hostEnd; p > host; p--) {
+        if (p[-1] == ':') {
+            hostEnd = p - 1;
+            break;
+        }
+        if (p[-1] < '0' || p[-1] > '9') {
+            break;
+        }
+    }
+    // The whole address is used if it has no host, like before.
+    if (host < hostEnd) {
+        *start = host;
+        *end = hostEnd;
+    }
+}
+
+#pragma mark - Characters
+
+/// Matches URLHostAllowedCharacterSet without the characters that are special in url-filter
+/// patterns. Non-ASCII characters are kept for the conversion to punycode.
+static bool isAllowed(uint32_t c)
+{
+    if (c >= 0x80) {
+        return c != 0x85 && c != 0xa0 && c != 0x1680 && !(c >= 0x2000 && c <= 0x200a) && c != 0x2028 && c != 0x2029
+            && c != 0x202f && c != 0x205f && c != 0x3000 && c != 0xfeff;
+    }
+    if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')) {
+        return true;
+    }
+    return c != 0 && strchr("!&'+,-.:;=]_~", (int)c) != NULL;
+}
+
+/// Lower case for ASCII and the common Latin, Greek and Cyrillic letters, including Latin Extended
+/// Additional. Internationalized labels are case folded before they are converted.
+static uint32_t lowercase(uint32_t c)
+{
+    if ((c >= 'A' && c <= 'Z') || (c >= 0xc0 && c <= 0xde && c != 0xd7) || (c >= 0x391 && c <= 0x3ab && c != 0x3a2)
+        || (c >= 0x410 && c <= 0x42f)) {
+        return c + 0x20;
+    }
+    if (c >= 0x400 && c <= 0x40f) {
+        return c + 0x50;
+    }
+    // Latin Extended-A alternates upper and lower case, the upper case letter is even in the
+    // first and third block and odd in the second and fourth.
+    if (((c >= 0x100 && c <= 0x137) && c != 0x130) || (c >= 0x14a && c <= 0x177)) {
+        return (c & 1) == 0 ? c + 1 : c;
+    }
+    if ((c >= 0x139 && c <= 0x148) || (c >= 0x179 && c <= 0x17e)) {
+        return (c & 1) == 1 ? c + 1 : c;
+    }
+    if (c == 0x178) {
+        return 0xff;
+    }
+    // Greek capitals with tonos.
+    if (c == 0x386) {
+        return 0x3ac;
+    }
+    if (c >= 0x388 && c <= 0x38a) {
+        return c + 0x25;
+    }
+    if (c == 0x38c) {
+        return 0x3cc;
+    }
+    if (c == 0x38e || c == 0x38f) {
+        return c + 0x3f;
+    }
+    // Latin Extended Additional alternates like Latin Extended-A, with the upper case letter even.
+    if ((c >= 0x1e00 && c <= 0x1e95) || (c >= 0x1ea0 && c <= 0x1eff)) {
+        return (c & 1) == 0 ? c + 1 : c;
+    }
+    if (c == 0x1e9e) {
+        return 0xdf;
+    }
+    return c;
+}
+
+/// Compatibility mapping of the fullwidth forms of ASCII and of the dots that separate labels
+/// like a full stop (UTS #46).
+static uint32_t mapCompatibility(uint32_t c)
+{
+    if (c >= 0xff01 && c <= 0xff5e) {
+        return c - 0xfee0;
+    }
+    if (c == 0x3002 || c == 0xff61) {
+        return '.';
+    }
+    return c;
+}
+
+#pragma mark - Punycode
+
+static const uint32_t base = 36;
+static const uint32_t tMin = 1;
+static const uint32_t tMax = 26;
+static const uint32_t skew = 38;
+static const uint32_t damp = 700;
+static const uint32_t initialBias = 72;
+static const uint32_t initialN = 0x80;
+
+static uint32_t adapt(uint32_t delta, uint32_t pointCount, bool firstTime)
+{
+    delta = firstTime ? delta / damp : delta / 2;
+    delta += delta / pointCount;
+    uint32_t k = 0;
+    while (delta > ((base - tMin) * tMax) / 2) {
+        delta /= base - tMin;
+        k += base;
+    }
+    return k + (base - tMin + 1) * delta / (delta + skew);
+}
+
+static char digit(uint32_t d)
+{
+    return (char)(d < 26 ? 'a' + d : '0' + d - 26);
+}
+
+/// RFC 3492 encoding of a label, prefixed with xn--. The label is short, there is no overflow.
+static void putPunycode(Output *output, const uint32_t *label, size_t length)
+{
+    put(output, 'x');
+    put(output, 'n');
+    put(output, '-');
+    put(output, '-');
+    uint32_t basicCount = 0;
+    for (size_t i = 0; i < length; i++) {
+        if (label[i] < 0x80) {
+            put(output, (char)label[i]);
+            basicCount++;
+        }
+    }
+    if (basicCount > 0) {
+        put(output, '-');
+    }
+
+    uint32_t n = initialN;
+    uint32_t delta = 0;
+    uint32_t bias = initialBias;
+    for (uint32_t handled = basicCount; handled < length;) {
+        uint32_t next = UINT32_MAX;
+        for (size_t i = 0; i < length; i++) {
+            if (label[i] >= n && label[i] < next) {
+                next = label[i];
+            }
+        }
+        delta += (next - n) * (handled + 1);
+        n = next;
+        for (size_t i = 0; i < length; i++) {
+            if (label[i] < n) {
+                delta++;
+            } else if (label[i] == n) {
+                uint32_t q = delta;
+                for (uint32_t k = base;; k += base) {
+                    uint32_t t = k <= bias ? tMin : (k >= bias + tMax ? tMax : k - bias);
+                    if (q < t) {
+                        break;
+                    }
+                    put(output, digit(t + (q - t) % (base - t)));
+                    q = (q - t) / (base - t);
+                }
+                put(output, digit(q));
+                bias = adapt(delta, handled + 1, handled == basicCount);
+                delta = 0;
+                handled++;
+            }
+        }
+        delta++;
+        n++;
+    }
+}
+
+#pragma mark - Normalizing
+
+typedef struct
+{
+    Output output;
+    uint32_t label[HostnameNormalizerMaxLabelLength];
+    size_t labelLength;
+    bool labelIsASCII;
+    // An ASCII label longer than the buffer is written directly.
+    bool labelIsStreamed;
+    // Only a leading www label is removed.
+    bool labelIsFirst;
+    bool failed;
+} Normalizer;
+
+static void putLabel(Normalizer *normalizer)
+{
+    if (normalizer->labelIsASCII) {
+        for (size_t i = 0; i < normalizer->labelLength; i++) {
+            put(&normalizer->output, (char)normalizer->label[i]);
+        }
+    } else {
+        putPunycode(&normalizer->output, normalizer->label, normalizer->labelLength);
+    }
+}
+
+static void addCodePoint(Normalizer *normalizer, uint32_t c)
+{
+    c = mapCompatibility(c);
+    if (!isAllowed(c)) {
+        return;
+    }
+    if (c == '.') {
+        bool isWWW = normalizer->labelIsFirst && normalizer->labelLength == 3 && normalizer->label[0] == 'w'
+            && normalizer->label[1] == 'w' && normalizer->label[2] == 'w' && !normalizer->labelIsStreamed;
+        if (!normalizer->labelIsStreamed && !isWWW) {
+            putLabel(normalizer);
+        }
+        if (!isWWW) {
+            put(&normalizer->output, '.');
+        }
+        normalizer->labelLength = 0;
+        normalizer->labelIsASCII = true;
+        normalizer->labelIsStreamed = false;
+        normalizer->labelIsFirst = false;
+        return;
+    }
+    if (c >= 0x80) {
+        if (normalizer->labelIsStreamed) {
+            normalizer->failed = true;
+            return;
+        }
+        normalizer->labelIsASCII = false;
+    }
+    // Hostnames are case insensitive, all of them are whitelisted in lower case. This also makes
+    // the comparison with www case insensitive.
+    c = lowercase(c);
+    if (normalizer->labelIsStreamed) {
+        put(&normalizer->output, (char)c);
+    } else if (normalizer->labelLength < HostnameNormalizerMaxLabelLength) {
+        normalizer->label[normalizer->labelLength++] = c;
+    } else if (normalizer->labelIsASCII) {
+        putLabel(normalizer);
+        put(&normalizer->output, (char)c);
+        normalizer->labelIsStreamed = true;
+    } else {
+        normalizer->failed = true;
+    }
+}
+
+static int hexValue(uint8_t c)
+{
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+size_t HostnameNormalizerNormalize(const char *input,
+                                   size_t inputLength,
+                                   char *output,
+                                   size_t outputCapacity)
+{
+    Normalizer normalizer;
+    normalizer.output = (Output){ output, outputCapacity, 0 };
+    normalizer.labelLength = 0;
+    normalizer.labelIsASCII = true;
+    normalizer.labelIsStreamed = false;
+    normalizer.labelIsFirst = true;
+    normalizer.failed = false;
+
+    const uint8_t *start = (const uint8_t *)input;
+    const uint8_t *end = start + inputLength;
+    trim(&start, &end);
+    extractHost(&start, &end);
+
+    // UTF-8 is decoded after percent escapes, invalid sequences are dropped.
+    uint32_t c = 0;
+    int pending = 0;
+    for (const uint8_t *p = start; p < end && !normalizer.failed; p++) {
+        uint8_t byte = *p;
+        if (byte == '%' && end - p >= 3 && hexValue(p[1]) >= 0 && hexValue(p[2]) >= 0) {
+            byte = (uint8_t)(hexValue(p[1]) << 4 | hexValue(p[2]));
+            p += 2;
+        }
+        if (pending > 0 && (byte & 0xc0) == 0x80) {
+            c = (c << 6) | (byte & 0x3f);
+            if (--pending == 0 && c >= 0x80 && c <= 0x10ffff && !(c >= 0xd800 && c <= 0xdfff)) {
+                addCodePoint(&normalizer, c);
+            }
+            continue;
+        }
+        pending = 0;
+        if (byte < 0x80) {
+            addCodePoint(&normalizer, byte);
+        } else if ((byte & 0xe0) == 0xc0) {
+            c = byte & 0x1f;
+            pending = 1;
+        } else if ((byte & 0xf0) == 0xe0) {
+            c = byte & 0x0f;
+            pending = 2;
+        } else if ((byte & 0xf8) == 0xf0) {
+            c = byte & 0x07;
+            pending = 3;
+        }
+    }
+    if (!normalizer.labelIsStreamed) {
+        putLabel(&normalizer);
+    }
+
+    if (normalizer.failed) {
+        normalizer.output.length = 0;
+    }
+    return finish(&normalizer.output);
+}
+
+#pragma mark - Escaping
+
+size_t HostnameNormalizerEscape(const char *hostname,
+                                size_t hostnameLength,
+                                char *output,
+                                size_t outputCapacity)
+{
+    Output escaped = { output, outputCapacity, 0 };
+    for (size_t i = 0; i < hostnameLength; i++) {
+        char c = hostname[i];
+        if (c != '\0' && strchr("\\|(){^$*+?.<>[]", c) != NULL) {
+            put(&escaped, '\\');
+        }
+        put(&escaped, c);
+    }
+    return finish(&escaped);
+}
@@ -0,0 +1,67 @@
+/*
+ * This file is part of Adblock Plus <https://adblockplus.org/>,
+ * Copyright (C) 2006-present eyeo GmbH
+ *
+ * Adblock Plus is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * Adblock Plus is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Adblock Plus.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HostnameNormalizer_h
+#define HostnameNormalizer_h
+
+// Foundation-free hostname handling behind -[NSString whitelistedHostname] and
+// +[AdblockPlus escapeHostname:]. Both functions work in a single pass over the input and write
+// into a buffer provided by the caller, they do not allocate.
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/// Internationalized labels longer than this, in code points, cannot be converted.
+#define HostnameNormalizerMaxLabelLength 63
+
+/// Extracts the hostname to whitelist from a website address typed or shared by the user:
+/// - surrounding whitespace is trimmed,
+/// - an http or https scheme, user info, port, path, query and fragment are dropped,
+/// - percent escapes in the host are decoded,
+/// - characters not allowed in hosts are removed,
+/// - fullwidth forms of ASCII and ideographic full stops are mapped to ASCII,
+/// - letters are converted to lower case,
+/// - a leading "www." label is removed, in any case,
+/// - labels with non-ASCII characters are converted to punycode (xn--).
+///
+/// Case folding covers the Latin, Greek and Cyrillic letters of the common blocks only and there is
+/// no further Unicode normalization. Other non-ASCII input has to be in NFKC and lower case
+/// already, -[NSString whitelistedHostname] maps it with Foundation.
+///
+/// The result is written to output, NUL terminated, and truncated if outputCapacity is too
+/// small. Returns the length of the complete result without the NUL, like snprintf. Returns 0 if
+/// there is no hostname or an internationalized label is too long.
+size_t HostnameNormalizerNormalize(const char *input,
+                                   size_t inputLength,
+                                   char *output,
+                                   size_t outputCapacity);
+
+/// Escapes the characters of a hostname that are special in content blocker url-filter
+/// patterns with a backslash. Output and return value as for HostnameNormalizerNormalize.
+size_t HostnameNormalizerEscape(const char *hostname,
+                                size_t hostnameLength,
+                                char *output,
+                                size_t outputCapacity);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HostnameNormalizer_h */
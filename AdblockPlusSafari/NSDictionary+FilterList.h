@@ -23,5 +23,6 @@
 @property (nonatomic, readonly) NSString *fileName;
 @property (nonatomic, readonly) BOOL downloaded;
 @property (nonatomic, readonly) NSUInteger taskIdentifier;
+@property (nonatomic, readonly) NSString *overlayBaseName;
 
 @end
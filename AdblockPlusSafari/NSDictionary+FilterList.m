@@ -39,4 +39,9 @@
     return [self[@"taskIdentifier"] unsignedIntegerValue];
 }
 
+- (NSString *)overlayBaseName
+{
+    return self[@"overlayBaseName"];
+}
+
 @end
@@ -19,8 +19,6 @@
 
 @interface NSString (AdblockPlus)
 
-- (NSString *__nullable)stringByRemovingHostDisallowedCharacters;
-
 - (NSString *__nullable)whitelistedHostname;
 
 @end
@@ -17,49 +17,33 @@
 
 #import "NSString+AdblockPlus.h"
 
-@implementation NSString (AdblockPlus)
+#include "HostnameNormalizer.h"
 
-- (NSString *__nullable)stringByRemovingHostDisallowedCharacters
-{
-    NSMutableCharacterSet *set = [[NSCharacterSet URLHostAllowedCharacterSet] mutableCopy];
-    // Some of those characters are allowed in above set.
-    [set removeCharactersInString:@"\\|()[{^$*?<>"];
-    [set invert];
-    return [[self componentsSeparatedByCharactersInSet:set] componentsJoinedByString:@""];
-}
+@implementation NSString (AdblockPlus)
 
 - (NSString *__nullable)whitelistedHostname
 {
-
-
-    // Trim hostname
-    NSString *hostname = [self stringByTrimmingCharactersInSet:[NSCharacterSet whitespaceAndNewlineCharacterSet]];
-
-    // Prepend scheme if needed
-    if (![hostname hasPrefix:@"http://"] && ![hostname hasPrefix:@"https://"]) {
-        hostname = [@"http://" stringByAppendingString:hostname];
+    // The normalizer folds the case of common letters only, non-ASCII input is mapped like
+    // UTS #46 does before: compatibility decomposition, composition and lower case.
+    NSString *string = self;
+    if (![self canBeConvertedToEncoding:NSASCIIStringEncoding]) {
+        string = self.precomposedStringWithCompatibilityMapping.lowercaseString;
     }
-
-    // URL percent encoding
-    // URLFragmentAllowedCharacterSet used as URLHostAllowedCharacterSet strips out "/" causing malformed domains to be whitelisted.
-    NSCharacterSet *set = [NSCharacterSet URLFragmentAllowedCharacterSet];
-    hostname = [hostname stringByAddingPercentEncodingWithAllowedCharacters:set];
-    
-    // Get host from URL
-    hostname = [[NSURL URLWithString:hostname] host];
-    if (hostname.length == 0) {
-        hostname = self;
+    const char *input = string.UTF8String;
+    if (!input) {
+        return nil;
     }
+    size_t inputLength = strlen(input);
 
-    // Remove not allowed characters
-    hostname = [hostname stringByRemovingHostDisallowedCharacters];
-
-    // Remove www prefix
-    if ([hostname hasPrefix:@"www."]) {
-        hostname = [hostname substringFromIndex:@"www.".length];
+    // Hostnames are short, the result only has to be written again if it does not fit.
+    char buffer[256];
+    size_t length = HostnameNormalizerNormalize(input, inputLength, buffer, sizeof(buffer));
+    if (length < sizeof(buffer)) {
+        return [[NSString alloc] initWithBytes:buffer length:length encoding:NSUTF8StringEncoding];
     }
-
-    return hostname;
+    NSMutableData *data = [NSMutableData dataWithLength:length + 1];
+    HostnameNormalizerNormalize(input, inputLength, data.mutableBytes, data.length);
+    return [[NSString alloc] initWithBytes:data.bytes length:length encoding:NSUTF8StringEncoding];
 }
 
 @end
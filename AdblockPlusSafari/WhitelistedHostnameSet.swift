@@ -0,0 +1,160 @@
+/*
+ * This file is part of Adblock Plus <https://adblockplus.org/>,
+ * Copyright (C) 2006-present eyeo GmbH
+ *
+ * Adblock Plus is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * Adblock Plus is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Adblock Plus.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/// Whitelisted hostnames, indexed by domain.
+///
+/// A hostname whitelists its subdomains as well, like the `*<hostname>` if-domain condition of
+/// the whitelisting rule. Hostnames covered by a member are therefore redundant and are not
+/// stored, and adding a parent domain removes the members below it. Lookups hash every parent
+/// domain of a hostname once, they take O(labels) regardless of the size of the whitelist.
+struct WhitelistedHostnameSet {
+    /// Members in the order they were added.
+    private(set) var hostnames = [String]()
+    private var members = Set<String>()
+    /// Number of members below a domain, only for domains that have members below them.
+    private var descendantCounts = [String: Int]()
+
+    var count: Int {
+        return hostnames.count
+    }
+
+    /// - Parameter hostnames: Normalized hostnames, redundant ones are dropped.
+    init(_ hostnames: [String] = []) {
+        insert(contentsOf: hostnames)
+    }
+
+    /// - Parameter hostname: Normalized hostname.
+    /// - Returns: The member equal to the hostname or to one of its parent domains.
+    func coveringHostname(for hostname: String) -> String? {
+        for domain in WhitelistedHostnameSet.domains(of: hostname) where members.contains(domain) {
+            return domain
+        }
+        return nil
+    }
+
+    /// - Parameter hostname: Normalized hostname.
+    /// - Returns: True if the hostname or one of its parent domains is whitelisted.
+    func covers(_ hostname: String) -> Bool {
+        return coveringHostname(for: hostname) != nil
+    }
+
+    /// - Returns: True if the hostname was added.
+    @discardableResult
+    mutating func insert(_ hostname: String) -> Bool {
+        return !insert(contentsOf: [hostname]).isEmpty
+    }
+
+    /// Add hostnames. Hostnames that are already covered are rejected, members covered by an
+    /// added hostname are removed.
+    /// - Parameter newHostnames: Normalized hostnames.
+    /// - Returns: The added hostnames, in the given order.
+    @discardableResult
+    mutating func insert(contentsOf newHostnames: [String]) -> [String] {
+        // Parents are added first, their subdomains in the same batch are then rejected.
+        let byLabelCount = newHostnames
+            .filter { !$0.isEmpty }
+            .map { (hostname: $0, domains: WhitelistedHostnameSet.domains(of: $0)) }
+            .sorted { $0.domains.count < $1.domains.count }
+        var added = Set<String>()
+        var parents = Set<String>()
+        for entry in byLabelCount where !entry.domains.contains(where: { members.contains($0) }) {
+            if descendantCounts[entry.hostname] != nil {
+                parents.insert(entry.hostname)
+            }
+            add(entry.hostname,
+                domains: entry.domains)
+            added.insert(entry.hostname)
+        }
+        if added.isEmpty {
+            return []
+        }
+
+        // Only members added before can be below a parent added now.
+        if !parents.isEmpty {
+            for hostname in hostnames {
+                let domains = WhitelistedHostnameSet.domains(of: hostname)
+                if domains.dropFirst().contains(where: { parents.contains($0) }) {
+                    remove(hostname,
+                           domains: domains)
+                }
+            }
+            hostnames = hostnames.filter { members.contains($0) }
+        }
+        var result = [String]()
+        for hostname in newHostnames where added.remove(hostname) != nil {
+            result.append(hostname)
+        }
+        hostnames += result
+        return result
+    }
+
+    /// - Returns: True if the hostname was a member.
+    @discardableResult
+    mutating func remove(_ hostname: String) -> Bool {
+        return !remove(contentsOf: [hostname]).isEmpty
+    }
+
+    /// Remove members. Subdomains of a member cannot be removed on their own.
+    /// - Returns: The removed hostnames, in the given order.
+    @discardableResult
+    mutating func remove(contentsOf oldHostnames: [String]) -> [String] {
+        var result = [String]()
+        for hostname in oldHostnames where members.contains(hostname) {
+            remove(hostname,
+                   domains: WhitelistedHostnameSet.domains(of: hostname))
+            result.append(hostname)
+        }
+        if !result.isEmpty {
+            hostnames = hostnames.filter { members.contains($0) }
+        }
+        return result
+    }
+
+    // ------------------------------------------------------------
+    // MARK: - Private -
+    // ------------------------------------------------------------
+
+    /// - Returns: The hostname followed by its parent domains, "a.b.c", "b.c", "c".
+    private static func domains(of hostname: String) -> [String] {
+        var result = [hostname]
+        var remainder = Substring(hostname)
+        while let dot = remainder.index(of: ".") {
+            remainder = remainder[remainder.index(after: dot)...]
+            if !remainder.isEmpty {
+                result.append(String(remainder))
+            }
+        }
+        return result
+    }
+
+    private mutating func add(_ hostname: String,
+                              domains: [String]) {
+        members.insert(hostname)
+        for domain in domains.dropFirst() {
+            descendantCounts[domain, default: 0] += 1
+        }
+    }
+
+    private mutating func remove(_ hostname: String,
+                                 domains: [String]) {
+        members.remove(hostname)
+        for domain in domains.dropFirst() {
+            let count = (descendantCounts[domain] ?? 1) - 1
+            descendantCounts[domain] = count > 0 ? count : nil
+        }
+    }
+}
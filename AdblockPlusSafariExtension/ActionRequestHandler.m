@@ -19,6 +19,7 @@
 
 #import "AdblockPlus+Extension.h"
 #import "AdblockPlus+ActivityChecking.h"
+#import "PipelineTrace.h"
 
 @interface ActionRequestHandler ()
 
@@ -28,10 +29,19 @@
 
 - (void)beginRequestWithExtensionContext:(NSExtensionContext *)context
 {
+    uint64_t start = PipelineTraceNow();
     AdblockPlus *adblockPlus = [[AdblockPlus alloc] init];
+    // Events of the extension are read by the app.
+    NSURL *container = [[NSFileManager defaultManager] containerURLForSecurityApplicationGroupIdentifier:adblockPlus.group];
+    if (container) {
+        PipelineTraceOpenSharedBuffer([container URLByAppendingPathComponent:@PipelineTraceSharedBufferName isDirectory:NO].fileSystemRepresentation);
+    }
 
     NSError *error;
-    if ([adblockPlus shouldRespondToActivityTest:&error]) {
+    BOOL respondsToActivityTest = [adblockPlus shouldRespondToActivityTest:&error];
+    // The extension may be terminated right after responding, the host app waits for the result.
+    [adblockPlus.settings commit:nil];
+    if (respondsToActivityTest) {
         [context cancelRequestWithError:error];
         return;
     }
@@ -48,11 +58,13 @@
 
     [context completeRequestReturningItems:@[ item ]
                          completionHandler:^(BOOL expired) {
+                             PipelineTraceSpan("extension-request", start, expired);
                              if (!expired) {
                                  // If the new filter list was updated during reloading
                                  // then downloadedVersion would be less then self.downloadedVersion.
                                  adblockPlus.installedVersion = MAX(adblockPlus.installedVersion, downloadedVersion);
                                  adblockPlus.lastActivity = [[NSDate alloc] init];
+                                 [adblockPlus.settings commit:nil];
                              }
                          }];
 }
@@ -21,6 +21,20 @@
 
 - (NSURL *__nullable)activeFilterListsURL;
 
+/// Returns the downloaded base of the active filter list if the list is stored as an overlay of
+/// it, or nil. An overlay whose base is missing is not used, see
+/// activeFilterListURLWithWhitelistedWebsites.
+- (NSURL *__nullable)activeBaseFilterListURL;
+
+/// Returns the active filter list merged with whitelisted websites. The merged list is cached
+/// under a key derived from downloadedVersion, the active filter list name, size and modification
+/// time of the merged files, the whitelist and the merge format, so it is only rebuilt when one of
+/// them changes. If merging fails, the stored list is returned,
+/// or the bundled version of it if the stored list is an overlay.
 - (NSURL *__nullable)activeFilterListURLWithWhitelistedWebsites;
 
+/// Builds the merged filter list in the background, so that the content blocker finds it in the cache.
+/// The completion is called on the main queue with the merged list or nil, if merging has failed.
+- (void)prepareActiveFilterListWithWhitelistedWebsites:(void (^__nullable)(NSURL *__nullable url))completion;
+
 @end
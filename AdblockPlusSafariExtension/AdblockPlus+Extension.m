@@ -18,8 +18,17 @@
 #import "AdblockPlus+Extension.h"
 #import "AdblockPlus+Parsing.h"
 #import "NSDictionary+FilterList.h"
+#import "FilterListSharder.h"
+#import "PipelineTrace.h"
+
+#import <CommonCrypto/CommonDigest.h>
+#include <sys/stat.h>
 
 static NSString *emptyFilterListName = @"empty.json";
+static NSString *mergedFilterListPrefix = @"ww-";
+// Increase whenever merging writes different output for the same lists, so that merged lists left
+// in the container by a previous version of the app are not used.
+static const NSInteger mergedFilterListFormatVersion = 2;
 
 @implementation AdblockPlus (Extension)
 
@@ -43,6 +52,11 @@ static NSString *emptyFilterListName = @"empty.json";
         }
     }
 
+    return [[self class] bundledFilterListURLForFileName:fileName];
+}
+
++ (NSURL *__nullable)bundledFilterListURLForFileName:(NSString *__nullable)fileName
+{
     if (!fileName) {
         fileName = emptyFilterListName;
     }
@@ -50,28 +64,172 @@ static NSString *emptyFilterListName = @"empty.json";
     return [[NSBundle mainBundle] URLForResource:[fileName stringByDeletingPathExtension] withExtension:@"json"];
 }
 
-- (NSURL *)activeFilterListURLWithWhitelistedWebsites
+/// Name of the base the active list is stored as an overlay of, nil if the stored list is complete.
+- (NSString *__nullable)activeOverlayBaseName
+{
+    NSDictionary *filterList = self.filterLists[self.activeFilterListName];
+    return self.enabled && filterList.downloaded ? filterList.overlayBaseName : nil;
+}
+
+- (NSURL *__nullable)activeBaseFilterListURL
+{
+    NSString *baseName = self.activeOverlayBaseName;
+    NSDictionary *baseList = baseName ? self.filterLists[baseName] : nil;
+    if (!baseList.downloaded || !baseList.fileName) {
+        return nil;
+    }
+
+    NSFileManager *fileManager = [NSFileManager defaultManager];
+    NSURL *url = [fileManager containerURLForSecurityApplicationGroupIdentifier:self.group];
+    url = [url URLByAppendingPathComponent:baseList.fileName isDirectory:NO];
+    return [fileManager fileExistsAtPath:url.path] ? url : nil;
+}
+
+/// Cache key of the merged filter list. Any change of the merged files, of the active list, of the
+/// whitelist or of the merge format results in a different key. Files are identified by size and
+/// modification time, which also tells apart bundled lists of different versions of the app.
+- (NSString *)mergedFilterListKeyForFilterListURL:(NSURL *)original
+{
+    NSMutableString *key = [NSMutableString stringWithFormat:@"%ld\n%ld\n%@\n%@", (long)mergedFilterListFormatVersion,
+                                                             (long)self.downloadedVersion, self.activeFilterListName, original.lastPathComponent];
+    NSURL *base = self.activeBaseFilterListURL;
+    for (NSURL *url in base ? @[ base, original ] : @[ original ]) {
+        struct stat status;
+        if (stat(url.fileSystemRepresentation, &status) == 0) {
+            [key appendFormat:@"\n%lld %ld.%09ld", (long long)status.st_size, (long)status.st_mtimespec.tv_sec, (long)status.st_mtimespec.tv_nsec];
+        }
+    }
+    for (NSString *website in self.whitelistedWebsites) {
+        [key appendFormat:@"\n%@", website];
+    }
+
+    NSData *data = [key dataUsingEncoding:NSUTF8StringEncoding];
+    unsigned char digest[CC_SHA256_DIGEST_LENGTH];
+    CC_SHA256(data.bytes, (CC_LONG)data.length, digest);
+
+    // 64 bits of the digest are more than enough to tell apart states of a single device.
+    NSMutableString *hex = [NSMutableString stringWithCapacity:16];
+    for (NSUInteger i = 0; i < 8; i++) {
+        [hex appendFormat:@"%02x", digest[i]];
+    }
+    return hex;
+}
+
+- (NSURL *__nullable)mergedFilterListURLForFilterListURL:(NSURL *)original
 {
-    NSURL *original = self.activeFilterListsURL;
     NSString *fileName = original.lastPathComponent;
 
     if (fileName == nil || [fileName isEqual:emptyFilterListName]) {
-        return original;
+        return nil;
     }
 
+    NSString *key = [self mergedFilterListKeyForFilterListURL:original];
+    NSURL *url = [[NSFileManager defaultManager] containerURLForSecurityApplicationGroupIdentifier:self.group];
+    return [url URLByAppendingPathComponent:[NSString stringWithFormat:@"%@%@-%@", mergedFilterListPrefix, key, fileName] isDirectory:NO];
+}
+
+/// Merges into a temporary file which is renamed afterwards, so that the app and the extension
+/// never see a partially written list. A list stored as an overlay is merged together with its
+/// base, it is not merged at all without it. Outdated merged lists of the same filter list, and
+/// shards left behind by earlier versions, are removed.
++ (BOOL)mergeFilterListFromURL:(NSURL *)original
+                   withBaseURL:(NSURL *__nullable)base
+                     isOverlay:(BOOL)overlay
+       withWhitelistedWebsites:(NSArray<NSString *> *)whitelistedWebsites
+                   toCachedURL:(NSURL *)cached
+{
     NSFileManager *fileManager = [NSFileManager defaultManager];
-    NSURL *copy = [fileManager containerURLForSecurityApplicationGroupIdentifier:self.group];
-    copy = [copy URLByAppendingPathComponent:[NSString stringWithFormat:@"ww-%@", fileName] isDirectory:NO];
+    if ([fileManager fileExistsAtPath:cached.path]) {
+        return YES;
+    }
+    if (overlay && !base) {
+        NSLog(@"Base of %@ is missing", original.lastPathComponent);
+        return NO;
+    }
+
+    NSString *temporaryName = [NSString stringWithFormat:@".%@.%@", cached.lastPathComponent, [NSUUID UUID].UUIDString];
+    NSURL *temporary = [cached.URLByDeletingLastPathComponent URLByAppendingPathComponent:temporaryName isDirectory:NO];
+    NSString *fileName = original.lastPathComponent;
+    NSURL *directory = cached.URLByDeletingLastPathComponent;
 
     NSError *error;
-    if (![[self class] mergeFilterListsFromURL:original
-                       withWhitelistedWebsites:self.whitelistedWebsites
-                                         toURL:copy
-                                         error:&error]) {
-        return original;
+    NSUInteger ruleCount = 0;
+    if (![self mergeFilterListsFromURLs:overlay ? @[ base, original ] : @[ original ]
+                withWhitelistedWebsites:whitelistedWebsites
+                                  toURL:temporary
+                              ruleCount:&ruleCount
+                                  error:&error]) {
+        NSLog(@"Merging of %@ has failed: %@", fileName, error);
+        [fileManager removeItemAtURL:temporary error:nil];
+        return NO;
+    }
+
+    // The extension is the only content blocker and loads the complete list, WebKit refuses it
+    // over the budget. The rule count is reported so that the app can tell.
+    if (ruleCount > FilterListSharderDefaultRuleBudget) {
+        NSLog(@"Merged %@ has %lu rules, over the budget of %d rules of a content blocker",
+              fileName, (unsigned long)ruleCount, FilterListSharderDefaultRuleBudget);
+        PipelineTraceCount("rule-budget-exceeded", (int64_t)ruleCount);
+    }
+
+    if (rename(temporary.fileSystemRepresentation, cached.fileSystemRepresentation) != 0) {
+        [fileManager removeItemAtURL:temporary error:nil];
+        return NO;
+    }
+
+    NSString *legacyName = [mergedFilterListPrefix stringByAppendingString:fileName];
+    NSString *suffix = [@"-" stringByAppendingString:fileName];
+    NSString *current = [cached.lastPathComponent substringToIndex:cached.lastPathComponent.length - fileName.length];
+    for (NSString *name in [fileManager contentsOfDirectoryAtPath:directory.path error:nil]) {
+        BOOL outdated = [name hasPrefix:mergedFilterListPrefix] && [name hasSuffix:suffix] && ![name hasPrefix:current];
+        if (outdated || [name isEqual:legacyName]) {
+            [fileManager removeItemAtURL:[directory URLByAppendingPathComponent:name isDirectory:NO] error:nil];
+        }
+    }
+
+    return YES;
+}
+
+- (NSURL *)activeFilterListURLWithWhitelistedWebsites
+{
+    NSURL *original = self.activeFilterListsURL;
+    NSURL *cached = [self mergedFilterListURLForFilterListURL:original];
+    BOOL overlay = self.activeOverlayBaseName != nil;
+
+    if (cached != nil && [[self class] mergeFilterListFromURL:original
+                                                  withBaseURL:self.activeBaseFilterListURL
+                                                    isOverlay:overlay
+                                      withWhitelistedWebsites:self.whitelistedWebsites
+                                                  toCachedURL:cached]) {
+        return cached;
     }
 
-    return copy;
+    // An overlay alone lacks most rules of the list, the bundled version of the list is complete.
+    return overlay ? [[self class] bundledFilterListURLForFileName:original.lastPathComponent] : original;
+}
+
+- (void)prepareActiveFilterListWithWhitelistedWebsites:(void (^__nullable)(NSURL *__nullable url))completion
+{
+    // The extension derives the cache key from the stored settings, which have to match the merged list.
+    [self.settings commit:nil];
+    NSURL *original = self.activeFilterListsURL;
+    NSURL *base = self.activeBaseFilterListURL;
+    BOOL overlay = self.activeOverlayBaseName != nil;
+    NSURL *cached = [self mergedFilterListURLForFilterListURL:original];
+    NSArray<NSString *> *whitelistedWebsites = [self.whitelistedWebsites copy];
+
+    dispatch_async(dispatch_get_global_queue(QOS_CLASS_UTILITY, 0), ^{
+        BOOL merged = cached != nil && [[self class] mergeFilterListFromURL:original
+                                                                withBaseURL:base
+                                                                  isOverlay:overlay
+                                                    withWhitelistedWebsites:whitelistedWebsites
+                                                                toCachedURL:cached];
+        dispatch_async(dispatch_get_main_queue(), ^{
+            if (completion) {
+                completion(merged ? cached : nil);
+            }
+        });
+    });
 }
 
 @end
@@ -29,4 +29,23 @@
                           toURL:(NSURL *__nonnull)output
                           error:(NSError *__nullable *__nonnull)error;
 
+/**
+ *  Same as above, ruleCount receives the number of merged rules, whitelisting rules included.
+ */
++ (BOOL)mergeFilterListsFromURL:(NSURL *__nonnull)input
+        withWhitelistedWebsites:(NSArray<NSString *> *__nonnull)whitelistedWebsites
+                          toURL:(NSURL *__nonnull)output
+                      ruleCount:(NSUInteger *__nullable)ruleCount
+                          error:(NSError *__nullable *__nonnull)error;
+
+/**
+ *  Same as above for a list stored in several parts, such as an overlay after its base. The parts
+ *  are merged as FilterListComposer composes them. Fails if one of them cannot be read.
+ */
++ (BOOL)mergeFilterListsFromURLs:(NSArray<NSURL *> *__nonnull)inputs
+         withWhitelistedWebsites:(NSArray<NSString *> *__nonnull)whitelistedWebsites
+                           toURL:(NSURL *__nonnull)output
+                       ruleCount:(NSUInteger *__nullable)ruleCount
+                           error:(NSError *__nullable *__nonnull)error;
+
 @end
@@ -17,319 +17,162 @@
 
 #import "AdblockPlus+Parsing.h"
 
-// yajl is sax-like json parser. Content blocker extension has limited amount of memory,
-// so that it is not possible to load whole filter list at once.
-#include <yajl_dynamic/yajl_parse.h>
-#include <yajl_dynamic/yajl_gen.h>
+#include "CompiledFilterList.h"
+#include "FilterListComposer.h"
+#include "FilterListMerger.h"
+#include "HostnameNormalizer.h"
+#include "PipelineTrace.h"
 
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
+#include <sys/stat.h>
 
-typedef struct
-{
-    BOOL writingEnabled;
-    AdblockPlusFilterListType filterListType;
-    NSUInteger mapLevel;
-    NSUInteger arrayLevel;
-    yajl_gen g;
-
-} AdblockPlusContext;
-
-static int reformatNull(void *ctx)
-{
-    AdblockPlusContext *context = (AdblockPlusContext *)ctx;
-    return !context->writingEnabled || yajl_gen_null(context->g) == yajl_gen_status_ok;
-}
-
-static int reformatBoolean(void *ctx, int boolean)
-{
-    AdblockPlusContext *context = (AdblockPlusContext *)ctx;
-    return !context->writingEnabled || yajl_gen_bool(context->g, boolean) == yajl_gen_status_ok;
-}
-
-static int reformatNumber(void *ctx, const char *s, size_t l)
-{
-    AdblockPlusContext *context = (AdblockPlusContext *)ctx;
-    return !context->writingEnabled || yajl_gen_number(context->g, s, l) == yajl_gen_status_ok;
-}
-
-static int reformatString(void *ctx, const unsigned char *string, size_t stringLength)
-{
-    AdblockPlusContext *context = (AdblockPlusContext *)ctx;
-    return !context->writingEnabled || yajl_gen_string(context->g, string, stringLength) == yajl_gen_status_ok;
-}
-
-static int reformatMapKey(void *ctx, const unsigned char *string, size_t stringLength)
-{
-    AdblockPlusContext *context = (AdblockPlusContext *)ctx;
-
-    if (context->mapLevel == 1 && context->filterListType == AdblockPlusFilterListTypeVersion2) {
-        context->writingEnabled = strncmp((const char *)string, "rules", stringLength) == 0;
-        return YES;
-    }
-
-    return !context->writingEnabled || yajl_gen_string(context->g, string, stringLength) == yajl_gen_status_ok;
-}
+@implementation AdblockPlus (Parsing)
 
-static int reformatStartMap(void *ctx)
++ (NSString *)escapeHostname:(NSString *)hostname
 {
-    AdblockPlusContext *context = (AdblockPlusContext *)ctx;
-    context->mapLevel += 1;
+    const char *input = hostname.UTF8String;
+    size_t inputLength = strlen(input);
 
-    if (context->mapLevel == 1 && context->arrayLevel == 0) {
-        context->filterListType = AdblockPlusFilterListTypeVersion2;
-        return YES;
+    char buffer[512];
+    size_t length = HostnameNormalizerEscape(input, inputLength, buffer, sizeof(buffer));
+    if (length < sizeof(buffer)) {
+        return [[NSString alloc] initWithBytes:buffer length:length encoding:NSUTF8StringEncoding];
     }
-
-    return !context->writingEnabled || yajl_gen_map_open(context->g) == yajl_gen_status_ok;
+    NSMutableData *data = [NSMutableData dataWithLength:length + 1];
+    HostnameNormalizerEscape(input, inputLength, data.mutableBytes, data.length);
+    return [[NSString alloc] initWithBytes:data.bytes length:length encoding:NSUTF8StringEncoding];
 }
 
-static int reformatEndMap(void *ctx)
++ (BOOL)mergeFilterListsFromURL:(NSURL *__nonnull)input
+        withWhitelistedWebsites:(NSArray<NSString *> *__nonnull)whitelistedWebsites
+                          toURL:(NSURL *__nonnull)output
+                          error:(NSError *__nullable __autoreleasing *__nonnull)error
 {
-    AdblockPlusContext *context = (AdblockPlusContext *)ctx;
-    context->mapLevel -= 1;
-    return !context->writingEnabled || yajl_gen_map_close(context->g) == yajl_gen_status_ok;
+    return [self mergeFilterListsFromURL:input withWhitelistedWebsites:whitelistedWebsites toURL:output ruleCount:NULL error:error];
 }
 
-static int reformatStartArray(void *ctx)
++ (BOOL)mergeFilterListsFromURL:(NSURL *__nonnull)input
+        withWhitelistedWebsites:(NSArray<NSString *> *__nonnull)whitelistedWebsites
+                          toURL:(NSURL *__nonnull)output
+                      ruleCount:(NSUInteger *__nullable)ruleCount
+                          error:(NSError *__nullable __autoreleasing *__nonnull)error
 {
-    AdblockPlusContext *context = (AdblockPlusContext *)ctx;
-    context->arrayLevel += 1;
-
-    if (context->mapLevel == 0 && context->arrayLevel == 1) {
-        context->filterListType = AdblockPlusFilterListTypeVersion1;
-        context->writingEnabled = YES;
-    }
-
-    return !context->writingEnabled || yajl_gen_array_open(context->g) == yajl_gen_status_ok;
+    return [self mergeFilterListsFromURLs:@[ input ] withWhitelistedWebsites:whitelistedWebsites toURL:output ruleCount:ruleCount error:error];
 }
 
-static int reformatEndArray(void *ctx)
+/// Composes the parts of a list into one JSON file, which is merged when the compiled parts are outdated.
++ (BOOL)composeFilterListsFromPaths:(const char *const *)inputPaths
+                              count:(NSUInteger)inputCount
+                              toURL:(NSURL *)composed
+                              error:(FilterListMergerError *)error
 {
-    AdblockPlusContext *context = (AdblockPlusContext *)ctx;
-    context->arrayLevel -= 1;
-
-    if (context->arrayLevel == 0 && context->writingEnabled) {
-        context->writingEnabled = NO;
-        return YES;
+    uint64_t start = PipelineTraceNow();
+    FilterListComposerResult result;
+    if (!FilterListComposerComposeFiles(inputPaths, inputCount, composed.fileSystemRepresentation, &result, error)) {
+        return NO;
     }
-
-    return !context->writingEnabled || yajl_gen_array_close(context->g) == yajl_gen_status_ok;
-}
-
-static yajl_callbacks callbacks = {
-    reformatNull,
-    reformatBoolean,
-    NULL,
-    NULL,
-    reformatNumber,
-    reformatString,
-    reformatStartMap,
-    reformatMapKey,
-    reformatEndMap,
-    reformatStartArray,
-    reformatEndArray
-};
-
-static BOOL writeDictionary(NSDictionary<NSString *, id> *__nonnull dictionary, yajl_gen g);
-
-static BOOL writeString(NSString *__nonnull string, yajl_gen g)
-{
-    const char *str = [string cStringUsingEncoding:NSUTF8StringEncoding];
-    return yajl_gen_string(g, (const unsigned char *)str, strlen(str)) == yajl_gen_status_ok;
+    PipelineTraceSpan("compose", start, (int64_t)result.ruleCount);
+    PipelineTraceCount("compose-duplicates", (int64_t)result.duplicateCount);
+    return YES;
 }
 
-static BOOL writeArray(NSArray<id> *array, yajl_gen g)
++ (BOOL)mergeFilterListsFromURLs:(NSArray<NSURL *> *__nonnull)inputs
+         withWhitelistedWebsites:(NSArray<NSString *> *__nonnull)whitelistedWebsites
+                           toURL:(NSURL *__nonnull)output
+                       ruleCount:(NSUInteger *__nullable)ruleCount
+                           error:(NSError *__nullable __autoreleasing *__nonnull)error
 {
-    if (yajl_gen_array_open(g) != yajl_gen_status_ok) {
+    uint64_t start = PipelineTraceNow();
+
+    // C strings are owned by the autoreleased NSStrings and NSURLs and remain valid for the duration of this call.
+    NSUInteger websitesCount = whitelistedWebsites.count;
+    NSUInteger inputCount = inputs.count;
+    const char **websites = malloc(MAX(websitesCount, 1) * sizeof(const char *));
+    const char **inputPaths = malloc(MAX(inputCount, 1) * sizeof(const char *));
+    const char **compiledPaths = malloc(MAX(inputCount, 1) * sizeof(const char *));
+    if (!websites || !inputPaths || !compiledPaths || inputCount == 0) {
+        free(websites);
+        free(inputPaths);
+        free(compiledPaths);
+        *error = [NSError errorWithDomain:NSPOSIXErrorDomain code:inputCount == 0 ? EINVAL : ENOMEM userInfo:nil];
         return NO;
     }
-
-    for (id value in array) {
-        BOOL result;
-        if ([value isKindOfClass:[NSDictionary class]]) {
-            result = writeDictionary(value, g);
-        } else if ([value isKindOfClass:[NSString class]]) {
-            result = writeString(value, g);
-        } else if ([value isKindOfClass:[NSArray class]]) {
-            result = writeArray(value, g);
-        } else {
-            result = yajl_gen_null(g) == yajl_gen_status_ok;
-        }
-
-        if (!result) {
-            return NO;
-        }
+    for (NSUInteger i = 0; i < websitesCount; i++) {
+        websites[i] = whitelistedWebsites[i].UTF8String;
     }
 
-    return yajl_gen_array_close(g) == yajl_gen_status_ok;
-}
-
-static BOOL writeDictionary(NSDictionary<NSString *, id> *__nonnull dictionary, yajl_gen g)
-{
-    if (yajl_gen_map_open(g) != yajl_gen_status_ok) {
-        return NO;
+    // The compiled lists written after downloading avoid parsing the JSON, they are used while they are current.
+    for (NSUInteger i = 0; i < inputCount; i++) {
+        inputPaths[i] = inputs[i].fileSystemRepresentation;
+        compiledPaths[i] = [inputs[i] URLByAppendingPathExtension:@CompiledFilterListPathExtension].fileSystemRepresentation;
     }
-
-    for (NSString *key in dictionary) {
-        id value = dictionary[key];
-
-        if (!writeString(key, g)) {
-            return NO;
-        }
-
-        BOOL result;
-        if ([value isKindOfClass:[NSDictionary class]]) {
-            result = writeDictionary(value, g);
-        } else if ([value isKindOfClass:[NSString class]]) {
-            result = writeString(value, g);
-        } else if ([value isKindOfClass:[NSArray class]]) {
-            result = writeArray(value, g);
-        } else {
-            result = yajl_gen_null(g) == yajl_gen_status_ok;
-        }
-
-        if (!result) {
-            return NO;
-        }
+    FilterListMergerError mergerError;
+    FilterListMergerResult mergerResult;
+    BOOL result;
+    if (inputCount == 1) {
+        result = FilterListMergerMergeCompiledFile(compiledPaths[0],
+                                                   inputPaths[0],
+                                                   output.fileSystemRepresentation,
+                                                   websites,
+                                                   websitesCount,
+                                                   &FilterListMergerDefaultOptions,
+                                                   &mergerResult,
+                                                   &mergerError);
+    } else {
+        result = FilterListMergerMergeCompiledFiles(compiledPaths,
+                                                    inputPaths,
+                                                    inputCount,
+                                                    output.fileSystemRepresentation,
+                                                    websites,
+                                                    websitesCount,
+                                                    &FilterListMergerDefaultOptions,
+                                                    &mergerResult,
+                                                    &mergerError);
     }
-
-    return yajl_gen_map_close(g) == yajl_gen_status_ok;
-}
-
-@implementation AdblockPlus (Parsing)
-
-+ (NSString *)escapeHostname:(NSString *)hostname
-{
-    NSRegularExpression *regexp =
-        [NSRegularExpression regularExpressionWithPattern:@"[\\\\|(){^$*+?.<>\\[\\]]"
-                                                  options:0
-                                                    error:nil];
-
-    NSMutableString *h = [hostname mutableCopy];
-    [regexp replaceMatchesInString:h
-                           options:0
-                             range:NSMakeRange(0, h.length)
-                      withTemplate:@"\\\\$0"];
-    return h;
-}
-
-+ (BOOL)mergeFilterListsFromURL:(NSURL *__nonnull)input
-        withWhitelistedWebsites:(NSArray<NSString *> *__nonnull)whitelistedWebsites
-                          toURL:(NSURL *__nonnull)output
-                          error:(NSError *__nullable __autoreleasing *__nonnull)error
-{
-
-    NSInputStream *inputStream = [NSInputStream inputStreamWithURL:input];
-    NSOutputStream *outputStream = [NSOutputStream outputStreamWithURL:output append:NO];
-    yajl_gen g = NULL;
-    yajl_handle hand = NULL;
-    AdblockPlusContext context = { NO, AdblockPlusFilterListTypeVersion1, 0, 0, NULL };
-
-    @try {
-        [inputStream open];
-        [outputStream open];
-        g = yajl_gen_alloc(NULL);
-        yajl_gen_config(g, yajl_gen_beautify, 0);
-        yajl_gen_config(g, yajl_gen_validate_utf8, 0);
-        hand = yajl_alloc(&callbacks, NULL, (void *)&context);
-        yajl_config(hand, yajl_allow_comments, 0);
-        yajl_config(hand, yajl_dont_validate_strings, 1);
-        context.g = g;
-
-        // Write buffer to output stream
-        BOOL (^writeBuffer)
-        (yajl_gen g) = ^BOOL(yajl_gen g) {
-            size_t outputBufferLength;
-            const uint8_t *outputBuffer;
-            yajl_gen_get_buf(g, &outputBuffer, &outputBufferLength);
-            if (outputBufferLength > 0) {
-                NSInteger written = [outputStream write:outputBuffer maxLength:outputBufferLength];
-                if (written == -1) {
-                    *error = outputStream.streamError;
-                    return NO;
-                }
-            }
-            yajl_gen_clear(g);
-            return true;
-        };
-
-        // Get parser error
-        NSError * (^getParseError)(yajl_handle hand) = ^NSError *(yajl_handle hand)
-        {
-            NSUInteger errorBufferLength = 256;
-            uint8_t errorBuffer[errorBufferLength];
-            unsigned char *error_string = yajl_get_error(hand, 1, errorBuffer, errorBufferLength);
-            NSString *errorString = [[NSString alloc] initWithCString:(const char *)error_string encoding:NSASCIIStringEncoding];
-            return [NSError errorWithDomain:AdblockPlusErrorDomain code:0 userInfo:@{ NSLocalizedDescriptionKey : errorString }];
-        };
-
-        // Read json file
-        const NSUInteger inputBufferLength = 256;
-        uint8_t inputBuffer[inputBufferLength];
-        NSInteger read;
-
-        while ((read = [inputStream read:inputBuffer maxLength:inputBufferLength])) {
-
-            yajl_status status = yajl_parse(hand, inputBuffer, read);
-            if (status != yajl_status_ok) {
-                *error = getParseError(hand);
-                return NO;
-            }
-
-            if (!writeBuffer(g)) {
-                return NO;
-            }
+    if (!result) {
+        // Parts without a current compiled form are composed into a single list first.
+        NSURL *composed = inputCount > 1 ? [output URLByAppendingPathExtension:@"composed"] : nil;
+        if (!composed || [self composeFilterListsFromPaths:inputPaths count:inputCount toURL:composed error:&mergerError]) {
+            result = FilterListMergerMergeFiles(composed ? composed.fileSystemRepresentation : inputPaths[0],
+                                                output.fileSystemRepresentation,
+                                                websites,
+                                                websitesCount,
+                                                &FilterListMergerDefaultOptions,
+                                                &mergerResult,
+                                                &mergerError);
         }
-
-        // Close parser
-        yajl_status status = yajl_complete_parse(hand);
-        if (status != yajl_status_ok) {
-            *error = getParseError(hand);
-            return NO;
-        }
-
-        // Write whitelisted websites
-        for (__strong NSString *website in whitelistedWebsites) {
-            // http://comments.gmane.org/gmane.os.opendarwin.webkit.user/3971
-            NSString *websiteFilter = [@"*" stringByAppendingString:website];
-            NSDictionary *whitelistingRule =
-                @{ @"trigger" : @{ @"url-filter" : @".*", @"if-domain" : @[ websiteFilter ] },
-                    @"action" : @{ @"type" : @"ignore-previous-rules" }
-                };
-
-            if (!writeDictionary(whitelistingRule, g)) {
-                *error = getParseError(hand);
-                return NO;
-            }
-
-            if (!writeBuffer(g)) {
-                return NO;
-            }
-        }
-
-        if (yajl_gen_array_close(g) != yajl_gen_status_ok) {
-            *error = getParseError(hand);
-            return NO;
-        }
-
-        if (!writeBuffer(g)) {
-            return NO;
+        if (composed) {
+            [[NSFileManager defaultManager] removeItemAtURL:composed error:nil];
         }
     }
-    @catch (NSException *exception) {
-        *error = [NSError errorWithDomain:AdblockPlusErrorDomain code:0 userInfo:@{ NSLocalizedDescriptionKey : [exception reason] }];
+    free(websites);
+    free(inputPaths);
+    free(compiledPaths);
+
+    // The peak shows how far the merge is from the memory limit of the extension.
+    PipelineTraceCount("merge-peak-bytes", (int64_t)mergerResult.statistics.peakBytes);
+    PipelineTraceCount("merge-allocations", (int64_t)(mergerResult.statistics.allocationCount + mergerResult.statistics.reallocationCount));
+
+    if (!result) {
+        NSDictionary *userInfo = @{ NSLocalizedDescriptionKey : @(mergerError.message) };
+        if (mergerError.systemError != 0) {
+            *error = [NSError errorWithDomain:NSPOSIXErrorDomain code:mergerError.systemError userInfo:userInfo];
+        } else if (mergerError.status == FilterListMergerStatusMemoryLimitError) {
+            *error = [NSError errorWithDomain:AdblockPlusErrorDomain code:AdblockPlusErrorCodeMemoryLimit userInfo:userInfo];
+        } else {
+            *error = [NSError errorWithDomain:AdblockPlusErrorDomain code:0 userInfo:userInfo];
+        }
         return NO;
     }
-    @finally {
-        [inputStream close];
-        [outputStream close];
-        yajl_gen_free(g);
-        yajl_free(hand);
-    }
 
-    return true;
+    struct stat status;
+    PipelineTraceSpan("merge", start, stat(output.fileSystemRepresentation, &status) == 0 ? status.st_size : 0);
+    size_t websitesPerRule = MAX(FilterListMergerDefaultOptions.whitelistedWebsitesPerRule, 1);
+    PipelineTraceCount("whitelist-rules", (int64_t)((websitesCount + websitesPerRule - 1) / websitesPerRule));
+    PipelineTraceCount("merged-rules", (int64_t)mergerResult.ruleCount);
+    if (ruleCount) {
+        *ruleCount = mergerResult.ruleCount;
+    }
+    return YES;
 }
 
 @end
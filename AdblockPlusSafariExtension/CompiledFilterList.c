@@ -0,0 +1,978 @@
+/*
+ * This file is part of Adblock Plus <https://adblockplus.org/>,
+ * Copyright (C) 2006-present eyeo GmbH
+ *
+ * Adblock Plus is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * Adblock Plus is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Adblock Plus.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "CompiledFilterList.h"
+
+#include <yajl_dynamic/yajl_parse.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define CompiledFilterListFormatVersion 1
+
+typedef struct
+{
+    char magic[4];
+    uint32_t formatVersion;
+    uint32_t filterListVersion;
+    uint32_t ruleCount;
+    uint32_t stringCount;
+    uint32_t listEntryCount;
+    uint32_t stringPoolLength;
+    uint32_t version;
+    uint32_t expires;
+    uint32_t reserved;
+    uint64_t sourceLength;
+    int64_t sourceModificationSeconds;
+    int64_t sourceModificationNanoseconds;
+    uint8_t sha256[32];
+} Header;
+
+typedef struct
+{
+    uint32_t offset;
+    uint32_t length;
+} StringRecord;
+
+static const char magic[4] = { 'A', 'B', 'P', 'C' };
+
+static const char *fieldNames[CompiledFilterListFieldCount] = {
+    "resource-type",
+    "load-type",
+    "if-domain",
+    "unless-domain",
+    "if-top-url",
+    "unless-top-url"
+};
+
+static void setErrorV(FilterListMergerError *error, FilterListMergerStatus status, int systemError, const char *format, va_list arguments)
+{
+    if (!error || error->status != FilterListMergerStatusOK) {
+        return;
+    }
+
+    error->status = status;
+    error->systemError = systemError;
+    vsnprintf(error->message, sizeof(error->message), format, arguments);
+}
+
+static void setError(FilterListMergerError *error, FilterListMergerStatus status, int systemError, const char *format, ...)
+{
+    va_list arguments;
+    va_start(arguments, format);
+    setErrorV(error, status, systemError, format, arguments);
+    va_end(arguments);
+}
+
+static bool equalKey(const unsigned char *string, size_t stringLength, const char *key)
+{
+    return stringLength == strlen(key) && memcmp(string, key, stringLength) == 0;
+}
+
+// Modification time with nanoseconds, the field is named differently on Darwin.
+static void modificationTime(const struct stat *status, int64_t *seconds, int64_t *nanoseconds)
+{
+#ifdef __APPLE__
+    *seconds = status->st_mtimespec.tv_sec;
+    *nanoseconds = status->st_mtimespec.tv_nsec;
+#else
+    *seconds = status->st_mtim.tv_sec;
+    *nanoseconds = status->st_mtim.tv_nsec;
+#endif
+}
+
+#pragma mark - Compiler
+
+typedef enum {
+    SectionNone,
+    SectionTrigger,
+    SectionAction
+} Section;
+
+typedef enum {
+    FieldNone,
+    FieldURLFilter,
+    FieldCaseSensitive,
+    FieldList,
+    FieldActionType,
+    FieldSelector
+} Field;
+
+typedef enum {
+    TopKeyOther,
+    TopKeyVersion,
+    TopKeyExpires,
+    TopKeyRules
+} TopKey;
+
+typedef struct
+{
+    void *bytes;
+    size_t count;
+    size_t capacity;
+} Vector;
+
+struct CompiledFilterListCompiler
+{
+    yajl_handle hand;
+
+    unsigned filterListVersion;
+    bool rulesArrayOpen;
+    bool rulesFound;
+    size_t mapLevel;
+    size_t arrayLevel;
+    TopKey topKey;
+
+    Section section;
+    Field field;
+    CompiledFilterListField listField;
+    bool listOpen;
+    CompiledFilterListRuleRecord rule;
+
+    uint32_t version;
+    uint32_t expires;
+
+    Vector rules;
+    Vector strings;
+    Vector listEntries;
+    Vector pool;
+
+    // Open addressing table of string index + 1, 0 marks an empty slot.
+    uint32_t *internTable;
+    size_t internTableCapacity;
+
+    FilterListMergerError error;
+};
+
+static bool reserve(CompiledFilterListCompiler *compiler, Vector *vector, size_t elementSize, size_t additional)
+{
+    if (vector->count + additional <= vector->capacity) {
+        return true;
+    }
+
+    size_t capacity = vector->capacity > 0 ? vector->capacity : 64;
+    while (capacity < vector->count + additional) {
+        capacity *= 2;
+    }
+    // Every index has to fit into 32 bits.
+    if (capacity >= CompiledFilterListNone) {
+        capacity = (size_t)CompiledFilterListNone - 1;
+        if (vector->count + additional > capacity) {
+            setError(&compiler->error, FilterListMergerStatusGenerateError, 0, "Filter list is too large");
+            return false;
+        }
+    }
+
+    void *bytes = realloc(vector->bytes, capacity * elementSize);
+    if (!bytes) {
+        setError(&compiler->error, FilterListMergerStatusGenerateError, ENOMEM, "Out of memory");
+        return false;
+    }
+    vector->bytes = bytes;
+    vector->capacity = capacity;
+    return true;
+}
+
+static uint32_t hashBytes(const unsigned char *bytes, size_t length)
+{
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static bool growInternTable(CompiledFilterListCompiler *compiler)
+{
+    size_t capacity = compiler->internTableCapacity > 0 ? compiler->internTableCapacity * 2 : 1024;
+    uint32_t *table = calloc(capacity, sizeof(uint32_t));
+    if (!table) {
+        setError(&compiler->error, FilterListMergerStatusGenerateError, ENOMEM, "Out of memory");
+        return false;
+    }
+
+    const StringRecord *strings = compiler->strings.bytes;
+    const unsigned char *pool = compiler->pool.bytes;
+    for (size_t i = 0; i < compiler->strings.count; i++) {
+        size_t slot = hashBytes(pool + strings[i].offset, strings[i].length) & (capacity - 1);
+        while (table[slot] != 0) {
+            slot = (slot + 1) & (capacity - 1);
+        }
+        table[slot] = (uint32_t)i + 1;
+    }
+
+    free(compiler->internTable);
+    compiler->internTable = table;
+    compiler->internTableCapacity = capacity;
+    return true;
+}
+
+// Returns the index of the string, adding it to the pool if it is new.
+static uint32_t intern(CompiledFilterListCompiler *compiler, const unsigned char *string, size_t length)
+{
+    if ((compiler->strings.count + 1) * 4 > compiler->internTableCapacity * 3 && !growInternTable(compiler)) {
+        return CompiledFilterListNone;
+    }
+
+    size_t mask = compiler->internTableCapacity - 1;
+    size_t slot = hashBytes(string, length) & mask;
+    for (; compiler->internTable[slot] != 0; slot = (slot + 1) & mask) {
+        const StringRecord *record = (const StringRecord *)compiler->strings.bytes + compiler->internTable[slot] - 1;
+        if (record->length == length && memcmp((const unsigned char *)compiler->pool.bytes + record->offset, string, length) == 0) {
+            return compiler->internTable[slot] - 1;
+        }
+    }
+
+    if (length >= CompiledFilterListNone - compiler->pool.count - 1
+        || !reserve(compiler, &compiler->pool, 1, length + 1)
+        || !reserve(compiler, &compiler->strings, sizeof(StringRecord), 1)) {
+        setError(&compiler->error, FilterListMergerStatusGenerateError, 0, "Filter list is too large");
+        return CompiledFilterListNone;
+    }
+
+    unsigned char *pool = compiler->pool.bytes;
+    memcpy(pool + compiler->pool.count, string, length);
+    pool[compiler->pool.count + length] = 0;
+
+    uint32_t index = (uint32_t)compiler->strings.count;
+    StringRecord *record = (StringRecord *)compiler->strings.bytes + index;
+    record->offset = (uint32_t)compiler->pool.count;
+    record->length = (uint32_t)length;
+    compiler->strings.count += 1;
+    compiler->pool.count += length + 1;
+
+    compiler->internTable[slot] = index + 1;
+    return index;
+}
+
+static int unsupported(CompiledFilterListCompiler *compiler, const char *what)
+{
+    setError(&compiler->error, FilterListMergerStatusParseError, 0, "Unsupported %s in rule %zu", what, compiler->rules.count);
+    return 0;
+}
+
+// Map level of a rule object, counted from the top level value.
+static size_t ruleLevel(const CompiledFilterListCompiler *compiler)
+{
+    return compiler->filterListVersion == 2 ? 2 : 1;
+}
+
+static bool inRules(const CompiledFilterListCompiler *compiler)
+{
+    return compiler->rulesArrayOpen && compiler->mapLevel >= ruleLevel(compiler) - 1;
+}
+
+static int compileNull(void *ctx)
+{
+    CompiledFilterListCompiler *compiler = ctx;
+    return inRules(compiler) ? unsupported(compiler, "null value") : 1;
+}
+
+static int compileBoolean(void *ctx, int boolean)
+{
+    CompiledFilterListCompiler *compiler = ctx;
+    if (!inRules(compiler)) {
+        return 1;
+    }
+    if (compiler->field != FieldCaseSensitive || compiler->listOpen) {
+        return unsupported(compiler, "boolean value");
+    }
+
+    compiler->rule.flags |= CompiledFilterListRuleHasCaseSensitivity;
+    if (boolean) {
+        compiler->rule.flags |= CompiledFilterListRuleIsCaseSensitive;
+    } else {
+        compiler->rule.flags &= ~(uint32_t)CompiledFilterListRuleIsCaseSensitive;
+    }
+    return 1;
+}
+
+static int compileNumber(void *ctx, const char *s, size_t l)
+{
+    CompiledFilterListCompiler *compiler = ctx;
+    (void)s;
+    (void)l;
+    return inRules(compiler) ? unsupported(compiler, "number value") : 1;
+}
+
+static int compileString(void *ctx, const unsigned char *string, size_t stringLength)
+{
+    CompiledFilterListCompiler *compiler = ctx;
+
+    if (!inRules(compiler)) {
+        if (compiler->filterListVersion == 2 && compiler->mapLevel == 1 && compiler->arrayLevel == 0) {
+            if (compiler->topKey == TopKeyVersion) {
+                compiler->version = intern(compiler, string, stringLength);
+                return compiler->version != CompiledFilterListNone;
+            }
+            if (compiler->topKey == TopKeyExpires) {
+                compiler->expires = intern(compiler, string, stringLength);
+                return compiler->expires != CompiledFilterListNone;
+            }
+        }
+        return 1;
+    }
+
+    uint32_t index = intern(compiler, string, stringLength);
+    if (index == CompiledFilterListNone) {
+        return 0;
+    }
+
+    if (compiler->listOpen) {
+        if (!reserve(compiler, &compiler->listEntries, sizeof(uint32_t), 1)) {
+            return 0;
+        }
+        ((uint32_t *)compiler->listEntries.bytes)[compiler->listEntries.count++] = index;
+        compiler->rule.lists[compiler->listField][1] += 1;
+        return 1;
+    }
+
+    switch (compiler->field) {
+        case FieldURLFilter:
+            compiler->rule.urlFilter = index;
+            return 1;
+        case FieldActionType:
+            compiler->rule.actionType = index;
+            return 1;
+        case FieldSelector:
+            compiler->rule.selector = index;
+            return 1;
+        default:
+            return unsupported(compiler, "string value");
+    }
+}
+
+static int compileMapKey(void *ctx, const unsigned char *string, size_t stringLength)
+{
+    CompiledFilterListCompiler *compiler = ctx;
+    size_t level = ruleLevel(compiler);
+
+    if (!inRules(compiler)) {
+        if (compiler->filterListVersion == 2 && compiler->mapLevel == 1 && compiler->arrayLevel == 0) {
+            if (equalKey(string, stringLength, "version")) {
+                compiler->topKey = TopKeyVersion;
+            } else if (equalKey(string, stringLength, "expires")) {
+                compiler->topKey = TopKeyExpires;
+            } else if (equalKey(string, stringLength, "rules")) {
+                compiler->topKey = TopKeyRules;
+            } else {
+                compiler->topKey = TopKeyOther;
+            }
+        }
+        return 1;
+    }
+
+    compiler->field = FieldNone;
+    if (compiler->mapLevel == level) {
+        if (equalKey(string, stringLength, "trigger")) {
+            compiler->section = SectionTrigger;
+        } else if (equalKey(string, stringLength, "action")) {
+            compiler->section = SectionAction;
+        } else {
+            return unsupported(compiler, "rule key");
+        }
+        return 1;
+    }
+
+    if (compiler->section == SectionTrigger) {
+        if (equalKey(string, stringLength, "url-filter")) {
+            compiler->field = FieldURLFilter;
+            return 1;
+        }
+        if (equalKey(string, stringLength, "url-filter-is-case-sensitive")) {
+            compiler->field = FieldCaseSensitive;
+            return 1;
+        }
+        for (size_t i = 0; i < CompiledFilterListFieldCount; i++) {
+            if (equalKey(string, stringLength, fieldNames[i])) {
+                compiler->field = FieldList;
+                compiler->listField = (CompiledFilterListField)i;
+                return 1;
+            }
+        }
+    } else if (compiler->section == SectionAction) {
+        if (equalKey(string, stringLength, "type")) {
+            compiler->field = FieldActionType;
+            return 1;
+        }
+        if (equalKey(string, stringLength, "selector")) {
+            compiler->field = FieldSelector;
+            return 1;
+        }
+    }
+    return unsupported(compiler, "trigger or action key");
+}
+
+static int compileStartMap(void *ctx)
+{
+    CompiledFilterListCompiler *compiler = ctx;
+    size_t level = ruleLevel(compiler);
+
+    if (compiler->mapLevel == 0 && compiler->arrayLevel == 0) {
+        compiler->filterListVersion = 2;
+    } else if (inRules(compiler)) {
+        if (compiler->mapLevel == level - 1 && !compiler->listOpen) {
+            memset(&compiler->rule, 0, sizeof(compiler->rule));
+            compiler->rule.urlFilter = CompiledFilterListNone;
+            compiler->rule.actionType = CompiledFilterListNone;
+            compiler->rule.selector = CompiledFilterListNone;
+            for (size_t i = 0; i < CompiledFilterListFieldCount; i++) {
+                compiler->rule.lists[i][0] = CompiledFilterListNone;
+            }
+            compiler->section = SectionNone;
+        } else if (compiler->mapLevel == level && compiler->section != SectionNone) {
+            compiler->rule.flags |= compiler->section == SectionTrigger ? CompiledFilterListRuleHasTrigger : CompiledFilterListRuleHasAction;
+        } else {
+            return unsupported(compiler, "object");
+        }
+    }
+
+    compiler->mapLevel += 1;
+    return 1;
+}
+
+static int compileEndMap(void *ctx)
+{
+    CompiledFilterListCompiler *compiler = ctx;
+    compiler->mapLevel -= 1;
+
+    if (!inRules(compiler)) {
+        return 1;
+    }
+
+    size_t level = ruleLevel(compiler);
+    if (compiler->mapLevel == level) {
+        compiler->section = SectionNone;
+        compiler->field = FieldNone;
+    } else if (compiler->mapLevel == level - 1) {
+        if (!reserve(compiler, &compiler->rules, sizeof(CompiledFilterListRuleRecord), 1)) {
+            return 0;
+        }
+        ((CompiledFilterListRuleRecord *)compiler->rules.bytes)[compiler->rules.count++] = compiler->rule;
+    }
+    return 1;
+}
+
+static int compileStartArray(void *ctx)
+{
+    CompiledFilterListCompiler *compiler = ctx;
+
+    if (compiler->mapLevel == 0 && compiler->arrayLevel == 0) {
+        compiler->filterListVersion = 1;
+        compiler->rulesArrayOpen = true;
+        compiler->rulesFound = true;
+    } else if (compiler->filterListVersion == 2 && compiler->mapLevel == 1 && compiler->arrayLevel == 0
+               && compiler->topKey == TopKeyRules) {
+        compiler->rulesArrayOpen = true;
+        compiler->rulesFound = true;
+    } else if (inRules(compiler)) {
+        if (compiler->field != FieldList || compiler->listOpen || compiler->mapLevel != ruleLevel(compiler) + 1) {
+            return unsupported(compiler, "array");
+        }
+        compiler->listOpen = true;
+        compiler->rule.lists[compiler->listField][0] = (uint32_t)compiler->listEntries.count;
+        compiler->rule.lists[compiler->listField][1] = 0;
+    }
+
+    compiler->arrayLevel += 1;
+    return 1;
+}
+
+static int compileEndArray(void *ctx)
+{
+    CompiledFilterListCompiler *compiler = ctx;
+    compiler->arrayLevel -= 1;
+
+    if (compiler->listOpen) {
+        compiler->listOpen = false;
+    } else if (compiler->rulesArrayOpen && compiler->arrayLevel == 0) {
+        compiler->rulesArrayOpen = false;
+    }
+    return 1;
+}
+
+static yajl_callbacks callbacks = {
+    compileNull,
+    compileBoolean,
+    NULL,
+    NULL,
+    compileNumber,
+    compileString,
+    compileStartMap,
+    compileMapKey,
+    compileEndMap,
+    compileStartArray,
+    compileEndArray
+};
+
+CompiledFilterListCompiler *CompiledFilterListCompilerCreate(void)
+{
+    CompiledFilterListCompiler *compiler = calloc(1, sizeof(CompiledFilterListCompiler));
+    if (!compiler) {
+        return NULL;
+    }
+
+    compiler->version = CompiledFilterListNone;
+    compiler->expires = CompiledFilterListNone;
+    compiler->hand = yajl_alloc(&callbacks, NULL, compiler);
+    if (!compiler->hand) {
+        free(compiler);
+        return NULL;
+    }
+    yajl_config(compiler->hand, yajl_allow_comments, 0);
+    yajl_config(compiler->hand, yajl_dont_validate_strings, 1);
+    return compiler;
+}
+
+void CompiledFilterListCompilerFree(CompiledFilterListCompiler *compiler)
+{
+    if (!compiler) {
+        return;
+    }
+    yajl_free(compiler->hand);
+    free(compiler->rules.bytes);
+    free(compiler->strings.bytes);
+    free(compiler->listEntries.bytes);
+    free(compiler->pool.bytes);
+    free(compiler->internTable);
+    free(compiler);
+}
+
+static void setParseError(CompiledFilterListCompiler *compiler)
+{
+    if (compiler->error.status != FilterListMergerStatusOK) {
+        return;
+    }
+    unsigned char *errorString = yajl_get_error(compiler->hand, 0, NULL, 0);
+    setError(&compiler->error, FilterListMergerStatusParseError, 0, "%s", errorString ? (const char *)errorString : "Parse error");
+    yajl_free_error(compiler->hand, errorString);
+}
+
+bool CompiledFilterListCompilerParse(CompiledFilterListCompiler *compiler, const uint8_t *bytes, size_t length)
+{
+    if (compiler->error.status != FilterListMergerStatusOK) {
+        return false;
+    }
+    if (yajl_parse(compiler->hand, bytes, length) != yajl_status_ok) {
+        setParseError(compiler);
+        return false;
+    }
+    return true;
+}
+
+static bool writeAll(int fd, const void *bytes, size_t length)
+{
+    const uint8_t *position = bytes;
+    while (length > 0) {
+        ssize_t written = write(fd, position, length);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        position += written;
+        length -= (size_t)written;
+    }
+    return true;
+}
+
+bool CompiledFilterListCompilerFinish(CompiledFilterListCompiler *compiler,
+                                      const char *outputPath,
+                                      const char *sourcePath,
+                                      const uint8_t sha256[32])
+{
+    if (compiler->error.status != FilterListMergerStatusOK) {
+        return false;
+    }
+    if (yajl_complete_parse(compiler->hand) != yajl_status_ok) {
+        setParseError(compiler);
+        return false;
+    }
+    if (!compiler->rulesFound) {
+        setError(&compiler->error, FilterListMergerStatusParseError, 0, "Filter list does not contain any rules");
+        return false;
+    }
+
+    Header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, magic, sizeof(magic));
+    header.formatVersion = CompiledFilterListFormatVersion;
+    header.filterListVersion = compiler->filterListVersion;
+    header.ruleCount = (uint32_t)compiler->rules.count;
+    header.stringCount = (uint32_t)compiler->strings.count;
+    header.listEntryCount = (uint32_t)compiler->listEntries.count;
+    header.stringPoolLength = (uint32_t)compiler->pool.count;
+    header.version = compiler->version;
+    header.expires = compiler->expires;
+    if (sha256) {
+        memcpy(header.sha256, sha256, sizeof(header.sha256));
+    }
+
+    struct stat status;
+    if (stat(sourcePath, &status) != 0) {
+        setError(&compiler->error, FilterListMergerStatusReadError, errno, "%s: %s", sourcePath, strerror(errno));
+        return false;
+    }
+    header.sourceLength = (uint64_t)status.st_size;
+    modificationTime(&status, &header.sourceModificationSeconds, &header.sourceModificationNanoseconds);
+
+    // Written next to the output and renamed, readers never see a partial file.
+    size_t temporaryPathLength = strlen(outputPath) + sizeof(".partial");
+    char *temporaryPath = malloc(temporaryPathLength);
+    if (!temporaryPath) {
+        setError(&compiler->error, FilterListMergerStatusWriteError, ENOMEM, "Out of memory");
+        return false;
+    }
+    snprintf(temporaryPath, temporaryPathLength, "%s.partial", outputPath);
+
+    int fd = open(temporaryPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    bool result = fd >= 0
+        && writeAll(fd, &header, sizeof(header))
+        && writeAll(fd, compiler->strings.bytes, compiler->strings.count * sizeof(StringRecord))
+        && writeAll(fd, compiler->listEntries.bytes, compiler->listEntries.count * sizeof(uint32_t))
+        && writeAll(fd, compiler->rules.bytes, compiler->rules.count * sizeof(CompiledFilterListRuleRecord))
+        && writeAll(fd, compiler->pool.bytes, compiler->pool.count);
+    if (fd >= 0 && close(fd) != 0) {
+        result = false;
+    }
+    result = result && rename(temporaryPath, outputPath) == 0;
+
+    if (!result) {
+        setError(&compiler->error, FilterListMergerStatusWriteError, errno, "%s: %s", outputPath, strerror(errno));
+        unlink(temporaryPath);
+    }
+    free(temporaryPath);
+    return result;
+}
+
+const FilterListMergerError *CompiledFilterListCompilerGetError(const CompiledFilterListCompiler *compiler)
+{
+    return &compiler->error;
+}
+
+bool CompiledFilterListCompileFile(const char *inputPath,
+                                   const char *outputPath,
+                                   FilterListMergerError *error)
+{
+    FilterListMergerError localError = { FilterListMergerStatusOK, 0, "" };
+
+    int input = open(inputPath, O_RDONLY);
+    if (input < 0) {
+        setError(&localError, FilterListMergerStatusReadError, errno, "%s: %s", inputPath, strerror(errno));
+        if (error) {
+            *error = localError;
+        }
+        return false;
+    }
+
+    CompiledFilterListCompiler *compiler = CompiledFilterListCompilerCreate();
+    uint8_t *buffer = malloc(64 * 1024);
+    bool result = compiler && buffer;
+    if (!result) {
+        setError(&localError, FilterListMergerStatusGenerateError, ENOMEM, "Out of memory");
+    }
+
+    while (result) {
+        ssize_t bytesRead = read(input, buffer, 64 * 1024);
+        if (bytesRead < 0 && errno == EINTR) {
+            continue;
+        }
+        if (bytesRead < 0) {
+            setError(&localError, FilterListMergerStatusReadError, errno, "Reading has failed: %s", strerror(errno));
+            result = false;
+        } else if (bytesRead == 0) {
+            break;
+        } else {
+            result = CompiledFilterListCompilerParse(compiler, buffer, (size_t)bytesRead);
+        }
+    }
+
+    result = result && CompiledFilterListCompilerFinish(compiler, outputPath, inputPath, NULL);
+    if (compiler && localError.status == FilterListMergerStatusOK) {
+        localError = compiler->error;
+    }
+
+    CompiledFilterListCompilerFree(compiler);
+    free(buffer);
+    close(input);
+    if (error) {
+        *error = localError;
+    }
+    return result;
+}
+
+#pragma mark - Reading
+
+struct CompiledFilterList
+{
+    void *mapped;
+    size_t length;
+    const Header *header;
+    const StringRecord *strings;
+    const uint32_t *listEntries;
+    const CompiledFilterListRuleRecord *rules;
+    const char *pool;
+};
+
+static bool validString(const CompiledFilterList *list, uint32_t index, bool optional)
+{
+    return index < list->header->stringCount || (optional && index == CompiledFilterListNone);
+}
+
+// Every index is checked once, so that accessors can trust the mapped file.
+static bool validate(const CompiledFilterList *list)
+{
+    const Header *header = list->header;
+
+    for (uint32_t i = 0; i < header->stringCount; i++) {
+        const StringRecord *string = &list->strings[i];
+        if ((uint64_t)string->offset + string->length >= header->stringPoolLength
+            || list->pool[string->offset + string->length] != 0) {
+            return false;
+        }
+    }
+    for (uint32_t i = 0; i < header->listEntryCount; i++) {
+        if (!validString(list, list->listEntries[i], false)) {
+            return false;
+        }
+    }
+    for (uint32_t i = 0; i < header->ruleCount; i++) {
+        const CompiledFilterListRuleRecord *rule = &list->rules[i];
+        if (!validString(list, rule->urlFilter, true)
+            || !validString(list, rule->actionType, true)
+            || !validString(list, rule->selector, true)) {
+            return false;
+        }
+        for (size_t field = 0; field < CompiledFilterListFieldCount; field++) {
+            if (rule->lists[field][0] != CompiledFilterListNone
+                && (uint64_t)rule->lists[field][0] + rule->lists[field][1] > header->listEntryCount) {
+                return false;
+            }
+        }
+    }
+    return validString(list, header->version, true) && validString(list, header->expires, true);
+}
+
+CompiledFilterList *CompiledFilterListOpen(const char *path,
+                                           const char *sourcePath,
+                                           FilterListMergerError *error)
+{
+    if (error) {
+        memset(error, 0, sizeof(*error));
+    }
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        setError(error, FilterListMergerStatusReadError, errno, "%s: %s", path, strerror(errno));
+        return NULL;
+    }
+
+    struct stat status;
+    CompiledFilterList *list = calloc(1, sizeof(CompiledFilterList));
+    if (!list || fstat(fd, &status) != 0 || (size_t)status.st_size < sizeof(Header)) {
+        setError(error, FilterListMergerStatusReadError, list ? errno : ENOMEM, "%s is not a compiled filter list", path);
+        free(list);
+        close(fd);
+        return NULL;
+    }
+
+    list->length = (size_t)status.st_size;
+    list->mapped = mmap(NULL, list->length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (list->mapped == MAP_FAILED) {
+        setError(error, FilterListMergerStatusReadError, errno, "%s: %s", path, strerror(errno));
+        free(list);
+        return NULL;
+    }
+
+    const uint8_t *bytes = list->mapped;
+    const Header *header = list->header = (const Header *)bytes;
+    uint64_t stringsOffset = sizeof(Header);
+    uint64_t listEntriesOffset = stringsOffset + (uint64_t)header->stringCount * sizeof(StringRecord);
+    uint64_t rulesOffset = listEntriesOffset + (uint64_t)header->listEntryCount * sizeof(uint32_t);
+    uint64_t poolOffset = rulesOffset + (uint64_t)header->ruleCount * sizeof(CompiledFilterListRuleRecord);
+
+    bool valid = memcmp(header->magic, magic, sizeof(magic)) == 0
+        && header->formatVersion == CompiledFilterListFormatVersion
+        && poolOffset + header->stringPoolLength == list->length;
+    if (valid) {
+        list->strings = (const StringRecord *)(bytes + stringsOffset);
+        list->listEntries = (const uint32_t *)(bytes + listEntriesOffset);
+        list->rules = (const CompiledFilterListRuleRecord *)(bytes + rulesOffset);
+        list->pool = (const char *)(bytes + poolOffset);
+        valid = validate(list);
+    }
+    if (!valid) {
+        setError(error, FilterListMergerStatusParseError, 0, "%s is not a valid compiled filter list", path);
+        CompiledFilterListClose(list);
+        return NULL;
+    }
+
+    if (sourcePath) {
+        int64_t seconds = 0;
+        int64_t nanoseconds = 0;
+        bool current = stat(sourcePath, &status) == 0;
+        if (current) {
+            modificationTime(&status, &seconds, &nanoseconds);
+        }
+        if (!current
+            || (uint64_t)status.st_size != header->sourceLength
+            || seconds != header->sourceModificationSeconds
+            || nanoseconds != header->sourceModificationNanoseconds) {
+            setError(error, FilterListMergerStatusReadError, 0, "%s is outdated", path);
+            CompiledFilterListClose(list);
+            return NULL;
+        }
+    }
+
+    return list;
+}
+
+void CompiledFilterListClose(CompiledFilterList *list)
+{
+    if (!list) {
+        return;
+    }
+    munmap(list->mapped, list->length);
+    free(list);
+}
+
+size_t CompiledFilterListGetRuleCount(const CompiledFilterList *list)
+{
+    return list->header->ruleCount;
+}
+
+unsigned CompiledFilterListGetFilterListVersion(const CompiledFilterList *list)
+{
+    return list->header->filterListVersion;
+}
+
+CompiledFilterListString CompiledFilterListGetVersion(const CompiledFilterList *list)
+{
+    return CompiledFilterListGetString(list, list->header->version);
+}
+
+CompiledFilterListString CompiledFilterListGetExpires(const CompiledFilterList *list)
+{
+    return CompiledFilterListGetString(list, list->header->expires);
+}
+
+const uint8_t *CompiledFilterListGetSHA256(const CompiledFilterList *list)
+{
+    return list->header->sha256;
+}
+
+const CompiledFilterListRuleRecord *CompiledFilterListGetRule(const CompiledFilterList *list, size_t index)
+{
+    return index < list->header->ruleCount ? &list->rules[index] : NULL;
+}
+
+CompiledFilterListString CompiledFilterListGetString(const CompiledFilterList *list, uint32_t index)
+{
+    CompiledFilterListString string = { NULL, 0 };
+    if (index < list->header->stringCount) {
+        string.bytes = list->pool + list->strings[index].offset;
+        string.length = list->strings[index].length;
+    }
+    return string;
+}
+
+uint32_t CompiledFilterListGetListEntry(const CompiledFilterList *list, uint32_t index)
+{
+    return index < list->header->listEntryCount ? list->listEntries[index] : CompiledFilterListNone;
+}
+
+#pragma mark - Generating
+
+static bool generateString(yajl_gen g, CompiledFilterListString string)
+{
+    return yajl_gen_string(g, (const unsigned char *)string.bytes, string.length) == yajl_gen_status_ok;
+}
+
+static bool generateKey(yajl_gen g, const char *key)
+{
+    return yajl_gen_string(g, (const unsigned char *)key, strlen(key)) == yajl_gen_status_ok;
+}
+
+static bool generateStringField(const CompiledFilterList *list, yajl_gen g, const char *key, uint32_t index)
+{
+    return index == CompiledFilterListNone
+        || (generateKey(g, key) && generateString(g, CompiledFilterListGetString(list, index)));
+}
+
+bool CompiledFilterListGenerateRule(const CompiledFilterList *list, size_t index, yajl_gen g)
+{
+    const CompiledFilterListRuleRecord *rule = CompiledFilterListGetRule(list, index);
+    if (!rule || yajl_gen_map_open(g) != yajl_gen_status_ok) {
+        return false;
+    }
+
+    if (rule->flags & CompiledFilterListRuleHasTrigger) {
+        if (!generateKey(g, "trigger")
+            || yajl_gen_map_open(g) != yajl_gen_status_ok
+            || !generateStringField(list, g, "url-filter", rule->urlFilter)) {
+            return false;
+        }
+        if (rule->flags & CompiledFilterListRuleHasCaseSensitivity) {
+            if (!generateKey(g, "url-filter-is-case-sensitive")
+                || yajl_gen_bool(g, (rule->flags & CompiledFilterListRuleIsCaseSensitive) != 0) != yajl_gen_status_ok) {
+                return false;
+            }
+        }
+        for (size_t field = 0; field < CompiledFilterListFieldCount; field++) {
+            uint32_t start = rule->lists[field][0];
+            if (start == CompiledFilterListNone) {
+                continue;
+            }
+            if (!generateKey(g, fieldNames[field]) || yajl_gen_array_open(g) != yajl_gen_status_ok) {
+                return false;
+            }
+            for (uint32_t i = start; i < start + rule->lists[field][1]; i++) {
+                if (!generateString(g, CompiledFilterListGetString(list, list->listEntries[i]))) {
+                    return false;
+                }
+            }
+            if (yajl_gen_array_close(g) != yajl_gen_status_ok) {
+                return false;
+            }
+        }
+        if (yajl_gen_map_close(g) != yajl_gen_status_ok) {
+            return false;
+        }
+    }
+
+    if (rule->flags & CompiledFilterListRuleHasAction) {
+        if (!generateKey(g, "action")
+            || yajl_gen_map_open(g) != yajl_gen_status_ok
+            || !generateStringField(list, g, "type", rule->actionType)
+            || !generateStringField(list, g, "selector", rule->selector)
+            || yajl_gen_map_close(g) != yajl_gen_status_ok) {
+            return false;
+        }
+    }
+
+    return yajl_gen_map_close(g) == yajl_gen_status_ok;
+}
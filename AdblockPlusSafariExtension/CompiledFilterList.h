@@ -0,0 +1,144 @@
+/*
+ * This file is part of Adblock Plus <https://adblockplus.org/>,
+ * Copyright (C) 2006-present eyeo GmbH
+ *
+ * Adblock Plus is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * Adblock Plus is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Adblock Plus.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CompiledFilterList_h
+#define CompiledFilterList_h
+
+// Binary form of a filter list, written once after downloading and stored next to the JSON as
+// <fileName>.compiled. It is mapped into memory and read without any JSON parsing.
+//
+// Layout, all integers are 32 bit in host byte order:
+//   header
+//   string table     stringCount x { offset, length } into the string pool
+//   list table       listEntryCount x string index
+//   rule table       ruleCount x CompiledFilterListRuleRecord
+//   string pool      NUL terminated strings, identical strings are stored once
+
+#include "FilterListMerger.h"
+
+#include <yajl_dynamic/yajl_gen.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CompiledFilterListPathExtension "compiled"
+
+/// Index of an absent string or list.
+#define CompiledFilterListNone UINT32_MAX
+
+/// Array valued trigger fields, in the order they are written.
+typedef enum {
+    CompiledFilterListFieldResourceType = 0,
+    CompiledFilterListFieldLoadType,
+    CompiledFilterListFieldIfDomain,
+    CompiledFilterListFieldUnlessDomain,
+    CompiledFilterListFieldIfTopURL,
+    CompiledFilterListFieldUnlessTopURL,
+    CompiledFilterListFieldCount
+} CompiledFilterListField;
+
+typedef enum {
+    CompiledFilterListRuleHasTrigger = 1 << 0,
+    CompiledFilterListRuleHasAction = 1 << 1,
+    CompiledFilterListRuleHasCaseSensitivity = 1 << 2,
+    CompiledFilterListRuleIsCaseSensitive = 1 << 3
+} CompiledFilterListRuleFlags;
+
+typedef struct
+{
+    uint32_t flags;
+    // String indices, CompiledFilterListNone if absent.
+    uint32_t urlFilter;
+    uint32_t actionType;
+    uint32_t selector;
+    // Start in the list table and number of entries, start is CompiledFilterListNone if absent.
+    uint32_t lists[CompiledFilterListFieldCount][2];
+} CompiledFilterListRuleRecord;
+
+typedef struct CompiledFilterList CompiledFilterList;
+
+typedef struct
+{
+    const char *bytes;
+    size_t length;
+} CompiledFilterListString;
+
+#pragma mark - Compiling
+
+typedef struct CompiledFilterListCompiler CompiledFilterListCompiler;
+
+CompiledFilterListCompiler *CompiledFilterListCompilerCreate(void);
+
+void CompiledFilterListCompilerFree(CompiledFilterListCompiler *compiler);
+
+/// Feeds the next part of a v1 or v2 filter list. Lists using keys unknown to the format are
+/// rejected, the JSON has to be used for them.
+bool CompiledFilterListCompilerParse(CompiledFilterListCompiler *compiler, const uint8_t *bytes, size_t length);
+
+/// Completes parsing and atomically writes the compiled list to outputPath. Size and modification
+/// time of the JSON at sourcePath are recorded to detect outdated compiled lists. sha256 is the
+/// digest of the JSON and may be NULL.
+bool CompiledFilterListCompilerFinish(CompiledFilterListCompiler *compiler,
+                                      const char *outputPath,
+                                      const char *sourcePath,
+                                      const uint8_t sha256[32]);
+
+const FilterListMergerError *CompiledFilterListCompilerGetError(const CompiledFilterListCompiler *compiler);
+
+/// Compiles the filter list at inputPath in one pass.
+bool CompiledFilterListCompileFile(const char *inputPath,
+                                   const char *outputPath,
+                                   FilterListMergerError *error);
+
+#pragma mark - Reading
+
+/// Maps and validates a compiled list. If sourcePath is not NULL, lists compiled from a different
+/// version of that file are rejected.
+CompiledFilterList *CompiledFilterListOpen(const char *path,
+                                           const char *sourcePath,
+                                           FilterListMergerError *error);
+
+void CompiledFilterListClose(CompiledFilterList *list);
+
+size_t CompiledFilterListGetRuleCount(const CompiledFilterList *list);
+
+/// 2 for lists with metadata, 1 for plain arrays of rules.
+unsigned CompiledFilterListGetFilterListVersion(const CompiledFilterList *list);
+
+CompiledFilterListString CompiledFilterListGetVersion(const CompiledFilterList *list);
+
+CompiledFilterListString CompiledFilterListGetExpires(const CompiledFilterList *list);
+
+const uint8_t *CompiledFilterListGetSHA256(const CompiledFilterList *list);
+
+const CompiledFilterListRuleRecord *CompiledFilterListGetRule(const CompiledFilterList *list, size_t index);
+
+/// Returns the string with the given index, bytes is NULL for CompiledFilterListNone.
+CompiledFilterListString CompiledFilterListGetString(const CompiledFilterList *list, uint32_t index);
+
+/// Returns the string index of an entry of the list table.
+uint32_t CompiledFilterListGetListEntry(const CompiledFilterList *list, uint32_t index);
+
+/// Writes one rule as WebKit content blocker JSON.
+bool CompiledFilterListGenerateRule(const CompiledFilterList *list, size_t index, yajl_gen g);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CompiledFilterList_h */
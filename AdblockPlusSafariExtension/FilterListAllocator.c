@@ -0,0 +1,239 @@
+/*
+ * This file is part of Adblock Plus <https://adblockplus.org/>,
+ * Copyright (C) 2006-present eyeo GmbH
+ *
+ * Adblock Plus is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * Adblock Plus is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Adblock Plus.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "FilterListAllocator.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Pooled blocks have a power of two size from 16 to 2048 bytes.
+#define SmallestClassShift 4
+#define ClassCount 8
+#define LargeClass ClassCount
+
+typedef struct
+{
+    // Size class, LargeClass for blocks allocated individually.
+    size_t sizeClass;
+    // Requested size, copied when the block moves.
+    size_t size;
+} __attribute__((aligned(16))) Header;
+
+// Freed pooled blocks are linked through their first bytes.
+typedef struct FreeBlock
+{
+    struct FreeBlock *next;
+} FreeBlock;
+
+typedef struct Chunk
+{
+    struct Chunk *next;
+} __attribute__((aligned(16))) Chunk;
+
+struct FilterListAllocator
+{
+    yajl_alloc_funcs functions;
+    FilterListAllocatorStatistics statistics;
+    Chunk *chunks;
+    // Unused part of the newest chunk.
+    uint8_t *cursor;
+    uint8_t *end;
+    FreeBlock *freeBlocks[ClassCount];
+};
+
+static size_t classSize(size_t sizeClass)
+{
+    return (size_t)1 << (sizeClass + SmallestClassShift);
+}
+
+static size_t classOf(size_t size)
+{
+    size_t sizeClass = 0;
+    while (sizeClass < LargeClass && classSize(sizeClass) < size) {
+        sizeClass += 1;
+    }
+    return sizeClass;
+}
+
+static void takeBytes(FilterListAllocator *allocator, size_t length)
+{
+    FilterListAllocatorStatistics *statistics = &allocator->statistics;
+    statistics->currentBytes += length;
+    if (statistics->currentBytes > statistics->peakBytes) {
+        statistics->peakBytes = statistics->currentBytes;
+    }
+    if (statistics->limit > 0 && statistics->currentBytes > statistics->limit) {
+        statistics->limitExceeded = true;
+    }
+}
+
+static Header *allocateBlock(FilterListAllocator *allocator, size_t size)
+{
+    size_t sizeClass = classOf(size);
+    Header *header;
+
+    if (sizeClass == LargeClass) {
+        header = malloc(sizeof(Header) + size);
+        if (!header) {
+            return NULL;
+        }
+        takeBytes(allocator, sizeof(Header) + size);
+    } else if (allocator->freeBlocks[sizeClass]) {
+        FreeBlock *block = allocator->freeBlocks[sizeClass];
+        allocator->freeBlocks[sizeClass] = block->next;
+        header = (Header *)block - 1;
+        allocator->statistics.reusedBlockCount += 1;
+    } else {
+        size_t blockLength = sizeof(Header) + classSize(sizeClass);
+        if ((size_t)(allocator->end - allocator->cursor) < blockLength) {
+            // The rest of the previous chunk is left unused.
+            Chunk *chunk = malloc(FilterListAllocatorChunkLength);
+            if (!chunk) {
+                return NULL;
+            }
+            takeBytes(allocator, FilterListAllocatorChunkLength);
+            chunk->next = allocator->chunks;
+            allocator->chunks = chunk;
+            allocator->cursor = (uint8_t *)(chunk + 1);
+            allocator->end = (uint8_t *)chunk + FilterListAllocatorChunkLength;
+        }
+        header = (Header *)allocator->cursor;
+        allocator->cursor += blockLength;
+    }
+
+    header->sizeClass = sizeClass;
+    header->size = size;
+    return header;
+}
+
+static void releaseBlock(FilterListAllocator *allocator, Header *header)
+{
+    if (header->sizeClass == LargeClass) {
+        allocator->statistics.currentBytes -= sizeof(Header) + header->size;
+        free(header);
+        return;
+    }
+
+    FreeBlock *block = (FreeBlock *)(header + 1);
+    block->next = allocator->freeBlocks[header->sizeClass];
+    allocator->freeBlocks[header->sizeClass] = block;
+}
+
+#pragma mark - yajl functions
+
+static void *allocate(void *context, size_t size)
+{
+    FilterListAllocator *allocator = context;
+    allocator->statistics.allocationCount += 1;
+
+    Header *header = allocateBlock(allocator, size);
+    return header ? header + 1 : NULL;
+}
+
+static void *reallocate(void *context, void *pointer, size_t size)
+{
+    FilterListAllocator *allocator = context;
+    allocator->statistics.reallocationCount += 1;
+
+    if (!pointer) {
+        Header *header = allocateBlock(allocator, size);
+        return header ? header + 1 : NULL;
+    }
+
+    Header *header = (Header *)pointer - 1;
+    if (header->sizeClass != LargeClass && size <= classSize(header->sizeClass)) {
+        header->size = size;
+        return pointer;
+    }
+
+    if (header->sizeClass == LargeClass && classOf(size) == LargeClass) {
+        size_t previousLength = sizeof(Header) + header->size;
+        Header *moved = realloc(header, sizeof(Header) + size);
+        if (!moved) {
+            return NULL;
+        }
+        allocator->statistics.currentBytes -= previousLength;
+        takeBytes(allocator, sizeof(Header) + size);
+        moved->size = size;
+        return moved + 1;
+    }
+
+    Header *moved = allocateBlock(allocator, size);
+    if (!moved) {
+        return NULL;
+    }
+    memcpy(moved + 1, pointer, header->size < size ? header->size : size);
+    releaseBlock(allocator, header);
+    return moved + 1;
+}
+
+static void release(void *context, void *pointer)
+{
+    FilterListAllocator *allocator = context;
+    if (!pointer) {
+        return;
+    }
+    allocator->statistics.freeCount += 1;
+    releaseBlock(allocator, (Header *)pointer - 1);
+}
+
+#pragma mark - Public
+
+FilterListAllocator *FilterListAllocatorCreate(size_t limit)
+{
+    FilterListAllocator *allocator = calloc(1, sizeof(FilterListAllocator));
+    if (!allocator) {
+        return NULL;
+    }
+
+    allocator->functions.malloc = allocate;
+    allocator->functions.realloc = reallocate;
+    allocator->functions.free = release;
+    allocator->functions.ctx = allocator;
+    allocator->statistics.limit = limit;
+    return allocator;
+}
+
+void FilterListAllocatorFree(FilterListAllocator *allocator)
+{
+    if (!allocator) {
+        return;
+    }
+    Chunk *chunk = allocator->chunks;
+    while (chunk) {
+        Chunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    free(allocator);
+}
+
+yajl_alloc_funcs *FilterListAllocatorGetFunctions(FilterListAllocator *allocator)
+{
+    return &allocator->functions;
+}
+
+bool FilterListAllocatorIsLimitExceeded(const FilterListAllocator *allocator)
+{
+    return allocator->statistics.limitExceeded;
+}
+
+FilterListAllocatorStatistics FilterListAllocatorGetStatistics(const FilterListAllocator *allocator)
+{
+    return allocator->statistics;
+}
@@ -0,0 +1,87 @@
+/*
+ * This file is part of Adblock Plus <https://adblockplus.org/>,
+ * Copyright (C) 2006-present eyeo GmbH
+ *
+ * Adblock Plus is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * Adblock Plus is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Adblock Plus.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FilterListAllocator_h
+#define FilterListAllocator_h
+
+// Memory for the yajl parsers and generators, with a ceiling and statistics, so that the work of
+// the content blocker extension stays well under its memory limit.
+//
+// Small blocks, which are most of what yajl allocates, come from pools of fixed size classes
+// carved out of larger arena chunks. Freed blocks are reused by later allocations of the same
+// class and chunks are only returned when the allocator is freed. Large blocks are allocated
+// individually.
+//
+// The ceiling is a soft limit. yajl does not handle failed allocations, so allocations beyond the
+// ceiling still succeed. Exceeding it is reported by FilterListAllocatorIsLimitExceeded instead,
+// callers check it after every call into yajl and stop. Memory in use can therefore overshoot the
+// ceiling by what yajl takes during one call, however large a single allocation is. The buffers of
+// yajl at most double when they grow, so a call that buffers n more bytes of input and output
+// ends with less than 2 * (limit + n) + FilterListAllocatorChunkLength in use.
+
+#include <yajl_dynamic/yajl_common.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/// Default ceiling of one parser and generator, far more than a filter list needs unless one of its
+/// tokens is exceptionally long.
+#define FilterListAllocatorDefaultLimit (4 * 1024 * 1024)
+
+/// Small blocks are carved out of chunks of this size.
+#define FilterListAllocatorChunkLength (32 * 1024)
+
+typedef struct
+{
+    // Ceiling in bytes, 0 if there is none.
+    size_t limit;
+    // Bytes taken from the system: arena chunks and large blocks.
+    size_t currentBytes;
+    size_t peakBytes;
+    // Calls made by yajl.
+    size_t allocationCount;
+    size_t reallocationCount;
+    size_t freeCount;
+    // Allocations served from a block freed before.
+    size_t reusedBlockCount;
+    bool limitExceeded;
+} FilterListAllocatorStatistics;
+
+typedef struct FilterListAllocator FilterListAllocator;
+
+/// Creates an allocator with the given ceiling in bytes, 0 for none.
+FilterListAllocator *FilterListAllocatorCreate(size_t limit);
+
+/// Frees all memory of the allocator. Parsers and generators using it must be freed before.
+void FilterListAllocatorFree(FilterListAllocator *allocator);
+
+/// Functions to pass to yajl_alloc and yajl_gen_alloc, valid as long as the allocator.
+yajl_alloc_funcs *FilterListAllocatorGetFunctions(FilterListAllocator *allocator);
+
+bool FilterListAllocatorIsLimitExceeded(const FilterListAllocator *allocator);
+
+FilterListAllocatorStatistics FilterListAllocatorGetStatistics(const FilterListAllocator *allocator);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FilterListAllocator_h */
@@ -0,0 +1,732 @@
+/*
+ * This file is part of Adblock Plus <https://adblockplus.org/>,
+ * Copyright (C) 2006-present eyeo GmbH
+ *
+ * Adblock Plus is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * Adblock Plus is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Adblock Plus.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "FilterListComposer.h"
+
+#include <yajl_dynamic/yajl_parse.h>
+#include <yajl_dynamic/yajl_gen.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Rules nest far less deeply, deeper ones are rejected.
+#define MaximumRuleDepth 32
+
+typedef enum {
+    HashTagNull = 1,
+    HashTagBoolean,
+    HashTagNumber,
+    HashTagString,
+    HashTagMap,
+    HashTagArray
+} HashTag;
+
+typedef struct
+{
+    bool map;
+    // Maps add the hashes of their members, so that the order of keys does not matter. Arrays
+    // keep the order of their elements.
+    uint64_t hash;
+    uint64_t keyHash;
+    size_t count;
+} Level;
+
+// Open addressing set of rule hashes, 0 marks a free slot.
+typedef struct
+{
+    uint64_t *slots;
+    size_t capacity;
+    size_t count;
+} HashSet;
+
+typedef struct
+{
+    int fd;
+    bool first;
+    uint8_t *buffer;
+    size_t length;
+} Output;
+
+typedef struct
+{
+    // Rules of the current input are only recorded, the base of an overlay.
+    bool recording;
+    // Top-level values other than the rules are copied from the current input.
+    bool copyingMembers;
+    bool rulesFound;
+    bool topLevelMap;
+    // The next value belongs to the "rules" key of the top-level object.
+    bool rulesKey;
+    size_t depth;
+    // Depth of the rules array, 0 outside of it.
+    size_t rulesDepth;
+    bool inRule;
+    bool inAction;
+    bool typeKey;
+    bool exception;
+    Level levels[MaximumRuleDepth];
+    size_t levelCount;
+    // Key of the top-level member being read, copied once its value turns out to be a scalar.
+    unsigned char memberKey[64];
+    size_t memberKeyLength;
+
+    HashSet hashes;
+    FilterListAllocator *allocator;
+    yajl_handle hand;
+    yajl_gen rule;
+    yajl_gen members;
+    Output output;
+    // Exceptions are collected here and appended after all other rules.
+    Output exceptions;
+    FilterListComposerResult result;
+    FilterListMergerError error;
+} Composer;
+
+static const size_t outputBufferLength = 64 * 1024;
+static const char *ignorePreviousRules = "ignore-previous-rules";
+
+static void setError(Composer *composer, FilterListMergerStatus status, int systemError, const char *format, ...)
+{
+    if (composer->error.status != FilterListMergerStatusOK) {
+        return;
+    }
+
+    composer->error.status = status;
+    composer->error.systemError = systemError;
+
+    va_list arguments;
+    va_start(arguments, format);
+    vsnprintf(composer->error.message, sizeof(composer->error.message), format, arguments);
+    va_end(arguments);
+}
+
+static bool equalKey(const unsigned char *string, size_t stringLength, const char *key)
+{
+    return stringLength == strlen(key) && memcmp(string, key, stringLength) == 0;
+}
+
+static bool checkMemoryLimit(Composer *composer)
+{
+    if (!FilterListAllocatorIsLimitExceeded(composer->allocator)) {
+        return true;
+    }
+    FilterListAllocatorStatistics statistics = FilterListAllocatorGetStatistics(composer->allocator);
+    setError(composer, FilterListMergerStatusMemoryLimitError, 0, "Memory limit of %zu bytes exceeded, %zu bytes in use",
+             statistics.limit, statistics.currentBytes);
+    return false;
+}
+
+#pragma mark - Hashing
+
+// Finalizer of SplitMix64, spreads the bits of FNV-1a over the whole word.
+static uint64_t mix(uint64_t value)
+{
+    value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    value = (value ^ (value >> 27)) * 0x94d049bb133111ebULL;
+    return value ^ (value >> 31);
+}
+
+static uint64_t hashBytes(HashTag tag, const unsigned char *bytes, size_t length)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL ^ tag;
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ bytes[i]) * 0x100000001b3ULL;
+    }
+    return mix(hash ^ length);
+}
+
+static void addValueHash(Composer *composer, uint64_t hash)
+{
+    Level *level = &composer->levels[composer->levelCount - 1];
+    if (level->map) {
+        level->hash += mix(level->keyHash ^ (hash * 0x9e3779b97f4a7c15ULL));
+    } else {
+        level->hash = mix(level->hash ^ hash) + level->count;
+    }
+    level->count += 1;
+}
+
+static bool openLevel(Composer *composer, bool map)
+{
+    if (composer->levelCount == MaximumRuleDepth) {
+        setError(composer, FilterListMergerStatusParseError, 0, "Rule %zu is nested too deeply", composer->result.inputRuleCount);
+        return false;
+    }
+    composer->levels[composer->levelCount++] = (Level){ map, 0, 0, 0 };
+    return true;
+}
+
+static uint64_t closeLevel(Composer *composer)
+{
+    Level *level = &composer->levels[--composer->levelCount];
+    return mix(level->hash ^ ((uint64_t)(level->map ? HashTagMap : HashTagArray) << 56) ^ level->count);
+}
+
+// Adds the hash to the set, returns false if it was there already.
+static bool insertHash(Composer *composer, uint64_t hash)
+{
+    HashSet *set = &composer->hashes;
+    if (hash == 0) {
+        hash = 1;
+    }
+
+    if ((set->count + 1) * 2 > set->capacity) {
+        size_t capacity = set->capacity ? set->capacity * 2 : 4096;
+        uint64_t *slots = calloc(capacity, sizeof(uint64_t));
+        if (!slots) {
+            setError(composer, FilterListMergerStatusGenerateError, ENOMEM, "Out of memory");
+            return false;
+        }
+        for (size_t i = 0; i < set->capacity; i++) {
+            if (set->slots[i] != 0) {
+                size_t index = (size_t)set->slots[i] & (capacity - 1);
+                while (slots[index] != 0) {
+                    index = (index + 1) & (capacity - 1);
+                }
+                slots[index] = set->slots[i];
+            }
+        }
+        free(set->slots);
+        set->slots = slots;
+        set->capacity = capacity;
+    }
+
+    size_t index = (size_t)hash & (set->capacity - 1);
+    while (set->slots[index] != 0) {
+        if (set->slots[index] == hash) {
+            return false;
+        }
+        index = (index + 1) & (set->capacity - 1);
+    }
+    set->slots[index] = hash;
+    set->count += 1;
+    return true;
+}
+
+#pragma mark - Output
+
+static bool writeAll(Composer *composer, int fd, const uint8_t *bytes, size_t length)
+{
+    while (length > 0) {
+        ssize_t written = write(fd, bytes, length);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            setError(composer, FilterListMergerStatusWriteError, errno, "Writing of composed filter list has failed: %s", strerror(errno));
+            return false;
+        }
+        bytes += written;
+        length -= (size_t)written;
+    }
+    return true;
+}
+
+static bool flushOutput(Composer *composer, Output *output)
+{
+    bool result = writeAll(composer, output->fd, output->buffer, output->length);
+    output->length = 0;
+    return result;
+}
+
+static bool appendToOutput(Composer *composer, Output *output, const uint8_t *bytes, size_t length)
+{
+    if (output->length + length > outputBufferLength && !flushOutput(composer, output)) {
+        return false;
+    }
+    if (length > outputBufferLength) {
+        return writeAll(composer, output->fd, bytes, length);
+    }
+    memcpy(output->buffer + output->length, bytes, length);
+    output->length += length;
+    return true;
+}
+
+static bool appendRule(Composer *composer, Output *output, const uint8_t *bytes, size_t length)
+{
+    const uint8_t *separator = (const uint8_t *)(output->first ? "" : ",");
+    output->first = false;
+    return appendToOutput(composer, output, separator, strlen((const char *)separator))
+        && appendToOutput(composer, output, bytes, length);
+}
+
+// Writes the rule generated so far, unless the same rule was read before.
+static bool finishRule(Composer *composer, uint64_t hash)
+{
+    const unsigned char *bytes;
+    size_t length;
+    yajl_gen_get_buf(composer->rule, &bytes, &length);
+
+    // Rules are generated as elements of one array, skip the separator.
+    if (length > 0 && bytes[0] == ',') {
+        bytes += 1;
+        length -= 1;
+    }
+
+    bool result = true;
+    composer->result.inputRuleCount += 1;
+    if (!insertHash(composer, hash)) {
+        result = composer->error.status == FilterListMergerStatusOK;
+        composer->result.duplicateCount += result && !composer->recording ? 1 : 0;
+    } else if (!composer->recording) {
+        result = appendRule(composer, composer->exception ? &composer->exceptions : &composer->output, bytes, length);
+        composer->result.ruleCount += 1;
+        composer->result.exceptionCount += composer->exception ? 1 : 0;
+    }
+
+    yajl_gen_clear(composer->rule);
+    return result && checkMemoryLimit(composer);
+}
+
+#pragma mark - Parser callbacks
+
+// Checks a scalar outside of the rules. Top-level ones of the last input are copied as members,
+// after their key has been generated here.
+static bool checkScalar(Composer *composer, bool *copy)
+{
+    if (composer->rulesDepth > 0 && composer->depth == composer->rulesDepth) {
+        setError(composer, FilterListMergerStatusParseError, 0, "Rule %zu is not an object", composer->result.inputRuleCount);
+        return false;
+    }
+
+    *copy = composer->copyingMembers && composer->depth == 1 && composer->topLevelMap && !composer->rulesKey
+        && composer->memberKeyLength > 0;
+    composer->rulesKey = false;
+    return !*copy || yajl_gen_string(composer->members, composer->memberKey, composer->memberKeyLength) == yajl_gen_status_ok;
+}
+
+static int composeNull(void *ctx)
+{
+    Composer *composer = (Composer *)ctx;
+    if (!composer->inRule) {
+        bool copy;
+        return checkScalar(composer, &copy) && (!copy || yajl_gen_null(composer->members) == yajl_gen_status_ok);
+    }
+    addValueHash(composer, hashBytes(HashTagNull, NULL, 0));
+    return yajl_gen_null(composer->rule) == yajl_gen_status_ok;
+}
+
+static int composeBoolean(void *ctx, int boolean)
+{
+    Composer *composer = (Composer *)ctx;
+    if (!composer->inRule) {
+        bool copy;
+        return checkScalar(composer, &copy) && (!copy || yajl_gen_bool(composer->members, boolean) == yajl_gen_status_ok);
+    }
+    unsigned char value = boolean ? 1 : 0;
+    addValueHash(composer, hashBytes(HashTagBoolean, &value, 1));
+    return yajl_gen_bool(composer->rule, boolean) == yajl_gen_status_ok;
+}
+
+static int composeNumber(void *ctx, const char *s, size_t l)
+{
+    Composer *composer = (Composer *)ctx;
+    if (!composer->inRule) {
+        bool copy;
+        return checkScalar(composer, &copy) && (!copy || yajl_gen_number(composer->members, s, l) == yajl_gen_status_ok);
+    }
+    addValueHash(composer, hashBytes(HashTagNumber, (const unsigned char *)s, l));
+    return yajl_gen_number(composer->rule, s, l) == yajl_gen_status_ok;
+}
+
+static int composeString(void *ctx, const unsigned char *string, size_t stringLength)
+{
+    Composer *composer = (Composer *)ctx;
+    if (!composer->inRule) {
+        bool copy;
+        return checkScalar(composer, &copy) && (!copy || yajl_gen_string(composer->members, string, stringLength) == yajl_gen_status_ok);
+    }
+
+    if (composer->typeKey) {
+        composer->exception = equalKey(string, stringLength, ignorePreviousRules);
+    }
+    composer->typeKey = false;
+
+    addValueHash(composer, hashBytes(HashTagString, string, stringLength));
+    return yajl_gen_string(composer->rule, string, stringLength) == yajl_gen_status_ok;
+}
+
+static int composeMapKey(void *ctx, const unsigned char *string, size_t stringLength)
+{
+    Composer *composer = (Composer *)ctx;
+
+    if (!composer->inRule) {
+        if (composer->depth == 1) {
+            composer->rulesKey = equalKey(string, stringLength, "rules");
+            // Overly long keys are not copied.
+            composer->memberKeyLength = stringLength <= sizeof(composer->memberKey) ? stringLength : 0;
+            memcpy(composer->memberKey, string, composer->memberKeyLength);
+        }
+        return 1;
+    }
+
+    size_t ruleLevel = composer->depth - composer->rulesDepth;
+    if (ruleLevel == 1) {
+        composer->inAction = equalKey(string, stringLength, "action");
+    }
+    composer->typeKey = ruleLevel == 2 && composer->inAction && equalKey(string, stringLength, "type");
+
+    composer->levels[composer->levelCount - 1].keyHash = hashBytes(HashTagString, string, stringLength);
+    return yajl_gen_string(composer->rule, string, stringLength) == yajl_gen_status_ok;
+}
+
+static int composeStartMap(void *ctx)
+{
+    Composer *composer = (Composer *)ctx;
+    composer->depth += 1;
+
+    if (composer->depth == 1) {
+        composer->topLevelMap = true;
+        return 1;
+    }
+    if (!composer->inRule && composer->rulesDepth > 0 && composer->depth == composer->rulesDepth + 1) {
+        composer->inRule = true;
+        composer->inAction = false;
+        composer->typeKey = false;
+        composer->exception = false;
+        composer->levelCount = 0;
+    } else if (!composer->inRule) {
+        composer->rulesKey = false;
+        return 1;
+    }
+
+    return openLevel(composer, true) && yajl_gen_map_open(composer->rule) == yajl_gen_status_ok;
+}
+
+static int composeEndMap(void *ctx)
+{
+    Composer *composer = (Composer *)ctx;
+    composer->depth -= 1;
+
+    if (!composer->inRule) {
+        return 1;
+    }
+    if (yajl_gen_map_close(composer->rule) != yajl_gen_status_ok) {
+        return 0;
+    }
+
+    uint64_t hash = closeLevel(composer);
+    if (composer->levelCount > 0) {
+        addValueHash(composer, hash);
+        return 1;
+    }
+    composer->inRule = false;
+    return finishRule(composer, hash);
+}
+
+static int composeStartArray(void *ctx)
+{
+    Composer *composer = (Composer *)ctx;
+    composer->depth += 1;
+
+    if (composer->rulesDepth == 0 && ((composer->depth == 1) || (composer->depth == 2 && composer->rulesKey))) {
+        composer->rulesKey = false;
+        composer->rulesDepth = composer->depth;
+        composer->rulesFound = true;
+        return 1;
+    }
+    if (!composer->inRule) {
+        composer->rulesKey = false;
+        if (composer->rulesDepth > 0 && composer->depth == composer->rulesDepth + 1) {
+            setError(composer, FilterListMergerStatusParseError, 0, "Rule %zu is not an object", composer->result.inputRuleCount);
+            return 0;
+        }
+        return 1;
+    }
+
+    return openLevel(composer, false) && yajl_gen_array_open(composer->rule) == yajl_gen_status_ok;
+}
+
+static int composeEndArray(void *ctx)
+{
+    Composer *composer = (Composer *)ctx;
+    composer->depth -= 1;
+
+    if (composer->depth + 1 == composer->rulesDepth) {
+        composer->rulesDepth = 0;
+        return 1;
+    }
+    if (!composer->inRule) {
+        return 1;
+    }
+    if (yajl_gen_array_close(composer->rule) != yajl_gen_status_ok) {
+        return 0;
+    }
+    addValueHash(composer, closeLevel(composer));
+    return 1;
+}
+
+static yajl_callbacks callbacks = {
+    composeNull,
+    composeBoolean,
+    NULL,
+    NULL,
+    composeNumber,
+    composeString,
+    composeStartMap,
+    composeMapKey,
+    composeEndMap,
+    composeStartArray,
+    composeEndArray
+};
+
+#pragma mark - Inputs
+
+static void setParseError(Composer *composer, const char *inputPath)
+{
+    unsigned char *errorString = yajl_get_error(composer->hand, 0, NULL, 0);
+    setError(composer, FilterListMergerStatusParseError, 0, "%s: %s", inputPath, errorString ? (const char *)errorString : "Parse error");
+    yajl_free_error(composer->hand, errorString);
+}
+
+static bool parseFile(Composer *composer, const char *inputPath, uint8_t *inputBuffer)
+{
+    int fd = open(inputPath, O_RDONLY);
+    if (fd < 0) {
+        setError(composer, FilterListMergerStatusReadError, errno, "%s: %s", inputPath, strerror(errno));
+        return false;
+    }
+
+    composer->depth = 0;
+    composer->rulesDepth = 0;
+    composer->rulesFound = false;
+    composer->topLevelMap = false;
+    composer->rulesKey = false;
+    composer->inRule = false;
+    composer->memberKeyLength = 0;
+
+    composer->hand = yajl_alloc(&callbacks, FilterListAllocatorGetFunctions(composer->allocator), composer);
+    if (!composer->hand) {
+        setError(composer, FilterListMergerStatusReadError, ENOMEM, "Out of memory");
+        close(fd);
+        return false;
+    }
+    yajl_config(composer->hand, yajl_dont_validate_strings, 1);
+
+    bool result = true;
+    for (;;) {
+        ssize_t bytesRead = read(fd, inputBuffer, FilterListMergerDefaultOptions.inputBufferLength);
+        if (bytesRead < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            setError(composer, FilterListMergerStatusReadError, errno, "Reading has failed: %s", strerror(errno));
+            result = false;
+            break;
+        }
+        yajl_status status = bytesRead == 0
+            ? yajl_complete_parse(composer->hand)
+            : yajl_parse(composer->hand, inputBuffer, (size_t)bytesRead);
+        if (status != yajl_status_ok) {
+            if (checkMemoryLimit(composer)) {
+                setParseError(composer, inputPath);
+            }
+            result = false;
+            break;
+        }
+        if (!checkMemoryLimit(composer)) {
+            result = false;
+            break;
+        }
+        if (bytesRead == 0) {
+            break;
+        }
+    }
+
+    yajl_free(composer->hand);
+    composer->hand = NULL;
+    close(fd);
+
+    if (result && !composer->rulesFound) {
+        setError(composer, FilterListMergerStatusParseError, 0, "%s does not contain any rules", inputPath);
+        result = false;
+    }
+    return result;
+}
+
+// Appends the collected exceptions to the output.
+static bool appendExceptions(Composer *composer, uint8_t *buffer, size_t bufferLength)
+{
+    Output *exceptions = &composer->exceptions;
+    if (exceptions->first) {
+        return true;
+    }
+    if (!flushOutput(composer, exceptions)) {
+        return false;
+    }
+    if (lseek(exceptions->fd, 0, SEEK_SET) != 0) {
+        setError(composer, FilterListMergerStatusReadError, errno, "Exceptions could not be read: %s", strerror(errno));
+        return false;
+    }
+
+    if (!composer->output.first && !appendToOutput(composer, &composer->output, (const uint8_t *)",", 1)) {
+        return false;
+    }
+    for (;;) {
+        ssize_t bytesRead = read(exceptions->fd, buffer, bufferLength);
+        if (bytesRead < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            setError(composer, FilterListMergerStatusReadError, errno, "Exceptions could not be read: %s", strerror(errno));
+            return false;
+        }
+        if (bytesRead == 0) {
+            return true;
+        }
+        if (!appendToOutput(composer, &composer->output, buffer, (size_t)bytesRead)) {
+            return false;
+        }
+    }
+}
+
+// Closes the rules array and appends the copied members to the object.
+static bool appendMembers(Composer *composer)
+{
+    const unsigned char *bytes;
+    size_t length;
+    yajl_gen_get_buf(composer->members, &bytes, &length);
+
+    return appendToOutput(composer, &composer->output, (const uint8_t *)(length > 0 ? "]," : "]"), length > 0 ? 2 : 1)
+        && appendToOutput(composer, &composer->output, bytes, length)
+        && appendToOutput(composer, &composer->output, (const uint8_t *)"}\n", 2);
+}
+
+// Composes the inputs, rules of the first recordedCount inputs are only used to drop the same
+// rules from the others.
+static bool composeFiles(const char *const *inputPaths,
+                         size_t inputCount,
+                         size_t recordedCount,
+                         const char *outputPath,
+                         FilterListComposerResult *result,
+                         FilterListMergerError *error)
+{
+    Composer composer;
+    memset(&composer, 0, sizeof(composer));
+    composer.output = (Output){ -1, true, NULL, 0 };
+    composer.exceptions = (Output){ -1, true, NULL, 0 };
+
+    char exceptionsPath[PATH_MAX];
+    snprintf(exceptionsPath, sizeof(exceptionsPath), "%s.exceptions", outputPath);
+
+    uint8_t *inputBuffer = malloc(FilterListMergerDefaultOptions.inputBufferLength);
+    composer.output.buffer = malloc(outputBufferLength);
+    composer.exceptions.buffer = malloc(outputBufferLength);
+    composer.allocator = FilterListAllocatorCreate(FilterListAllocatorDefaultLimit);
+    if (composer.allocator) {
+        composer.rule = yajl_gen_alloc(FilterListAllocatorGetFunctions(composer.allocator));
+        composer.members = yajl_gen_alloc(FilterListAllocatorGetFunctions(composer.allocator));
+    }
+
+    bool success = false;
+    if (!inputBuffer || !composer.output.buffer || !composer.exceptions.buffer || !composer.rule || !composer.members) {
+        setError(&composer, FilterListMergerStatusGenerateError, ENOMEM, "Out of memory");
+    } else {
+        composer.output.fd = open(outputPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        composer.exceptions.fd = open(exceptionsPath, O_RDWR | O_CREAT | O_TRUNC, 0600);
+        if (composer.output.fd < 0 || composer.exceptions.fd < 0) {
+            setError(&composer, FilterListMergerStatusWriteError, errno, "%s: %s", outputPath, strerror(errno));
+        } else {
+            // The file is only needed while it is open.
+            unlink(exceptionsPath);
+            success = true;
+        }
+    }
+
+    if (success) {
+        yajl_gen_config(composer.rule, yajl_gen_validate_utf8, 0);
+        yajl_gen_config(composer.members, yajl_gen_validate_utf8, 0);
+        // Rules are generated as array elements and members as object members, so that one
+        // generator can be used for all of them.
+        yajl_gen_array_open(composer.rule);
+        yajl_gen_clear(composer.rule);
+        yajl_gen_map_open(composer.members);
+        yajl_gen_clear(composer.members);
+
+        success = appendToOutput(&composer, &composer.output, (const uint8_t *)"{\"rules\":[", 10);
+        for (size_t i = 0; i < inputCount && success; i++) {
+            composer.recording = i < recordedCount;
+            composer.copyingMembers = i == inputCount - 1;
+            success = parseFile(&composer, inputPaths[i], inputBuffer);
+        }
+        success = success
+            && appendExceptions(&composer, inputBuffer, FilterListMergerDefaultOptions.inputBufferLength)
+            && appendMembers(&composer)
+            && flushOutput(&composer, &composer.output);
+    }
+
+    if (composer.output.fd >= 0 && close(composer.output.fd) != 0 && success) {
+        setError(&composer, FilterListMergerStatusWriteError, errno, "%s: %s", outputPath, strerror(errno));
+        success = false;
+    }
+    if (composer.exceptions.fd >= 0) {
+        close(composer.exceptions.fd);
+    }
+    if (!success) {
+        unlink(outputPath);
+    }
+
+    if (composer.allocator) {
+        composer.result.statistics = FilterListAllocatorGetStatistics(composer.allocator);
+    }
+    if (result) {
+        *result = composer.result;
+    }
+    if (error) {
+        *error = composer.error;
+    }
+
+    if (composer.rule) {
+        yajl_gen_free(composer.rule);
+    }
+    if (composer.members) {
+        yajl_gen_free(composer.members);
+    }
+    FilterListAllocatorFree(composer.allocator);
+    free(composer.hashes.slots);
+    free(composer.output.buffer);
+    free(composer.exceptions.buffer);
+    free(inputBuffer);
+    return success;
+}
+
+#pragma mark - Public
+
+bool FilterListComposerComposeFiles(const char *const *inputPaths,
+                                    size_t inputCount,
+                                    const char *outputPath,
+                                    FilterListComposerResult *result,
+                                    FilterListMergerError *error)
+{
+    return composeFiles(inputPaths, inputCount, 0, outputPath, result, error);
+}
+
+bool FilterListComposerWriteOverlay(const char *basePath,
+                                    const char *inputPath,
+                                    const char *outputPath,
+                                    FilterListComposerResult *result,
+                                    FilterListMergerError *error)
+{
+    const char *inputPaths[] = { basePath, inputPath };
+    return composeFiles(inputPaths, 2, 1, outputPath, result, error);
+}
@@ -0,0 +1,69 @@
+/*
+ * This file is part of Adblock Plus <https://adblockplus.org/>,
+ * Copyright (C) 2006-present eyeo GmbH
+ *
+ * Adblock Plus is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * Adblock Plus is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Adblock Plus.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FilterListComposer_h
+#define FilterListComposer_h
+
+// Combines several filter lists (v1 or v2) into one v2 list, streaming one list after the other.
+//
+// Rules are deduplicated by a canonical hash, which does not depend on the order of keys or on
+// how strings are escaped. ignore-previous-rules only affects the rules before it, so exceptions
+// of all lists are kept in a temporary file and written after all other rules. Other rules keep
+// the order of the lists and of the rules within them.
+//
+// The same hashing stores a list as an overlay of a base list it mostly repeats: the overlay only
+// holds the rules the base does not have, composing base and overlay restores the list.
+
+#include "FilterListMerger.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct
+{
+    // Rules read, those of the base of an overlay included.
+    size_t inputRuleCount;
+    // Rules written, exceptions included.
+    size_t ruleCount;
+    size_t exceptionCount;
+    // Rules not written, because the same rule was read before.
+    size_t duplicateCount;
+    FilterListAllocatorStatistics statistics;
+} FilterListComposerResult;
+
+/// Composes the lists at inputPaths in the given order and writes the result to outputPath.
+/// Top-level values other than the rules, such as the version, are taken from the last list.
+bool FilterListComposerComposeFiles(const char *const *inputPaths,
+                                    size_t inputCount,
+                                    const char *outputPath,
+                                    FilterListComposerResult *result,
+                                    FilterListMergerError *error);
+
+/// Writes the rules of the list at inputPath which the list at basePath does not have, together
+/// with the top-level values of the list.
+bool FilterListComposerWriteOverlay(const char *basePath,
+                                    const char *inputPath,
+                                    const char *outputPath,
+                                    FilterListComposerResult *result,
+                                    FilterListMergerError *error);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FilterListComposer_h */
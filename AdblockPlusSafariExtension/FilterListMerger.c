@@ -0,0 +1,942 @@
+/*
+ * This file is part of Adblock Plus <https://adblockplus.org/>,
+ * Copyright (C) 2006-present eyeo GmbH
+ *
+ * Adblock Plus is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * Adblock Plus is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Adblock Plus.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "FilterListMerger.h"
+#include "CompiledFilterList.h"
+
+// yajl is sax-like json parser. Content blocker extension has limited amount of memory,
+// so that it is not possible to load whole filter list at once.
+#include <yajl_dynamic/yajl_parse.h>
+#include <yajl_dynamic/yajl_gen.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+const FilterListMergerOptions FilterListMergerDefaultOptions = {
+    64 * 1024,
+    64 * 1024,
+    true,
+    256,
+    FilterListAllocatorDefaultLimit,
+    true,
+    false
+};
+
+typedef enum {
+    FilterListMergerTypeVersion1,
+    FilterListMergerTypeVersion2
+} FilterListMergerType;
+
+// Same as the nesting limit of yajl.
+#define ScannerMaxDepth 128
+
+static const char *ignorePreviousRules = "ignore-previous-rules";
+
+// Finds the rules array in a filter list fed in arbitrary slices, see copyRulesVerbatim.
+typedef struct
+{
+    // Bytes scanned before the current slice.
+    size_t offset;
+    size_t depth;
+    // '{' or '[' for each open level.
+    char containers[ScannerMaxDepth];
+    bool started;
+    bool complete;
+    bool inString;
+    bool escaped;
+    // Keys of the top-level object are collected to find "rules".
+    bool expectingKey;
+    bool collectingKey;
+    bool keyComplete;
+    char key[8];
+    size_t keyLength;
+    // The next value belongs to the "rules" key.
+    bool rulesValue;
+    // Inside the rules array, whose depth is rulesDepth.
+    bool copying;
+    size_t rulesDepth;
+    // The rules array is not empty.
+    bool rulesCopied;
+} VerbatimScanner;
+
+struct FilterListMerger
+{
+    bool writingEnabled;
+    bool rulesFound;
+    // Rules were appended from a compiled list, the parser has not been used.
+    bool compiledInput;
+    FilterListMergerType filterListType;
+    size_t mapLevel;
+    size_t arrayLevel;
+    // Rules written so far, whitelisting rules included.
+    size_t ruleCount;
+    yajl_gen g;
+    yajl_handle hand;
+    FilterListAllocator *allocator;
+    VerbatimScanner scanner;
+
+    FilterListMergerOptions options;
+    FilterListMergerWriteFunction write;
+    void *writeContext;
+    FilterListMergerError error;
+};
+
+static void setError(FilterListMerger *merger, FilterListMergerStatus status, int systemError, const char *format, ...)
+{
+    if (merger->error.status != FilterListMergerStatusOK) {
+        return;
+    }
+
+    merger->error.status = status;
+    merger->error.systemError = systemError;
+
+    va_list arguments;
+    va_start(arguments, format);
+    vsnprintf(merger->error.message, sizeof(merger->error.message), format, arguments);
+    va_end(arguments);
+}
+
+static void setParseError(FilterListMerger *merger)
+{
+    unsigned char *errorString = yajl_get_error(merger->hand, 0, NULL, 0);
+    setError(merger, FilterListMergerStatusParseError, 0, "%s", errorString ? (const char *)errorString : "Parse error");
+    yajl_free_error(merger->hand, errorString);
+}
+
+// Parser and generator cannot fail allocations, they are stopped after exceeding the limit instead.
+static bool checkMemoryLimit(FilterListMerger *merger)
+{
+    if (!FilterListAllocatorIsLimitExceeded(merger->allocator)) {
+        return true;
+    }
+    FilterListAllocatorStatistics statistics = FilterListAllocatorGetStatistics(merger->allocator);
+    setError(merger, FilterListMergerStatusMemoryLimitError, 0, "Memory limit of %zu bytes exceeded, %zu bytes in use",
+             statistics.limit, statistics.currentBytes);
+    return false;
+}
+
+#pragma mark - Parser callbacks
+
+static int reformatNull(void *ctx)
+{
+    FilterListMerger *context = (FilterListMerger *)ctx;
+    return !context->writingEnabled || yajl_gen_null(context->g) == yajl_gen_status_ok;
+}
+
+static int reformatBoolean(void *ctx, int boolean)
+{
+    FilterListMerger *context = (FilterListMerger *)ctx;
+    return !context->writingEnabled || yajl_gen_bool(context->g, boolean) == yajl_gen_status_ok;
+}
+
+static int reformatNumber(void *ctx, const char *s, size_t l)
+{
+    FilterListMerger *context = (FilterListMerger *)ctx;
+    return !context->writingEnabled || yajl_gen_number(context->g, s, l) == yajl_gen_status_ok;
+}
+
+static int reformatString(void *ctx, const unsigned char *string, size_t stringLength)
+{
+    FilterListMerger *context = (FilterListMerger *)ctx;
+    return !context->writingEnabled || yajl_gen_string(context->g, string, stringLength) == yajl_gen_status_ok;
+}
+
+static int reformatMapKey(void *ctx, const unsigned char *string, size_t stringLength)
+{
+    FilterListMerger *context = (FilterListMerger *)ctx;
+
+    if (context->mapLevel == 1 && context->filterListType == FilterListMergerTypeVersion2) {
+        context->writingEnabled = stringLength == strlen("rules") && memcmp(string, "rules", stringLength) == 0;
+        return 1;
+    }
+
+    return !context->writingEnabled || yajl_gen_string(context->g, string, stringLength) == yajl_gen_status_ok;
+}
+
+static int reformatStartMap(void *ctx)
+{
+    FilterListMerger *context = (FilterListMerger *)ctx;
+    context->mapLevel += 1;
+
+    if (context->mapLevel == 1 && context->arrayLevel == 0) {
+        context->filterListType = FilterListMergerTypeVersion2;
+        return 1;
+    }
+
+    // Rules are the objects directly inside the rules array.
+    size_t ruleLevel = context->filterListType == FilterListMergerTypeVersion2 ? 2 : 1;
+    if (context->writingEnabled && context->arrayLevel == 1 && context->mapLevel == ruleLevel) {
+        context->ruleCount += 1;
+    }
+
+    return !context->writingEnabled || yajl_gen_map_open(context->g) == yajl_gen_status_ok;
+}
+
+static int reformatEndMap(void *ctx)
+{
+    FilterListMerger *context = (FilterListMerger *)ctx;
+    context->mapLevel -= 1;
+    return !context->writingEnabled || yajl_gen_map_close(context->g) == yajl_gen_status_ok;
+}
+
+static int reformatStartArray(void *ctx)
+{
+    FilterListMerger *context = (FilterListMerger *)ctx;
+    context->arrayLevel += 1;
+
+    if (context->mapLevel == 0 && context->arrayLevel == 1) {
+        context->filterListType = FilterListMergerTypeVersion1;
+        context->writingEnabled = true;
+    }
+
+    if (context->arrayLevel == 1 && context->writingEnabled) {
+        context->rulesFound = true;
+    }
+
+    return !context->writingEnabled || yajl_gen_array_open(context->g) == yajl_gen_status_ok;
+}
+
+static int reformatEndArray(void *ctx)
+{
+    FilterListMerger *context = (FilterListMerger *)ctx;
+    context->arrayLevel -= 1;
+
+    if (context->arrayLevel == 0 && context->writingEnabled) {
+        context->writingEnabled = false;
+        return 1;
+    }
+
+    return !context->writingEnabled || yajl_gen_array_close(context->g) == yajl_gen_status_ok;
+}
+
+static yajl_callbacks callbacks = {
+    reformatNull,
+    reformatBoolean,
+    NULL,
+    NULL,
+    reformatNumber,
+    reformatString,
+    reformatStartMap,
+    reformatMapKey,
+    reformatEndMap,
+    reformatStartArray,
+    reformatEndArray
+};
+
+#pragma mark - Output
+
+// Hands generated output to the writer. Unless forced, output is batched until it reaches outputBufferLength.
+static bool flushOutput(FilterListMerger *merger, bool force)
+{
+    if (!checkMemoryLimit(merger)) {
+        return false;
+    }
+
+    const unsigned char *outputBuffer;
+    size_t outputBufferLength;
+    yajl_gen_get_buf(merger->g, &outputBuffer, &outputBufferLength);
+
+    if (outputBufferLength == 0 || (!force && outputBufferLength < merger->options.outputBufferLength)) {
+        return true;
+    }
+
+    int systemError = 0;
+    if (!merger->write(merger->writeContext, outputBuffer, outputBufferLength, &systemError)) {
+        setError(merger, FilterListMergerStatusWriteError, systemError, "Writing of %zu bytes has failed: %s",
+                 outputBufferLength, systemError ? strerror(systemError) : "unknown error");
+        return false;
+    }
+
+    yajl_gen_clear(merger->g);
+    return true;
+}
+
+static bool writeCString(yajl_gen g, const char *string)
+{
+    return yajl_gen_string(g, (const unsigned char *)string, strlen(string)) == yajl_gen_status_ok;
+}
+
+// Writes {"trigger": {"url-filter": ".*", "if-domain": ["*<website>", ...]}, "action": {"type": "ignore-previous-rules"}}
+static bool writeWhitelistingRule(FilterListMerger *merger, const char *const *websites, size_t websitesCount)
+{
+    yajl_gen g = merger->g;
+
+    bool result = yajl_gen_map_open(g) == yajl_gen_status_ok
+        && writeCString(g, "trigger")
+        && yajl_gen_map_open(g) == yajl_gen_status_ok
+        && writeCString(g, "url-filter")
+        && writeCString(g, ".*")
+        && writeCString(g, "if-domain")
+        && yajl_gen_array_open(g) == yajl_gen_status_ok;
+
+    // http://comments.gmane.org/gmane.os.opendarwin.webkit.user/3971
+    // The "*" prefix extends every entry to its subdomains, it is applied to each entry separately.
+    char *websiteFilter = NULL;
+    size_t websiteFilterCapacity = 0;
+    for (size_t i = 0; i < websitesCount && result; i++) {
+        size_t websiteLength = strlen(websites[i]);
+        if (websiteLength + 2 > websiteFilterCapacity) {
+            free(websiteFilter);
+            websiteFilterCapacity = websiteLength + 2;
+            websiteFilter = malloc(websiteFilterCapacity);
+            if (!websiteFilter) {
+                setError(merger, FilterListMergerStatusGenerateError, ENOMEM, "Out of memory");
+                return false;
+            }
+        }
+        websiteFilter[0] = '*';
+        memcpy(websiteFilter + 1, websites[i], websiteLength + 1);
+        result = writeCString(g, websiteFilter);
+    }
+    free(websiteFilter);
+
+    result = result
+        && yajl_gen_array_close(g) == yajl_gen_status_ok
+        && yajl_gen_map_close(g) == yajl_gen_status_ok
+        && writeCString(g, "action")
+        && yajl_gen_map_open(g) == yajl_gen_status_ok
+        && writeCString(g, "type")
+        && writeCString(g, ignorePreviousRules)
+        && yajl_gen_map_close(g) == yajl_gen_status_ok
+        && yajl_gen_map_close(g) == yajl_gen_status_ok;
+
+    if (!result) {
+        setError(merger, FilterListMergerStatusGenerateError, 0, "Whitelisting rule for %s could not be generated", websites[0]);
+    }
+    return result;
+}
+
+#pragma mark - Verbatim rules
+
+static bool writeBytes(FilterListMerger *merger, const uint8_t *bytes, size_t length)
+{
+    if (length == 0) {
+        return true;
+    }
+    // Generated output comes first.
+    if (!flushOutput(merger, true)) {
+        return false;
+    }
+
+    int systemError = 0;
+    if (!merger->write(merger->writeContext, bytes, length, &systemError)) {
+        setError(merger, FilterListMergerStatusWriteError, systemError, "Writing of %zu bytes has failed: %s",
+                 length, systemError ? strerror(systemError) : "unknown error");
+        return false;
+    }
+    return true;
+}
+
+static bool setScanError(FilterListMerger *merger, size_t index, const char *message)
+{
+    setError(merger, FilterListMergerStatusParseError, 0, "%s at byte %zu", message, merger->scanner.offset + index);
+    return false;
+}
+
+// Tracks the nesting of the input and copies the contents of the rules array. The opening bracket is
+// generated, so that whitelisting rules can be generated into the same array.
+static bool scanVerbatim(FilterListMerger *merger, const uint8_t *bytes, size_t length)
+{
+    VerbatimScanner *scanner = &merger->scanner;
+    size_t copyStart = 0;
+
+    for (size_t i = 0; i < length; i++) {
+        if (scanner->inString && !scanner->escaped && !scanner->collectingKey) {
+            while (i < length && bytes[i] != '"' && bytes[i] != '\\') {
+                i++;
+            }
+            if (i == length) {
+                break;
+            }
+        }
+
+        uint8_t c = bytes[i];
+        if (scanner->inString) {
+            if (scanner->escaped) {
+                scanner->escaped = false;
+            } else if (c == '\\') {
+                scanner->escaped = true;
+            } else if (c == '"') {
+                scanner->inString = false;
+                scanner->keyComplete = scanner->collectingKey;
+                scanner->collectingKey = false;
+                continue;
+            }
+            // Escaped keys are compared as they are written, "rules" is never escaped in practice.
+            if (scanner->collectingKey && scanner->keyLength < sizeof(scanner->key)) {
+                scanner->key[scanner->keyLength++] = (char)c;
+            }
+            continue;
+        }
+
+        if (c == ' ' || c == '\n' || c == '\r' || c == '\t') {
+            continue;
+        }
+        if (scanner->complete) {
+            return setScanError(merger, i, "Unexpected data after the filter list");
+        }
+        if (scanner->copying && !(c == ']' && scanner->depth == scanner->rulesDepth)) {
+            scanner->rulesCopied = true;
+        }
+
+        switch (c) {
+        case '{':
+        case '[': {
+            bool rules = c == '[' && !merger->rulesFound && (scanner->depth == 0 || (scanner->depth == 1 && scanner->rulesValue));
+            if (scanner->depth == ScannerMaxDepth) {
+                return setScanError(merger, i, "Nesting is too deep");
+            }
+            if (c == '{' && scanner->copying && scanner->depth == scanner->rulesDepth) {
+                merger->ruleCount += 1;
+            }
+            scanner->started = true;
+            scanner->containers[scanner->depth++] = (char)c;
+            scanner->rulesValue = false;
+            scanner->expectingKey = scanner->depth == 1 && c == '{';
+            if (rules) {
+                if (yajl_gen_array_open(merger->g) != yajl_gen_status_ok) {
+                    setError(merger, FilterListMergerStatusGenerateError, 0, "Rules array could not be opened");
+                    return false;
+                }
+                merger->rulesFound = true;
+                scanner->copying = true;
+                scanner->rulesDepth = scanner->depth;
+                copyStart = i + 1;
+            }
+            break;
+        }
+        case '}':
+        case ']':
+            if (scanner->depth == 0 || scanner->containers[scanner->depth - 1] != (c == '}' ? '{' : '[')) {
+                return setScanError(merger, i, "Unbalanced brackets");
+            }
+            if (scanner->copying && scanner->depth == scanner->rulesDepth) {
+                scanner->copying = false;
+                if (!writeBytes(merger, bytes + copyStart, i - copyStart)) {
+                    return false;
+                }
+            }
+            scanner->depth -= 1;
+            scanner->complete = scanner->depth == 0;
+            break;
+        case '"':
+            if (scanner->depth == 0) {
+                return setScanError(merger, i, "Filter list is not an array or object");
+            }
+            scanner->inString = true;
+            scanner->collectingKey = scanner->depth == 1 && scanner->expectingKey;
+            scanner->keyLength = 0;
+            scanner->expectingKey = false;
+            scanner->rulesValue = false;
+            break;
+        case ':':
+            if (scanner->depth == 1 && scanner->keyComplete) {
+                scanner->rulesValue = scanner->keyLength == strlen("rules") && memcmp(scanner->key, "rules", scanner->keyLength) == 0;
+            }
+            scanner->keyComplete = false;
+            break;
+        case ',':
+            scanner->expectingKey = scanner->depth == 1 && scanner->containers[0] == '{';
+            scanner->rulesValue = false;
+            break;
+        default:
+            // Numbers, true, false and null are not checked.
+            if (scanner->depth == 0) {
+                return setScanError(merger, i, "Filter list is not an array or object");
+            }
+            scanner->rulesValue = false;
+            break;
+        }
+    }
+
+    scanner->offset += length;
+    return !scanner->copying || writeBytes(merger, bytes + copyStart, length - copyStart);
+}
+
+static bool finishScan(FilterListMerger *merger)
+{
+    if (merger->scanner.started && !merger->scanner.complete) {
+        setError(merger, FilterListMergerStatusParseError, 0, "Filter list ends unexpectedly after %zu bytes", merger->scanner.offset);
+        return false;
+    }
+    return true;
+}
+
+#pragma mark - Public
+
+FilterListMerger *FilterListMergerCreate(const FilterListMergerOptions *options,
+                                         FilterListMergerWriteFunction write,
+                                         void *writeContext)
+{
+    FilterListMerger *merger = calloc(1, sizeof(FilterListMerger));
+    if (!merger) {
+        return NULL;
+    }
+
+    merger->options = options ? *options : FilterListMergerDefaultOptions;
+    if (merger->options.inputBufferLength == 0) {
+        merger->options.inputBufferLength = FilterListMergerDefaultOptions.inputBufferLength;
+    }
+    merger->write = write;
+    merger->writeContext = writeContext;
+    merger->filterListType = FilterListMergerTypeVersion1;
+
+    merger->allocator = FilterListAllocatorCreate(merger->options.memoryLimit);
+    if (!merger->allocator) {
+        FilterListMergerFree(merger);
+        return NULL;
+    }
+    // Copied rules are only validated by yajl on request, it does not generate anything then.
+    bool parse = !merger->options.copyRulesVerbatim || merger->options.validateVerbatimRules;
+    yajl_callbacks *parserCallbacks = merger->options.copyRulesVerbatim ? NULL : &callbacks;
+    merger->g = yajl_gen_alloc(FilterListAllocatorGetFunctions(merger->allocator));
+    merger->hand = parse ? yajl_alloc(parserCallbacks, FilterListAllocatorGetFunctions(merger->allocator), (void *)merger) : NULL;
+    if (!merger->g || (parse && !merger->hand)) {
+        FilterListMergerFree(merger);
+        return NULL;
+    }
+
+    yajl_gen_config(merger->g, yajl_gen_beautify, 0);
+    yajl_gen_config(merger->g, yajl_gen_validate_utf8, 0);
+    if (merger->hand) {
+        yajl_config(merger->hand, yajl_allow_comments, 0);
+        yajl_config(merger->hand, yajl_dont_validate_strings, 1);
+    }
+    return merger;
+}
+
+void FilterListMergerFree(FilterListMerger *merger)
+{
+    if (!merger) {
+        return;
+    }
+    if (merger->g) {
+        yajl_gen_free(merger->g);
+    }
+    if (merger->hand) {
+        yajl_free(merger->hand);
+    }
+    FilterListAllocatorFree(merger->allocator);
+    free(merger);
+}
+
+bool FilterListMergerParse(FilterListMerger *merger, const uint8_t *bytes, size_t length)
+{
+    if (merger->error.status != FilterListMergerStatusOK) {
+        return false;
+    }
+
+    if (merger->hand && yajl_parse(merger->hand, bytes, length) != yajl_status_ok) {
+        if (checkMemoryLimit(merger)) {
+            setParseError(merger);
+        }
+        return false;
+    }
+
+    if (merger->options.copyRulesVerbatim && !scanVerbatim(merger, bytes, length)) {
+        return false;
+    }
+
+    return flushOutput(merger, false);
+}
+
+bool FilterListMergerFinish(FilterListMerger *merger,
+                            const char *const *whitelistedWebsites,
+                            size_t whitelistedWebsitesCount)
+{
+    if (merger->error.status != FilterListMergerStatusOK) {
+        return false;
+    }
+
+    // Close parser
+    if (!merger->compiledInput && merger->hand && yajl_complete_parse(merger->hand) != yajl_status_ok) {
+        setParseError(merger);
+        return false;
+    }
+    bool scanned = merger->options.copyRulesVerbatim && !merger->compiledInput;
+    if (scanned && !finishScan(merger)) {
+        return false;
+    }
+
+    if (!merger->rulesFound) {
+        setError(merger, FilterListMergerStatusParseError, 0, "Filter list does not contain any rules");
+        return false;
+    }
+
+    // The generator does not know about copied rules and omits the separator before the first whitelisting rule.
+    if (scanned && merger->scanner.rulesCopied && whitelistedWebsitesCount > 0 && !writeBytes(merger, (const uint8_t *)",", 1)) {
+        return false;
+    }
+
+    // Write whitelisted websites
+    size_t websitesPerRule = merger->options.whitelistedWebsitesPerRule > 0 ? merger->options.whitelistedWebsitesPerRule : 1;
+    for (size_t i = 0; i < whitelistedWebsitesCount; i += websitesPerRule) {
+        size_t count = whitelistedWebsitesCount - i < websitesPerRule ? whitelistedWebsitesCount - i : websitesPerRule;
+        if (!writeWhitelistingRule(merger, whitelistedWebsites + i, count) || !flushOutput(merger, false)) {
+            return false;
+        }
+        merger->ruleCount += 1;
+    }
+
+    if (yajl_gen_array_close(merger->g) != yajl_gen_status_ok) {
+        setError(merger, FilterListMergerStatusGenerateError, 0, "Rules array could not be closed");
+        return false;
+    }
+
+    return flushOutput(merger, true);
+}
+
+static bool openCompiledRules(FilterListMerger *merger)
+{
+    if (merger->error.status != FilterListMergerStatusOK) {
+        return false;
+    }
+
+    if (merger->rulesFound || yajl_gen_array_open(merger->g) != yajl_gen_status_ok) {
+        setError(merger, FilterListMergerStatusGenerateError, 0, "Rules array could not be opened");
+        return false;
+    }
+    merger->compiledInput = true;
+    merger->rulesFound = true;
+    return true;
+}
+
+static bool isException(const CompiledFilterList *list, size_t index)
+{
+    CompiledFilterListString type = CompiledFilterListGetString(list, CompiledFilterListGetRule(list, index)->actionType);
+    return type.bytes && type.length == strlen(ignorePreviousRules) && memcmp(type.bytes, ignorePreviousRules, type.length) == 0;
+}
+
+// Appends the rules of a compiled list, all of them or only those that are or are not exceptions.
+static bool appendCompiledRules(FilterListMerger *merger, const CompiledFilterList *list, int exceptions)
+{
+    size_t ruleCount = CompiledFilterListGetRuleCount(list);
+    for (size_t i = 0; i < ruleCount; i++) {
+        if (exceptions >= 0 && isException(list, i) != (exceptions > 0)) {
+            continue;
+        }
+        if (!CompiledFilterListGenerateRule(list, i, merger->g)) {
+            setError(merger, FilterListMergerStatusGenerateError, 0, "Rule %zu could not be generated", i);
+            return false;
+        }
+        if (!flushOutput(merger, false)) {
+            return false;
+        }
+        merger->ruleCount += 1;
+    }
+    return true;
+}
+
+bool FilterListMergerAppendCompiledFilterList(FilterListMerger *merger, const struct CompiledFilterList *list)
+{
+    return openCompiledRules(merger) && appendCompiledRules(merger, list, -1);
+}
+
+bool FilterListMergerAppendCompiledFilterLists(FilterListMerger *merger, const struct CompiledFilterList *const *lists, size_t count)
+{
+    if (!openCompiledRules(merger)) {
+        return false;
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (!appendCompiledRules(merger, lists[i], 0)) {
+            return false;
+        }
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (!appendCompiledRules(merger, lists[i], 1)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+const FilterListMergerError *FilterListMergerGetError(const FilterListMerger *merger)
+{
+    return &merger->error;
+}
+
+FilterListAllocatorStatistics FilterListMergerGetMemoryStatistics(const FilterListMerger *merger)
+{
+    return FilterListAllocatorGetStatistics(merger->allocator);
+}
+
+size_t FilterListMergerGetRuleCount(const FilterListMerger *merger)
+{
+    return merger->ruleCount;
+}
+
+#pragma mark - Files
+
+static bool writeToFileDescriptor(void *context, const uint8_t *bytes, size_t length, int *systemError)
+{
+    int fd = *(int *)context;
+    while (length > 0) {
+        ssize_t written = write(fd, bytes, length);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            *systemError = errno;
+            return false;
+        }
+        bytes += written;
+        length -= (size_t)written;
+    }
+    return true;
+}
+
+// Feeds a mapped file to the parser in slices, so that the generated output never grows beyond one slice.
+static bool parseMappedFile(FilterListMerger *merger, int fd, size_t fileLength)
+{
+    void *mapped = mmap(NULL, fileLength, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapped == MAP_FAILED) {
+        return false;
+    }
+    madvise(mapped, fileLength, MADV_SEQUENTIAL);
+
+    const uint8_t *bytes = mapped;
+    bool result = true;
+    for (size_t offset = 0; offset < fileLength && result; offset += merger->options.inputBufferLength) {
+        size_t length = fileLength - offset;
+        if (length > merger->options.inputBufferLength) {
+            length = merger->options.inputBufferLength;
+        }
+        result = FilterListMergerParse(merger, bytes + offset, length);
+    }
+
+    munmap(mapped, fileLength);
+    return result;
+}
+
+static bool parseReadFile(FilterListMerger *merger, int fd)
+{
+    uint8_t *inputBuffer = malloc(merger->options.inputBufferLength);
+    if (!inputBuffer) {
+        setError(merger, FilterListMergerStatusReadError, ENOMEM, "Out of memory");
+        return false;
+    }
+
+    bool result = true;
+    for (;;) {
+        ssize_t bytesRead = read(fd, inputBuffer, merger->options.inputBufferLength);
+        if (bytesRead < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            setError(merger, FilterListMergerStatusReadError, errno, "Reading has failed: %s", strerror(errno));
+            result = false;
+            break;
+        }
+        if (bytesRead == 0 || !FilterListMergerParse(merger, inputBuffer, (size_t)bytesRead)) {
+            result = bytesRead == 0;
+            break;
+        }
+    }
+
+    free(inputBuffer);
+    return result;
+}
+
+typedef bool (*InputFunction)(FilterListMerger *merger, void *context);
+
+static bool parseFile(FilterListMerger *merger, void *context)
+{
+    int input = *(int *)context;
+    struct stat status;
+
+    // Mapping fails for empty files and some file systems, reading is always possible.
+    if (merger->options.memoryMapInput && fstat(input, &status) == 0 && status.st_size > 0) {
+        if (parseMappedFile(merger, input, (size_t)status.st_size) || merger->error.status != FilterListMergerStatusOK) {
+            return merger->error.status == FilterListMergerStatusOK;
+        }
+    }
+    return parseReadFile(merger, input);
+}
+
+typedef struct
+{
+    CompiledFilterList **lists;
+    size_t count;
+} CompiledFilterListArray;
+
+static bool appendCompiledFilterList(FilterListMerger *merger, void *context)
+{
+    return FilterListMergerAppendCompiledFilterList(merger, context);
+}
+
+// Runs a merger writing to outputPath, its rules are provided by the input function.
+static bool mergeToFile(InputFunction input,
+                        void *inputContext,
+                        const char *outputPath,
+                        const char *const *whitelistedWebsites,
+                        size_t whitelistedWebsitesCount,
+                        const FilterListMergerOptions *options,
+                        FilterListMergerResult *mergerResult,
+                        FilterListMergerError *error)
+{
+    int output = open(outputPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (output < 0) {
+        error->status = FilterListMergerStatusWriteError;
+        error->systemError = errno;
+        snprintf(error->message, sizeof(error->message), "%s: %s", outputPath, strerror(errno));
+        return false;
+    }
+
+    bool result = false;
+    FilterListMerger *merger = FilterListMergerCreate(options, writeToFileDescriptor, &output);
+    if (!merger) {
+        error->status = FilterListMergerStatusGenerateError;
+        error->systemError = ENOMEM;
+        snprintf(error->message, sizeof(error->message), "Out of memory");
+    } else {
+        result = input(merger, inputContext)
+            && FilterListMergerFinish(merger, whitelistedWebsites, whitelistedWebsitesCount);
+        *error = merger->error;
+        if (mergerResult) {
+            mergerResult->ruleCount = merger->ruleCount;
+            mergerResult->statistics = FilterListMergerGetMemoryStatistics(merger);
+        }
+        FilterListMergerFree(merger);
+    }
+
+    if (close(output) != 0 && result) {
+        error->status = FilterListMergerStatusWriteError;
+        error->systemError = errno;
+        snprintf(error->message, sizeof(error->message), "%s: %s", outputPath, strerror(errno));
+        result = false;
+    }
+    return result;
+}
+
+bool FilterListMergerMergeFiles(const char *inputPath,
+                                const char *outputPath,
+                                const char *const *whitelistedWebsites,
+                                size_t whitelistedWebsitesCount,
+                                const FilterListMergerOptions *options,
+                                FilterListMergerResult *result,
+                                FilterListMergerError *error)
+{
+    FilterListMergerError localError = { FilterListMergerStatusOK, 0, "" };
+    if (result) {
+        memset(result, 0, sizeof(*result));
+    }
+
+    int input = open(inputPath, O_RDONLY);
+    if (input < 0) {
+        localError.status = FilterListMergerStatusReadError;
+        localError.systemError = errno;
+        snprintf(localError.message, sizeof(localError.message), "%s: %s", inputPath, strerror(errno));
+        if (error) {
+            *error = localError;
+        }
+        return false;
+    }
+
+    bool merged = mergeToFile(parseFile, &input, outputPath, whitelistedWebsites, whitelistedWebsitesCount, options, result, &localError);
+    close(input);
+
+    if (error) {
+        *error = localError;
+    }
+    return merged;
+}
+
+bool FilterListMergerMergeCompiledFile(const char *compiledPath,
+                                       const char *sourcePath,
+                                       const char *outputPath,
+                                       const char *const *whitelistedWebsites,
+                                       size_t whitelistedWebsitesCount,
+                                       const FilterListMergerOptions *options,
+                                       FilterListMergerResult *result,
+                                       FilterListMergerError *error)
+{
+    FilterListMergerError localError = { FilterListMergerStatusOK, 0, "" };
+    if (result) {
+        memset(result, 0, sizeof(*result));
+    }
+
+    bool merged = false;
+    CompiledFilterList *list = CompiledFilterListOpen(compiledPath, sourcePath, &localError);
+    if (list) {
+        merged = mergeToFile(appendCompiledFilterList, list, outputPath, whitelistedWebsites, whitelistedWebsitesCount, options,
+                             result, &localError);
+        CompiledFilterListClose(list);
+    }
+
+    if (error) {
+        *error = localError;
+    }
+    return merged;
+}
+
+static bool appendCompiledFilterLists(FilterListMerger *merger, void *context)
+{
+    const CompiledFilterListArray *array = context;
+    return FilterListMergerAppendCompiledFilterLists(merger, (const CompiledFilterList *const *)array->lists, array->count);
+}
+
+bool FilterListMergerMergeCompiledFiles(const char *const *compiledPaths,
+                                        const char *const *sourcePaths,
+                                        size_t count,
+                                        const char *outputPath,
+                                        const char *const *whitelistedWebsites,
+                                        size_t whitelistedWebsitesCount,
+                                        const FilterListMergerOptions *options,
+                                        FilterListMergerResult *result,
+                                        FilterListMergerError *error)
+{
+    FilterListMergerError localError = { FilterListMergerStatusOK, 0, "" };
+    if (result) {
+        memset(result, 0, sizeof(*result));
+    }
+
+    bool merged = false;
+    CompiledFilterListArray array = { calloc(count > 0 ? count : 1, sizeof(CompiledFilterList *)), 0 };
+    if (!array.lists) {
+        localError.status = FilterListMergerStatusReadError;
+        localError.systemError = ENOMEM;
+        snprintf(localError.message, sizeof(localError.message), "Out of memory");
+    } else {
+        while (array.count < count) {
+            CompiledFilterList *list = CompiledFilterListOpen(compiledPaths[array.count], sourcePaths[array.count], &localError);
+            if (!list) {
+                break;
+            }
+            array.lists[array.count++] = list;
+        }
+        if (array.count == count) {
+            merged = mergeToFile(appendCompiledFilterLists, &array, outputPath, whitelistedWebsites, whitelistedWebsitesCount,
+                                 options, result, &localError);
+        }
+        for (size_t i = 0; i < array.count; i++) {
+            CompiledFilterListClose(array.lists[i]);
+        }
+        free(array.lists);
+    }
+
+    if (error) {
+        *error = localError;
+    }
+    return merged;
+}
@@ -0,0 +1,160 @@
+/*
+ * This file is part of Adblock Plus <https://adblockplus.org/>,
+ * Copyright (C) 2006-present eyeo GmbH
+ *
+ * Adblock Plus is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * Adblock Plus is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Adblock Plus.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FilterListMerger_h
+#define FilterListMerger_h
+
+// Foundation-free merge engine used by +[AdblockPlus mergeFilterListsFromURL:...].
+// It only depends on yajl and POSIX, so it can be compiled and exercised outside of Xcode.
+
+#include "FilterListAllocator.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    FilterListMergerStatusOK = 0,
+    FilterListMergerStatusReadError,
+    FilterListMergerStatusWriteError,
+    FilterListMergerStatusParseError,
+    FilterListMergerStatusGenerateError,
+    // The parser and generator needed more than FilterListMergerOptions.memoryLimit.
+    FilterListMergerStatusMemoryLimitError
+} FilterListMergerStatus;
+
+typedef struct
+{
+    FilterListMergerStatus status;
+    // errno of a failed read or write, 0 otherwise.
+    int systemError;
+    char message[256];
+} FilterListMergerError;
+
+typedef struct
+{
+    // Size of the slices handed to the parser. Applies to both read(2) and mmap(2) input.
+    size_t inputBufferLength;
+    // Generated output is kept in memory until it reaches this size and then written at once.
+    size_t outputBufferLength;
+    // Map the input file instead of reading it into a buffer.
+    bool memoryMapInput;
+    // Number of whitelisted websites sharing the if-domain array of one ignore-previous-rules rule.
+    // 0 and 1 emit one rule per website.
+    size_t whitelistedWebsitesPerRule;
+    // Ceiling of the memory used by the parser and generator, 0 for none. It is checked after every
+    // slice of inputBufferLength bytes, see FilterListAllocator.h for how far one slice can exceed it.
+    size_t memoryLimit;
+    // Copy the bytes of the rules array to the output instead of generating every token again. The
+    // output only differs in whitespace. Copied bytes are written as they are read, regardless of
+    // outputBufferLength.
+    bool copyRulesVerbatim;
+    // With copyRulesVerbatim, parse the input with yajl as well. Otherwise only the nesting of the
+    // input is checked, which suffices for lists that were validated when they were downloaded.
+    bool validateVerbatimRules;
+} FilterListMergerOptions;
+
+extern const FilterListMergerOptions FilterListMergerDefaultOptions;
+
+typedef struct
+{
+    // Rules written, whitelisting rules included.
+    size_t ruleCount;
+    FilterListAllocatorStatistics statistics;
+} FilterListMergerResult;
+
+/// Receives batches of generated output. Returns false on failure.
+typedef bool (*FilterListMergerWriteFunction)(void *context, const uint8_t *bytes, size_t length, int *systemError);
+
+typedef struct FilterListMerger FilterListMerger;
+
+struct CompiledFilterList;
+
+/// Creates a merger writing its output through the given function. Options may be NULL.
+FilterListMerger *FilterListMergerCreate(const FilterListMergerOptions *options,
+                                         FilterListMergerWriteFunction write,
+                                         void *writeContext);
+
+void FilterListMergerFree(FilterListMerger *merger);
+
+/// Feeds the next part of a v1 (array) or v2 (object with rules) filter list.
+bool FilterListMergerParse(FilterListMerger *merger, const uint8_t *bytes, size_t length);
+
+/// Completes parsing, appends whitelisting rules and flushes the remaining output.
+bool FilterListMergerFinish(FilterListMerger *merger,
+                            const char *const *whitelistedWebsites,
+                            size_t whitelistedWebsitesCount);
+
+/// Appends all rules of a compiled list instead of parsing JSON. Replaces FilterListMergerParse.
+bool FilterListMergerAppendCompiledFilterList(FilterListMerger *merger, const struct CompiledFilterList *list);
+
+/// Appends the rules of several compiled lists in the order of FilterListComposer: the exceptions
+/// of all lists follow all other rules. Rules are not deduplicated, which suits a base and its
+/// overlay. Replaces FilterListMergerParse.
+bool FilterListMergerAppendCompiledFilterLists(FilterListMerger *merger, const struct CompiledFilterList *const *lists, size_t count);
+
+const FilterListMergerError *FilterListMergerGetError(const FilterListMerger *merger);
+
+/// Memory used by the parser and generator so far, including the peak.
+FilterListAllocatorStatistics FilterListMergerGetMemoryStatistics(const FilterListMerger *merger);
+
+/// Rules written so far, whitelisting rules included.
+size_t FilterListMergerGetRuleCount(const FilterListMerger *merger);
+
+/// Merges the filter list at inputPath with whitelisted websites and writes the result to outputPath.
+/// result may be NULL, it is set whether or not merging succeeds.
+bool FilterListMergerMergeFiles(const char *inputPath,
+                                const char *outputPath,
+                                const char *const *whitelistedWebsites,
+                                size_t whitelistedWebsitesCount,
+                                const FilterListMergerOptions *options,
+                                FilterListMergerResult *result,
+                                FilterListMergerError *error);
+
+/// Merges the compiled form of the filter list at sourcePath, see CompiledFilterList.h. Fails
+/// without writing anything if the compiled list is missing or outdated.
+bool FilterListMergerMergeCompiledFile(const char *compiledPath,
+                                       const char *sourcePath,
+                                       const char *outputPath,
+                                       const char *const *whitelistedWebsites,
+                                       size_t whitelistedWebsitesCount,
+                                       const FilterListMergerOptions *options,
+                                       FilterListMergerResult *result,
+                                       FilterListMergerError *error);
+
+/// Merges the compiled forms of the filter lists at sourcePaths as composed by FilterListComposer,
+/// so that a list stored as an overlay is merged with its base without parsing JSON. Fails
+/// without writing anything if one of the compiled lists is missing or outdated.
+bool FilterListMergerMergeCompiledFiles(const char *const *compiledPaths,
+                                        const char *const *sourcePaths,
+                                        size_t count,
+                                        const char *outputPath,
+                                        const char *const *whitelistedWebsites,
+                                        size_t whitelistedWebsitesCount,
+                                        const FilterListMergerOptions *options,
+                                        FilterListMergerResult *result,
+                                        FilterListMergerError *error);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FilterListMerger_h */
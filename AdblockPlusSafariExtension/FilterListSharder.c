@@ -0,0 +1,590 @@
+/*
+ * This file is part of Adblock Plus <https://adblockplus.org/>,
+ * Copyright (C) 2006-present eyeo GmbH
+ *
+ * Adblock Plus is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * Adblock Plus is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Adblock Plus.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "FilterListSharder.h"
+#include "FilterListAllocator.h"
+
+#include <yajl_dynamic/yajl_parse.h>
+#include <yajl_dynamic/yajl_gen.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+typedef struct
+{
+    int fd;
+    // Shards are written under a unique name and renamed when all of them are complete.
+    char temporaryPath[PATH_MAX];
+    bool first;
+    // Position of the first rule and position following the last blocking rule of the shard.
+    size_t start;
+    size_t end;
+    uint8_t *buffer;
+    size_t length;
+} Shard;
+
+typedef struct
+{
+    // The first pass only classifies rules, the second one writes them.
+    bool writing;
+    bool rulesFound;
+    bool inRule;
+    bool inAction;
+    bool typeKey;
+    size_t mapLevel;
+    size_t arrayLevel;
+    size_t ruleIndex;
+    size_t ruleCount;
+
+    // One byte per rule, set for ignore-previous-rules rules.
+    uint8_t *exceptions;
+    size_t exceptionsCapacity;
+    size_t exceptionCount;
+
+    Shard *shards;
+    size_t shardCount;
+    size_t currentShard;
+
+    // Shard i is written to outputPathPrefix, i in decimal and outputPathSuffix.
+    const char *outputPathPrefix;
+    const char *outputPathSuffix;
+
+    // Parsers and the generator draw from one allocator with a ceiling.
+    FilterListAllocator *allocator;
+    yajl_handle hand;
+    yajl_gen g;
+    FilterListMergerError error;
+} Sharder;
+
+static const size_t shardBufferLength = 64 * 1024;
+static const char *ignorePreviousRules = "ignore-previous-rules";
+
+static void setError(Sharder *sharder, FilterListMergerStatus status, int systemError, const char *format, ...)
+{
+    if (sharder->error.status != FilterListMergerStatusOK) {
+        return;
+    }
+
+    sharder->error.status = status;
+    sharder->error.systemError = systemError;
+
+    va_list arguments;
+    va_start(arguments, format);
+    vsnprintf(sharder->error.message, sizeof(sharder->error.message), format, arguments);
+    va_end(arguments);
+}
+
+static bool equalKey(const unsigned char *string, size_t stringLength, const char *key)
+{
+    return stringLength == strlen(key) && memcmp(string, key, stringLength) == 0;
+}
+
+static bool checkMemoryLimit(Sharder *sharder)
+{
+    if (!FilterListAllocatorIsLimitExceeded(sharder->allocator)) {
+        return true;
+    }
+    FilterListAllocatorStatistics statistics = FilterListAllocatorGetStatistics(sharder->allocator);
+    setError(sharder, FilterListMergerStatusMemoryLimitError, 0, "Memory limit of %zu bytes exceeded, %zu bytes in use",
+             statistics.limit, statistics.currentBytes);
+    return false;
+}
+
+static bool shardPath(Sharder *sharder, size_t index, char path[PATH_MAX])
+{
+    if (snprintf(path, PATH_MAX, "%s%zu%s", sharder->outputPathPrefix, index, sharder->outputPathSuffix) >= PATH_MAX) {
+        setError(sharder, FilterListMergerStatusWriteError, ENAMETOOLONG, "%s: %s", sharder->outputPathPrefix, strerror(ENAMETOOLONG));
+        return false;
+    }
+    return true;
+}
+
+#pragma mark - Output
+
+static bool writeAll(Sharder *sharder, int fd, const uint8_t *bytes, size_t length)
+{
+    while (length > 0) {
+        ssize_t written = write(fd, bytes, length);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            setError(sharder, FilterListMergerStatusWriteError, errno, "Writing of shard has failed: %s", strerror(errno));
+            return false;
+        }
+        bytes += written;
+        length -= (size_t)written;
+    }
+    return true;
+}
+
+static bool flushShard(Sharder *sharder, Shard *shard)
+{
+    bool result = writeAll(sharder, shard->fd, shard->buffer, shard->length);
+    shard->length = 0;
+    return result;
+}
+
+static bool appendToShard(Sharder *sharder, Shard *shard, const uint8_t *bytes, size_t length)
+{
+    if (shard->length + length > shardBufferLength && !flushShard(sharder, shard)) {
+        return false;
+    }
+    if (length > shardBufferLength) {
+        return writeAll(sharder, shard->fd, bytes, length);
+    }
+    memcpy(shard->buffer + shard->length, bytes, length);
+    shard->length += length;
+    return true;
+}
+
+static bool appendRule(Sharder *sharder, Shard *shard, const uint8_t *bytes, size_t length)
+{
+    const uint8_t *separator = (const uint8_t *)(shard->first ? "" : ",");
+    shard->first = false;
+    return appendToShard(sharder, shard, separator, strlen((const char *)separator))
+        && appendToShard(sharder, shard, bytes, length);
+}
+
+// Writes the rule generated so far into all shards it belongs to.
+static bool routeRule(Sharder *sharder)
+{
+    const unsigned char *bytes;
+    size_t length;
+    yajl_gen_get_buf(sharder->g, &bytes, &length);
+
+    // Rules are generated as elements of one array, skip the separator.
+    if (length > 0 && bytes[0] == ',') {
+        bytes += 1;
+        length -= 1;
+    }
+
+    bool result = true;
+    size_t index = sharder->ruleIndex;
+    if (sharder->exceptions[index]) {
+        for (size_t i = 0; i < sharder->shardCount && sharder->shards[i].start <= index && result; i++) {
+            result = appendRule(sharder, &sharder->shards[i], bytes, length);
+        }
+    } else {
+        while (sharder->currentShard + 1 < sharder->shardCount && index >= sharder->shards[sharder->currentShard].end) {
+            sharder->currentShard += 1;
+        }
+        result = appendRule(sharder, &sharder->shards[sharder->currentShard], bytes, length);
+    }
+
+    yajl_gen_clear(sharder->g);
+    return result && checkMemoryLimit(sharder);
+}
+
+#pragma mark - Parser callbacks
+
+static int shardNull(void *ctx)
+{
+    Sharder *sharder = (Sharder *)ctx;
+    return !sharder->writing || !sharder->inRule || yajl_gen_null(sharder->g) == yajl_gen_status_ok;
+}
+
+static int shardBoolean(void *ctx, int boolean)
+{
+    Sharder *sharder = (Sharder *)ctx;
+    return !sharder->writing || !sharder->inRule || yajl_gen_bool(sharder->g, boolean) == yajl_gen_status_ok;
+}
+
+static int shardNumber(void *ctx, const char *s, size_t l)
+{
+    Sharder *sharder = (Sharder *)ctx;
+    return !sharder->writing || !sharder->inRule || yajl_gen_number(sharder->g, s, l) == yajl_gen_status_ok;
+}
+
+static int shardString(void *ctx, const unsigned char *string, size_t stringLength)
+{
+    Sharder *sharder = (Sharder *)ctx;
+
+    if (!sharder->writing && sharder->typeKey && equalKey(string, stringLength, ignorePreviousRules)) {
+        sharder->exceptions[sharder->ruleIndex] = 1;
+        sharder->exceptionCount += 1;
+    }
+    sharder->typeKey = false;
+
+    return !sharder->writing || !sharder->inRule || yajl_gen_string(sharder->g, string, stringLength) == yajl_gen_status_ok;
+}
+
+static int shardMapKey(void *ctx, const unsigned char *string, size_t stringLength)
+{
+    Sharder *sharder = (Sharder *)ctx;
+
+    if (sharder->mapLevel == 1) {
+        sharder->inAction = equalKey(string, stringLength, "action");
+    }
+    sharder->typeKey = sharder->mapLevel == 2 && sharder->inAction && equalKey(string, stringLength, "type");
+
+    return !sharder->writing || yajl_gen_string(sharder->g, string, stringLength) == yajl_gen_status_ok;
+}
+
+static int shardStartMap(void *ctx)
+{
+    Sharder *sharder = (Sharder *)ctx;
+
+    if (sharder->arrayLevel == 0) {
+        setError(sharder, FilterListMergerStatusParseError, 0, "Only merged filter lists can be sharded");
+        return 0;
+    }
+
+    if (sharder->mapLevel == 0 && sharder->arrayLevel == 1) {
+        sharder->inRule = true;
+        sharder->ruleIndex = sharder->ruleCount;
+        sharder->ruleCount += 1;
+
+        if (!sharder->writing && sharder->ruleIndex >= sharder->exceptionsCapacity) {
+            size_t capacity = sharder->exceptionsCapacity ? sharder->exceptionsCapacity * 2 : 4096;
+            uint8_t *exceptions = realloc(sharder->exceptions, capacity);
+            if (!exceptions) {
+                setError(sharder, FilterListMergerStatusGenerateError, ENOMEM, "Out of memory");
+                return 0;
+            }
+            sharder->exceptions = exceptions;
+            sharder->exceptionsCapacity = capacity;
+        }
+        if (!sharder->writing) {
+            sharder->exceptions[sharder->ruleIndex] = 0;
+        }
+    }
+
+    sharder->mapLevel += 1;
+    return !sharder->writing || !sharder->inRule || yajl_gen_map_open(sharder->g) == yajl_gen_status_ok;
+}
+
+static int shardEndMap(void *ctx)
+{
+    Sharder *sharder = (Sharder *)ctx;
+    sharder->mapLevel -= 1;
+
+    if (sharder->writing && sharder->inRule && yajl_gen_map_close(sharder->g) != yajl_gen_status_ok) {
+        return 0;
+    }
+
+    if (sharder->mapLevel == 0 && sharder->arrayLevel == 1) {
+        sharder->inRule = false;
+        sharder->inAction = false;
+        return !sharder->writing || routeRule(sharder);
+    }
+    return 1;
+}
+
+static int shardStartArray(void *ctx)
+{
+    Sharder *sharder = (Sharder *)ctx;
+    sharder->arrayLevel += 1;
+
+    if (sharder->mapLevel == 0 && sharder->arrayLevel == 1) {
+        sharder->rulesFound = true;
+        return 1;
+    }
+
+    return !sharder->writing || !sharder->inRule || yajl_gen_array_open(sharder->g) == yajl_gen_status_ok;
+}
+
+static int shardEndArray(void *ctx)
+{
+    Sharder *sharder = (Sharder *)ctx;
+    sharder->arrayLevel -= 1;
+
+    if (sharder->mapLevel == 0 && sharder->arrayLevel == 0) {
+        return 1;
+    }
+
+    return !sharder->writing || !sharder->inRule || yajl_gen_array_close(sharder->g) == yajl_gen_status_ok;
+}
+
+static yajl_callbacks callbacks = {
+    shardNull,
+    shardBoolean,
+    NULL,
+    NULL,
+    shardNumber,
+    shardString,
+    shardStartMap,
+    shardMapKey,
+    shardEndMap,
+    shardStartArray,
+    shardEndArray
+};
+
+#pragma mark - Passes
+
+static bool parseFile(Sharder *sharder, const char *inputPath)
+{
+    int fd = open(inputPath, O_RDONLY);
+    if (fd < 0) {
+        setError(sharder, FilterListMergerStatusReadError, errno, "%s: %s", inputPath, strerror(errno));
+        return false;
+    }
+
+    sharder->hand = yajl_alloc(&callbacks, FilterListAllocatorGetFunctions(sharder->allocator), sharder);
+    uint8_t *inputBuffer = malloc(FilterListMergerDefaultOptions.inputBufferLength);
+    if (!sharder->hand || !inputBuffer) {
+        setError(sharder, FilterListMergerStatusReadError, ENOMEM, "Out of memory");
+        free(inputBuffer);
+        close(fd);
+        return false;
+    }
+    yajl_config(sharder->hand, yajl_dont_validate_strings, 1);
+
+    bool result = true;
+    for (;;) {
+        ssize_t bytesRead = read(fd, inputBuffer, FilterListMergerDefaultOptions.inputBufferLength);
+        if (bytesRead < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            setError(sharder, FilterListMergerStatusReadError, errno, "Reading has failed: %s", strerror(errno));
+            result = false;
+            break;
+        }
+        yajl_status status = bytesRead == 0
+            ? yajl_complete_parse(sharder->hand)
+            : yajl_parse(sharder->hand, inputBuffer, (size_t)bytesRead);
+        if (status != yajl_status_ok) {
+            if (checkMemoryLimit(sharder)) {
+                unsigned char *errorString = yajl_get_error(sharder->hand, 0, NULL, 0);
+                setError(sharder, FilterListMergerStatusParseError, 0, "%s", errorString ? (const char *)errorString : "Parse error");
+                yajl_free_error(sharder->hand, errorString);
+            }
+            result = false;
+            break;
+        }
+        if (!checkMemoryLimit(sharder)) {
+            result = false;
+            break;
+        }
+        if (bytesRead == 0) {
+            break;
+        }
+    }
+
+    free(inputBuffer);
+    yajl_free(sharder->hand);
+    sharder->hand = NULL;
+    close(fd);
+
+    if (result && !sharder->rulesFound) {
+        setError(sharder, FilterListMergerStatusParseError, 0, "Filter list does not contain any rules");
+        result = false;
+    }
+    return result;
+}
+
+// Splits blocking rules into ranges, so that each range plus the exceptions following its start fit the budget.
+static bool planShards(Sharder *sharder, size_t ruleBudget)
+{
+    size_t capacity = 0;
+    size_t exceptionsBefore = 0;
+    size_t index = 0;
+
+    while (index < sharder->ruleCount || sharder->shardCount == 0) {
+        size_t start = index;
+        size_t exceptionsFollowing = sharder->exceptionCount - exceptionsBefore;
+        if (exceptionsFollowing >= ruleBudget) {
+            setError(sharder, FilterListMergerStatusGenerateError, 0,
+                     "%zu exceptions do not fit into the budget of %zu rules", exceptionsFollowing, ruleBudget);
+            return false;
+        }
+
+        size_t blockingRules = 0;
+        while (index < sharder->ruleCount && blockingRules < ruleBudget - exceptionsFollowing) {
+            if (sharder->exceptions[index]) {
+                exceptionsBefore += 1;
+            } else {
+                blockingRules += 1;
+            }
+            index += 1;
+        }
+        size_t end = index;
+
+        // Exceptions following the range stay with it, the next shard starts with a blocking rule.
+        while (index < sharder->ruleCount && sharder->exceptions[index]) {
+            exceptionsBefore += 1;
+            index += 1;
+        }
+
+        if (sharder->shardCount == capacity) {
+            capacity = capacity ? capacity * 2 : 4;
+            Shard *shards = realloc(sharder->shards, capacity * sizeof(Shard));
+            if (!shards) {
+                setError(sharder, FilterListMergerStatusGenerateError, ENOMEM, "Out of memory");
+                return false;
+            }
+            sharder->shards = shards;
+        }
+        sharder->shards[sharder->shardCount] = (Shard){ -1, "", true, start, end, NULL, 0 };
+        sharder->shardCount += 1;
+    }
+    return true;
+}
+
+static bool openShards(Sharder *sharder)
+{
+    for (size_t i = 0; i < sharder->shardCount; i++) {
+        char path[PATH_MAX];
+        if (!shardPath(sharder, i, path)) {
+            return false;
+        }
+
+        Shard *shard = &sharder->shards[i];
+        if (snprintf(shard->temporaryPath, sizeof(shard->temporaryPath), "%s.XXXXXX", path) >= (int)sizeof(shard->temporaryPath)) {
+            shard->temporaryPath[0] = '\0';
+            setError(sharder, FilterListMergerStatusWriteError, ENAMETOOLONG, "%s: %s", path, strerror(ENAMETOOLONG));
+            return false;
+        }
+        shard->buffer = malloc(shardBufferLength);
+        shard->fd = shard->buffer ? mkstemp(shard->temporaryPath) : -1;
+        if (shard->fd < 0) {
+            shard->temporaryPath[0] = '\0';
+        }
+        if (!shard->buffer || shard->fd < 0 || fchmod(shard->fd, 0644) != 0) {
+            setError(sharder, FilterListMergerStatusWriteError, shard->buffer ? errno : ENOMEM, "%s: %s", path,
+                     strerror(shard->buffer ? errno : ENOMEM));
+            return false;
+        }
+        if (!appendToShard(sharder, shard, (const uint8_t *)"[", 1)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Shards replace earlier ones with the same names only if all of them were written, so that
+// readers never see a partially written shard.
+static bool closeShards(Sharder *sharder, bool success)
+{
+    for (size_t i = 0; i < sharder->shardCount; i++) {
+        Shard *shard = &sharder->shards[i];
+        if (success) {
+            success = appendToShard(sharder, shard, (const uint8_t *)"]", 1) && flushShard(sharder, shard);
+        }
+        if (shard->fd >= 0 && close(shard->fd) != 0 && success) {
+            setError(sharder, FilterListMergerStatusWriteError, errno, "Closing of shard has failed: %s", strerror(errno));
+            success = false;
+        }
+        shard->fd = -1;
+        free(shard->buffer);
+        shard->buffer = NULL;
+    }
+
+    size_t renamed = 0;
+    for (; success && renamed < sharder->shardCount; renamed++) {
+        char path[PATH_MAX];
+        if (!shardPath(sharder, renamed, path)) {
+            success = false;
+            break;
+        }
+        if (rename(sharder->shards[renamed].temporaryPath, path) != 0) {
+            setError(sharder, FilterListMergerStatusWriteError, errno, "%s: %s", path, strerror(errno));
+            success = false;
+            break;
+        }
+    }
+
+    if (!success) {
+        for (size_t i = 0; i < sharder->shardCount; i++) {
+            char path[PATH_MAX];
+            if (i < renamed && shardPath(sharder, i, path)) {
+                unlink(path);
+            } else if (sharder->shards[i].temporaryPath[0] != '\0') {
+                unlink(sharder->shards[i].temporaryPath);
+            }
+        }
+    }
+    return success;
+}
+
+#pragma mark - Public
+
+bool FilterListSharderShardFile(const char *inputPath,
+                                const char *outputPathPrefix,
+                                const char *outputPathSuffix,
+                                size_t ruleBudget,
+                                FilterListSharderResult *result,
+                                FilterListMergerError *error)
+{
+    Sharder sharder;
+    memset(&sharder, 0, sizeof(sharder));
+    sharder.outputPathPrefix = outputPathPrefix;
+    sharder.outputPathSuffix = outputPathSuffix;
+
+    sharder.allocator = FilterListAllocatorCreate(FilterListAllocatorDefaultLimit);
+    bool success = sharder.allocator != NULL;
+    if (!success) {
+        setError(&sharder, FilterListMergerStatusGenerateError, ENOMEM, "Out of memory");
+    } else {
+        success = parseFile(&sharder, inputPath);
+    }
+
+    if (success && sharder.ruleCount > ruleBudget) {
+        success = planShards(&sharder, ruleBudget);
+
+        if (success) {
+            sharder.g = yajl_gen_alloc(FilterListAllocatorGetFunctions(sharder.allocator));
+            if (!sharder.g) {
+                setError(&sharder, FilterListMergerStatusGenerateError, ENOMEM, "Out of memory");
+                success = false;
+            } else {
+                yajl_gen_config(sharder.g, yajl_gen_validate_utf8, 0);
+                // Rules are generated as array elements, so that one generator can be used for all of them.
+                yajl_gen_array_open(sharder.g);
+                yajl_gen_clear(sharder.g);
+            }
+        }
+
+        if (success) {
+            success = openShards(&sharder);
+            if (success) {
+                sharder.writing = true;
+                sharder.ruleCount = 0;
+                sharder.rulesFound = false;
+                success = parseFile(&sharder, inputPath);
+            }
+            success = closeShards(&sharder, success);
+        }
+    } else if (success) {
+        sharder.shardCount = 1;
+    }
+
+    if (result) {
+        result->ruleCount = sharder.ruleCount;
+        result->exceptionCount = sharder.exceptionCount;
+        result->shardCount = success ? sharder.shardCount : 0;
+    }
+    if (error) {
+        *error = sharder.error;
+    }
+
+    if (sharder.g) {
+        yajl_gen_free(sharder.g);
+    }
+    FilterListAllocatorFree(sharder.allocator);
+    free(sharder.shards);
+    free(sharder.exceptions);
+    return success;
+}
@@ -0,0 +1,58 @@
+/*
+ * This file is part of Adblock Plus <https://adblockplus.org/>,
+ * Copyright (C) 2006-present eyeo GmbH
+ *
+ * Adblock Plus is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * Adblock Plus is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Adblock Plus.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FilterListSharder_h
+#define FilterListSharder_h
+
+// Splits a merged (v1) filter list into shards that stay under a rule budget.
+//
+// ignore-previous-rules only affects the rules before it in the same content blocker. Blocking
+// rules are therefore split into consecutive ranges, and every shard additionally receives all
+// exceptions following the start of its range, in their original order.
+
+#include "FilterListMerger.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/// WebKit refuses content blockers with more rules than this.
+#define FilterListSharderDefaultRuleBudget 50000
+
+typedef struct
+{
+    size_t ruleCount;
+    size_t exceptionCount;
+    // 1 if the list fits into the budget, no shard is written in that case.
+    size_t shardCount;
+} FilterListSharderResult;
+
+/// Shards the filter list at inputPath. Shard i is written to outputPathPrefix, followed by the zero
+/// based index i in decimal and outputPathSuffix. Parsing and generating are subject to
+/// FilterListAllocatorDefaultLimit.
+bool FilterListSharderShardFile(const char *inputPath,
+                                const char *outputPathPrefix,
+                                const char *outputPathSuffix,
+                                size_t ruleBudget,
+                                FilterListSharderResult *result,
+                                FilterListMergerError *error);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FilterListSharder_h */
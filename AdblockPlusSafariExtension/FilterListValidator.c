@@ -0,0 +1,929 @@
+/*
+ * This file is part of Adblock Plus <https://adblockplus.org/>,
+ * Copyright (C) 2006-present eyeo GmbH
+ *
+ * Adblock Plus is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * Adblock Plus is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Adblock Plus.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "FilterListValidator.h"
+
+#include <yajl_dynamic/yajl_parse.h>
+#include <yajl_dynamic/yajl_gen.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+typedef enum {
+    ValueNull,
+    ValueBoolean,
+    ValueNumber,
+    ValueString,
+    ValueMap,
+    ValueArray
+} ValueKind;
+
+typedef enum {
+    SectionNone,
+    SectionTrigger,
+    SectionAction
+} Section;
+
+typedef enum {
+    FieldOther,
+    FieldURLFilter,
+    FieldResourceType,
+    FieldLoadType,
+    FieldIfDomain,
+    FieldUnlessDomain,
+    FieldIfTopURL,
+    FieldUnlessTopURL,
+    FieldType,
+    FieldSelector
+} Field;
+
+typedef enum {
+    ActionNone,
+    ActionUnknown,
+    ActionCSSDisplayNone,
+    ActionOther
+} Action;
+
+struct FilterListValidator
+{
+    size_t depth;
+    // Depth of the elements of the rules array, set once the array is found.
+    size_t rulesDepth;
+    bool rulesFound;
+    bool inRules;
+    // The last key of a v2 list was "rules".
+    bool rulesKey;
+
+    size_t ruleCount;
+    size_t rejectedRuleCount;
+
+    // State of the current rule.
+    FilterListValidatorIssue issue;
+    Section ruleKey;
+    Section section;
+    Field field;
+    bool inList;
+    size_t listLength;
+    bool hasTrigger;
+    bool hasAction;
+    bool hasURLFilter;
+    bool hasSelector;
+    Action action;
+    // One bit per if-domain, unless-domain, if-top-url and unless-top-url.
+    unsigned int conditions;
+
+    FilterListValidatorIssueFunction report;
+    void *reportContext;
+
+    // Output is only generated if there is a write function.
+    bool writing;
+    bool wroteRule;
+    yajl_gen g;
+    uint8_t *output;
+    size_t outputLength;
+    FilterListMergerWriteFunction write;
+    void *writeContext;
+
+    yajl_handle hand;
+    FilterListMergerError error;
+};
+
+static const size_t outputBufferLength = 64 * 1024;
+
+// Resource types known to all supported iOS versions.
+static const char *const resourceTypes[] = {
+    "document", "image", "style-sheet", "script", "font", "raw", "svg-document", "media", "popup", NULL
+};
+
+static const char *const loadTypes[] = { "first-party", "third-party", NULL };
+
+static const char *const actionTypes[] = { "block", "block-cookies", "ignore-previous-rules", "make-https", NULL };
+
+static void setError(FilterListValidator *validator, FilterListMergerStatus status, int systemError, const char *format, ...)
+{
+    if (validator->error.status != FilterListMergerStatusOK) {
+        return;
+    }
+
+    validator->error.status = status;
+    validator->error.systemError = systemError;
+
+    va_list arguments;
+    va_start(arguments, format);
+    vsnprintf(validator->error.message, sizeof(validator->error.message), format, arguments);
+    va_end(arguments);
+}
+
+static void setParseError(FilterListValidator *validator)
+{
+    unsigned char *errorString = yajl_get_error(validator->hand, 0, NULL, 0);
+    setError(validator, FilterListMergerStatusParseError, 0, "%s", errorString ? (const char *)errorString : "Parse error");
+    yajl_free_error(validator->hand, errorString);
+}
+
+static bool equalKey(const unsigned char *string, size_t stringLength, const char *key)
+{
+    return stringLength == strlen(key) && memcmp(string, key, stringLength) == 0;
+}
+
+static bool isListed(const unsigned char *string, size_t stringLength, const char *const *list)
+{
+    for (; *list; list++) {
+        if (equalKey(string, stringLength, *list)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+#pragma mark - Grammar
+
+static bool isAlphanumeric(unsigned char character)
+{
+    return (character >= '0' && character <= '9') || (character >= 'a' && character <= 'z') || (character >= 'A' && character <= 'Z');
+}
+
+// The subset of regular expressions WebKit compiles: ASCII only, no disjunction, counted
+// repetition, backreferences or character class escapes, ^ and $ only at the ends. Kept in
+// line with the url-filter check of ContentBlockerRuleEvaluator.
+static bool isSupportedURLFilter(const unsigned char *string, size_t length)
+{
+    size_t groupDepth = 0;
+    bool inBrackets = false;
+
+    if (length == 0) {
+        return false;
+    }
+    for (size_t i = 0; i < length; i++) {
+        unsigned char character = string[i];
+        if (character >= 0x80) {
+            return false;
+        }
+        switch (character) {
+        case '\\':
+            if (i + 1 == length || string[i + 1] >= 0x80 || isAlphanumeric(string[i + 1])) {
+                return false;
+            }
+            i += 1;
+            break;
+        case '[':
+            if (inBrackets) {
+                return false;
+            }
+            inBrackets = true;
+            break;
+        case ']':
+            inBrackets = false;
+            break;
+        case '(':
+            groupDepth += inBrackets ? 0 : 1;
+            break;
+        case ')':
+            if (!inBrackets) {
+                if (groupDepth == 0) {
+                    return false;
+                }
+                groupDepth -= 1;
+            }
+            break;
+        case '|':
+        case '{':
+        case '}':
+            if (!inBrackets) {
+                return false;
+            }
+            break;
+        case '^':
+            if (!inBrackets && i > 0) {
+                return false;
+            }
+            break;
+        case '$':
+            if (!inBrackets && i != length - 1) {
+                return false;
+            }
+            break;
+        default:
+            break;
+        }
+    }
+    return groupDepth == 0 && !inBrackets;
+}
+
+static bool isLowercaseASCII(const unsigned char *string, size_t length)
+{
+    for (size_t i = 0; i < length; i++) {
+        if (string[i] >= 0x80 || (string[i] >= 'A' && string[i] <= 'Z')) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static Field fieldForKey(Section section, const unsigned char *key, size_t keyLength)
+{
+    if (section == SectionTrigger) {
+        if (equalKey(key, keyLength, "url-filter")) {
+            return FieldURLFilter;
+        } else if (equalKey(key, keyLength, "resource-type")) {
+            return FieldResourceType;
+        } else if (equalKey(key, keyLength, "load-type")) {
+            return FieldLoadType;
+        } else if (equalKey(key, keyLength, "if-domain")) {
+            return FieldIfDomain;
+        } else if (equalKey(key, keyLength, "unless-domain")) {
+            return FieldUnlessDomain;
+        } else if (equalKey(key, keyLength, "if-top-url")) {
+            return FieldIfTopURL;
+        } else if (equalKey(key, keyLength, "unless-top-url")) {
+            return FieldUnlessTopURL;
+        }
+    } else if (section == SectionAction) {
+        if (equalKey(key, keyLength, "type")) {
+            return FieldType;
+        } else if (equalKey(key, keyLength, "selector")) {
+            return FieldSelector;
+        }
+    }
+    return FieldOther;
+}
+
+// Only the first issue of a rule is reported.
+static void reject(FilterListValidator *validator, FilterListValidatorIssue issue)
+{
+    if (validator->issue == FilterListValidatorIssueNone) {
+        validator->issue = issue;
+    }
+}
+
+static void startList(FilterListValidator *validator, ValueKind kind)
+{
+    if (kind != ValueArray) {
+        reject(validator, FilterListValidatorIssueInvalidValue);
+        return;
+    }
+    validator->inList = true;
+    validator->listLength = 0;
+}
+
+// Checks the value of a trigger or action field.
+static void checkField(FilterListValidator *validator, ValueKind kind, const unsigned char *string, size_t length)
+{
+    switch (validator->field) {
+    case FieldURLFilter:
+        validator->hasURLFilter = true;
+        if (kind != ValueString) {
+            reject(validator, FilterListValidatorIssueInvalidValue);
+        } else if (!isSupportedURLFilter(string, length)) {
+            reject(validator, FilterListValidatorIssueUnsupportedURLFilter);
+        }
+        break;
+    case FieldIfDomain:
+    case FieldUnlessDomain:
+    case FieldIfTopURL:
+    case FieldUnlessTopURL:
+        validator->conditions |= 1u << (validator->field - FieldIfDomain);
+        startList(validator, kind);
+        break;
+    case FieldResourceType:
+    case FieldLoadType:
+        startList(validator, kind);
+        break;
+    case FieldType:
+        if (kind != ValueString) {
+            reject(validator, FilterListValidatorIssueInvalidValue);
+        } else if (equalKey(string, length, "css-display-none")) {
+            validator->action = ActionCSSDisplayNone;
+        } else {
+            validator->action = isListed(string, length, actionTypes) ? ActionOther : ActionUnknown;
+        }
+        break;
+    case FieldSelector:
+        // Only css-display-none requires a selector, other actions ignore it.
+        validator->hasSelector = kind == ValueString;
+        break;
+    case FieldOther:
+        break;
+    }
+}
+
+// Checks an element of a resource-type, load-type or condition list.
+static void checkListEntry(FilterListValidator *validator, ValueKind kind, const unsigned char *string, size_t length)
+{
+    validator->listLength += 1;
+    if (kind != ValueString) {
+        reject(validator, FilterListValidatorIssueInvalidValue);
+        return;
+    }
+
+    switch (validator->field) {
+    case FieldResourceType:
+        if (!isListed(string, length, resourceTypes)) {
+            reject(validator, FilterListValidatorIssueInvalidResourceType);
+        }
+        break;
+    case FieldLoadType:
+        if (!isListed(string, length, loadTypes)) {
+            reject(validator, FilterListValidatorIssueInvalidLoadType);
+        }
+        break;
+    case FieldIfDomain:
+    case FieldUnlessDomain:
+        if (!isLowercaseASCII(string, length)) {
+            reject(validator, FilterListValidatorIssueInvalidDomain);
+        }
+        break;
+    case FieldIfTopURL:
+    case FieldUnlessTopURL:
+        if (!isSupportedURLFilter(string, length)) {
+            reject(validator, FilterListValidatorIssueUnsupportedURLFilter);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+static void endList(FilterListValidator *validator)
+{
+    bool isCondition = validator->field >= FieldIfDomain && validator->field <= FieldUnlessTopURL;
+    if (isCondition && validator->listLength == 0) {
+        reject(validator, FilterListValidatorIssueInvalidDomain);
+    }
+    validator->inList = false;
+}
+
+#pragma mark - Output
+
+static bool writeOutput(FilterListValidator *validator, const uint8_t *bytes, size_t length)
+{
+    int systemError = 0;
+    if (length > 0 && !validator->write(validator->writeContext, bytes, length, &systemError)) {
+        setError(validator, FilterListMergerStatusWriteError, systemError, "Writing of %zu bytes has failed: %s",
+                 length, systemError ? strerror(systemError) : "unknown error");
+        return false;
+    }
+    return true;
+}
+
+static bool flushOutput(FilterListValidator *validator)
+{
+    bool result = writeOutput(validator, validator->output, validator->outputLength);
+    validator->outputLength = 0;
+    return result;
+}
+
+static bool appendOutput(FilterListValidator *validator, const uint8_t *bytes, size_t length)
+{
+    if (validator->outputLength + length > outputBufferLength && !flushOutput(validator)) {
+        return false;
+    }
+    if (length > outputBufferLength) {
+        return writeOutput(validator, bytes, length);
+    }
+    memcpy(validator->output + validator->outputLength, bytes, length);
+    validator->outputLength += length;
+    return true;
+}
+
+// Moves generated bytes to the output. The generator only ever holds the current rule or the
+// structure around the rules, so a rejected rule is dropped by clearing it.
+static bool moveGenerated(FilterListValidator *validator, bool isRule)
+{
+    const unsigned char *bytes;
+    size_t length;
+    yajl_gen_get_buf(validator->g, &bytes, &length);
+
+    bool result = true;
+    if (isRule) {
+        // The generator separates array elements itself, rejected rules must not leave a separator behind.
+        if (length > 0 && bytes[0] == ',') {
+            bytes += 1;
+            length -= 1;
+        }
+        if (validator->wroteRule) {
+            result = appendOutput(validator, (const uint8_t *)",", 1);
+        }
+        validator->wroteRule = true;
+    }
+    result = result && appendOutput(validator, bytes, length);
+    yajl_gen_clear(validator->g);
+    return result;
+}
+
+#pragma mark - Rules
+
+static bool startRule(FilterListValidator *validator)
+{
+    validator->ruleCount += 1;
+    validator->issue = FilterListValidatorIssueNone;
+    validator->ruleKey = SectionNone;
+    validator->section = SectionNone;
+    validator->field = FieldOther;
+    validator->inList = false;
+    validator->hasTrigger = false;
+    validator->hasAction = false;
+    validator->hasURLFilter = false;
+    validator->hasSelector = false;
+    validator->action = ActionNone;
+    validator->conditions = 0;
+
+    return !validator->writing || moveGenerated(validator, false);
+}
+
+static bool endRule(FilterListValidator *validator)
+{
+    unsigned int conditions = validator->conditions;
+
+    if (!validator->hasTrigger) {
+        reject(validator, FilterListValidatorIssueMissingTrigger);
+    } else if (!validator->hasURLFilter) {
+        reject(validator, FilterListValidatorIssueMissingURLFilter);
+    } else if (conditions & (conditions - 1)) {
+        reject(validator, FilterListValidatorIssueConflictingConditions);
+    }
+    if (!validator->hasAction) {
+        reject(validator, FilterListValidatorIssueMissingAction);
+    } else if (validator->action == ActionNone || validator->action == ActionUnknown) {
+        reject(validator, FilterListValidatorIssueUnknownActionType);
+    } else if (validator->action == ActionCSSDisplayNone && !validator->hasSelector) {
+        reject(validator, FilterListValidatorIssueMissingSelector);
+    }
+
+    if (validator->issue != FilterListValidatorIssueNone) {
+        validator->rejectedRuleCount += 1;
+        if (validator->report) {
+            validator->report(validator->reportContext, validator->ruleCount - 1, validator->issue);
+        }
+        if (validator->writing) {
+            yajl_gen_clear(validator->g);
+        }
+        return true;
+    }
+    return !validator->writing || moveGenerated(validator, true);
+}
+
+// Called for every value before it is generated, with the depth of the enclosing container.
+static bool beginValue(FilterListValidator *validator, ValueKind kind, const unsigned char *string, size_t length)
+{
+    if (!validator->inRules) {
+        return true;
+    }
+
+    size_t depth = validator->depth;
+    if (depth == validator->rulesDepth) {
+        if (!startRule(validator)) {
+            return false;
+        }
+        if (kind != ValueMap) {
+            reject(validator, FilterListValidatorIssueNotAnObject);
+        }
+    } else if (depth == validator->rulesDepth + 1) {
+        if (validator->ruleKey != SectionNone && kind != ValueMap) {
+            reject(validator, FilterListValidatorIssueNotAnObject);
+        } else if (validator->ruleKey != SectionNone) {
+            validator->hasTrigger |= validator->ruleKey == SectionTrigger;
+            validator->hasAction |= validator->ruleKey == SectionAction;
+            validator->section = validator->ruleKey;
+        }
+    } else if (depth == validator->rulesDepth + 2 && validator->section != SectionNone) {
+        checkField(validator, kind, string, length);
+    } else if (depth == validator->rulesDepth + 3 && validator->inList) {
+        checkListEntry(validator, kind, string, length);
+    }
+    return true;
+}
+
+// Completes rules that consist of a single scalar.
+static bool endScalar(FilterListValidator *validator)
+{
+    return !validator->inRules || validator->depth != validator->rulesDepth || endRule(validator);
+}
+
+#pragma mark - Parser callbacks
+
+static int validateNull(void *ctx)
+{
+    FilterListValidator *validator = (FilterListValidator *)ctx;
+    return beginValue(validator, ValueNull, NULL, 0)
+        && (!validator->writing || yajl_gen_null(validator->g) == yajl_gen_status_ok)
+        && endScalar(validator);
+}
+
+static int validateBoolean(void *ctx, int boolean)
+{
+    FilterListValidator *validator = (FilterListValidator *)ctx;
+    return beginValue(validator, ValueBoolean, NULL, 0)
+        && (!validator->writing || yajl_gen_bool(validator->g, boolean) == yajl_gen_status_ok)
+        && endScalar(validator);
+}
+
+static int validateNumber(void *ctx, const char *s, size_t l)
+{
+    FilterListValidator *validator = (FilterListValidator *)ctx;
+    return beginValue(validator, ValueNumber, NULL, 0)
+        && (!validator->writing || yajl_gen_number(validator->g, s, l) == yajl_gen_status_ok)
+        && endScalar(validator);
+}
+
+static int validateString(void *ctx, const unsigned char *string, size_t stringLength)
+{
+    FilterListValidator *validator = (FilterListValidator *)ctx;
+    return beginValue(validator, ValueString, string, stringLength)
+        && (!validator->writing || yajl_gen_string(validator->g, string, stringLength) == yajl_gen_status_ok)
+        && endScalar(validator);
+}
+
+static int validateMapKey(void *ctx, const unsigned char *string, size_t stringLength)
+{
+    FilterListValidator *validator = (FilterListValidator *)ctx;
+    size_t depth = validator->depth;
+
+    if (!validator->inRules) {
+        validator->rulesKey = depth == 1 && !validator->rulesFound && equalKey(string, stringLength, "rules");
+    } else if (depth == validator->rulesDepth + 1) {
+        validator->ruleKey = equalKey(string, stringLength, "trigger") ? SectionTrigger
+            : equalKey(string, stringLength, "action") ? SectionAction : SectionNone;
+    } else if (depth == validator->rulesDepth + 2 && validator->section != SectionNone) {
+        validator->field = fieldForKey(validator->section, string, stringLength);
+        validator->inList = false;
+    }
+
+    return !validator->writing || yajl_gen_string(validator->g, string, stringLength) == yajl_gen_status_ok;
+}
+
+static int validateStartMap(void *ctx)
+{
+    FilterListValidator *validator = (FilterListValidator *)ctx;
+    if (!beginValue(validator, ValueMap, NULL, 0)) {
+        return 0;
+    }
+    validator->depth += 1;
+    return !validator->writing || yajl_gen_map_open(validator->g) == yajl_gen_status_ok;
+}
+
+static int validateEndMap(void *ctx)
+{
+    FilterListValidator *validator = (FilterListValidator *)ctx;
+    validator->depth -= 1;
+
+    if (validator->writing && yajl_gen_map_close(validator->g) != yajl_gen_status_ok) {
+        return 0;
+    }
+
+    if (validator->inRules && validator->depth == validator->rulesDepth + 1) {
+        validator->section = SectionNone;
+    } else if (validator->inRules && validator->depth == validator->rulesDepth) {
+        return endRule(validator);
+    }
+    return 1;
+}
+
+static int validateStartArray(void *ctx)
+{
+    FilterListValidator *validator = (FilterListValidator *)ctx;
+
+    if (!validator->inRules && (validator->depth == 0 || (validator->depth == 1 && validator->rulesKey))) {
+        validator->rulesFound = true;
+        validator->inRules = true;
+        validator->rulesDepth = validator->depth + 1;
+    } else if (!beginValue(validator, ValueArray, NULL, 0)) {
+        return 0;
+    }
+
+    validator->depth += 1;
+    return !validator->writing || yajl_gen_array_open(validator->g) == yajl_gen_status_ok;
+}
+
+static int validateEndArray(void *ctx)
+{
+    FilterListValidator *validator = (FilterListValidator *)ctx;
+    validator->depth -= 1;
+
+    if (validator->writing && yajl_gen_array_close(validator->g) != yajl_gen_status_ok) {
+        return 0;
+    }
+
+    if (!validator->inRules) {
+        return 1;
+    }
+    if (validator->depth + 1 == validator->rulesDepth) {
+        validator->inRules = false;
+        validator->rulesKey = false;
+    } else if (validator->depth == validator->rulesDepth + 2 && validator->inList) {
+        endList(validator);
+    } else if (validator->depth == validator->rulesDepth) {
+        return endRule(validator);
+    }
+    return 1;
+}
+
+static yajl_callbacks callbacks = {
+    validateNull,
+    validateBoolean,
+    NULL,
+    NULL,
+    validateNumber,
+    validateString,
+    validateStartMap,
+    validateMapKey,
+    validateEndMap,
+    validateStartArray,
+    validateEndArray
+};
+
+#pragma mark - Public
+
+FilterListValidator *FilterListValidatorCreate(FilterListValidatorIssueFunction report,
+                                               void *reportContext,
+                                               FilterListMergerWriteFunction write,
+                                               void *writeContext)
+{
+    FilterListValidator *validator = calloc(1, sizeof(FilterListValidator));
+    if (!validator) {
+        return NULL;
+    }
+
+    validator->report = report;
+    validator->reportContext = reportContext;
+    validator->write = write;
+    validator->writeContext = writeContext;
+    validator->writing = write != NULL;
+
+    validator->hand = yajl_alloc(&callbacks, NULL, (void *)validator);
+    if (!validator->hand) {
+        FilterListValidatorFree(validator);
+        return NULL;
+    }
+    yajl_config(validator->hand, yajl_allow_comments, 0);
+    yajl_config(validator->hand, yajl_dont_validate_strings, 1);
+
+    if (validator->writing) {
+        validator->g = yajl_gen_alloc(NULL);
+        validator->output = malloc(outputBufferLength);
+        if (!validator->g || !validator->output) {
+            FilterListValidatorFree(validator);
+            return NULL;
+        }
+        yajl_gen_config(validator->g, yajl_gen_beautify, 0);
+        yajl_gen_config(validator->g, yajl_gen_validate_utf8, 0);
+    }
+    return validator;
+}
+
+void FilterListValidatorFree(FilterListValidator *validator)
+{
+    if (!validator) {
+        return;
+    }
+    if (validator->g) {
+        yajl_gen_free(validator->g);
+    }
+    if (validator->hand) {
+        yajl_free(validator->hand);
+    }
+    free(validator->output);
+    free(validator);
+}
+
+bool FilterListValidatorParse(FilterListValidator *validator, const uint8_t *bytes, size_t length)
+{
+    if (validator->error.status != FilterListMergerStatusOK) {
+        return false;
+    }
+
+    if (yajl_parse(validator->hand, bytes, length) != yajl_status_ok) {
+        setParseError(validator);
+        return false;
+    }
+    return true;
+}
+
+bool FilterListValidatorFinish(FilterListValidator *validator)
+{
+    if (validator->error.status != FilterListMergerStatusOK) {
+        return false;
+    }
+
+    if (yajl_complete_parse(validator->hand) != yajl_status_ok) {
+        setParseError(validator);
+        return false;
+    }
+
+    if (!validator->rulesFound) {
+        setError(validator, FilterListMergerStatusParseError, 0, "Filter list does not contain any rules");
+        return false;
+    }
+
+    return !validator->writing || (moveGenerated(validator, false) && flushOutput(validator));
+}
+
+size_t FilterListValidatorGetRuleCount(const FilterListValidator *validator)
+{
+    return validator->ruleCount;
+}
+
+size_t FilterListValidatorGetRejectedRuleCount(const FilterListValidator *validator)
+{
+    return validator->rejectedRuleCount;
+}
+
+const FilterListMergerError *FilterListValidatorGetError(const FilterListValidator *validator)
+{
+    return &validator->error;
+}
+
+const char *FilterListValidatorIssueDescription(FilterListValidatorIssue issue)
+{
+    switch (issue) {
+    case FilterListValidatorIssueNone:
+        return "valid";
+    case FilterListValidatorIssueNotAnObject:
+        return "rule, trigger or action is not an object";
+    case FilterListValidatorIssueMissingTrigger:
+        return "trigger is missing";
+    case FilterListValidatorIssueMissingURLFilter:
+        return "url-filter is missing";
+    case FilterListValidatorIssueUnsupportedURLFilter:
+        return "regular expression is not supported";
+    case FilterListValidatorIssueMissingAction:
+        return "action is missing";
+    case FilterListValidatorIssueUnknownActionType:
+        return "action type is missing or unknown";
+    case FilterListValidatorIssueMissingSelector:
+        return "css-display-none without selector";
+    case FilterListValidatorIssueInvalidResourceType:
+        return "unknown resource-type";
+    case FilterListValidatorIssueInvalidLoadType:
+        return "unknown load-type";
+    case FilterListValidatorIssueInvalidDomain:
+        return "empty condition list or domain not in lower case ASCII";
+    case FilterListValidatorIssueConflictingConditions:
+        return "more than one of if-domain, unless-domain, if-top-url and unless-top-url";
+    case FilterListValidatorIssueInvalidValue:
+        return "value has the wrong type";
+    }
+    return "unknown issue";
+}
+
+#pragma mark - Files
+
+static void collectIssue(void *context, size_t ruleIndex, FilterListValidatorIssue issue)
+{
+    FilterListValidatorResult *result = (FilterListValidatorResult *)context;
+    if (result->reportedRuleCount < FilterListValidatorMaxReportedRules) {
+        result->reportedRuleIndices[result->reportedRuleCount] = ruleIndex;
+        result->reportedIssues[result->reportedRuleCount] = issue;
+        result->reportedRuleCount += 1;
+    }
+}
+
+static bool writeToFileDescriptor(void *context, const uint8_t *bytes, size_t length, int *systemError)
+{
+    int fd = *(int *)context;
+    while (length > 0) {
+        ssize_t written = write(fd, bytes, length);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            *systemError = errno;
+            return false;
+        }
+        bytes += written;
+        length -= (size_t)written;
+    }
+    return true;
+}
+
+// Runs the validator over the file at inputPath.
+static bool validateFile(FilterListValidator *validator, const char *inputPath)
+{
+    int fd = open(inputPath, O_RDONLY);
+    if (fd < 0) {
+        setError(validator, FilterListMergerStatusReadError, errno, "%s: %s", inputPath, strerror(errno));
+        return false;
+    }
+
+    uint8_t *inputBuffer = malloc(FilterListMergerDefaultOptions.inputBufferLength);
+    if (!inputBuffer) {
+        setError(validator, FilterListMergerStatusReadError, ENOMEM, "Out of memory");
+        close(fd);
+        return false;
+    }
+
+    bool result = true;
+    for (;;) {
+        ssize_t bytesRead = read(fd, inputBuffer, FilterListMergerDefaultOptions.inputBufferLength);
+        if (bytesRead < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            setError(validator, FilterListMergerStatusReadError, errno, "Reading has failed: %s", strerror(errno));
+            result = false;
+            break;
+        }
+        if (bytesRead == 0) {
+            result = FilterListValidatorFinish(validator);
+            break;
+        }
+        if (!FilterListValidatorParse(validator, inputBuffer, (size_t)bytesRead)) {
+            result = false;
+            break;
+        }
+    }
+
+    free(inputBuffer);
+    close(fd);
+    return result;
+}
+
+static bool writeValidRules(const char *inputPath, const char *outputPath, FilterListMergerError *error)
+{
+    int output = open(outputPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (output < 0) {
+        error->status = FilterListMergerStatusWriteError;
+        error->systemError = errno;
+        snprintf(error->message, sizeof(error->message), "%s: %s", outputPath, strerror(errno));
+        return false;
+    }
+
+    bool result = false;
+    FilterListValidator *validator = FilterListValidatorCreate(NULL, NULL, writeToFileDescriptor, &output);
+    if (!validator) {
+        error->status = FilterListMergerStatusGenerateError;
+        error->systemError = ENOMEM;
+        snprintf(error->message, sizeof(error->message), "Out of memory");
+    } else {
+        result = validateFile(validator, inputPath);
+        *error = validator->error;
+        FilterListValidatorFree(validator);
+    }
+
+    if (close(output) != 0 && result) {
+        error->status = FilterListMergerStatusWriteError;
+        error->systemError = errno;
+        snprintf(error->message, sizeof(error->message), "%s: %s", outputPath, strerror(errno));
+        result = false;
+    }
+    if (!result) {
+        unlink(outputPath);
+    }
+    return result;
+}
+
+bool FilterListValidatorValidateFile(const char *inputPath,
+                                     const char *outputPath,
+                                     FilterListValidatorResult *result,
+                                     FilterListMergerError *error)
+{
+    FilterListMergerError localError = { FilterListMergerStatusOK, 0, "" };
+    FilterListValidatorResult localResult;
+    memset(&localResult, 0, sizeof(localResult));
+
+    // Valid lists, the common case, are only read. The list is read again to drop rejected rules.
+    bool success = false;
+    FilterListValidator *validator = FilterListValidatorCreate(collectIssue, &localResult, NULL, NULL);
+    if (!validator) {
+        localError.status = FilterListMergerStatusGenerateError;
+        localError.systemError = ENOMEM;
+        snprintf(localError.message, sizeof(localError.message), "Out of memory");
+    } else {
+        success = validateFile(validator, inputPath);
+        localResult.ruleCount = validator->ruleCount;
+        localResult.rejectedRuleCount = validator->rejectedRuleCount;
+        localError = validator->error;
+        FilterListValidatorFree(validator);
+    }
+
+    if (success && localResult.rejectedRuleCount > 0 && outputPath) {
+        success = writeValidRules(inputPath, outputPath, &localError);
+    }
+
+    if (result) {
+        *result = localResult;
+    }
+    if (error) {
+        *error = localError;
+    }
+    return success;
+}
@@ -0,0 +1,110 @@
+/*
+ * This file is part of Adblock Plus <https://adblockplus.org/>,
+ * Copyright (C) 2006-present eyeo GmbH
+ *
+ * Adblock Plus is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * Adblock Plus is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Adblock Plus.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FilterListValidator_h
+#define FilterListValidator_h
+
+// Checks every rule of a v1 or v2 filter list against the content blocker grammar of WebKit,
+// so that rules Safari would reject are found before the whole list fails to load.
+//
+// Rules are checked while they are parsed, memory use does not depend on the size of the list.
+// Optionally the list is written again without the rejected rules, only one rule is held in
+// memory at a time.
+
+#include "FilterListMerger.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    FilterListValidatorIssueNone = 0,
+    // The rule, its trigger or its action is not an object.
+    FilterListValidatorIssueNotAnObject,
+    FilterListValidatorIssueMissingTrigger,
+    FilterListValidatorIssueMissingURLFilter,
+    // Empty, not ASCII or using regular expression features WebKit does not support.
+    FilterListValidatorIssueUnsupportedURLFilter,
+    FilterListValidatorIssueMissingAction,
+    // The action type is missing or unknown.
+    FilterListValidatorIssueUnknownActionType,
+    // css-display-none without a selector.
+    FilterListValidatorIssueMissingSelector,
+    FilterListValidatorIssueInvalidResourceType,
+    FilterListValidatorIssueInvalidLoadType,
+    // An empty domain list or a domain that is not lower case ASCII.
+    FilterListValidatorIssueInvalidDomain,
+    // More than one of if-domain, unless-domain, if-top-url and unless-top-url.
+    FilterListValidatorIssueConflictingConditions,
+    // A known key with a value of the wrong type.
+    FilterListValidatorIssueInvalidValue
+} FilterListValidatorIssue;
+
+/// Receives the zero based index of every rejected rule, in list order, with its first issue.
+typedef void (*FilterListValidatorIssueFunction)(void *context, size_t ruleIndex, FilterListValidatorIssue issue);
+
+/// Number of rejected rules listed in FilterListValidatorResult.
+#define FilterListValidatorMaxReportedRules 32
+
+typedef struct
+{
+    size_t ruleCount;
+    size_t rejectedRuleCount;
+    // The first rejected rules, up to FilterListValidatorMaxReportedRules.
+    size_t reportedRuleCount;
+    size_t reportedRuleIndices[FilterListValidatorMaxReportedRules];
+    FilterListValidatorIssue reportedIssues[FilterListValidatorMaxReportedRules];
+} FilterListValidatorResult;
+
+typedef struct FilterListValidator FilterListValidator;
+
+/// Creates a validator. report may be NULL. If write is not NULL, the list is written through
+/// it without the rejected rules.
+FilterListValidator *FilterListValidatorCreate(FilterListValidatorIssueFunction report,
+                                               void *reportContext,
+                                               FilterListMergerWriteFunction write,
+                                               void *writeContext);
+
+void FilterListValidatorFree(FilterListValidator *validator);
+
+/// Feeds the next part of a v1 (array) or v2 (object with rules) filter list.
+bool FilterListValidatorParse(FilterListValidator *validator, const uint8_t *bytes, size_t length);
+
+/// Completes parsing and writes the remaining output.
+bool FilterListValidatorFinish(FilterListValidator *validator);
+
+size_t FilterListValidatorGetRuleCount(const FilterListValidator *validator);
+
+size_t FilterListValidatorGetRejectedRuleCount(const FilterListValidator *validator);
+
+const FilterListMergerError *FilterListValidatorGetError(const FilterListValidator *validator);
+
+/// Short English description of an issue, for logging.
+const char *FilterListValidatorIssueDescription(FilterListValidatorIssue issue);
+
+/// Validates the filter list at inputPath. If rules are rejected and outputPath is not NULL,
+/// the list without them is written to outputPath. Nothing is written if all rules are valid.
+bool FilterListValidatorValidateFile(const char *inputPath,
+                                     const char *outputPath,
+                                     FilterListValidatorResult *result,
+                                     FilterListMergerError *error);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FilterListValidator_h */
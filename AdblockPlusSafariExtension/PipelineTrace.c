@@ -0,0 +1,179 @@
+/*
+ * This file is part of Adblock Plus <https://adblockplus.org/>,
+ * Copyright (C) 2006-present eyeo GmbH
+ *
+ * Adblock Plus is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * Adblock Plus is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Adblock Plus.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "PipelineTrace.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __APPLE__
+#include <mach/mach_time.h>
+#endif
+
+// Changes with the layout of the buffer, a buffer of another layout is cleared.
+static const uint32_t bufferMagic = 0x41425031;
+
+typedef struct
+{
+    // Index of the event plus one once it is complete, 0 while it is written.
+    uint64_t sequence;
+    PipelineTraceEvent event;
+} Slot;
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t capacity;
+    // Index of the next event, slots are claimed by incrementing it.
+    uint64_t next;
+    Slot slots[PipelineTraceCapacity];
+} Buffer;
+
+static Buffer processBuffer = { bufferMagic, PipelineTraceCapacity, 0, { { 0 } } };
+static Buffer *buffer = &processBuffer;
+
+// getpid is a system call on some platforms.
+static int32_t processIdentifier;
+
+static Buffer *currentBuffer(void)
+{
+    return __atomic_load_n(&buffer, __ATOMIC_ACQUIRE);
+}
+
+static void record(PipelineTraceKind kind, const char *name, uint64_t time, uint64_t duration, int64_t value)
+{
+    Buffer *target = currentBuffer();
+    uint64_t index = __atomic_fetch_add(&target->next, 1, __ATOMIC_RELAXED);
+    Slot *slot = &target->slots[index % PipelineTraceCapacity];
+
+    // Readers skip the slot until the sequence matches again. A slot is only written by two
+    // processes at once if more than a full buffer of events is recorded meanwhile.
+    __atomic_store_n(&slot->sequence, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    slot->event.time = time;
+    slot->event.duration = duration;
+    slot->event.value = value;
+    if (processIdentifier == 0) {
+        processIdentifier = (int32_t)getpid();
+    }
+    slot->event.process = processIdentifier;
+    slot->event.kind = kind;
+    strncpy(slot->event.name, name, PipelineTraceNameLength - 1);
+    slot->event.name[PipelineTraceNameLength - 1] = '\0';
+
+    __atomic_store_n(&slot->sequence, index + 1, __ATOMIC_RELEASE);
+}
+
+#pragma mark - Public
+
+uint64_t PipelineTraceNow(void)
+{
+#ifdef __APPLE__
+    // clock_gettime is not available before iOS 10. mach_absolute_time counts from boot and is
+    // the same for all processes.
+    static mach_timebase_info_data_t timebase;
+    if (timebase.denom == 0) {
+        mach_timebase_info(&timebase);
+    }
+    return mach_absolute_time() * timebase.numer / timebase.denom;
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+#endif
+}
+
+void PipelineTraceSpan(const char *name, uint64_t start, int64_t value)
+{
+    uint64_t now = PipelineTraceNow();
+    record(PipelineTraceKindSpan, name, now, now > start ? now - start : 0, value);
+}
+
+void PipelineTraceCount(const char *name, int64_t value)
+{
+    record(PipelineTraceKindCounter, name, PipelineTraceNow(), 0, value);
+}
+
+bool PipelineTraceOpenSharedBuffer(const char *path)
+{
+    if (currentBuffer() != &processBuffer) {
+        return true;
+    }
+
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        return false;
+    }
+
+    // Extending the file fills it with zeros, which is an empty buffer apart from the header.
+    struct stat status;
+    if (fstat(fd, &status) != 0 || (status.st_size != (off_t)sizeof(Buffer) && ftruncate(fd, sizeof(Buffer)) != 0)) {
+        close(fd);
+        return false;
+    }
+    void *mapped = mmap(NULL, sizeof(Buffer), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        return false;
+    }
+
+    Buffer *shared = mapped;
+    if (shared->magic != bufferMagic || shared->capacity != PipelineTraceCapacity) {
+        memset(shared, 0, sizeof(Buffer));
+        shared->capacity = PipelineTraceCapacity;
+        shared->magic = bufferMagic;
+    }
+
+    // Writers that loaded the process buffer before finish their event there, so it is never unmapped.
+    Buffer *expected = &processBuffer;
+    if (!__atomic_compare_exchange_n(&buffer, &expected, shared, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        munmap(mapped, sizeof(Buffer));
+    }
+    return true;
+}
+
+size_t PipelineTraceCopyEvents(PipelineTraceEvent *events, size_t capacity, uint64_t *overwritten)
+{
+    Buffer *source = currentBuffer();
+    uint64_t next = __atomic_load_n(&source->next, __ATOMIC_ACQUIRE);
+    uint64_t first = next > PipelineTraceCapacity ? next - PipelineTraceCapacity : 0;
+    if (next - first > capacity) {
+        first = next - capacity;
+    }
+    if (overwritten) {
+        *overwritten = next > PipelineTraceCapacity ? next - PipelineTraceCapacity : 0;
+    }
+
+    size_t count = 0;
+    for (uint64_t index = first; index < next; index++) {
+        Slot *slot = &source->slots[index % PipelineTraceCapacity];
+        if (__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) != index + 1) {
+            continue;
+        }
+        events[count] = slot->event;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&slot->sequence, __ATOMIC_RELAXED) == index + 1) {
+            count += 1;
+        }
+    }
+    return count;
+}
@@ -0,0 +1,81 @@
+/*
+ * This file is part of Adblock Plus <https://adblockplus.org/>,
+ * Copyright (C) 2006-present eyeo GmbH
+ *
+ * Adblock Plus is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * Adblock Plus is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Adblock Plus.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PipelineTrace_h
+#define PipelineTrace_h
+
+// Tracing of the download, parse, merge and reload stages. Spans are measured with the monotonic
+// clock, which is shared by all processes, and recorded with counters in a fixed size ring buffer.
+// The newest events overwrite the oldest ones. Recording takes no locks and makes no system calls.
+//
+// Until PipelineTraceOpenSharedBuffer is called, events are kept in memory of the process. The
+// shared buffer is a file mapping, so that the app sees the events of the content blocker extension.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PipelineTraceCapacity 1024
+#define PipelineTraceNameLength 24
+
+/// Name of the shared buffer in the app group container.
+#define PipelineTraceSharedBufferName "pipeline-trace"
+
+typedef enum {
+    PipelineTraceKindSpan = 1,
+    PipelineTraceKindCounter
+} PipelineTraceKind;
+
+typedef struct
+{
+    // End of a span or time of a counter, in nanoseconds of the monotonic clock.
+    uint64_t time;
+    // Nanoseconds, 0 for counters.
+    uint64_t duration;
+    // Bytes, rules or another measure of the work done, depending on the event.
+    int64_t value;
+    int32_t process;
+    uint32_t kind;
+    // Truncated to PipelineTraceNameLength - 1 bytes.
+    char name[PipelineTraceNameLength];
+} PipelineTraceEvent;
+
+/// Current time of the monotonic clock in nanoseconds, the start of a span.
+uint64_t PipelineTraceNow(void);
+
+/// Records a span that started at start and ends now.
+void PipelineTraceSpan(const char *name, uint64_t start, int64_t value);
+
+void PipelineTraceCount(const char *name, int64_t value);
+
+/// Moves recording to the buffer mapped from the file at path, which is created if needed.
+/// Events recorded before are not moved. Only the first successful call has an effect.
+bool PipelineTraceOpenSharedBuffer(const char *path);
+
+/// Copies the recorded events, oldest first. Events being recorded at the same time are skipped.
+/// overwritten is set to the number of events that were overwritten by newer ones, it may be NULL.
+size_t PipelineTraceCopyEvents(PipelineTraceEvent *events, size_t capacity, uint64_t *overwritten);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PipelineTrace_h */
@@ -16,3 +16,4 @@
  */
 
 #import "AdblockPlusSafari-Bridging-Header.h"
+#import "AdblockPlus+Parsing.h"
@@ -21,6 +21,13 @@
 #import "AdblockPlus+Parsing.h"
 #import "NSString+AdblockPlus.h"
 #import "FilterList+Processing.h"
+#import "CompiledFilterList.h"
+#import "FilterListComposer.h"
+#import "FilterListConverter.h"
+#import "FilterListMerger.h"
+#import "FilterListSharder.h"
+#import "FilterListValidator.h"
+#import "HostnameNormalizer.h"
 #import "NSDictionary+FilterList.h"
 
 @import SafariServices;
@@ -40,9 +47,11 @@
     id websites = @[ @"adblockplus.org", @"acceptableads.org" ];
 
     NSError *error;
+    NSUInteger ruleCount = 0;
     if (![AdblockPlus mergeFilterListsFromURL:input
                       withWhitelistedWebsites:websites
                                         toURL:output
+                                    ruleCount:&ruleCount
                                         error:&error]) {
         XCTAssert(false, @"Merging has failed: %@", [error localizedDescription]);
         return;
@@ -60,6 +69,7 @@
         id rules = [NSJSONSerialization JSONObjectWithStream:inputStream options:NSJSONReadingMutableContainers error:&error];
         XCTAssert(error == nil && rules != nil, @"JSON is not valid: %@", error);
         XCTAssert([rules isKindOfClass:[NSArray class]], @"Rules is not type of array.");
+        XCTAssert([rules count] == ruleCount, @"Merged rules were counted wrong");
     }
     @catch (NSException *exception) {
         XCTAssert(false, @"Reading failed %@", exception.reason);
@@ -84,6 +94,626 @@
     [self performMergeFilterList:@"easylist+exceptionrules_content_blocker"];
 }
 
+static bool appendToData(void *context, const uint8_t *bytes, size_t length, int *systemError)
+{
+    [(__bridge NSMutableData *)context appendBytes:bytes length:length];
+    return true;
+}
+
+- (NSData *)mergeData:(NSData *)input
+          withOptions:(FilterListMergerOptions)options
+  whitelistedWebsites:(const char *const *)websites
+                count:(size_t)websitesCount
+                error:(FilterListMergerError *)error
+{
+    NSMutableData *output = [NSMutableData data];
+    FilterListMerger *merger = FilterListMergerCreate(&options, appendToData, (__bridge void *)output);
+
+    BOOL result = YES;
+    const uint8_t *bytes = input.bytes;
+    for (size_t offset = 0; offset < input.length && result; offset += options.inputBufferLength) {
+        result = FilterListMergerParse(merger, bytes + offset, MIN(options.inputBufferLength, input.length - offset));
+    }
+    result = result && FilterListMergerFinish(merger, websites, websitesCount);
+    *error = *FilterListMergerGetError(merger);
+    FilterListMergerFree(merger);
+    return result ? output : nil;
+}
+
+- (NSData *)mergeData:(NSData *)input
+      withInputLength:(size_t)inputLength
+         outputLength:(size_t)outputLength
+                error:(FilterListMergerError *)error
+{
+    FilterListMergerOptions options = { inputLength, outputLength, false, 1, FilterListAllocatorDefaultLimit, false, false };
+    const char *websites[] = { "adblockplus.org", "acceptableads.org" };
+    return [self mergeData:input withOptions:options whitelistedWebsites:websites count:2 error:error];
+}
+
+/// Evaluates ignore-previous-rules rules with url-filter ".*" the way WebKit does for a page on the given host.
+static BOOL isHostWhitelisted(NSArray *rules, NSString *host)
+{
+    for (NSDictionary *rule in rules) {
+        if (![rule[@"action"][@"type"] isEqual:@"ignore-previous-rules"] || ![rule[@"trigger"][@"url-filter"] isEqual:@".*"]) {
+            continue;
+        }
+        for (NSString *domain in rule[@"trigger"][@"if-domain"]) {
+            if (![domain hasPrefix:@"*"]) {
+                if ([host isEqualToString:domain]) {
+                    return YES;
+                }
+                continue;
+            }
+            NSString *suffix = [domain substringFromIndex:1];
+            if ([host isEqualToString:suffix] || [host hasSuffix:[@"." stringByAppendingString:suffix]]) {
+                return YES;
+            }
+        }
+    }
+    return NO;
+}
+
+- (void)testMergerOutputDoesNotDependOnBufferLengths
+{
+    NSURL *input = [[NSBundle bundleForClass:[self class]] URLForResource:@"easylist_content_blocker_v2" withExtension:@"json"];
+    NSData *data = [NSData dataWithContentsOfURL:input];
+    XCTAssert(data != nil, @"Filter list is missing");
+
+    FilterListMergerError error;
+    NSData *expected = [self mergeData:data withInputLength:data.length outputLength:SIZE_MAX error:&error];
+    XCTAssert(expected != nil, @"Merging has failed: %s", error.message);
+
+    for (NSNumber *length in @[ @1, @7, @256, @65536 ]) {
+        NSData *output = [self mergeData:data withInputLength:length.unsignedIntegerValue outputLength:length.unsignedIntegerValue error:&error];
+        XCTAssert([output isEqualToData:expected], @"Output differs for buffer length %@", length);
+    }
+
+    id rules = [NSJSONSerialization JSONObjectWithData:expected options:0 error:nil];
+    XCTAssert([rules isKindOfClass:[NSArray class]], @"Rules is not type of array.");
+    XCTAssert([[rules lastObject][@"trigger"][@"if-domain"] isEqual:@[ @"*acceptableads.org" ]], @"Whitelisting rule is missing");
+}
+
+- (void)testMergerMemoryLimit
+{
+    NSURL *input = [[NSBundle bundleForClass:[self class]] URLForResource:@"easylist_content_blocker" withExtension:@"json"];
+    NSData *data = [NSData dataWithContentsOfURL:input];
+    XCTAssert(data != nil, @"Filter list is missing");
+
+    const char *websites[] = { "adblockplus.org" };
+    FilterListMergerOptions options = FilterListMergerDefaultOptions;
+    NSMutableData *output = [NSMutableData data];
+    FilterListMerger *merger = FilterListMergerCreate(&options, appendToData, (__bridge void *)output);
+    BOOL result = FilterListMergerParse(merger, data.bytes, data.length) && FilterListMergerFinish(merger, websites, 1);
+    FilterListAllocatorStatistics statistics = FilterListMergerGetMemoryStatistics(merger);
+    FilterListMergerFree(merger);
+    XCTAssert(result && !statistics.limitExceeded, @"Merging has failed");
+    XCTAssert(statistics.peakBytes > 0 && statistics.peakBytes < options.memoryLimit, @"Peak is wrong: %zu", statistics.peakBytes);
+    XCTAssert(statistics.allocationCount > 0 && statistics.currentBytes <= statistics.peakBytes, @"Statistics are wrong");
+    NSLog(@"Merging %lu bytes: %zu bytes peak, %zu allocations, %zu reallocations", (unsigned long)data.length,
+          statistics.peakBytes, statistics.allocationCount, statistics.reallocationCount);
+
+    // The whole list in one string needs more than the limit.
+    NSMutableData *longToken = [@"[{\"trigger\": {\"url-filter\": \"" dataUsingEncoding:NSUTF8StringEncoding].mutableCopy;
+    [longToken increaseLengthBy:64 * 1024];
+    memset((uint8_t *)longToken.mutableBytes + longToken.length - 64 * 1024, 'a', 64 * 1024);
+    options.memoryLimit = 48 * 1024;
+    FilterListMergerError error;
+    XCTAssert([self mergeData:longToken withOptions:options whitelistedWebsites:websites count:1 error:&error] == nil,
+              @"Limit was not enforced");
+    XCTAssert(error.status == FilterListMergerStatusMemoryLimitError, @"Error is wrong: %s", error.message);
+
+    // The limit is soft, a token that never ends is buffered by yajl until one slice exceeds it.
+    NSMutableData *slice = [NSMutableData dataWithLength:64 * 1024];
+    memset(slice.mutableBytes, 'a', slice.length);
+    for (NSNumber *sliceLength in @[ @(4 * 1024), @(slice.length) ]) {
+        size_t length = sliceLength.unsignedIntegerValue;
+        merger = FilterListMergerCreate(&options, appendToData, (__bridge void *)output);
+        BOOL parsed = FilterListMergerParse(merger, longToken.bytes, longToken.length - 64 * 1024);
+        for (size_t fed = 0; parsed && fed < 16 * 1024 * 1024; fed += length) {
+            parsed = FilterListMergerParse(merger, slice.bytes, length);
+        }
+        statistics = FilterListMergerGetMemoryStatistics(merger);
+        FilterListMergerStatus status = FilterListMergerGetError(merger)->status;
+        FilterListMergerFree(merger);
+        size_t bound = 2 * (options.memoryLimit + length) + FilterListAllocatorChunkLength;
+        XCTAssert(!parsed && status == FilterListMergerStatusMemoryLimitError, @"Limit was not enforced for slices of %zu bytes", length);
+        XCTAssert(statistics.peakBytes > options.memoryLimit && statistics.peakBytes < bound,
+                  @"Peak of %zu bytes is beyond %zu bytes for slices of %zu bytes", statistics.peakBytes, bound, length);
+    }
+}
+
+- (void)testVerbatimMergeMatchesReformattedRules
+{
+    const char *websites[] = { "adblockplus.org", "acceptableads.org" };
+    for (NSString *name in @[ @"easylist_content_blocker", @"easylist_content_blocker_v2", @"empty" ]) {
+        NSURL *input = [[NSBundle bundleForClass:[self class]] URLForResource:name withExtension:@"json"];
+        NSData *data = [NSData dataWithContentsOfURL:input];
+        XCTAssert(data != nil, @"Filter list is missing");
+
+        FilterListMergerError error;
+        FilterListMergerOptions options = FilterListMergerDefaultOptions;
+        options.copyRulesVerbatim = false;
+        NSData *reformatted = [self mergeData:data withOptions:options whitelistedWebsites:websites count:2 error:&error];
+        XCTAssert(reformatted != nil, @"Merging has failed: %s", error.message);
+        id expected = [NSJSONSerialization JSONObjectWithData:reformatted options:0 error:nil];
+
+        options.copyRulesVerbatim = true;
+        for (NSNumber *validate in @[ @NO, @YES ]) {
+            options.validateVerbatimRules = validate.boolValue;
+            for (NSNumber *length in @[ @1, @7, @65536 ]) {
+                options.inputBufferLength = length.unsignedIntegerValue;
+                NSData *copied = [self mergeData:data withOptions:options whitelistedWebsites:websites count:2 error:&error];
+                XCTAssert(copied != nil, @"Merging has failed: %s", error.message);
+                id rules = [NSJSONSerialization JSONObjectWithData:copied options:0 error:nil];
+                XCTAssert([rules isEqual:expected], @"Rules of %@ differ for buffer length %@", name, length);
+            }
+        }
+    }
+
+    // Without yajl only the nesting is checked.
+    FilterListMergerOptions options = FilterListMergerDefaultOptions;
+    FilterListMergerError error;
+    for (NSString *list in @[ @"[{\"a\": 1}", @"[{\"a\": 1}]]", @"[] []", @"\"rules\"", @"{\"rules\": [\"]}" ]) {
+        NSData *data = [list dataUsingEncoding:NSUTF8StringEncoding];
+        XCTAssert([self mergeData:data withOptions:options whitelistedWebsites:websites count:2 error:&error] == nil,
+                  @"Malformed list %@ was merged", list);
+        XCTAssert(error.status == FilterListMergerStatusParseError, @"Unexpected error status");
+    }
+}
+
+- (void)testBatchedWhitelistingRulesMatchSameHosts
+{
+    NSURL *input = [[NSBundle bundleForClass:[self class]] URLForResource:@"easylist_content_blocker" withExtension:@"json"];
+    NSData *data = [NSData dataWithContentsOfURL:input];
+    XCTAssert(data != nil, @"Filter list is missing");
+
+    NSMutableArray<NSString *> *websites = [NSMutableArray array];
+    for (NSUInteger i = 0; i < 100; i++) {
+        [websites addObject:[NSString stringWithFormat:@"site%lu.example", (unsigned long)i]];
+    }
+    [websites addObjectsFromArray:@[ @"adblockplus.org", @"xn--mller-kva.de", @"co.uk" ]];
+
+    const char **cWebsites = malloc(websites.count * sizeof(const char *));
+    for (NSUInteger i = 0; i < websites.count; i++) {
+        cWebsites[i] = websites[i].UTF8String;
+    }
+
+    FilterListMergerError error;
+    FilterListMergerOptions options = FilterListMergerDefaultOptions;
+    options.whitelistedWebsitesPerRule = 1;
+    NSData *single = [self mergeData:data withOptions:options whitelistedWebsites:cWebsites count:websites.count error:&error];
+    XCTAssert(single != nil, @"Merging has failed: %s", error.message);
+    options.whitelistedWebsitesPerRule = 16;
+    NSData *batched = [self mergeData:data withOptions:options whitelistedWebsites:cWebsites count:websites.count error:&error];
+    XCTAssert(batched != nil, @"Merging has failed: %s", error.message);
+    free(cWebsites);
+
+    NSArray *singleRules = [NSJSONSerialization JSONObjectWithData:single options:0 error:nil];
+    NSArray *batchedRules = [NSJSONSerialization JSONObjectWithData:batched options:0 error:nil];
+    NSArray *originalRules = [NSJSONSerialization JSONObjectWithData:data options:0 error:nil];
+    XCTAssert(singleRules.count == originalRules.count + websites.count, @"Unexpected number of rules");
+    XCTAssert(batchedRules.count == originalRules.count + 7, @"Websites are not batched");
+    XCTAssert([[batchedRules subarrayWithRange:NSMakeRange(0, originalRules.count)] isEqual:originalRules], @"Blocking rules differ");
+
+    NSMutableArray<NSString *> *hosts = [NSMutableArray array];
+    for (NSString *website in websites) {
+        [hosts addObjectsFromArray:@[ website,
+                                      [@"www." stringByAppendingString:website],
+                                      [@"a.b." stringByAppendingString:website],
+                                      [@"not" stringByAppendingString:website],
+                                      [website stringByAppendingString:@".evil"] ]];
+    }
+    [hosts addObjectsFromArray:@[ @"example", @"uk", @"bbc.co.uk", @"eyeo.com", @"" ]];
+
+    for (NSString *host in hosts) {
+        XCTAssert(isHostWhitelisted(singleRules, host) == isHostWhitelisted(batchedRules, host), @"Whitelisting of %@ differs", host);
+    }
+    XCTAssert(isHostWhitelisted(batchedRules, @"www.adblockplus.org"), @"Subdomain is not whitelisted");
+    XCTAssert(!isHostWhitelisted(batchedRules, @"notadblockplus.org"), @"Unrelated domain is whitelisted");
+}
+
+- (void)testMergerRejectsFilterListWithoutRules
+{
+    NSData *input = [@"{\"version\": \"201512011207\"}" dataUsingEncoding:NSUTF8StringEncoding];
+    FilterListMergerError error;
+    XCTAssert([self mergeData:input withInputLength:16 outputLength:16 error:&error] == nil, @"Merging should fail");
+    XCTAssert(error.status == FilterListMergerStatusParseError, @"Unexpected error status");
+}
+
+- (void)testShardingKeepsExceptionsWithPrecedingRules
+{
+    // 12 blocking rules, exceptions after the 1st, 8th and 12th.
+    NSMutableArray *rules = [NSMutableArray array];
+    for (NSUInteger i = 0; i < 12; i++) {
+        [rules addObject:@{ @"trigger" : @{ @"url-filter" : [NSString stringWithFormat:@"ads%lu", (unsigned long)i] },
+                            @"action" : @{ @"type" : @"block" } }];
+        if (i == 0 || i == 7 || i == 11) {
+            [rules addObject:@{ @"trigger" : @{ @"url-filter" : @".*", @"if-domain" : @[ [NSString stringWithFormat:@"*site%lu.org", (unsigned long)i] ] },
+                                @"action" : @{ @"type" : @"ignore-previous-rules" } }];
+        }
+    }
+
+    NSURL *directory = [[NSURL fileURLWithPath:NSTemporaryDirectory() isDirectory:YES] URLByAppendingPathComponent:[NSUUID UUID].UUIDString isDirectory:YES];
+    [[NSFileManager defaultManager] createDirectoryAtURL:directory withIntermediateDirectories:YES attributes:nil error:nil];
+    NSURL *input = [directory URLByAppendingPathComponent:@"list.json" isDirectory:NO];
+    [[NSJSONSerialization dataWithJSONObject:rules options:0 error:nil] writeToURL:input atomically:NO];
+    NSString *prefix = [directory URLByAppendingPathComponent:@"shard-" isDirectory:NO].path;
+
+    FilterListSharderResult result;
+    FilterListMergerError error;
+    XCTAssert(FilterListSharderShardFile(input.fileSystemRepresentation, prefix.fileSystemRepresentation, ".json", 6, &result, &error), @"Sharding has failed: %s", error.message);
+    XCTAssert(result.ruleCount == 15 && result.exceptionCount == 3, @"Wrong rule counts");
+
+    NSMutableArray *blocking = [NSMutableArray array];
+    for (size_t i = 0; i < result.shardCount; i++) {
+        NSData *data = [NSData dataWithContentsOfFile:[NSString stringWithFormat:@"%@%zu.json", prefix, i]];
+        NSArray *shard = data ? [NSJSONSerialization JSONObjectWithData:data options:0 error:nil] : nil;
+        XCTAssert(shard.count > 0 && shard.count <= 6, @"Shard %zu exceeds the budget", i);
+
+        // Every exception following a blocking rule of the shard has to be part of it.
+        NSUInteger first = [rules indexOfObject:shard.firstObject];
+        NSMutableArray *expected = [NSMutableArray array];
+        for (NSUInteger j = first; j < rules.count; j++) {
+            if ([rules[j][@"action"][@"type"] isEqual:@"ignore-previous-rules"] || [shard containsObject:rules[j]]) {
+                [expected addObject:rules[j]];
+            }
+        }
+        XCTAssert([shard isEqual:expected], @"Shard %zu is not an ordered subset with all following exceptions", i);
+        for (NSDictionary *rule in shard) {
+            if ([rule[@"action"][@"type"] isEqual:@"block"]) {
+                [blocking addObject:rule];
+            }
+        }
+    }
+    XCTAssert(result.shardCount > 1 && blocking.count == 12, @"Blocking rules are lost or duplicated");
+
+    XCTAssert(FilterListSharderShardFile(input.fileSystemRepresentation, prefix.fileSystemRepresentation, ".json", 100, &result, &error) && result.shardCount == 1, @"Small lists are not sharded");
+    NSString *first = [directory URLByAppendingPathComponent:@"shard-0.json" isDirectory:NO].path;
+    NSData *shard = [NSData dataWithContentsOfFile:first];
+    XCTAssert(!FilterListSharderShardFile(input.fileSystemRepresentation, prefix.fileSystemRepresentation, ".json", 3, &result, &error), @"Exceptions do not fit");
+
+    // Failed sharding keeps the shards written before and leaves no temporary files behind.
+    XCTAssert(shard && [[NSData dataWithContentsOfFile:first] isEqual:shard], @"Shards were replaced by a failed sharding");
+    for (NSString *name in [[NSFileManager defaultManager] contentsOfDirectoryAtPath:directory.path error:nil]) {
+        XCTAssert([name.pathExtension isEqual:@"json"], @"Temporary file %@ was left behind", name);
+    }
+    [[NSFileManager defaultManager] removeItemAtURL:directory error:nil];
+}
+
+- (void)testComposerDeduplicatesAndPlacesExceptionsLast
+{
+    NSDictionary *block = @{ @"type" : @"block" };
+    NSDictionary *ignore = @{ @"type" : @"ignore-previous-rules" };
+    NSArray *first = @[ @{ @"trigger" : @{ @"url-filter" : @"ads", @"resource-type" : @[ @"image", @"script" ] }, @"action" : block },
+                        @{ @"trigger" : @{ @"url-filter" : @".*", @"if-domain" : @[ @"*site1.org" ] }, @"action" : ignore },
+                        @{ @"trigger" : @{ @"url-filter" : @"banner" }, @"action" : block } ];
+    NSArray *second = @[ @{ @"trigger" : @{ @"url-filter" : @"tracker" }, @"action" : block },
+                         @{ @"trigger" : @{ @"url-filter" : @".*", @"if-domain" : @[ @"*site2.org" ] }, @"action" : ignore },
+                         @{ @"trigger" : @{ @"url-filter" : @".*", @"if-domain" : @[ @"*site1.org" ] }, @"action" : ignore } ];
+    // The duplicate of the first rule differs in the order of keys and in escaping.
+    NSString *secondText = @"{\"version\":\"201810170000\",\"rules\":["
+                            "{\"trigger\":{\"url-filter\":\"tracker\"},\"action\":{\"type\":\"block\"}},"
+                            "{\"trigger\":{\"url-filter\":\".*\",\"if-domain\":[\"*site2.org\"]},\"action\":{\"type\":\"ignore-previous-rules\"}},"
+                            "{\"action\":{\"type\":\"ignore-previous-rules\"},\"trigger\":{\"if-domain\":[\"*site1.org\"],\"url-filter\":\".*\"}},"
+                            "{\"action\":{\"type\":\"block\"},\"trigger\":{\"resource-type\":[\"image\",\"script\"],\"url-filter\":\"\\u0061ds\"}}]}";
+
+    NSURL *directory = [[NSURL fileURLWithPath:NSTemporaryDirectory() isDirectory:YES] URLByAppendingPathComponent:[NSUUID UUID].UUIDString isDirectory:YES];
+    [[NSFileManager defaultManager] createDirectoryAtURL:directory withIntermediateDirectories:YES attributes:nil error:nil];
+    NSURL *firstURL = [directory URLByAppendingPathComponent:@"first.json" isDirectory:NO];
+    NSURL *secondURL = [directory URLByAppendingPathComponent:@"second.json" isDirectory:NO];
+    NSURL *output = [directory URLByAppendingPathComponent:@"composed.json" isDirectory:NO];
+    [[NSJSONSerialization dataWithJSONObject:first options:0 error:nil] writeToURL:firstURL atomically:NO];
+    [[secondText dataUsingEncoding:NSUTF8StringEncoding] writeToURL:secondURL atomically:NO];
+
+    const char *inputPaths[] = { firstURL.fileSystemRepresentation, secondURL.fileSystemRepresentation };
+    FilterListComposerResult result;
+    FilterListMergerError error;
+    XCTAssert(FilterListComposerComposeFiles(inputPaths, 2, output.fileSystemRepresentation, &result, &error), @"Composing has failed: %s", error.message);
+    XCTAssert(result.inputRuleCount == 7 && result.ruleCount == 5 && result.exceptionCount == 2 && result.duplicateCount == 2, @"Wrong rule counts");
+
+    NSData *data = [NSData dataWithContentsOfURL:output];
+    NSDictionary *composed = data ? [NSJSONSerialization JSONObjectWithData:data options:0 error:nil] : nil;
+    NSArray *expected = @[ first[0], first[2], second[0], first[1], second[1] ];
+    XCTAssert([composed[@"rules"] isEqual:expected], @"Rules are not deduplicated or exceptions are not last");
+    XCTAssert([composed[@"version"] isEqual:@"201810170000"], @"Version of the last list was not kept");
+    [[NSFileManager defaultManager] removeItemAtURL:directory error:nil];
+}
+
+- (void)testComposerOverlayRestoresList
+{
+    NSMutableArray *base = [NSMutableArray array];
+    NSMutableArray *rules = [NSMutableArray array];
+    for (NSUInteger i = 0; i < 1000; i++) {
+        NSDictionary *rule = @{ @"trigger" : @{ @"url-filter" : [NSString stringWithFormat:@"ads%lu", (unsigned long)i] }, @"action" : @{ @"type" : @"block" } };
+        [base addObject:rule];
+        [rules addObject:rule];
+        if (i % 100 == 0) {
+            [rules addObject:@{ @"trigger" : @{ @"url-filter" : @".*", @"if-domain" : @[ [NSString stringWithFormat:@"*site%lu.org", (unsigned long)i] ] },
+                                @"action" : @{ @"type" : @"ignore-previous-rules" } }];
+        }
+    }
+    // A rule only the base has, composing keeps it.
+    [base addObject:@{ @"trigger" : @{ @"url-filter" : @"removed" }, @"action" : @{ @"type" : @"block" } }];
+
+    NSURL *directory = [[NSURL fileURLWithPath:NSTemporaryDirectory() isDirectory:YES] URLByAppendingPathComponent:[NSUUID UUID].UUIDString isDirectory:YES];
+    [[NSFileManager defaultManager] createDirectoryAtURL:directory withIntermediateDirectories:YES attributes:nil error:nil];
+    NSURL *baseURL = [directory URLByAppendingPathComponent:@"base.json" isDirectory:NO];
+    NSURL *listURL = [directory URLByAppendingPathComponent:@"list.json" isDirectory:NO];
+    NSURL *overlayURL = [directory URLByAppendingPathComponent:@"overlay.json" isDirectory:NO];
+    NSURL *composedURL = [directory URLByAppendingPathComponent:@"composed.json" isDirectory:NO];
+    [[NSJSONSerialization dataWithJSONObject:@{ @"rules" : base } options:0 error:nil] writeToURL:baseURL atomically:NO];
+    [[NSJSONSerialization dataWithJSONObject:@{ @"version" : @"201810170000", @"rules" : rules } options:0 error:nil] writeToURL:listURL atomically:NO];
+
+    FilterListComposerResult result;
+    FilterListMergerError error;
+    XCTAssert(FilterListComposerWriteOverlay(baseURL.fileSystemRepresentation, listURL.fileSystemRepresentation, overlayURL.fileSystemRepresentation, &result, &error),
+              @"Overlay was not written: %s", error.message);
+    XCTAssert(result.ruleCount == 10 && result.exceptionCount == 10 && result.duplicateCount == 1000, @"Overlay does not only hold the difference");
+
+    const char *inputPaths[] = { baseURL.fileSystemRepresentation, overlayURL.fileSystemRepresentation };
+    XCTAssert(FilterListComposerComposeFiles(inputPaths, 2, composedURL.fileSystemRepresentation, &result, &error), @"Composing has failed: %s", error.message);
+    NSData *data = [NSData dataWithContentsOfURL:composedURL];
+    NSDictionary *composed = data ? [NSJSONSerialization JSONObjectWithData:data options:0 error:nil] : nil;
+    NSMutableArray *expected = [base mutableCopy];
+    for (NSDictionary *rule in rules) {
+        if ([rule[@"action"][@"type"] isEqual:@"ignore-previous-rules"]) {
+            [expected addObject:rule];
+        }
+    }
+    XCTAssert([composed[@"rules"] isEqual:expected], @"Base and overlay do not compose to the list");
+    XCTAssert([composed[@"version"] isEqual:@"201810170000"], @"Version was not kept in the overlay");
+
+    // Base and overlay feed the whitelist merge, from the JSON and from their compiled forms.
+    NSURL *merged = [directory URLByAppendingPathComponent:@"merged.json" isDirectory:NO];
+    NSURL *mergedFromCompiled = [directory URLByAppendingPathComponent:@"compiled.json" isDirectory:NO];
+    NSError *mergeError;
+    NSUInteger ruleCount = 0;
+    XCTAssert([AdblockPlus mergeFilterListsFromURLs:@[ baseURL, overlayURL ] withWhitelistedWebsites:@[ @"adblockplus.org" ] toURL:merged ruleCount:&ruleCount error:&mergeError],
+              @"Merging has failed: %@", mergeError);
+    XCTAssert(ruleCount == expected.count + 1, @"Merged list does not hold the composed rules");
+    for (NSURL *url in @[ baseURL, overlayURL ]) {
+        NSURL *compiledURL = [url URLByAppendingPathExtension:@CompiledFilterListPathExtension];
+        XCTAssert(CompiledFilterListCompileFile(url.fileSystemRepresentation, compiledURL.fileSystemRepresentation, &error), @"Compiling has failed: %s", error.message);
+    }
+    XCTAssert([AdblockPlus mergeFilterListsFromURLs:@[ baseURL, overlayURL ] withWhitelistedWebsites:@[ @"adblockplus.org" ] toURL:mergedFromCompiled ruleCount:&ruleCount error:&mergeError],
+              @"Merging has failed: %@", mergeError);
+    NSData *mergedData = [NSData dataWithContentsOfURL:merged];
+    NSData *compiledData = [NSData dataWithContentsOfURL:mergedFromCompiled];
+    id mergedRules = mergedData ? [NSJSONSerialization JSONObjectWithData:mergedData options:0 error:nil] : nil;
+    id compiledRules = compiledData ? [NSJSONSerialization JSONObjectWithData:compiledData options:0 error:nil] : nil;
+    XCTAssert(mergedRules && [mergedRules isEqual:compiledRules], @"Compiled base and overlay merge differently");
+
+    // Without its base, the overlay is not merged.
+    [[NSFileManager defaultManager] removeItemAtURL:baseURL error:nil];
+    XCTAssertFalse([AdblockPlus mergeFilterListsFromURLs:@[ baseURL, overlayURL ] withWhitelistedWebsites:@[] toURL:merged ruleCount:NULL error:&mergeError],
+                   @"Overlay was merged without its base");
+    [[NSFileManager defaultManager] removeItemAtURL:directory error:nil];
+}
+
+- (void)testValidatorDropsRulesWebKitRejects
+{
+    NSDictionary *block = @{ @"type" : @"block" };
+    NSArray *rules = @[ @{ @"trigger" : @{ @"url-filter" : @"^https?://([^/]+\\.)?ads\\.test[/:]", @"load-type" : @[ @"third-party" ] }, @"action" : block },
+                        @{ @"trigger" : @{ @"url-filter" : @"ads|banners" }, @"action" : block },
+                        @{ @"trigger" : @{ @"url-filter" : @".*", @"if-domain" : @[ @"a.test" ], @"unless-domain" : @[ @"b.test" ] }, @"action" : block },
+                        @{ @"trigger" : @{ @"url-filter" : @".*" }, @"action" : @{ @"type" : @"css-display-none", @"selector" : @".ad" } },
+                        @{ @"trigger" : @{ @"url-filter" : @".*" }, @"action" : @{ @"type" : @"redirect" } },
+                        @{ @"trigger" : @{ @"url-filter" : @".*", @"if-domain" : @[ @"*Example.com" ] }, @"action" : block },
+                        @{ @"trigger" : @{ @"url-filter" : @".*", @"resource-type" : @[ @"sound" ] }, @"action" : block },
+                        @{ @"action" : block },
+                        @{ @"trigger" : @{ @"url-filter" : @".*", @"if-domain" : @[ @"*trusted.test" ] }, @"action" : @{ @"type" : @"ignore-previous-rules" } } ];
+    NSDictionary *list = @{ @"version" : @"201512011207", @"rules" : rules };
+
+    NSURL *directory = [[NSURL fileURLWithPath:NSTemporaryDirectory() isDirectory:YES] URLByAppendingPathComponent:[NSUUID UUID].UUIDString isDirectory:YES];
+    [[NSFileManager defaultManager] createDirectoryAtURL:directory withIntermediateDirectories:YES attributes:nil error:nil];
+    NSURL *input = [directory URLByAppendingPathComponent:@"list.json" isDirectory:NO];
+    NSURL *output = [directory URLByAppendingPathComponent:@"validated.json" isDirectory:NO];
+    [[NSJSONSerialization dataWithJSONObject:list options:0 error:nil] writeToURL:input atomically:NO];
+
+    FilterListValidatorResult result;
+    FilterListMergerError error;
+    XCTAssert(FilterListValidatorValidateFile(input.fileSystemRepresentation, output.fileSystemRepresentation, &result, &error), @"Validation has failed: %s", error.message);
+    XCTAssert(result.ruleCount == rules.count && result.rejectedRuleCount == 6 && result.reportedRuleCount == 6, @"Wrong rule counts");
+    size_t expectedIndices[] = { 1, 2, 4, 5, 6, 7 };
+    FilterListValidatorIssue expectedIssues[] = { FilterListValidatorIssueUnsupportedURLFilter, FilterListValidatorIssueConflictingConditions,
+                                                  FilterListValidatorIssueUnknownActionType, FilterListValidatorIssueInvalidDomain,
+                                                  FilterListValidatorIssueInvalidResourceType, FilterListValidatorIssueMissingTrigger };
+    for (size_t i = 0; i < result.reportedRuleCount && i < 6; i++) {
+        XCTAssert(result.reportedRuleIndices[i] == expectedIndices[i] && result.reportedIssues[i] == expectedIssues[i],
+                  @"Rule %zu was rejected for %s", result.reportedRuleIndices[i], FilterListValidatorIssueDescription(result.reportedIssues[i]));
+    }
+
+    NSData *data = [NSData dataWithContentsOfURL:output];
+    NSDictionary *validated = data ? [NSJSONSerialization JSONObjectWithData:data options:0 error:nil] : nil;
+    NSArray *expected = @[ rules[0], rules[3], rules[8] ];
+    XCTAssert([validated[@"rules"] isEqual:expected] && [validated[@"version"] isEqual:list[@"version"]], @"Valid rules or header were not kept");
+
+    // Lists without rejected rules are not written again.
+    [[NSFileManager defaultManager] removeItemAtURL:input error:nil];
+    [[NSFileManager defaultManager] moveItemAtURL:output toURL:input error:nil];
+    XCTAssert(FilterListValidatorValidateFile(input.fileSystemRepresentation, output.fileSystemRepresentation, &result, &error), @"Validation has failed: %s", error.message);
+    XCTAssert(result.rejectedRuleCount == 0 && ![[NSFileManager defaultManager] fileExistsAtPath:output.path], @"Valid list was written");
+    [[NSFileManager defaultManager] removeItemAtURL:directory error:nil];
+}
+
+- (void)testValidatorBenchmark
+{
+    NSUInteger ruleCount = 100000;
+    NSMutableData *data = [NSMutableData dataWithCapacity:ruleCount * 120];
+    [data appendBytes:"[" length:1];
+    for (NSUInteger i = 0; i < ruleCount; i++) {
+        NSString *rule = [NSString stringWithFormat:@"%@{\"trigger\":{\"url-filter\":\"^https?://([^/]+\\\\.)?adhost%lu\\\\.test[/:]\","
+                                                     "\"load-type\":[\"third-party\"]},\"action\":{\"type\":\"%@\"}}",
+                                                    i > 0 ? @"," : @"", (unsigned long)i, i % 1000 == 0 ? @"redirect" : @"block"];
+        [data appendData:[rule dataUsingEncoding:NSUTF8StringEncoding]];
+    }
+    [data appendBytes:"]" length:1];
+
+    NSURL *directory = [[NSURL fileURLWithPath:NSTemporaryDirectory() isDirectory:YES] URLByAppendingPathComponent:[NSUUID UUID].UUIDString isDirectory:YES];
+    [[NSFileManager defaultManager] createDirectoryAtURL:directory withIntermediateDirectories:YES attributes:nil error:nil];
+    NSURL *input = [directory URLByAppendingPathComponent:@"list.json" isDirectory:NO];
+    NSURL *output = [directory URLByAppendingPathComponent:@"validated.json" isDirectory:NO];
+    [data writeToURL:input atomically:NO];
+
+    FilterListValidatorResult result;
+    FilterListMergerError error;
+    CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+    XCTAssert(FilterListValidatorValidateFile(input.fileSystemRepresentation, NULL, &result, &error), @"Validation has failed: %s", error.message);
+    CFAbsoluteTime checking = CFAbsoluteTimeGetCurrent() - start;
+    start = CFAbsoluteTimeGetCurrent();
+    XCTAssert(FilterListValidatorValidateFile(input.fileSystemRepresentation, output.fileSystemRepresentation, &result, &error), @"Validation has failed: %s", error.message);
+    CFAbsoluteTime dropping = CFAbsoluteTimeGetCurrent() - start;
+    XCTAssert(result.rejectedRuleCount == ruleCount / 1000, @"Wrong number of rejected rules");
+    NSLog(@"Validation of %lu rules (%.1f MB): %.0f ms checking, %.0f ms checking and dropping %zu rules",
+          (unsigned long)ruleCount, data.length / 1e6, checking * 1000, dropping * 1000, result.rejectedRuleCount);
+    [[NSFileManager defaultManager] removeItemAtURL:directory error:nil];
+}
+
+- (void)testConverterConvertsFilterSyntax
+{
+    NSString *text = @"[Adblock Plus 2.0]\n"
+                      "! Version: 201810170000\n"
+                      "! Expires: 4 days (update frequency)\n"
+                      "\n"
+                      "##.ad-banner\n"
+                      "Example.com,other.test##div[id=\"ad\"]\n"
+                      "@@||ads.test/allowed/*$image\n"
+                      "||ads.test^\n"
+                      "||tracker.test^$third-party,script,domain=~b.test\n"
+                      "/banner/*/ad.gif|\r\n"
+                      "@@||trusted.test^$document\n"
+                      "example.com#@#.ad-banner\n"
+                      "/^regex$/\n"
+                      "||ads.test^$csp=script-src 'none'\n"
+                      "a.test,b.test##.sponsor\n"
+                      "b.test#@#.sponsor\n"
+                      "##.lifted\n"
+                      "#@#.lifted\n"
+                      "@@||news.test^$elemhide\n"
+                      "@@||shop.test^$generichide\n"
+                      "~c.test#@#.ad-banner\n";
+
+    NSURL *directory = [[NSURL fileURLWithPath:NSTemporaryDirectory() isDirectory:YES] URLByAppendingPathComponent:[NSUUID UUID].UUIDString isDirectory:YES];
+    [[NSFileManager defaultManager] createDirectoryAtURL:directory withIntermediateDirectories:YES attributes:nil error:nil];
+    NSURL *input = [directory URLByAppendingPathComponent:@"list.txt" isDirectory:NO];
+    NSURL *output = [directory URLByAppendingPathComponent:@"converted.json" isDirectory:NO];
+    [[text dataUsingEncoding:NSUTF8StringEncoding] writeToURL:input atomically:NO];
+
+    FilterListConverterResult result;
+    FilterListMergerError error;
+    XCTAssert(FilterListConverterIsFilterText(input.fileSystemRepresentation), @"List was not recognized");
+    XCTAssert(FilterListConverterConvertFile(input.fileSystemRepresentation, output.fileSystemRepresentation, NULL, &result, &error), @"Conversion has failed: %s", error.message);
+    XCTAssert(result.ruleCount == 10 && result.exceptionCount == 4 && result.hidingExceptionCount == 3 && result.unsupportedFilterCount == 3,
+              @"Wrong rule counts");
+
+    NSData *data = [NSData dataWithContentsOfURL:output];
+    NSDictionary *list = data ? [NSJSONSerialization JSONObjectWithData:data options:0 error:nil] : nil;
+    NSArray *rules = list[@"rules"];
+    XCTAssert([list[@"version"] isEqual:@"201810170000"] && [list[@"expires"] isEqual:@"4 days (update frequency)"], @"Header was not kept");
+    XCTAssert(rules.count == 10, @"Wrong number of rules");
+    XCTAssert([rules[0][@"trigger"][@"unless-domain"] isEqual:@[ @"*example.com" ]] && [rules[0][@"action"][@"selector"] isEqual:@".ad-banner"],
+              @"Hiding exception was not folded into the generic rule");
+    XCTAssert([rules[1][@"trigger"][@"if-domain"] isEqual:@[ @"*shop.test" ]] && [rules[1][@"action"][@"type"] isEqual:@"ignore-previous-rules"],
+              @"Generichide exception does not follow the generic hiding rules");
+    XCTAssert([rules[2][@"trigger"][@"if-domain"] isEqual:(@[ @"*example.com", @"*other.test" ])] &&
+                  [rules[2][@"action"][@"selector"] isEqual:@"div[id=\"ad\"]"],
+              @"Element hiding rule is wrong");
+    XCTAssert([rules[3][@"trigger"][@"if-domain"] isEqual:@[ @"*a.test" ]] && [rules[3][@"action"][@"selector"] isEqual:@".sponsor"],
+              @"Lifted domain was not dropped");
+    XCTAssert([rules[4][@"trigger"][@"if-domain"] isEqual:@[ @"*news.test" ]] && [rules[4][@"action"][@"type"] isEqual:@"ignore-previous-rules"],
+              @"Elemhide exception does not precede the blocking rules");
+    XCTAssert([rules[6][@"trigger"][@"load-type"] isEqual:@[ @"third-party" ]] && [rules[6][@"trigger"][@"resource-type"] isEqual:@[ @"script" ]] &&
+                  [rules[6][@"trigger"][@"unless-domain"] isEqual:@[ @"*b.test" ]],
+              @"Blocking rule options are wrong");
+    XCTAssert([rules[7][@"trigger"][@"url-filter"] isEqual:@"/banner/.*/ad\\.gif$"], @"Pattern was not converted");
+    XCTAssert([rules[8][@"action"][@"type"] isEqual:@"ignore-previous-rules"] && [rules[9][@"trigger"][@"if-domain"] isEqual:@[ @"*trusted.test" ]],
+              @"Exceptions were not written last");
+
+    // WebKit accepts all converted rules.
+    FilterListValidatorResult validatorResult;
+    XCTAssert(FilterListValidatorValidateFile(output.fileSystemRepresentation, NULL, &validatorResult, &error) && validatorResult.rejectedRuleCount == 0,
+              @"Converted rules are not valid");
+    [[NSFileManager defaultManager] removeItemAtURL:directory error:nil];
+}
+
+- (void)testConverterOutputDoesNotDependOnThreads
+{
+    NSMutableString *text = [NSMutableString stringWithString:@"[Adblock Plus 2.0]\n"];
+    for (NSUInteger i = 0; i < 20000; i++) {
+        [text appendFormat:i % 10 == 0 ? @"@@||host%lu.test^$script\n" : (i % 2 ? @"##.ad-%lu\n" : @"||host%lu.test^$third-party\n"), (unsigned long)i];
+    }
+
+    NSURL *directory = [[NSURL fileURLWithPath:NSTemporaryDirectory() isDirectory:YES] URLByAppendingPathComponent:[NSUUID UUID].UUIDString isDirectory:YES];
+    [[NSFileManager defaultManager] createDirectoryAtURL:directory withIntermediateDirectories:YES attributes:nil error:nil];
+    NSURL *input = [directory URLByAppendingPathComponent:@"list.txt" isDirectory:NO];
+    [[text dataUsingEncoding:NSUTF8StringEncoding] writeToURL:input atomically:NO];
+
+    NSData *expected;
+    for (size_t threadCount = 1; threadCount <= 8; threadCount *= 2) {
+        NSURL *output = [directory URLByAppendingPathComponent:[NSString stringWithFormat:@"converted-%zu.json", threadCount] isDirectory:NO];
+        FilterListConverterOptions options = { 64 * 1024, threadCount };
+        FilterListConverterResult result;
+        FilterListMergerError error;
+        XCTAssert(FilterListConverterConvertFile(input.fileSystemRepresentation, output.fileSystemRepresentation, &options, &result, &error), @"Conversion has failed: %s", error.message);
+        XCTAssert(result.ruleCount == 20000 && result.exceptionCount == 2000, @"Wrong rule counts");
+        NSData *data = [NSData dataWithContentsOfURL:output];
+        XCTAssert(expected == nil || [data isEqualToData:expected], @"Output of %zu threads differs", threadCount);
+        expected = expected ?: data;
+    }
+    [[NSFileManager defaultManager] removeItemAtURL:directory error:nil];
+}
+
+- (void)testConverterBenchmark
+{
+    // About the size of EasyList.
+    NSUInteger filterCount = 70000;
+    NSMutableString *text = [NSMutableString stringWithCapacity:filterCount * 40];
+    [text appendString:@"[Adblock Plus 2.0]\n! Version: 1\n"];
+    for (NSUInteger i = 0; i < filterCount; i++) {
+        switch (i % 8) {
+            case 0:
+            case 1:
+            case 2:
+                [text appendFormat:@"##.ad-container-%lu\n", (unsigned long)i];
+                break;
+            case 3:
+                [text appendFormat:@"site%lu.test,~www.site%lu.test##div[class^=\"sponsor\"]\n", (unsigned long)i, (unsigned long)i];
+                break;
+            case 4:
+            case 5:
+                [text appendFormat:@"||adhost%lu.test^$third-party\n", (unsigned long)i];
+                break;
+            case 6:
+                [text appendFormat:@"/banners/*/ad%lu.gif|\n", (unsigned long)i];
+                break;
+            default:
+                [text appendFormat:@"@@||cdn%lu.test/ads.js$script,domain=site%lu.test\n", (unsigned long)i, (unsigned long)i];
+                break;
+        }
+    }
+    NSData *data = [text dataUsingEncoding:NSUTF8StringEncoding];
+
+    NSURL *directory = [[NSURL fileURLWithPath:NSTemporaryDirectory() isDirectory:YES] URLByAppendingPathComponent:[NSUUID UUID].UUIDString isDirectory:YES];
+    [[NSFileManager defaultManager] createDirectoryAtURL:directory withIntermediateDirectories:YES attributes:nil error:nil];
+    NSURL *input = [directory URLByAppendingPathComponent:@"list.txt" isDirectory:NO];
+    NSURL *output = [directory URLByAppendingPathComponent:@"converted.json" isDirectory:NO];
+    [data writeToURL:input atomically:NO];
+
+    for (size_t threadCount = 1; threadCount <= [NSProcessInfo processInfo].activeProcessorCount; threadCount *= 2) {
+        FilterListConverterOptions options = FilterListConverterDefaultOptions;
+        options.threadCount = threadCount;
+        FilterListConverterResult result;
+        FilterListMergerError error;
+        CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+        XCTAssert(FilterListConverterConvertFile(input.fileSystemRepresentation, output.fileSystemRepresentation, &options, &result, &error), @"Conversion has failed: %s", error.message);
+        CFAbsoluteTime seconds = CFAbsoluteTimeGetCurrent() - start;
+        XCTAssert(result.ruleCount + result.unsupportedFilterCount == filterCount, @"Filters were lost");
+        NSLog(@"Conversion of %lu filters (%.1f MB) with %zu threads: %.0f ms, %.1f MB/s",
+              (unsigned long)filterCount, data.length / 1e6, threadCount, seconds * 1000, data.length / 1e6 / seconds);
+    }
+    [[NSFileManager defaultManager] removeItemAtURL:directory error:nil];
+}
+
 - (void)testHostnameEscaping
 {
     NSDictionary<NSString *, NSString *> *input =
@@ -133,6 +763,84 @@
     }
 }
 
+/// Reads the input and expected hostname pairs of hostnames.txt.
+- (NSArray<NSArray<NSString *> *> *)hostnameCorpus
+{
+    NSURL *url = [[NSBundle bundleForClass:[self class]] URLForResource:@"hostnames" withExtension:@"txt"];
+    NSString *corpus = [NSString stringWithContentsOfURL:url encoding:NSUTF8StringEncoding error:nil];
+    NSMutableArray<NSArray<NSString *> *> *pairs = [NSMutableArray array];
+    for (NSString *line in [corpus componentsSeparatedByString:@"\n"]) {
+        if (line.length == 0 || [line hasPrefix:@"#"]) {
+            continue;
+        }
+        NSArray<NSString *> *fields = [line componentsSeparatedByString:@"\t"];
+        XCTAssert(fields.count == 2, @"Corpus line is malformed: %@", line);
+        if (fields.count == 2) {
+            [pairs addObject:fields];
+        }
+    }
+    return pairs;
+}
+
+- (void)testHostnameCorpus
+{
+    NSArray<NSArray<NSString *> *> *corpus = self.hostnameCorpus;
+    XCTAssert(corpus.count > 0, @"Corpus is missing");
+    for (NSArray<NSString *> *pair in corpus) {
+        NSString *result = [pair[0] whitelistedHostname];
+        XCTAssert([result isEqualToString:pair[1]], @"%@ was normalized to %@ instead of %@", pair[0], result, pair[1]);
+    }
+
+    // Decomposed letters and compatibility characters are mapped with Foundation before.
+    XCTAssert([[@"bu\u0308cher.de" whitelistedHostname] isEqualToString:@"xn--bcher-kva.de"], @"Decomposed letter was not composed");
+    XCTAssert([[@"\uFB01le.com" whitelistedHostname] isEqualToString:@"file.com"], @"Compatibility character was not mapped");
+
+    // Results longer than the stack buffer are written again.
+    NSString *label = [@"" stringByPaddingToLength:60 withString:@"a" startingAtIndex:0];
+    NSString *longHostname = [@[ label, label, label, label, label, @"com" ] componentsJoinedByString:@"."];
+    XCTAssert([[longHostname whitelistedHostname] isEqualToString:longHostname], @"Long hostname was truncated");
+    XCTAssert([[longHostname.uppercaseString whitelistedHostname] isEqualToString:longHostname], @"Long hostname was not lowercased");
+    NSString *longEscaped = [longHostname stringByReplacingOccurrencesOfString:@"." withString:@"\\."];
+    XCTAssert([[AdblockPlus escapeHostname:longHostname] isEqualToString:longEscaped], @"Long hostname was not escaped");
+}
+
+- (void)testHostnameNormalizerBenchmark
+{
+    NSMutableArray<NSString *> *inputs = [NSMutableArray array];
+    for (NSArray<NSString *> *pair in self.hostnameCorpus) {
+        [inputs addObject:pair[0]];
+    }
+    [inputs addObjectsFromArray:self.urls];
+
+    NSUInteger rounds = 2000;
+    CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+    for (NSUInteger i = 0; i < rounds; i++) {
+        for (NSString *input in inputs) {
+            @autoreleasepool {
+                [AdblockPlus escapeHostname:[input whitelistedHostname]];
+            }
+        }
+    }
+    CFAbsoluteTime elapsed = CFAbsoluteTimeGetCurrent() - start;
+    NSLog(@"Hostname normalizing and escaping: %.0f ns per host",
+          elapsed * 1e9 / (double)(rounds * inputs.count));
+
+    // Without Foundation.
+    char output[256];
+    size_t total = 0;
+    start = CFAbsoluteTimeGetCurrent();
+    for (NSUInteger i = 0; i < rounds; i++) {
+        for (NSString *input in inputs) {
+            const char *bytes = input.UTF8String;
+            size_t length = HostnameNormalizerNormalize(bytes, strlen(bytes), output, sizeof(output));
+            total += HostnameNormalizerEscape(output, MIN(length, sizeof(output) - 1), output, 0);
+        }
+    }
+    elapsed = CFAbsoluteTimeGetCurrent() - start;
+    NSLog(@"Hostname normalizing and escaping, C functions: %.0f ns per host (%zu bytes)",
+          elapsed * 1e9 / (double)(rounds * inputs.count), total);
+}
+
 - (void)testWhitelisting
 {
     AdblockPlusExtras *adblockPlus = [[AdblockPlusExtras alloc] init];
@@ -234,6 +942,71 @@
     [self processFilterList:@"easylist+exceptionrules_content_blocker_v2" expectedVersion:@"201512011207" expectedExpires:4 * 3600 * 24];
 }
 
+- (void)testProcessingCollectsFilterListMetadata
+{
+    NSURL *input = [[NSBundle bundleForClass:[self class]] URLForResource:@"easylist_content_blocker_v2_short" withExtension:@"json"];
+    FilterList *filterList = [[FilterList alloc] initWithDictionary:@{@"downloadCount": @0}];
+
+    NSError *error = nil;
+    XCTAssert([filterList parseFilterListFromURL:input error:&error], @"Parsing should be successful: %@", error);
+    XCTAssert(filterList.ruleCount == 3, @"Rules should be counted");
+    XCTAssert([filterList.sourceVersions isEqual:@[ @{ @"url" : @"https://easylist-downloads.adblockplus.org/easylist_noadult.txt",
+                                                       @"version" : @"201512011200" } ]], @"Source versions should be filled");
+    XCTAssert([filterList.contentHash isEqualToString:@"4b8d7c8bdb87a06cd91db7503b8087fd41942a15c467202ec0b4c6a3cb00fce4"], @"Content hash differs");
+
+    NSURL *output = [[NSURL fileURLWithPath:NSTemporaryDirectory() isDirectory:YES] URLByAppendingPathComponent:@"metadata.json" isDirectory:NO];
+    XCTAssert([filterList writeMetadataToURL:output error:&error], @"Writing should be successful: %@", error);
+    NSDictionary *metadata = [NSJSONSerialization JSONObjectWithData:[NSData dataWithContentsOfURL:output] options:0 error:nil];
+    XCTAssert([metadata[@"version"] isEqual:@"201512011207"] && [metadata[@"ruleCount"] isEqual:@3], @"Metadata is incomplete");
+    XCTAssertNil(metadata[@"base"], @"A complete list has no base");
+
+    filterList.overlayBaseName = @"easylist";
+    XCTAssert([filterList writeMetadataToURL:output error:&error], @"Writing should be successful: %@", error);
+    metadata = [NSJSONSerialization JSONObjectWithData:[NSData dataWithContentsOfURL:output] options:0 error:nil];
+    XCTAssert([metadata[@"base"] isEqual:@"easylist"], @"Base of the overlay is not recorded");
+}
+
+- (void)testCompiledFilterListRoundTrip
+{
+    NSURL *fixture = [[NSBundle bundleForClass:[self class]] URLForResource:@"easylist_content_blocker_v2_short" withExtension:@"json"];
+    NSURL *directory = [[NSURL fileURLWithPath:NSTemporaryDirectory() isDirectory:YES] URLByAppendingPathComponent:[NSUUID UUID].UUIDString isDirectory:YES];
+    [[NSFileManager defaultManager] createDirectoryAtURL:directory withIntermediateDirectories:YES attributes:nil error:nil];
+    NSURL *input = [directory URLByAppendingPathComponent:@"list.json" isDirectory:NO];
+    [[NSFileManager defaultManager] copyItemAtURL:fixture toURL:input error:nil];
+    NSURL *compiled = [input URLByAppendingPathExtension:@CompiledFilterListPathExtension];
+
+    FilterList *filterList = [[FilterList alloc] initWithDictionary:@{@"downloadCount": @0}];
+    NSError *error = nil;
+    XCTAssert([filterList parseFilterListFromURL:input compilingToURL:compiled error:&error], @"Parsing should be successful: %@", error);
+
+    FilterList *fromHeader = [[FilterList alloc] initWithDictionary:@{@"downloadCount": @0}];
+    XCTAssert([fromHeader readCompiledFilterListFromURL:compiled forFilterListAtURL:input], @"Compiled list should be current");
+    XCTAssert([fromHeader.version isEqual:filterList.version] && fromHeader.ruleCount == 3 && fromHeader.expires == filterList.expires,
+              @"Header differs from the parsed metadata");
+    XCTAssert([fromHeader.contentHash isEqual:filterList.contentHash], @"Content hash differs");
+
+    // Merging the compiled list yields the same rules as merging the JSON.
+    const char *websites[] = { "adblockplus.org" };
+    NSURL *fromCompiled = [directory URLByAppendingPathComponent:@"compiled.json" isDirectory:NO];
+    NSURL *fromJSON = [directory URLByAppendingPathComponent:@"json.json" isDirectory:NO];
+    FilterListMergerError mergerError;
+    XCTAssert(FilterListMergerMergeCompiledFile(compiled.fileSystemRepresentation, input.fileSystemRepresentation, fromCompiled.fileSystemRepresentation,
+                                                websites, 1, NULL, NULL, &mergerError), @"Merging has failed: %s", mergerError.message);
+    XCTAssert(FilterListMergerMergeFiles(input.fileSystemRepresentation, fromJSON.fileSystemRepresentation, websites, 1, NULL, NULL, &mergerError),
+              @"Merging has failed: %s", mergerError.message);
+    id compiledRules = [NSJSONSerialization JSONObjectWithData:[NSData dataWithContentsOfURL:fromCompiled] options:0 error:nil];
+    id jsonRules = [NSJSONSerialization JSONObjectWithData:[NSData dataWithContentsOfURL:fromJSON] options:0 error:nil];
+    XCTAssert(compiledRules && [compiledRules isEqual:jsonRules], @"Re-serialized rules differ");
+
+    // Replacing the JSON invalidates the compiled list.
+    [[NSFileManager defaultManager] removeItemAtURL:input error:nil];
+    [@"[]" writeToURL:input atomically:YES encoding:NSUTF8StringEncoding error:nil];
+    XCTAssert(![fromHeader readCompiledFilterListFromURL:compiled forFilterListAtURL:input], @"Outdated compiled list should be rejected");
+    XCTAssert(!FilterListMergerMergeCompiledFile(compiled.fileSystemRepresentation, input.fileSystemRepresentation, fromCompiled.fileSystemRepresentation,
+                                                 websites, 1, NULL, NULL, &mergerError), @"Outdated compiled list should not be merged");
+    [[NSFileManager defaultManager] removeItemAtURL:directory error:nil];
+}
+
 #pragma MARK : -
 
 - (BOOL)fileManager:(NSFileManager *)fileManager shouldProceedAfterError:(NSError *)error movingItemAtURL:(NSURL *)srcURL toURL:(NSURL *)dstURL
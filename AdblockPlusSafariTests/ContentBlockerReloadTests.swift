@@ -0,0 +1,191 @@
+/*
+ * This file is part of Adblock Plus <https://adblockplus.org/>,
+ * Copyright (C) 2006-present eyeo GmbH
+ *
+ * Adblock Plus is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * Adblock Plus is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Adblock Plus.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+@testable import AdblockPlusSafari
+import libadblockplus_ios
+import XCTest
+
+/// Stands in for the Safari content blocker manager. Reloads end when finishReloads() is called.
+class FakeContentBlockerManager: NSObject,
+                                 ContentBlockerManagerProtocol {
+    var reloadCount = 0
+    var error: Error?
+    private var pending = [(Error?) -> Void]()
+
+    func reload(withIdentifier identifier: String,
+                completionHandler: ((Error?) -> Void)? = nil) {
+        reloadCount += 1
+        if let uwCompletion = completionHandler {
+            pending.append(uwCompletion)
+        }
+    }
+
+    func finishReloads() {
+        let completions = pending
+        pending = []
+        for completion in completions {
+            completion(error)
+        }
+    }
+}
+
+/// Test coalescing of content blocker reloads.
+class ContentBlockerReloadTests: XCTestCase {
+    let timeout = 10.0
+    let window = 0.05
+    var manager: FakeContentBlockerManager!
+    var safariCB: SafariContentBlocker!
+    var legacyReloading = false
+
+    override func setUp() {
+        super.setUp()
+        manager = FakeContentBlockerManager()
+        let scheduler = ContentBlockerReloadScheduler(identifier: "test",
+                                                      window: window) { [weak self] identifier, completion in
+            guard let manager = self?.manager else {
+                completion(ABPContentBlockerError.reloaderUnavailable)
+                return
+            }
+            manager.reload(withIdentifier: identifier,
+                           completionHandler: completion)
+        }
+        safariCB = SafariContentBlocker(reloadScheduler: scheduler,
+                                        reloadingSetter: { [weak self] reloading in
+            self?.legacyReloading = reloading
+        }, performingActivityTestSetter: { _ in })
+    }
+
+    /// Test that a burst of requests results in one reload whose result reaches every requester.
+    func testBurstIsCoalesced() {
+        let requestCount = 5
+        let expect = expectation(description: "Completions")
+        expect.expectedFulfillmentCount = requestCount
+        for _ in 0..<requestCount {
+            safariCB.reloadContentBlocker { error in
+                XCTAssert(error == nil, "Unexpected error: \(String(describing: error))")
+                expect.fulfill()
+            }
+        }
+        XCTAssert(legacyReloading && safariCB.reloading.value, "Reloading state was not set")
+        pass(window * 4)
+        XCTAssert(manager.reloadCount == 1, "Requests were not coalesced: \(manager.reloadCount)")
+        manager.finishReloads()
+        wait(for: [expect],
+             timeout: timeout)
+
+        let counters = safariCB.reloadScheduler.counters
+        XCTAssert(counters.requested == requestCount, "Requested count is wrong")
+        XCTAssert(counters.coalesced == requestCount - 1, "Coalesced count is wrong")
+        XCTAssert(counters.executed == 1, "Executed count is wrong")
+        XCTAssert(!legacyReloading && !safariCB.reloading.value, "Reloading state was not reset")
+    }
+
+    /// Test that requests during a running reload are queued into one more reload, which receives
+    /// its own result.
+    func testRequestsDuringReloadAreQueued() {
+        let first = expectation(description: "First completion")
+        safariCB.reloadContentBlocker { error in
+            XCTAssert(error == nil, "Unexpected error: \(String(describing: error))")
+            first.fulfill()
+        }
+        pass(window * 4)
+        XCTAssert(manager.reloadCount == 1, "Reload was not started")
+
+        let queuedCount = 3
+        let queued = expectation(description: "Queued completions")
+        queued.expectedFulfillmentCount = queuedCount
+        for _ in 0..<queuedCount {
+            safariCB.reloadContentBlocker { error in
+                XCTAssert(error != nil, "Error of the queued reload was not delivered")
+                queued.fulfill()
+            }
+        }
+        pass(window * 4)
+        XCTAssert(manager.reloadCount == 1, "Reload started while another was running")
+
+        manager.error = ABPContentBlockerError.invalidIdentifier
+        manager.finishReloads()
+        wait(for: [first],
+             timeout: timeout)
+        XCTAssert(safariCB.reloading.value, "Reloading state was reset with a queued reload")
+        pass(window * 4)
+        XCTAssert(manager.reloadCount == 2, "Queued reload was not started")
+        manager.finishReloads()
+        wait(for: [queued],
+             timeout: timeout)
+
+        let counters = safariCB.reloadScheduler.counters
+        XCTAssert(counters.requested == 1 + queuedCount, "Requested count is wrong")
+        XCTAssert(counters.coalesced == queuedCount - 1, "Coalesced count is wrong")
+        XCTAssert(counters.executed == 2, "Executed count is wrong")
+        XCTAssert(!safariCB.reloading.value, "Reloading state was not reset")
+    }
+
+    /// Test that instances reloading the same content blocker share one scheduler, so that their
+    /// requests are coalesced and each of them observes the reloading state.
+    func testInstancesShareScheduler() {
+        let identifier = "test.\(UUID().uuidString)"
+        let scheduler = SafariContentBlocker.reloadScheduler(for: identifier)
+        XCTAssert(SafariContentBlocker.reloadScheduler(for: identifier) === scheduler, "Scheduler was not shared")
+        scheduler.window = window
+        scheduler.reloader = { [weak self] identifier, completion in
+            guard let manager = self?.manager else {
+                completion(ABPContentBlockerError.reloaderUnavailable)
+                return
+            }
+            manager.reload(withIdentifier: identifier,
+                           completionHandler: completion)
+        }
+        var otherReloading = false
+        let other = SafariContentBlocker(reloadScheduler: scheduler,
+                                         reloadingSetter: { reloading in otherReloading = reloading },
+                                         performingActivityTestSetter: { _ in })
+        safariCB = SafariContentBlocker(reloadScheduler: scheduler,
+                                        reloadingSetter: { [weak self] reloading in
+            self?.legacyReloading = reloading
+        }, performingActivityTestSetter: { _ in })
+
+        let expect = expectation(description: "Completions")
+        expect.expectedFulfillmentCount = 2
+        for safariCB in [safariCB!, other] {
+            safariCB.reloadContentBlocker { _ in
+                expect.fulfill()
+            }
+        }
+        XCTAssert(legacyReloading && otherReloading, "Reloading state was not shared")
+        pass(window * 4)
+        manager.finishReloads()
+        wait(for: [expect],
+             timeout: timeout)
+        XCTAssert(manager.reloadCount == 1, "Requests of both instances were not coalesced: \(manager.reloadCount)")
+        XCTAssert(!legacyReloading && !otherReloading, "Reloading state was not reset")
+    }
+
+    // ------------------------------------------------------------
+    // MARK: - Private -
+    // ------------------------------------------------------------
+
+    /// Let the main queue run for the given interval.
+    private func pass(_ interval: TimeInterval) {
+        let expect = expectation(description: "Interval")
+        DispatchQueue.main.asyncAfter(deadline: .now() + interval) {
+            expect.fulfill()
+        }
+        wait(for: [expect],
+             timeout: interval + timeout)
+    }
+}
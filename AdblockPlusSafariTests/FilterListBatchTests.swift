@@ -0,0 +1,119 @@
+/*
+ * This file is part of Adblock Plus <https://adblockplus.org/>,
+ * Copyright (C) 2006-present eyeo GmbH
+ *
+ * Adblock Plus is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * Adblock Plus is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Adblock Plus.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+@testable import AdblockPlusSafari
+import libadblockplus_ios
+import RxSwift
+import XCTest
+
+/// Test concurrent filter list downloads.
+class FilterListBatchTests: XCTestCase {
+    let timeout = 10.0
+    let updateCount = 6
+    var updater: FilterListsUpdater!
+    var session: URLSession!
+    var updates = [FilterListUpdate]()
+    var savedMaxConcurrentDownloads = 0
+    var bag: DisposeBag!
+
+    override func setUp() {
+        super.setUp()
+        updater = ABPManager.sharedInstance().filterListsUpdater
+        savedMaxConcurrentDownloads = updater.maxConcurrentDownloads
+        session = URLSession(configuration: .ephemeral)
+        bag = DisposeBag()
+        updates = []
+        for index in 0..<updateCount {
+            // The tasks are never started, downloads are simulated.
+            guard let url = URL(string: "https://filterlists.test/\(index)") else { continue }
+            updates.append(FilterListUpdate(filterList: libadblockplus_ios.FilterList(),
+                                            task: session.downloadTask(with: url),
+                                            userTriggered: false))
+        }
+    }
+
+    override func tearDown() {
+        updater.maxConcurrentDownloads = savedMaxConcurrentDownloads
+        bag = nil
+        super.tearDown()
+    }
+
+    /// Test that no more than the allowed number of downloads run at the same time.
+    func testBoundedParallelism() {
+        updater.maxConcurrentDownloads = 2
+        var running = 0
+        var maxRunning = 0
+        let batch = updater.downloadBatch(Observable.from(updates),
+                                          timeout: timeout) { update -> Observable<FilterListUpdate> in
+            return Observable<Int>.timer(0.05,
+                                         scheduler: MainScheduler.instance)
+                .map { _ in update }
+                .do(onSubscribe: {
+                    running += 1
+                    maxRunning = max(maxRunning, running)
+                }, onDispose: {
+                    running -= 1
+                })
+        }
+        guard let result = run(batch) else { return }
+        XCTAssert(result.updates.count == updateCount, "Downloads are missing")
+        XCTAssert(result.error == nil, "Unexpected error: \(String(describing: result.error))")
+        XCTAssert(maxRunning == 2, "Downloads were not run concurrently up to the limit: \(maxRunning)")
+    }
+
+    /// Test that a failed download and a download exceeding the timeout do not stop the others.
+    func testFailedDownloads() {
+        let failingID = updates[0].task.taskIdentifier
+        let stalledID = updates[1].task.taskIdentifier
+        let batch = updater.downloadBatch(Observable.from(updates),
+                                          timeout: 0.2) { update -> Observable<FilterListUpdate> in
+            switch update.task.taskIdentifier {
+            case failingID:
+                return Observable.error(ABPFilterListError.invalidData)
+            case stalledID:
+                return Observable.never()
+            default:
+                return Observable.just(update)
+            }
+        }
+        guard let result = run(batch) else { return }
+        XCTAssert(result.updates.count == updateCount - 2, "Completed downloads are missing")
+        XCTAssert(!result.updates.contains { $0.task.taskIdentifier == stalledID }, "Stalled download completed")
+        XCTAssert(result.error != nil, "Error was not reported")
+    }
+
+    // ------------------------------------------------------------
+    // MARK: - Private -
+    // ------------------------------------------------------------
+
+    private func run(_ batch: Observable<(updates: [FilterListUpdate], error: Error?)>)
+        -> (updates: [FilterListUpdate], error: Error?)? {
+        let expect = expectation(description: "Batch")
+        var result: (updates: [FilterListUpdate], error: Error?)?
+        batch.subscribe(onNext: { batchResult in
+            result = batchResult
+        }, onError: { error in
+            XCTAssert(false, "Batch failed: \(error)")
+            expect.fulfill()
+        }, onCompleted: {
+            expect.fulfill()
+        }).disposed(by: bag)
+        wait(for: [expect],
+             timeout: timeout)
+        return result
+    }
+}
@@ -0,0 +1,147 @@
+/*
+ * This file is part of Adblock Plus <https://adblockplus.org/>,
+ * Copyright (C) 2006-present eyeo GmbH
+ *
+ * Adblock Plus is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * Adblock Plus is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Adblock Plus.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+@testable import AdblockPlusSafari
+@testable import libadblockplus_ios
+import XCTest
+
+/// Times the hot paths of filter list processing on synthetic lists of growing size and writes
+/// the results as JSON, so that runs on different revisions can be compared.
+///
+/// The environment variable BENCHMARK_RULE_COUNTS overrides the list sizes (comma separated),
+/// BENCHMARK_OUTPUT the path of the results.
+class FilterListBenchmarkTests: XCTestCase {
+    let defaultRuleCounts = [1000, 10000, 50000, 200_000]
+    let whitelistCounts = [0, 100, 1000, 5000]
+    var directory: URL!
+    var results = [[String: Any]]()
+
+    override func setUp() {
+        super.setUp()
+        directory = URL(fileURLWithPath: NSTemporaryDirectory()).appendingPathComponent(UUID().uuidString)
+        XCTAssert((try? FileManager.default.createDirectory(at: directory,
+                                                            withIntermediateDirectories: true)) != nil,
+                  "Directory was not created")
+        results = []
+    }
+
+    override func tearDown() {
+        try? FileManager.default.removeItem(at: directory)
+        super.tearDown()
+    }
+
+    /// Test the generated lists and measure parsing, merging, decoding and hostname normalization.
+    func testFilterListBenchmark() {
+        let websites = SyntheticFilterList.websites(count: whitelistCounts.max() ?? 0)
+        let hostnames = benchmarkHostnames(websites)
+
+        for ruleCount in ruleCounts() {
+            for version in [1, 2] {
+                let data = SyntheticFilterList(ruleCount: ruleCount).data(version: version)
+                let input = directory.appendingPathComponent("v\(version)-\(ruleCount).json")
+                let output = directory.appendingPathComponent("merged.json")
+                XCTAssert((try? data.write(to: input)) != nil, "List was not written")
+                let parameters: [String: Any] = ["version": version, "rules": ruleCount, "bytes": data.count]
+
+                let bridge = FilterListSwiftBridge(dictionary: [:])
+                time("parse", parameters) {
+                    XCTAssert((try? bridge.parseFilterList(from: input)) != nil, "List was not parsed")
+                }
+                XCTAssert(bridge.filterList?.ruleCount == ruleCount, "Rule count is wrong")
+
+                time("decode", parameters) {
+                    let rules = version == 2 ?
+                        V2FilterList(with: data)?.rules.count :
+                        (try? JSONDecoder().decode(V1FilterList.self, from: data))?.rules.count
+                    XCTAssert(rules == ruleCount, "List was not decoded")
+                }
+
+                for whitelistCount in whitelistCounts {
+                    var whitelistParameters = parameters
+                    whitelistParameters["whitelisted"] = whitelistCount
+                    time("merge", whitelistParameters) {
+                        XCTAssert((try? AdblockPlus.mergeFilterLists(from: input,
+                                                                     withWhitelistedWebsites: Array(hostnames.prefix(whitelistCount)),
+                                                                     to: output)) != nil,
+                                  "Lists were not merged")
+                    }
+                }
+                try? FileManager.default.removeItem(at: input)
+                try? FileManager.default.removeItem(at: output)
+            }
+        }
+        XCTAssert(writeResults(), "Results were not written")
+    }
+
+    // ------------------------------------------------------------
+    // MARK: - Private -
+    // ------------------------------------------------------------
+
+    private func ruleCounts() -> [Int] {
+        guard let value = ProcessInfo.processInfo.environment["BENCHMARK_RULE_COUNTS"] else {
+            return defaultRuleCounts
+        }
+        return value.split(separator: ",").compactMap { Int($0.trimmingCharacters(in: .whitespaces)) }
+    }
+
+    /// Normalizes and escapes the websites as whitelisting does, recording the time per host.
+    private func benchmarkHostnames(_ websites: [String]) -> [String] {
+        var hostnames = [String]()
+        time("hostnames", ["websites": websites.count]) {
+            hostnames = websites.compactMap { ($0 as NSString).whitelistedHostname() }
+            hostnames.forEach { _ = AdblockPlus.escapeHostname($0) }
+        }
+        XCTAssert(hostnames.count == websites.count, "Websites were not normalized")
+        return hostnames
+    }
+
+    private func time(_ benchmark: String,
+                      _ parameters: [String: Any],
+                      block: () -> Void) {
+        let start = Date()
+        block()
+        let seconds = Date().timeIntervalSince(start)
+        var result = parameters
+        result["benchmark"] = benchmark
+        result["seconds"] = seconds
+        results.append(result)
+        print("Benchmark \(benchmark) \(parameters): \(String(format: "%.1f", seconds * 1000)) ms")
+    }
+
+    private func writeResults() -> Bool {
+        let path = ProcessInfo.processInfo.environment["BENCHMARK_OUTPUT"] ??
+            (NSTemporaryDirectory() as NSString).appendingPathComponent("filter-list-benchmark.json")
+        #if DEBUG
+        let configuration = "debug"
+        #else
+        let configuration = "release"
+        #endif
+        let report: [String: Any] = [
+            "date": Date().timeIntervalSince1970,
+            "configuration": configuration,
+            "system": ProcessInfo.processInfo.operatingSystemVersionString,
+            "results": results
+        ]
+        guard let data = try? JSONSerialization.data(withJSONObject: report, options: [.prettyPrinted]),
+            (try? data.write(to: URL(fileURLWithPath: path))) != nil
+        else {
+            return false
+        }
+        print("Benchmark results written to \(path)")
+        return true
+    }
+}
@@ -0,0 +1,165 @@
+/*
+ * This file is part of Adblock Plus <https://adblockplus.org/>,
+ * Copyright (C) 2006-present eyeo GmbH
+ *
+ * Adblock Plus is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * Adblock Plus is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Adblock Plus.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+@testable import AdblockPlusSafari
+import libadblockplus_ios
+import XCTest
+
+/// Test differential filter list updates.
+class FilterListDiffTests: XCTestCase {
+    let timeout = 10.0
+    var session: URLSession!
+    var directory: URL!
+    var destination: URL!
+    var baseRules = [Data]()
+    var newRules = [Data]()
+
+    override func setUp() {
+        super.setUp()
+        let config = URLSessionConfiguration.ephemeral
+        config.protocolClasses = [FilterListServerProtocol.self]
+        session = URLSession(configuration: config)
+        directory = URL(fileURLWithPath: NSTemporaryDirectory())
+            .appendingPathComponent(UUID().uuidString,
+                                    isDirectory: true)
+        try? FileManager.default.createDirectory(at: directory,
+                                                 withIntermediateDirectories: true)
+        destination = directory.appendingPathComponent("list.json",
+                                                       isDirectory: false)
+
+        let testBundle = Bundle(for: type(of: self))
+        guard let path = testBundle.path(forResource: "easylist_content_blocker_v2_short",
+                                         ofType: "json"),
+            let reader = try? FilterListRuleReader(url: URL(fileURLWithPath: path)),
+            let fixture = try? Data(contentsOf: URL(fileURLWithPath: path))
+        else {
+            XCTAssert(false, "Filter list missing")
+            return
+        }
+        baseRules = []
+        while let rule = try? reader.nextRuleData(), let uwRule = rule {
+            baseRules.append(uwRule)
+        }
+        XCTAssert(baseRules.count == 3, "Rule count is wrong")
+
+        // The new version drops the second rule and adds one rule at the start and one at the end.
+        let first = Data("{\"action\":{\"type\":\"block\"},\"trigger\":{\"url-filter\":\"^https?://first\\\\.test/\"}}".utf8)
+        let last = Data("{\"action\":{\"type\":\"ignore-previous-rules\"},\"trigger\":{\"url-filter\":\"^https?://last\\\\.test/\"}}".utf8)
+        newRules = [first, baseRules[0], baseRules[2], last]
+        FilterListServerProtocol.reset()
+        FilterListServerProtocol.fullList = fixture
+        let diffHeader = "{\"from\": \"201512011207\", \"version\": \"201512021207\", " +
+            "\"sha256\": \"\(sha256(of: newRules))\", \"removed\": [1], \"added\": [0, 3], \"rules\": ["
+        FilterListServerProtocol.diff = Data(diffHeader.utf8) + first + Data(",".utf8) + last + Data("]}".utf8)
+    }
+
+    override func tearDown() {
+        try? FileManager.default.removeItem(at: directory)
+        super.tearDown()
+    }
+
+    /// * Test that a diff is applied to the stored list.
+    /// * Test that a diff failing verification removes the stored list and a complete list is
+    ///   downloaded instead.
+    func testApplyDiff() {
+        guard let updater = ABPManager.sharedInstance().filterListsUpdater else {
+            XCTAssert(false, "Updater missing")
+            return
+        }
+        var list = libadblockplus_ios.FilterList()
+        list.name = "easylist"
+        list.source = "https://filterlists.test/easylist_content_blocker.json"
+        let base = updater.baseURL(forFilterListURL: destination)
+
+        XCTAssert(download(list: list, acceptingDiff: false, updater: updater), "Complete list was not stored")
+        XCTAssert(rules(at: base) == baseRules, "Stored list is wrong")
+        XCTAssert(FileManager.default.fileExists(atPath: destination.path), "List was not installed")
+
+        list.version = "201512011207"
+        XCTAssert(download(list: list, acceptingDiff: true, updater: updater), "Diff was not applied")
+        XCTAssert(FilterListServerProtocol.requestedDiffs.last! == "201512011207", "Diff was not requested")
+        XCTAssert(rules(at: base) == newRules, "Rules after applying the diff are wrong")
+        XCTAssert(header(at: base, key: "version") == Data("\"201512021207\"".utf8), "Version was not replaced")
+        XCTAssert(header(at: base, key: "sources") != nil, "Values not in the diff were lost")
+
+        // The diff no longer matches the stored list.
+        FilterListServerProtocol.corruptDiff = true
+        try? FileManager.default.removeItem(at: base)
+        XCTAssert(download(list: list, acceptingDiff: false, updater: updater), "Complete list was not stored")
+        XCTAssert(!download(list: list, acceptingDiff: true, updater: updater), "Diff with a wrong digest was applied")
+        XCTAssert(!FileManager.default.fileExists(atPath: base.path), "Stored list was kept")
+        XCTAssert(download(list: list, acceptingDiff: false, updater: updater), "Complete list was not stored")
+        XCTAssert(FilterListServerProtocol.requestedDiffs.last! == nil, "Complete list was not requested")
+        XCTAssert(rules(at: base) == baseRules, "Stored list is wrong")
+    }
+
+    // ------------------------------------------------------------
+    // MARK: - Private -
+    // ------------------------------------------------------------
+
+    /// Download from the stand-in server and store the result like the download delegate.
+    private func download(list: libadblockplus_ios.FilterList,
+                          acceptingDiff: Bool,
+                          updater: FilterListsUpdater) -> Bool {
+        guard let url = updater.downloadURL(for: list,
+                                            acceptingDiff: acceptingDiff)
+        else {
+            XCTAssert(false, "Download URL missing")
+            return false
+        }
+        let expect = expectation(description: "Download")
+        var stored = false
+        session.downloadTask(with: url) { location, response, error in
+            XCTAssert(error == nil, "Error during download: \(String(describing: error))")
+            if let uwLocation = location {
+                stored = updater.storeDownloadedFilterList(at: uwLocation,
+                                                           response: response as? HTTPURLResponse,
+                                                           destination: self.destination,
+                                                           named: "easylist")
+            }
+            expect.fulfill()
+        }.resume()
+        wait(for: [expect],
+             timeout: timeout)
+        return stored
+    }
+
+    private func rules(at url: URL) -> [Data] {
+        var result = [Data]()
+        guard let reader = try? FilterListRuleReader(url: url) else { return result }
+        while let rule = try? reader.nextRuleData(), let uwRule = rule {
+            result.append(uwRule)
+        }
+        return result
+    }
+
+    private func header(at url: URL,
+                        key: String) -> Data? {
+        guard let reader = try? FilterListRuleReader(url: url) else { return nil }
+        while let rule = try? reader.nextRuleData(), rule != nil {}
+        return reader.header.first(where: { $0.key == key })?.value
+    }
+
+    private func sha256(of rules: [Data]) -> String {
+        let array = Data("[".utf8) + Data(rules.joined(separator: Data(",".utf8))) + Data("]".utf8)
+        var digest = [UInt8](repeating: 0, count: Int(CC_SHA256_DIGEST_LENGTH))
+        array.withUnsafeBytes { (bytes: UnsafePointer<UInt8>) -> Void in
+            _ = CC_SHA256(bytes, CC_LONG(array.count), &digest)
+        }
+        return digest.map { String(format: "%02x", $0) }.joined()
+    }
+}
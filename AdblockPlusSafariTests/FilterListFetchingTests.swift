@@ -0,0 +1,164 @@
+/*
+ * This file is part of Adblock Plus <https://adblockplus.org/>,
+ * Copyright (C) 2006-present eyeo GmbH
+ *
+ * Adblock Plus is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * Adblock Plus is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Adblock Plus.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+@testable import AdblockPlusSafari
+import libadblockplus_ios
+import XCTest
+
+/// Test conditional and compressed filter list downloads.
+class FilterListFetchingTests: XCTestCase {
+    let timeout = 10.0
+    let entityTag = "\"201512011207\""
+    let lastModified = "Tue, 01 Dec 2015 12:07:00 GMT"
+    var session: URLSession!
+    var directory: URL!
+    var destination: URL!
+    var fixture = Data()
+
+    override func setUp() {
+        super.setUp()
+        let config = URLSessionConfiguration.ephemeral
+        config.protocolClasses = [FilterListServerProtocol.self]
+        session = URLSession(configuration: config)
+        directory = URL(fileURLWithPath: NSTemporaryDirectory())
+            .appendingPathComponent(UUID().uuidString,
+                                    isDirectory: true)
+        try? FileManager.default.createDirectory(at: directory,
+                                                 withIntermediateDirectories: true)
+        destination = directory.appendingPathComponent("list.json",
+                                                       isDirectory: false)
+
+        let testBundle = Bundle(for: type(of: self))
+        guard let path = testBundle.path(forResource: "easylist_content_blocker_v2_short",
+                                         ofType: "json"),
+            let data = try? Data(contentsOf: URL(fileURLWithPath: path))
+        else {
+            XCTAssert(false, "Filter list missing")
+            return
+        }
+        fixture = data
+        FilterListServerProtocol.reset()
+        FilterListServerProtocol.fullList = fixture
+        FilterListServerProtocol.entityTag = entityTag
+        FilterListServerProtocol.lastModified = lastModified
+    }
+
+    override func tearDown() {
+        try? FileManager.default.removeItem(at: directory)
+        super.tearDown()
+    }
+
+    /// * Test that validators are recorded and sent with the next request.
+    /// * Test that a 304 response only refreshes the last update.
+    /// * Test that a changed list is stored again.
+    func testConditionalDownload() {
+        guard let updater = ABPManager.sharedInstance().filterListsUpdater else {
+            XCTAssert(false, "Updater missing")
+            return
+        }
+        var list = filterList()
+        let base = updater.baseURL(forFilterListURL: destination)
+
+        XCTAssert(fetch(&list, conditional: true, updater: updater) == .stored, "List was not stored")
+        XCTAssert(list.entityTag == entityTag, "ETag was not recorded")
+        XCTAssert(list.lastModified == lastModified, "Last-Modified was not recorded")
+        XCTAssert((try? Data(contentsOf: base)) == fixture, "Stored list is wrong")
+
+        // The stored list must stay untouched.
+        try? FileManager.default.removeItem(at: base)
+        let lastUpdate = Date(timeIntervalSinceReferenceDate: 0)
+        list.lastUpdate = lastUpdate
+        XCTAssert(fetch(&list, conditional: true, updater: updater) == .notModified, "Unchanged list was not detected")
+        let request = FilterListServerProtocol.requests.last
+        XCTAssert(request?.value(forHTTPHeaderField: "If-None-Match") == entityTag, "ETag was not sent")
+        XCTAssert(request?.value(forHTTPHeaderField: "If-Modified-Since") == lastModified, "Last-Modified was not sent")
+        XCTAssert(list.lastUpdate != nil && list.lastUpdate! > lastUpdate, "Last update was not refreshed")
+        XCTAssert(!FileManager.default.fileExists(atPath: base.path), "Unchanged list was stored")
+
+        FilterListServerProtocol.entityTag = "\"201512021207\""
+        FilterListServerProtocol.lastModified = "Wed, 02 Dec 2015 12:07:00 GMT"
+        XCTAssert(fetch(&list, conditional: true, updater: updater) == .stored, "Changed list was not stored")
+        XCTAssert(list.entityTag == "\"201512021207\"", "ETag was not replaced")
+        XCTAssert((try? Data(contentsOf: base)) == fixture, "Stored list is wrong")
+
+        XCTAssert(fetch(&list, conditional: false, updater: updater) == .stored, "Unconditional request was answered with 304")
+        XCTAssert(FilterListServerProtocol.requests.last?.value(forHTTPHeaderField: "If-None-Match") == nil,
+                  "Validators were sent with an unconditional request")
+    }
+
+    /// Test that a gzip compressed list is inflated before it is stored.
+    func testCompressedDownload() {
+        guard let updater = ABPManager.sharedInstance().filterListsUpdater else {
+            XCTAssert(false, "Updater missing")
+            return
+        }
+        let testBundle = Bundle(for: type(of: self))
+        guard let path = testBundle.path(forResource: "easylist_content_blocker_v2_short.json",
+                                         ofType: "gz")
+        else {
+            XCTAssert(false, "Compressed filter list missing")
+            return
+        }
+        FilterListServerProtocol.compressedFullList = try? Data(contentsOf: URL(fileURLWithPath: path))
+        var list = filterList()
+        XCTAssert(fetch(&list, conditional: false, updater: updater) == .stored, "List was not stored")
+        XCTAssert((try? Data(contentsOf: updater.baseURL(forFilterListURL: destination))) == fixture,
+                  "Stored list was not inflated")
+        XCTAssert(FileManager.default.fileExists(atPath: destination.path), "List was not installed")
+    }
+
+    // ------------------------------------------------------------
+    // MARK: - Private -
+    // ------------------------------------------------------------
+
+    private func filterList() -> libadblockplus_ios.FilterList {
+        var list = libadblockplus_ios.FilterList()
+        list.name = "easylist"
+        list.source = "https://filterlists.test/easylist_content_blocker.json"
+        return list
+    }
+
+    /// Download from the stand-in server and process the result like the download delegate.
+    private func fetch(_ list: inout libadblockplus_ios.FilterList,
+                       conditional: Bool,
+                       updater: FilterListsUpdater) -> FilterListDownloadResult? {
+        guard let request = updater.downloadRequest(for: list,
+                                                    acceptingDiff: false,
+                                                    conditional: conditional)
+        else {
+            XCTAssert(false, "Download request missing")
+            return nil
+        }
+        let expect = expectation(description: "Download")
+        var fetched = list
+        var result: FilterListDownloadResult?
+        session.downloadTask(with: request) { location, response, error in
+            XCTAssert(error == nil, "Error during download: \(String(describing: error))")
+            if let uwLocation = location {
+                result = updater.processDownload(at: uwLocation,
+                                                 response: response as? HTTPURLResponse,
+                                                 destination: self.destination,
+                                                 filterList: &fetched)
+            }
+            expect.fulfill()
+        }.resume()
+        wait(for: [expect],
+             timeout: timeout)
+        list = fetched
+        return result
+    }
+}
@@ -0,0 +1,127 @@
+/*
+ * This file is part of Adblock Plus <https://adblockplus.org/>,
+ * Copyright (C) 2006-present eyeo GmbH
+ *
+ * Adblock Plus is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * Adblock Plus is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Adblock Plus.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+@testable import AdblockPlusSafari
+import Foundation
+
+/// Stands in for the filter list server.
+/// * Complete lists are served unless a diff is requested. The diff is served with a wrong
+///   digest if corruptDiff is set.
+/// * Responses carry entityTag and lastModified, a request with a matching validator receives
+///   304.
+/// * The complete list is served gzip compressed if compressedFullList is set.
+class FilterListServerProtocol: URLProtocol {
+    static var fullList = Data()
+    static var compressedFullList: Data?
+    static var diff = Data()
+    static var corruptDiff = false
+    static var entityTag: String?
+    static var lastModified: String?
+    static var requests = [URLRequest]()
+    static var requestedDiffs = [String?]()
+
+    /// Restore the initial state.
+    static func reset() {
+        fullList = Data()
+        compressedFullList = nil
+        diff = Data()
+        corruptDiff = false
+        entityTag = nil
+        lastModified = nil
+        requests = []
+        requestedDiffs = []
+    }
+
+    override class func canInit(with request: URLRequest) -> Bool {
+        return request.url?.host == "filterlists.test"
+    }
+
+    override class func canonicalRequest(for request: URLRequest) -> URLRequest {
+        return request
+    }
+
+    override func startLoading() {
+        guard let url = request.url else { return }
+        FilterListServerProtocol.requests.append(request)
+        let diffVersion = URLComponents(url: url,
+                                        resolvingAgainstBaseURL: false)?
+            .queryItems?.first(where: { $0.name == "diff" })?.value
+        FilterListServerProtocol.requestedDiffs.append(diffVersion)
+
+        var headerFields = [String: String]()
+        headerFields["ETag"] = FilterListServerProtocol.entityTag
+        headerFields["Last-Modified"] = FilterListServerProtocol.lastModified
+        if notModified() {
+            respond(statusCode: 304,
+                    headerFields: headerFields,
+                    body: Data())
+            return
+        }
+
+        var body = FilterListServerProtocol.fullList
+        headerFields["Content-Type"] = "application/json"
+        if diffVersion != nil {
+            body = FilterListServerProtocol.diff
+            headerFields["Content-Type"] = FilterListPatcher.contentType
+            if FilterListServerProtocol.corruptDiff {
+                let text = String(decoding: body, as: UTF8.self)
+                body = Data(text.replacingOccurrences(of: "\"sha256\": \"",
+                                                      with: "\"sha256\": \"00").utf8)
+            }
+        } else if let compressed = FilterListServerProtocol.compressedFullList {
+            // Stand-in protocols receive the body as it is sent, like lists served as gzip files.
+            body = compressed
+            headerFields["Content-Encoding"] = "gzip"
+        }
+        respond(statusCode: 200,
+                headerFields: headerFields,
+                body: body)
+    }
+
+    override func stopLoading() {}
+
+    private func notModified() -> Bool {
+        if let entityTag = FilterListServerProtocol.entityTag,
+            request.value(forHTTPHeaderField: "If-None-Match") == entityTag {
+            return true
+        }
+        if let lastModified = FilterListServerProtocol.lastModified,
+            request.value(forHTTPHeaderField: "If-Modified-Since") == lastModified {
+            return true
+        }
+        return false
+    }
+
+    private func respond(statusCode: Int,
+                         headerFields: [String: String],
+                         body: Data) {
+        guard let url = request.url,
+            let response = HTTPURLResponse(url: url,
+                                           statusCode: statusCode,
+                                           httpVersion: "HTTP/1.1",
+                                           headerFields: headerFields)
+        else {
+            return
+        }
+        client?.urlProtocol(self,
+                            didReceive: response,
+                            cacheStoragePolicy: .notAllowed)
+        client?.urlProtocol(self,
+                            didLoad: body)
+        client?.urlProtocolDidFinishLoading(self)
+    }
+}
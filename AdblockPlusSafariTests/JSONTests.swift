@@ -71,5 +71,6 @@ class JSONTests: XCTestCase {
             return
         }
         XCTAssert(list.version == "201512011207", "Set version value is wrong")
+        XCTAssert(list.ruleCount == 3, "Rule count is wrong")
     }
 }
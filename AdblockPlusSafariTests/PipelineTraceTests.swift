@@ -0,0 +1,84 @@
+/*
+ * This file is part of Adblock Plus <https://adblockplus.org/>,
+ * Copyright (C) 2006-present eyeo GmbH
+ *
+ * Adblock Plus is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * Adblock Plus is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Adblock Plus.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+@testable import AdblockPlusSafari
+import XCTest
+
+/// Test the ring buffer of pipeline events and its export.
+class PipelineTraceTests: XCTestCase {
+    /// * Test that spans measure the time since their start.
+    /// * Test that the newest events replace the oldest ones.
+    func testRingBuffer() {
+        let start = PipelineTraceNow()
+        usleep(2000)
+        PipelineTraceSpan("test-span", start, 42)
+        PipelineTraceCount("test-counter", 7)
+
+        var recent = events()
+        XCTAssert(recent.count >= 2, "Events are missing")
+        let span = recent[recent.count - 2]
+        let counter = recent[recent.count - 1]
+        XCTAssert(name(of: span) == "test-span" && span.value == 42 && span.duration >= 2_000_000, "Span is wrong")
+        XCTAssert(name(of: counter) == "test-counter" && counter.kind == PipelineTraceKindCounter.rawValue, "Counter is wrong")
+        XCTAssert(counter.time >= span.time && span.time - span.duration >= start, "Times are not monotonic")
+
+        for index in 0..<(Int(PipelineTraceCapacity) + 10) {
+            PipelineTraceCount("test-overwrite", Int64(index))
+        }
+        var overwritten: UInt64 = 0
+        recent = events(overwritten: &overwritten)
+        XCTAssert(recent.count == Int(PipelineTraceCapacity), "Buffer is not full")
+        let values = recent.filter { name(of: $0) == "test-overwrite" }.map { $0.value }
+        XCTAssert(values.first ?? 0 >= 10 && values.last == Int64(PipelineTraceCapacity) + 9, "Oldest events were kept")
+        XCTAssert(overwritten >= 12, "Overwritten count is wrong")
+    }
+
+    /// Test that the export sums up the spans of each stage.
+    func testExport() {
+        for duration: UInt64 in [1_000_000, 3_000_000] {
+            PipelineTraceSpan("test-export", PipelineTraceNow() - duration, 1)
+        }
+        guard let data = ABPManager.sharedInstance().pipelineTraceJSON(),
+            let json = try? JSONSerialization.jsonObject(with: data) as? [String: Any],
+            let events = json?["events"] as? [[String: Any]],
+            let stage = (json?["stages"] as? [String: [String: Double]])?["test-export"]
+        else {
+            XCTFail("Export is not valid JSON")
+            return
+        }
+        XCTAssert(events.last?["name"] as? String == "test-export", "Last event is missing")
+        XCTAssert(stage["count"] == 2 && (stage["total"] ?? 0) >= 4 && (stage["max"] ?? 0) >= 3, "Stage is wrong: \(stage)")
+    }
+
+    // ------------------------------------------------------------
+    // MARK: - Private -
+    // ------------------------------------------------------------
+
+    private func events(overwritten: UnsafeMutablePointer<UInt64>? = nil) -> [PipelineTraceEvent] {
+        var events = [PipelineTraceEvent](repeating: PipelineTraceEvent(),
+                                          count: Int(PipelineTraceCapacity))
+        let count = PipelineTraceCopyEvents(&events,
+                                            events.count,
+                                            overwritten)
+        return Array(events.prefix(count))
+    }
+
+    private func name(of event: PipelineTraceEvent) -> String {
+        var copy = event
+        return String(cString: &copy.name.0)
+    }
+}
@@ -0,0 +1,264 @@
+/*
+ * This file is part of Adblock Plus <https://adblockplus.org/>,
+ * Copyright (C) 2006-present eyeo GmbH
+ *
+ * Adblock Plus is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * Adblock Plus is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Adblock Plus.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+@testable import AdblockPlusSafari
+import libadblockplus_ios
+import XCTest
+
+/// Test batched and journaled settings commits.
+class SettingsTests: XCTestCase {
+    let timeout = 10.0
+    let filterListsKey = "AdblockPlusFilterListsVersion2"
+    let downloadedVersionKey = "AdblockPlusDownloadedVersion"
+    var directory: URL!
+    var url: URL!
+
+    override func setUp() {
+        super.setUp()
+        directory = URL(fileURLWithPath: NSTemporaryDirectory())
+            .appendingPathComponent(UUID().uuidString,
+                                    isDirectory: true)
+        url = directory.appendingPathComponent("AdblockPlusSettings.plist",
+                                               isDirectory: false)
+    }
+
+    override func tearDown() {
+        try? FileManager.default.removeItem(at: directory)
+        super.tearDown()
+    }
+
+    /// * Test that changes in quick succession are written in one commit.
+    /// * Test that setting an unchanged value does not cause a commit.
+    func testChangesAreCommittedTogether() {
+        let settings = makeSettings()
+        settings.commitDelay = 0.1
+        for version in 1...10 {
+            settings.set(version, forKey: downloadedVersionKey)
+            settings.set(version % 2 == 0, forKey: "AdblockPlusEnabled")
+        }
+        XCTAssert(settings.hasChanges && settings.writeCount == 0, "Changes were written immediately")
+        pass(settings.commitDelay * 5)
+        XCTAssert(!settings.hasChanges && settings.writeCount == 1, "Changes were not committed together: \(settings.writeCount)")
+
+        let reader = makeSettings()
+        XCTAssert(reader.integer(forKey: downloadedVersionKey) == 10, "Committed value was not read")
+        XCTAssert(reader.bool(forKey: "AdblockPlusEnabled"), "Committed value was not read")
+        XCTAssert(reader.generation == settings.generation, "Generation is wrong")
+
+        settings.set(10, forKey: downloadedVersionKey)
+        XCTAssert(!settings.hasChanges, "Unchanged value was marked as changed")
+    }
+
+    /// Test that a commit keeps the values committed by another process in the meantime.
+    func testConcurrentCommits() {
+        let app = makeSettings()
+        let ext = makeSettings()
+        app.set("app", forKey: "A")
+        XCTAssert((try? app.commit()) != nil, "Commit failed")
+        ext.set("extension", forKey: "B")
+        XCTAssert((try? ext.commit()) != nil, "Commit failed")
+        XCTAssert(ext.object(forKey: "A") as? String == "app", "Commit of the other process was lost")
+
+        app.set("uncommitted", forKey: "C")
+        app.reload()
+        XCTAssert(app.object(forKey: "B") as? String == "extension", "Commit of the other process was not read")
+        XCTAssert(app.object(forKey: "C") as? String == "uncommitted", "Uncommitted change was lost")
+        XCTAssert(app.generation == 2, "Generation is wrong")
+    }
+
+    /// Test that a change followed at once by a content blocker reload is stored before the
+    /// extension reads the settings, although its scheduled commit is still pending.
+    func testChangeIsCommittedBeforeReload() {
+        let settings = makeSettings()
+        var read: [String]?
+        let scheduler = ContentBlockerReloadScheduler(identifier: "test",
+                                                      window: 0.05) { [unowned self] _, completion in
+            read = self.makeSettings().object(forKey: "AdblockPlusWhitelistedWebsites") as? [String]
+            completion(nil)
+        }
+        scheduler.willReload = {
+            try? settings.commit()
+        }
+        let safariCB = SafariContentBlocker(reloadScheduler: scheduler,
+                                            reloadingSetter: { _ in },
+                                            performingActivityTestSetter: { _ in })
+
+        let expect = expectation(description: "Reload")
+        settings.set(["example.com"], forKey: "AdblockPlusWhitelistedWebsites")
+        safariCB.reloadContentBlocker { _ in
+            expect.fulfill()
+        }
+        wait(for: [expect],
+             timeout: timeout)
+        XCTAssert(read == ["example.com"], "Extension read stale settings: \(String(describing: read))")
+    }
+
+    /// Test that an interrupted commit is rolled forward if its journal is complete and discarded
+    /// otherwise.
+    func testJournalRecovery() {
+        let settings = makeSettings()
+        settings.set(1, forKey: downloadedVersionKey)
+        XCTAssert((try? settings.commit()) != nil, "Commit failed")
+        let journal = URL(fileURLWithPath: url.path + ".journal")
+
+        XCTAssert(writeJournal(to: journal, generation: settings.generation + 1, version: 2, complete: true),
+                  "Journal was not written")
+        XCTAssert(makeSettings().integer(forKey: downloadedVersionKey) == 2, "Complete journal was not rolled forward")
+        XCTAssert(!FileManager.default.fileExists(atPath: journal.path), "Journal was kept")
+
+        XCTAssert(writeJournal(to: journal, generation: settings.generation + 2, version: 3, complete: false),
+                  "Journal was not written")
+        XCTAssert(makeSettings().integer(forKey: downloadedVersionKey) == 2, "Incomplete journal was applied")
+        XCTAssert(!FileManager.default.fileExists(atPath: journal.path), "Journal was kept")
+    }
+
+    /// Test that values are imported from the legacy user defaults when nothing is stored yet.
+    func testMigration() {
+        let suiteName = "SettingsTests.\(UUID().uuidString)"
+        guard let defaults = UserDefaults(suiteName: suiteName) else {
+            XCTAssert(false, "User defaults missing")
+            return
+        }
+        defer { defaults.removePersistentDomain(forName: suiteName) }
+        defaults.set(5, forKey: downloadedVersionKey)
+        defaults.set(["example.com"], forKey: "AdblockPlusWhitelistedWebsites")
+
+        let settings = AdblockPlusSettings(url: url,
+                                           legacyDefaults: defaults,
+                                           migratedKeys: [downloadedVersionKey, filterListsKey])
+        XCTAssert(settings.integer(forKey: downloadedVersionKey) == 5, "Value was not imported")
+        XCTAssert(settings.object(forKey: "AdblockPlusWhitelistedWebsites") == nil, "Value of another key was imported")
+        XCTAssert(FileManager.default.fileExists(atPath: url.path), "Imported values were not written")
+    }
+
+    /// Test that pending changes are written when the app resigns active, so that they survive
+    /// the app being suspended and killed before the scheduled commit.
+    func testChangeIsCommittedBeforeSuspension() {
+        let settings = makeSettings()
+        settings.commitDelay = 60
+        settings.set(["example.com"], forKey: "AdblockPlusWhitelistedWebsites")
+        XCTAssert(settings.hasChanges, "Change was written immediately")
+        NotificationCenter.default.post(name: .UIApplicationWillResignActive,
+                                        object: nil)
+        XCTAssert(!settings.hasChanges, "Change was not committed")
+        XCTAssert(makeSettings().object(forKey: "AdblockPlusWhitelistedWebsites") as? [String] == ["example.com"],
+                  "Committed change was not read")
+    }
+
+    /// Measure the settings written by one filter list update of the app. The list is changed
+    /// through the registry and the updater, as when its download starts, when the download task
+    /// is known and when the download is stored. Every change used to synchronize the complete
+    /// settings. Results are printed to the test log.
+    func testWriteCostPerUpdateCycle() {
+        let mgr = ABPManager.sharedInstance()
+        let name = DefaultFilterListName
+        guard let updater = mgr.filterListsUpdater,
+            let original = updater.filterList(withName: name),
+            let url = URL(string: "https://filterlists.test/\(name)")
+        else {
+            XCTAssert(false, "Updater missing")
+            return
+        }
+        // The registry writes back through the shared instance, the updater has its own.
+        let allSettings = [mgr.adblockPlus.settings, updater.settings]
+        let originalVersion = updater.downloadedVersion
+        let commit = {
+            mgr.filterListRegistry.flush()
+            allSettings.forEach { try? $0.commit() }
+        }
+        defer {
+            updater.replaceFilterList(withName: name,
+                                      withNewList: original)
+            updater.downloadedVersion = originalVersion
+            commit()
+        }
+        commit()
+        let writeCount = allSettings.reduce(0) { $0 + $1.writeCount }
+        let writtenBytes = allSettings.reduce(0) { $0 + $1.writtenBytes }
+        let writeBackCount = mgr.filterListRegistry.writeBackCount
+        // The task is never resumed, only its identifier is recorded.
+        let task = URLSession(configuration: .ephemeral).downloadTask(with: url)
+
+        let start = Date()
+        var list = original
+        list.updating = true
+        updater.replaceFilterList(withName: name,
+                                  withNewList: list)
+        pass(0.02)
+        XCTAssert((try? updater.internallyUpdate(with: FilterListUpdate(filterList: list,
+                                                                        task: task,
+                                                                        userTriggered: false))) != nil,
+                  "Update failed")
+        pass(0.02)
+        list = updater.filterList(withName: name) ?? list
+        list.lastUpdate = Date()
+        list.downloaded = true
+        list.updating = false
+        list.taskIdentifier = nil
+        updater.downloadedVersion += 1
+        updater.replaceFilterList(withName: name,
+                                  withNewList: list)
+        commit()
+        let elapsed = Date().timeIntervalSince(start)
+
+        // Each write-back of the registry and the downloaded version used to synchronize.
+        let changes = Int(mgr.filterListRegistry.writeBackCount - writeBackCount) + 1
+        let writes = allSettings.reduce(0) { $0 + $1.writeCount } - writeCount
+        let bytes = allSettings.reduce(0) { $0 + $1.writtenBytes } - writtenBytes
+        let snapshotBytes = writes > 0 ? bytes / writes : 0
+        XCTAssert(writes > 0 && writes <= allSettings.count, "Changes were not batched: \(writes) writes for \(changes) changes")
+        print("Settings update cycle: \(changes) changes in \(Int(elapsed * 1000)) ms, "
+            + "synchronize per change \(changes) writes / \(changes * snapshotBytes) bytes, "
+            + "batched \(writes) writes / \(bytes) bytes")
+        task.cancel()
+    }
+
+    // ------------------------------------------------------------
+    // MARK: - Private -
+    // ------------------------------------------------------------
+
+    private func makeSettings() -> AdblockPlusSettings {
+        return AdblockPlusSettings(url: url,
+                                   legacyDefaults: nil,
+                                   migratedKeys: nil)
+    }
+
+    private func writeJournal(to journal: URL,
+                              generation: UInt,
+                              version: Int,
+                              complete: Bool) -> Bool {
+        let snapshot: [String: Any] = ["generation": generation,
+                                       "values": [downloadedVersionKey: version]]
+        guard let data = try? PropertyListSerialization.data(fromPropertyList: snapshot,
+                                                             format: .binary,
+                                                             options: 0)
+        else {
+            return false
+        }
+        return (try? (complete ? data : data.prefix(data.count / 2)).write(to: journal)) != nil
+    }
+
+    /// Let the main queue run for the given interval.
+    private func pass(_ interval: TimeInterval) {
+        let expect = expectation(description: "Interval")
+        DispatchQueue.main.asyncAfter(deadline: .now() + interval) {
+            expect.fulfill()
+        }
+        wait(for: [expect],
+             timeout: interval + timeout)
+    }
+}
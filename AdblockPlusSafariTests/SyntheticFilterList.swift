@@ -0,0 +1,188 @@
+/*
+ * This file is part of Adblock Plus <https://adblockplus.org/>,
+ * Copyright (C) 2006-present eyeo GmbH
+ *
+ * Adblock Plus is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * Adblock Plus is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Adblock Plus.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+import Foundation
+
+/// Deterministic pseudo random numbers, the generated lists are the same in every run.
+struct SplitMix {
+    private var state: UInt64
+
+    init(seed: UInt64) {
+        state = seed
+    }
+
+    /// - Returns: A number in 0..<upperBound.
+    mutating func next(_ upperBound: Int) -> Int {
+        state = state &+ 0x9E37_79B9_7F4A_7C15
+        var value = state
+        value = (value ^ (value >> 30)) &* 0xBF58_476D_1CE4_E5B9
+        value = (value ^ (value >> 27)) &* 0x94D0_49BB_1331_11EB
+        value ^= value >> 31
+        return Int(value % UInt64(upperBound))
+    }
+}
+
+/// Filter lists shaped like EasyList converted by abp2blocklist, for benchmarks of any size. The
+/// mix follows the real list: mostly element hiding rules, generic and per domain, then blocking
+/// rules with regular expression url-filters, some limited by resource type, load type or
+/// domain, and a few exceptions at the end.
+struct SyntheticFilterList {
+    let ruleCount: Int
+    let seed: UInt64
+
+    init(ruleCount: Int,
+         seed: UInt64 = 1) {
+        self.ruleCount = ruleCount
+        self.seed = seed
+    }
+
+    /// - Parameter version: 1 for a bare array of rules, 2 for an object with version, expires,
+    ///   sources and rules.
+    /// - Returns: The list as JSON, the same for the same rule count and seed.
+    func data(version: Int) -> Data {
+        var generator = SplitMix(seed: seed)
+        var json = ""
+        json.reserveCapacity(ruleCount * 140)
+        if version == 2 {
+            json += "{\"version\": \"201801011200\", \"expires\": \"4 days\", \"sources\": ["
+            json += "{\"url\": \"https://easylist-downloads.adblockplus.org/easylist.txt\", \"version\": \"201801011200\"}"
+            json += "], \"rules\": "
+        }
+        json += "["
+        let exceptionCount = ruleCount / 50
+        for index in 0..<ruleCount {
+            if index > 0 {
+                json += ","
+            }
+            json += "\n"
+            json += index < ruleCount - exceptionCount ? rule(index, generator: &generator) : exception(index, generator: &generator)
+        }
+        json += "\n]"
+        if version == 2 {
+            json += "\n}"
+        }
+        return Data(json.utf8)
+    }
+
+    /// - Returns: Addresses as typed or shared by users, with schemes, paths, ports, upper case
+    ///   and internationalized hosts, for whitelisting.
+    static func websites(count: Int,
+                         seed: UInt64 = 1) -> [String] {
+        var generator = SplitMix(seed: seed)
+        return (0..<count).map { index -> String in
+            let host = "site\(index).\(topLevelDomains[generator.next(topLevelDomains.count)])"
+            switch generator.next(8) {
+            case 0:
+                return host
+            case 1:
+                return "www.\(host)"
+            case 2:
+                return "HTTPS://WWW.\(host.uppercased())/"
+            case 3:
+                return "  http://user@\(host):8080/path?query=\(index)#top "
+            case 4:
+                return "https://bücher\(index).example/"
+            default:
+                return "https://www.\(host)/articles/\(generator.next(100_000)).html"
+            }
+        }
+    }
+
+    // ------------------------------------------------------------
+    // MARK: - Private -
+    // ------------------------------------------------------------
+
+    private static let topLevelDomains = ["com", "net", "org", "de", "co.uk", "example"]
+
+    private static let resourceTypes = ["image", "script", "style-sheet", "raw", "media", "popup"]
+
+    private func rule(_ index: Int,
+                      generator: inout SplitMix) -> String {
+        switch generator.next(100) {
+        case 0..<45:
+            return hidingRule(selector(index, generator: &generator), domains: nil)
+        case 45..<60:
+            return hidingRule(selector(index, generator: &generator), domains: domains(generator: &generator))
+        case 60..<75:
+            let domain = SyntheticFilterList.topLevelDomains[generator.next(SyntheticFilterList.topLevelDomains.count)]
+            var trigger = "\"url-filter\": " + quoted("^https?://([^/]+\\.)?adhost\(index)\\.\(domain)[/:]")
+            if generator.next(2) == 0 {
+                trigger += ", \"load-type\": [\"third-party\"]"
+            }
+            return blockingRule(trigger)
+        case 75..<90:
+            let size = ["300x250", "728x90", "160x600"][generator.next(3)]
+            let fileExtension = ["gif", "png", "jpg"][generator.next(3)]
+            var trigger = "\"url-filter\": " + quoted("/ads?/banner\(index)[_-]\(size)\\.\(fileExtension)")
+            let type = SyntheticFilterList.resourceTypes[generator.next(SyntheticFilterList.resourceTypes.count)]
+            trigger += ", \"resource-type\": [\"image\", \"\(type)\"]"
+            return blockingRule(trigger)
+        default:
+            var trigger = "\"url-filter\": " + quoted("[?&]ad_slot=\(index)&")
+            trigger += ", \"url-filter-is-case-sensitive\": true"
+            trigger += ", \"unless-domain\": \(domains(generator: &generator))"
+            return blockingRule(trigger)
+        }
+    }
+
+    private func exception(_ index: Int,
+                           generator: inout SplitMix) -> String {
+        let trigger = "\"url-filter\": " + quoted("^https?://([^/]+\\.)?cdn\(index)\\.example") +
+            ", \"if-domain\": " + domains(generator: &generator)
+        return "{\"trigger\": {\(trigger)}, \"action\": {\"type\": \"ignore-previous-rules\"}}"
+    }
+
+    private func selector(_ index: Int,
+                          generator: inout SplitMix) -> String {
+        switch generator.next(4) {
+        case 0:
+            return "#ad-banner-\(index)"
+        case 1:
+            return ".sponsored_box_\(index), .sidebar > .promo\(index)"
+        case 2:
+            return "a[href^=\"https://track\(index).example/\"]"
+        default:
+            return "div[id^=\"adslot-\(index)\"] > iframe"
+        }
+    }
+
+    private func domains(generator: inout SplitMix) -> String {
+        let domains = (0...generator.next(3)).map { _ -> String in
+            let topLevelDomain = SyntheticFilterList.topLevelDomains[generator.next(SyntheticFilterList.topLevelDomains.count)]
+            return "\"*site\(generator.next(50_000)).\(topLevelDomain)\""
+        }
+        return "[" + domains.joined(separator: ", ") + "]"
+    }
+
+    private func hidingRule(_ selector: String,
+                            domains: String?) -> String {
+        var trigger = "\"url-filter\": \"^https?://\""
+        if let domains = domains {
+            trigger += ", \"if-domain\": \(domains)"
+        }
+        return "{\"trigger\": {\(trigger)}, \"action\": {\"type\": \"css-display-none\", \"selector\": \(quoted(selector))}}"
+    }
+
+    private func blockingRule(_ trigger: String) -> String {
+        return "{\"trigger\": {\(trigger)}, \"action\": {\"type\": \"block\"}}"
+    }
+
+    /// JSON string of a selector or regular expression, which contain no control characters.
+    private func quoted(_ string: String) -> String {
+        return "\"" + string.replacingOccurrences(of: "\\", with: "\\\\").replacingOccurrences(of: "\"", with: "\\\"") + "\""
+    }
+}
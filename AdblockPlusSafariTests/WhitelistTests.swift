@@ -0,0 +1,126 @@
+/*
+ * This file is part of Adblock Plus <https://adblockplus.org/>,
+ * Copyright (C) 2006-present eyeo GmbH
+ *
+ * Adblock Plus is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * Adblock Plus is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Adblock Plus.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+@testable import AdblockPlusSafari
+import RxSwift
+import XCTest
+
+/// Test the whitelist index and bulk whitelisting.
+class WhitelistTests: XCTestCase {
+    var abpManager: ABPManager!
+    var savedWebsites = [String]()
+    var bag: DisposeBag!
+
+    override func setUp() {
+        super.setUp()
+        abpManager = ABPManager.sharedInstance()
+        savedWebsites = abpManager.adblockPlus.whitelistedWebsites
+        bag = DisposeBag()
+    }
+
+    override func tearDown() {
+        bag = nil
+        abpManager.adblockPlus.whitelistedWebsites = savedWebsites
+        super.tearDown()
+    }
+
+    /// * Test that subdomains of a member are covered and redundant hostnames are rejected.
+    /// * Test that adding a parent domain removes the members below it.
+    func testCoverage() {
+        var set = WhitelistedHostnameSet(["ads.example.com", "example.org", "ads.example.com"])
+        XCTAssert(set.hostnames == ["ads.example.com", "example.org"], "Duplicates were kept")
+        XCTAssert(set.covers("ads.example.com") && set.covers("a.b.ads.example.com"), "Subdomain is not covered")
+        XCTAssert(!set.covers("example.com") && !set.covers("badexample.org"), "Unrelated hostname is covered")
+        XCTAssert(set.coveringHostname(for: "www.example.org") == "example.org", "Covering hostname is wrong")
+
+        XCTAssert(!set.insert("cdn.example.org"), "Covered hostname was added")
+        XCTAssert(set.insert("example.com"), "Parent domain was not added")
+        XCTAssert(set.hostnames == ["example.org", "example.com"], "Members below the parent domain were kept")
+        XCTAssert(set.covers("ads.example.com"), "Subdomain is not covered")
+
+        // Parents are added before their subdomains whatever the order.
+        let added = set.insert(contentsOf: ["a.test", "b.a.test", "c.test", "test.net", "a.test"])
+        XCTAssert(added == ["a.test", "c.test", "test.net"], "Added hostnames are wrong: \(added)")
+
+        XCTAssert(!set.remove("ads.example.com"), "Subdomain of a member was removed")
+        XCTAssert(set.remove(contentsOf: ["example.com", "c.test"]) == ["example.com", "c.test"], "Members were not removed")
+        XCTAssert(!set.covers("ads.example.com"), "Removed member still covers its subdomains")
+        XCTAssert(set.insert("ads.example.com"), "Subdomain of a removed member was not added")
+        XCTAssert(set.count == 4, "Count is wrong")
+    }
+
+    /// Test that adding and removing many websites stores the whitelist once.
+    func testBulkWhitelisting() {
+        abpManager.adblockPlus.whitelistedWebsites = ["example.com"]
+        var changes = 0
+        abpManager.adblockPlus.rx
+            .observeWeakly(NSArray.self,
+                           ABPState.whitelistedWebsites.rawValue,
+                           options: [.new])
+            .subscribe(onNext: { _ in
+                changes += 1
+            }).disposed(by: bag)
+
+        let websites = hostnames(count: 1000) + ["https://www.ads.example.com/page", "host1.test"]
+        let added = abpManager.whiteList(websites: websites)
+        XCTAssert(added.count == 1000, "Added count is wrong: \(added.count)")
+        XCTAssert(changes == 1, "Whitelist was stored \(changes) times")
+        XCTAssert(abpManager.isWhitelisted(website: "http://cdn.host1.test/"), "Subdomain is not whitelisted")
+        XCTAssert(abpManager.isWhitelisted(website: "ads.example.com"), "Subdomain is not whitelisted")
+
+        let removed = abpManager.removeFromWhitelist(websites: Array(websites.prefix(500)))
+        XCTAssert(removed.count == 500, "Removed count is wrong: \(removed.count)")
+        XCTAssert(changes == 2, "Whitelist was stored \(changes) times")
+        XCTAssert(abpManager.adblockPlus.whitelistedWebsites.count == 501, "Whitelist is wrong")
+
+        // Hostnames are whitelisted in lower case, also those stored in mixed case before.
+        XCTAssert(abpManager.whiteList(websites: ["WWW.Example.ORG"]) == ["example.org"], "Hostname was not lowercased")
+        abpManager.adblockPlus.whitelistedWebsites = ["Example.NET"]
+        XCTAssert(abpManager.isWhitelisted(website: "ADS.example.net"), "Stored hostname was compared in mixed case")
+
+        // Changes made elsewhere are picked up.
+        abpManager.adblockPlus.whitelistedWebsites = []
+        XCTAssert(!abpManager.isWhitelisted(website: "ads.example.com"), "Stale index was used")
+    }
+
+    /// Print the cost of building the index and of coverage queries.
+    func testCoverageBenchmark() {
+        let members = hostnames(count: 20000)
+        var start = Date()
+        let set = WhitelistedHostnameSet(members)
+        let buildTime = Date().timeIntervalSince(start)
+
+        let queries = members.map { "a.b." + $0 }
+        start = Date()
+        var covered = 0
+        for query in queries where set.covers(query) {
+            covered += 1
+        }
+        let queryTime = Date().timeIntervalSince(start)
+        XCTAssert(covered == queries.count, "Subdomains are not covered")
+        print("Whitelist index: \(members.count) hosts built in \(String(format: "%.1f", buildTime * 1000)) ms, " +
+              "\(String(format: "%.2f", queryTime * 1e6 / Double(queries.count))) µs per coverage query")
+    }
+
+    // ------------------------------------------------------------
+    // MARK: - Private -
+    // ------------------------------------------------------------
+
+    private func hostnames(count: Int) -> [String] {
+        return (0..<count).map { "host\($0).test" }
+    }
+}
@@ -0,0 +1,159 @@
+/*
+ * This file is part of Adblock Plus <https://adblockplus.org/>,
+ * Copyright (C) 2006-present eyeo GmbH
+ *
+ * Adblock Plus is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * Adblock Plus is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Adblock Plus.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Runs one stage of the filter list pipeline on the given files and reports its time and memory,
+// so that the engines can be measured off the device.
+
+#include "CompiledFilterList.h"
+#include "FilterListComposer.h"
+#include "FilterListConverter.h"
+#include "FilterListMerger.h"
+#include "FilterListSharder.h"
+#include "FilterListValidator.h"
+#include "PipelineTrace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+
+static const char *usage =
+    "usage: filter-list-benchmark <command> <arguments>\n"
+    "  generate <output> <rule count>      write a synthetic v2 list\n"
+    "  merge <input> <output> [website...] merge a list with whitelisted websites\n"
+    "  compile <input> <output>            write the compiled form of a list\n"
+    "  shard <input> <output prefix> [budget]\n"
+    "  validate <input> [output]\n"
+    "  compose <output> <input>...\n"
+    "  convert <input> <output> [threads]  convert a list in filter syntax\n";
+
+static size_t fileSize(const char *path)
+{
+    struct stat status;
+    return stat(path, &status) == 0 ? (size_t)status.st_size : 0;
+}
+
+static void report(const char *command, const char *input, uint64_t start, size_t peakBytes)
+{
+    double seconds = (double)(PipelineTraceNow() - start) / 1e9;
+    size_t bytes = fileSize(input);
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    long maximumResidentKilobytes = usage.ru_maxrss / 1024;
+#else
+    long maximumResidentKilobytes = usage.ru_maxrss;
+#endif
+    printf("%s: %.1f ms, %.1f MB/s, %zu bytes parser and generator peak, %ld kB maximum resident\n",
+           command, seconds * 1000, seconds > 0 ? (double)bytes / 1e6 / seconds : 0, peakBytes, maximumResidentKilobytes);
+}
+
+static bool generate(const char *outputPath, size_t ruleCount)
+{
+    FILE *file = fopen(outputPath, "wb");
+    if (!file) {
+        perror(outputPath);
+        return false;
+    }
+    // Mostly element hiding and blocking rules with some exceptions, as in easylist.
+    fputs("{\"version\":\"201810170000\",\"expires\":\"4 days\",\"rules\":[", file);
+    for (size_t i = 0; i < ruleCount; i++) {
+        fputs(i > 0 ? "," : "", file);
+        switch (i % 10) {
+        case 0:
+            fprintf(file, "{\"trigger\":{\"url-filter\":\".*\",\"if-domain\":[\"*site%zu.test\"]},"
+                          "\"action\":{\"type\":\"ignore-previous-rules\"}}", i);
+            break;
+        case 1:
+        case 2:
+        case 3:
+            fprintf(file, "{\"trigger\":{\"url-filter\":\"^https?://([^/]+\\\\.)?adhost%zu\\\\.test[/:]\","
+                          "\"load-type\":[\"third-party\"],\"resource-type\":[\"image\",\"script\"]},"
+                          "\"action\":{\"type\":\"block\"}}", i);
+            break;
+        default:
+            fprintf(file, "{\"trigger\":{\"url-filter\":\".*\"},\"action\":{\"type\":\"css-display-none\","
+                          "\"selector\":\".ad-banner-%zu, #ad-%zu\"}}", i, i);
+            break;
+        }
+    }
+    fputs("]}\n", file);
+    return fclose(file) == 0;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 3) {
+        fputs(usage, stderr);
+        return EXIT_FAILURE;
+    }
+
+    const char *command = argv[1];
+    FilterListMergerError error = { FilterListMergerStatusOK, 0, "" };
+    uint64_t start = PipelineTraceNow();
+    bool result;
+    if (strcmp(command, "generate") == 0 && argc == 4) {
+        return generate(argv[2], strtoul(argv[3], NULL, 10)) ? EXIT_SUCCESS : EXIT_FAILURE;
+    } else if (strcmp(command, "merge") == 0 && argc >= 4) {
+        FilterListMergerResult mergerResult = { 0 };
+        result = FilterListMergerMergeFiles(argv[2], argv[3], (const char *const *)argv + 4, (size_t)(argc - 4), NULL, &mergerResult, &error);
+        report(command, argv[2], start, mergerResult.statistics.peakBytes);
+        printf("%zu rules\n", mergerResult.ruleCount);
+    } else if (strcmp(command, "compile") == 0 && argc == 4) {
+        result = CompiledFilterListCompileFile(argv[2], argv[3], &error);
+        report(command, argv[2], start, 0);
+    } else if (strcmp(command, "shard") == 0 && (argc == 4 || argc == 5)) {
+        FilterListSharderResult sharderResult = { 0 };
+        size_t budget = argc == 5 ? strtoul(argv[4], NULL, 10) : FilterListSharderDefaultRuleBudget;
+        result = FilterListSharderShardFile(argv[2], argv[3], ".json", budget, &sharderResult, &error);
+        report(command, argv[2], start, 0);
+        printf("%zu rules, %zu exceptions, %zu shards\n", sharderResult.ruleCount, sharderResult.exceptionCount, sharderResult.shardCount);
+    } else if (strcmp(command, "validate") == 0 && (argc == 3 || argc == 4)) {
+        FilterListValidatorResult validatorResult = { 0 };
+        result = FilterListValidatorValidateFile(argv[2], argc == 4 ? argv[3] : NULL, &validatorResult, &error);
+        report(command, argv[2], start, 0);
+        printf("%zu rules, %zu rejected\n", validatorResult.ruleCount, validatorResult.rejectedRuleCount);
+        for (size_t i = 0; i < validatorResult.reportedRuleCount; i++) {
+            printf("  rule %zu: %s\n", validatorResult.reportedRuleIndices[i],
+                   FilterListValidatorIssueDescription(validatorResult.reportedIssues[i]));
+        }
+    } else if (strcmp(command, "compose") == 0 && argc >= 4) {
+        FilterListComposerResult composerResult = { 0 };
+        result = FilterListComposerComposeFiles((const char *const *)argv + 3, (size_t)(argc - 3), argv[2], &composerResult, &error);
+        report(command, argv[3], start, composerResult.statistics.peakBytes);
+        printf("%zu rules read, %zu written, %zu exceptions, %zu duplicates\n", composerResult.inputRuleCount,
+               composerResult.ruleCount, composerResult.exceptionCount, composerResult.duplicateCount);
+    } else if (strcmp(command, "convert") == 0 && (argc == 4 || argc == 5)) {
+        FilterListConverterOptions options = FilterListConverterDefaultOptions;
+        options.threadCount = argc == 5 ? strtoul(argv[4], NULL, 10) : options.threadCount;
+        FilterListConverterResult converterResult = { 0 };
+        result = FilterListConverterConvertFile(argv[2], argv[3], &options, &converterResult, &error);
+        report(command, argv[2], start, 0);
+        printf("%zu lines, %zu rules, %zu exceptions, %zu hiding exceptions, %zu unsupported\n", converterResult.lineCount,
+               converterResult.ruleCount, converterResult.exceptionCount, converterResult.hidingExceptionCount,
+               converterResult.unsupportedFilterCount);
+    } else {
+        fputs(usage, stderr);
+        return EXIT_FAILURE;
+    }
+
+    if (!result) {
+        fprintf(stderr, "%s has failed: %s\n", command, error.message);
+    }
+    return result ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,856 @@
+/*
+ * This file is part of Adblock Plus <https://adblockplus.org/>,
+ * Copyright (C) 2006-present eyeo GmbH
+ *
+ * Adblock Plus is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * Adblock Plus is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Adblock Plus.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Tests of the filter list engines without Foundation, run by ctest. The XCTest cases in
+// AdblockPlusSafariTests cover the same engines through the app.
+//
+// usage: FilterListEngineTests [test ...]
+
+#include "CompiledFilterList.h"
+#include "FilterListAllocator.h"
+#include "FilterListComposer.h"
+#include "FilterListConverter.h"
+#include "FilterListDecompressor.h"
+#include "FilterListMerger.h"
+#include "FilterListSharder.h"
+#include "FilterListValidator.h"
+#include "HostnameNormalizer.h"
+
+#include <dirent.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifndef FixtureDirectory
+#define FixtureDirectory "AdblockPlusSafariTests"
+#endif
+
+static int failureCount;
+static char directory[PATH_MAX / 2];
+
+#define check(condition, ...)                                       \
+    do {                                                            \
+        if (!(condition)) {                                         \
+            fprintf(stderr, "%s:%d: failed: ", __FILE__, __LINE__); \
+            fprintf(stderr, __VA_ARGS__);                           \
+            fputc('\n', stderr);                                    \
+            failureCount++;                                         \
+        }                                                           \
+    } while (0)
+
+#pragma mark - Files
+
+static const char *pathForName(char path[PATH_MAX], const char *name)
+{
+    snprintf(path, PATH_MAX, "%s/%s", directory, name);
+    return path;
+}
+
+static bool writeFile(const char *path, const char *text)
+{
+    FILE *file = fopen(path, "wb");
+    if (!file) {
+        return false;
+    }
+    bool result = fwrite(text, 1, strlen(text), file) == strlen(text);
+    return fclose(file) == 0 && result;
+}
+
+/// Returns the NUL terminated contents of the file, to be freed by the caller, or NULL.
+static char *readFile(const char *path, size_t *length)
+{
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        return NULL;
+    }
+    size_t capacity = 4096;
+    size_t used = 0;
+    char *bytes = malloc(capacity);
+    size_t count;
+    while (bytes && (count = fread(bytes + used, 1, capacity - used - 1, file)) > 0) {
+        used += count;
+        if (capacity - used == 1) {
+            capacity *= 2;
+            char *grown = realloc(bytes, capacity);
+            if (!grown) {
+                free(bytes);
+            }
+            bytes = grown;
+        }
+    }
+    fclose(file);
+    if (bytes) {
+        bytes[used] = 0;
+    }
+    if (length) {
+        *length = used;
+    }
+    return bytes;
+}
+
+static bool fileExists(const char *path)
+{
+    return access(path, F_OK) == 0;
+}
+
+/// Removes whitespace outside of strings, so that reformatted lists can be compared.
+static void removeWhitespace(char *json)
+{
+    bool inString = false;
+    char *output = json;
+    for (const char *input = json; *input; input++) {
+        if (inString) {
+            if (*input == '\\' && input[1]) {
+                *output++ = *input++;
+            } else if (*input == '"') {
+                inString = false;
+            }
+        } else if (*input == '"') {
+            inString = true;
+        } else if (strchr(" \t\r\n", *input)) {
+            continue;
+        }
+        *output++ = *input;
+    }
+    *output = 0;
+}
+
+/// Counts the rules of a list with the validator, which accepts v1 and v2 lists.
+static size_t ruleCountOfFile(const char *path)
+{
+    FilterListValidatorResult result;
+    FilterListMergerError error;
+    return FilterListValidatorValidateFile(path, NULL, &result, &error) ? result.ruleCount : SIZE_MAX;
+}
+
+#pragma mark - Merging
+
+static bool appendToBuffer(void *context, const uint8_t *bytes, size_t length, int *systemError)
+{
+    (void)systemError;
+    char **buffer = context;
+    size_t used = *buffer ? strlen(*buffer) : 0;
+    char *grown = realloc(*buffer, used + length + 1);
+    if (!grown) {
+        return false;
+    }
+    memcpy(grown + used, bytes, length);
+    grown[used + length] = 0;
+    *buffer = grown;
+    return true;
+}
+
+static char *mergeText(const char *text, FilterListMergerOptions options, const char *const *websites, size_t websiteCount,
+                       FilterListMergerError *error)
+{
+    char *output = NULL;
+    FilterListMerger *merger = FilterListMergerCreate(&options, appendToBuffer, &output);
+    bool result = true;
+    size_t length = strlen(text);
+    for (size_t offset = 0; offset < length && result; offset += options.inputBufferLength) {
+        size_t part = length - offset < options.inputBufferLength ? length - offset : options.inputBufferLength;
+        result = FilterListMergerParse(merger, (const uint8_t *)text + offset, part);
+    }
+    result = result && FilterListMergerFinish(merger, websites, websiteCount);
+    *error = *FilterListMergerGetError(merger);
+    FilterListMergerFree(merger);
+    if (!result) {
+        free(output);
+        return NULL;
+    }
+    return output;
+}
+
+static void testMerger(void)
+{
+    char *list = readFile(FixtureDirectory "/easylist_content_blocker_v2_short.json", NULL);
+    check(list, "Filter list is missing");
+    if (!list) {
+        return;
+    }
+
+    const char *websites[] = { "adblockplus.org", "acceptableads.org" };
+    FilterListMergerError error;
+    FilterListMergerOptions options = FilterListMergerDefaultOptions;
+    options.copyRulesVerbatim = false;
+    options.whitelistedWebsitesPerRule = 1;
+    options.inputBufferLength = strlen(list);
+    options.outputBufferLength = SIZE_MAX;
+    char *expected = mergeText(list, options, websites, 2, &error);
+    check(expected, "Merging has failed: %s", error.message);
+
+    size_t lengths[] = { 1, 7, 256, 65536 };
+    for (size_t i = 0; expected && i < sizeof(lengths) / sizeof(lengths[0]); i++) {
+        options.inputBufferLength = lengths[i];
+        options.outputBufferLength = lengths[i];
+        char *output = mergeText(list, options, websites, 2, &error);
+        check(output && strcmp(output, expected) == 0, "Output differs for buffer length %zu", lengths[i]);
+        free(output);
+    }
+    check(expected && expected[0] == '[' && strstr(expected, "#A9AdsServicesWidgetTop") &&
+              strstr(expected, "{\"trigger\":{\"url-filter\":\".*\",\"if-domain\":[\"*acceptableads.org\"]},"
+                               "\"action\":{\"type\":\"ignore-previous-rules\"}}]"),
+          "Whitelisting rule is missing: %s", expected);
+    free(expected);
+    free(list);
+
+    options = FilterListMergerDefaultOptions;
+    check(!mergeText("{\"version\": \"201512011207\"}", options, websites, 2, &error) &&
+              error.status == FilterListMergerStatusParseError,
+          "List without rules was merged");
+
+    // The whole list in one string needs more than the limit.
+    size_t tokenLength = 64 * 1024;
+    const char *prefix = "[{\"trigger\": {\"url-filter\": \"";
+    char *longToken = malloc(strlen(prefix) + tokenLength + 8);
+    strcpy(longToken, prefix);
+    memset(longToken + strlen(prefix), 'a', tokenLength);
+    strcpy(longToken + strlen(prefix) + tokenLength, "\"}}]");
+    options.copyRulesVerbatim = false;
+    options.memoryLimit = 48 * 1024;
+    char *output = mergeText(longToken, options, websites, 1, &error);
+    check(!output && error.status == FilterListMergerStatusMemoryLimitError, "Limit was not enforced");
+    free(output);
+    free(longToken);
+
+    // The limit is soft, a token that never ends is buffered by yajl until one slice exceeds it.
+    uint8_t slice[64 * 1024];
+    memset(slice, 'a', sizeof(slice));
+    size_t sliceLengths[] = { 4 * 1024, sizeof(slice) };
+    for (size_t i = 0; i < sizeof(sliceLengths) / sizeof(sliceLengths[0]); i++) {
+        output = NULL;
+        FilterListMerger *merger = FilterListMergerCreate(&options, appendToBuffer, &output);
+        bool parsed = FilterListMergerParse(merger, (const uint8_t *)prefix, strlen(prefix));
+        for (size_t fed = 0; parsed && fed < 16 * 1024 * 1024; fed += sliceLengths[i]) {
+            parsed = FilterListMergerParse(merger, slice, sliceLengths[i]);
+        }
+        FilterListAllocatorStatistics statistics = FilterListMergerGetMemoryStatistics(merger);
+        size_t bound = 2 * (options.memoryLimit + sliceLengths[i]) + FilterListAllocatorChunkLength;
+        check(!parsed && FilterListMergerGetError(merger)->status == FilterListMergerStatusMemoryLimitError,
+              "Limit was not enforced for slices of %zu bytes", sliceLengths[i]);
+        check(statistics.peakBytes > options.memoryLimit && statistics.peakBytes < bound,
+              "Peak of %zu bytes is beyond %zu bytes for slices of %zu bytes", statistics.peakBytes, bound, sliceLengths[i]);
+        FilterListMergerFree(merger);
+        free(output);
+    }
+
+    // Merging files maps or reads the input.
+    char input[PATH_MAX], merged[PATH_MAX];
+    pathForName(input, "list.json");
+    pathForName(merged, "merged.json");
+    check(writeFile(input, "[{\"trigger\":{\"url-filter\":\"ads\"},\"action\":{\"type\":\"block\"}}]"), "List was not written");
+    for (int memoryMap = 0; memoryMap < 2; memoryMap++) {
+        options = FilterListMergerDefaultOptions;
+        options.memoryMapInput = memoryMap;
+        FilterListMergerResult result;
+        check(FilterListMergerMergeFiles(input, merged, websites, 2, &options, &result, &error), "Merging has failed: %s", error.message);
+        // Both websites share one whitelisting rule.
+        check(ruleCountOfFile(merged) == 2 && result.ruleCount == 2, "Wrong number of merged rules");
+        check(result.statistics.peakBytes > 0 && !result.statistics.limitExceeded, "Statistics are wrong");
+    }
+}
+
+static void testMergerCopiesRulesVerbatim(void)
+{
+    const char *websites[] = { "adblockplus.org" };
+    const char *lists[] = {
+        "[\n  {\"trigger\": {\"url-filter\": \"a\\\"ds\", \"resource-type\": [\"image\"]},\n   \"action\": {\"type\": \"block\"}}\n]",
+        "{\"version\": \"1\", \"rules\": [{\"trigger\": {\"url-filter\": \"ads\"}, \"action\": {\"type\": \"css-display-none\", \"selector\": \"[a=\\\"b\\\"]\"}}]}",
+        "[]"
+    };
+    for (size_t i = 0; i < sizeof(lists) / sizeof(lists[0]); i++) {
+        FilterListMergerError error;
+        FilterListMergerOptions options = FilterListMergerDefaultOptions;
+        options.copyRulesVerbatim = false;
+        char *expected = mergeText(lists[i], options, websites, 1, &error);
+        check(expected, "Merging has failed: %s", error.message);
+
+        options.copyRulesVerbatim = true;
+        for (int validate = 0; expected && validate < 2; validate++) {
+            options.validateVerbatimRules = validate;
+            size_t lengths[] = { 1, 7, 65536 };
+            for (size_t j = 0; j < sizeof(lengths) / sizeof(lengths[0]); j++) {
+                options.inputBufferLength = lengths[j];
+                char *copied = mergeText(lists[i], options, websites, 1, &error);
+                check(copied, "Merging has failed: %s", error.message);
+                if (copied) {
+                    removeWhitespace(copied);
+                    check(strcmp(copied, expected) == 0, "Rules of list %zu differ for buffer length %zu", i, lengths[j]);
+                }
+                free(copied);
+            }
+        }
+        free(expected);
+    }
+
+    // Copied rules are counted as well, nested objects are not.
+    char input[PATH_MAX], merged[PATH_MAX];
+    check(writeFile(pathForName(input, "list.json"), lists[1]), "List was not written");
+    for (int validate = 0; validate < 2; validate++) {
+        FilterListMergerOptions options = FilterListMergerDefaultOptions;
+        options.validateVerbatimRules = validate;
+        FilterListMergerResult result;
+        FilterListMergerError error;
+        check(FilterListMergerMergeFiles(input, pathForName(merged, "merged.json"), websites, 1, &options, &result, &error) &&
+                  result.ruleCount == 2,
+              "Wrong number of merged rules: %zu", result.ruleCount);
+    }
+
+    // Without yajl only the nesting is checked.
+    const char *malformed[] = { "[{\"a\": 1}", "[{\"a\": 1}]]", "[] []", "\"rules\"", "{\"rules\": [\"]}" };
+    for (size_t i = 0; i < sizeof(malformed) / sizeof(malformed[0]); i++) {
+        FilterListMergerError error;
+        char *output = mergeText(malformed[i], FilterListMergerDefaultOptions, websites, 1, &error);
+        check(!output && error.status == FilterListMergerStatusParseError, "Malformed list %s was merged", malformed[i]);
+        free(output);
+    }
+}
+
+static void testCompiledFilterList(void)
+{
+    char input[PATH_MAX], compiled[PATH_MAX], fromCompiled[PATH_MAX], fromJSON[PATH_MAX];
+    pathForName(input, "list.json");
+    pathForName(compiled, "list.json." CompiledFilterListPathExtension);
+    pathForName(fromCompiled, "compiled.json");
+    pathForName(fromJSON, "json.json");
+    char *list = readFile(FixtureDirectory "/easylist_content_blocker_v2_short.json", NULL);
+    check(list && writeFile(input, list), "List was not written");
+    free(list);
+
+    FilterListMergerError error;
+    check(CompiledFilterListCompileFile(input, compiled, &error), "Compiling has failed: %s", error.message);
+    CompiledFilterList *compiledList = CompiledFilterListOpen(compiled, input, &error);
+    check(compiledList, "Compiled list should be current: %s", error.message);
+    if (compiledList) {
+        CompiledFilterListString version = CompiledFilterListGetVersion(compiledList);
+        check(CompiledFilterListGetRuleCount(compiledList) == 3 && CompiledFilterListGetFilterListVersion(compiledList) == 2 &&
+                  version.length == 12 && memcmp(version.bytes, "201512011207", 12) == 0,
+              "Header differs from the list");
+        CompiledFilterListClose(compiledList);
+    }
+
+    // Merging the compiled list yields the same rules as merging the JSON.
+    const char *websites[] = { "adblockplus.org" };
+    FilterListMergerOptions options = FilterListMergerDefaultOptions;
+    options.copyRulesVerbatim = false;
+    FilterListMergerResult compiledResult, jsonResult;
+    check(FilterListMergerMergeCompiledFile(compiled, input, fromCompiled, websites, 1, &options, &compiledResult, &error),
+          "Merging has failed: %s", error.message);
+    check(FilterListMergerMergeFiles(input, fromJSON, websites, 1, &options, &jsonResult, &error), "Merging has failed: %s", error.message);
+    check(compiledResult.ruleCount == 4 && jsonResult.ruleCount == 4, "Wrong number of merged rules");
+    const char *inputPaths[] = { fromJSON, fromCompiled };
+    char composed[PATH_MAX];
+    FilterListComposerResult result;
+    check(FilterListComposerComposeFiles(inputPaths, 2, pathForName(composed, "composed.json"), &result, &error) &&
+              result.ruleCount == 4 && result.duplicateCount == 4,
+          "Re-serialized rules differ");
+
+    // Replacing the JSON invalidates the compiled list.
+    check(writeFile(input, "[]"), "List was not written");
+    compiledList = CompiledFilterListOpen(compiled, input, &error);
+    check(!compiledList, "Outdated compiled list should be rejected");
+    CompiledFilterListClose(compiledList);
+    check(!FilterListMergerMergeCompiledFile(compiled, input, fromCompiled, websites, 1, NULL, NULL, &error),
+          "Outdated compiled list should not be merged");
+}
+
+#pragma mark - Sharding
+
+static void testSharder(void)
+{
+    // 12 blocking rules, exceptions after the 1st, 8th and 12th.
+    char list[4096] = "[";
+    for (size_t i = 0; i < 12; i++) {
+        char rule[256];
+        snprintf(rule, sizeof(rule), "%s{\"trigger\":{\"url-filter\":\"ads%zu\"},\"action\":{\"type\":\"block\"}}", i > 0 ? "," : "", i);
+        strcat(list, rule);
+        if (i == 0 || i == 7 || i == 11) {
+            snprintf(rule, sizeof(rule), ",{\"trigger\":{\"url-filter\":\".*\",\"if-domain\":[\"*site%zu.org\"]},"
+                                         "\"action\":{\"type\":\"ignore-previous-rules\"}}", i);
+            strcat(list, rule);
+        }
+    }
+    strcat(list, "]");
+
+    // The prefix is used literally, it is no format.
+    char input[PATH_MAX], prefix[PATH_MAX];
+    const char *suffix = ".json";
+    pathForName(input, "list.json");
+    pathForName(prefix, "shard%s-");
+    check(writeFile(input, list), "List was not written");
+
+    FilterListSharderResult result;
+    FilterListMergerError error;
+    check(FilterListSharderShardFile(input, prefix, suffix, 6, &result, &error), "Sharding has failed: %s", error.message);
+    check(result.ruleCount == 15 && result.exceptionCount == 3 && result.shardCount > 1, "Wrong rule counts");
+
+    size_t blockingCount = 0;
+    for (size_t i = 0; i < result.shardCount; i++) {
+        char path[PATH_MAX + 32];
+        snprintf(path, sizeof(path), "%s%zu%s", prefix, i, suffix);
+        char *shard = readFile(path, NULL);
+        size_t ruleCount = ruleCountOfFile(path);
+        check(shard && ruleCount > 0 && ruleCount <= 6, "Shard %zu exceeds the budget", i);
+
+        // Every exception following a blocking rule of the shard has to be part of it.
+        size_t first = SIZE_MAX;
+        for (size_t j = 0; shard && j < 12; j++) {
+            char filter[32];
+            snprintf(filter, sizeof(filter), "\"ads%zu\"", j);
+            if (strstr(shard, filter)) {
+                first = first < j ? first : j;
+                blockingCount++;
+            }
+        }
+        size_t exceptions[] = { 0, 7, 11 };
+        for (size_t j = 0; shard && j < 3; j++) {
+            char domain[32];
+            snprintf(domain, sizeof(domain), "\"*site%zu.org\"", exceptions[j]);
+            check((strstr(shard, domain) != NULL) == (exceptions[j] >= first), "Shard %zu has the wrong exceptions", i);
+        }
+        free(shard);
+    }
+    check(blockingCount == 12, "Blocking rules are lost or duplicated");
+
+    char first[PATH_MAX + 32];
+    snprintf(first, sizeof(first), "%s0%s", prefix, suffix);
+    char *shard = readFile(first, NULL);
+    check(FilterListSharderShardFile(input, prefix, suffix, 100, &result, &error) && result.shardCount == 1, "Small lists are not sharded");
+    check(!FilterListSharderShardFile(input, prefix, suffix, 3, &result, &error), "Exceptions do not fit");
+
+    // Failed sharding keeps the shards written before and leaves no temporary files behind.
+    char *kept = readFile(first, NULL);
+    check(shard && kept && strcmp(shard, kept) == 0, "Shards were replaced by a failed sharding");
+    free(shard);
+    free(kept);
+    DIR *entries = opendir(directory);
+    for (struct dirent *entry = entries ? readdir(entries) : NULL; entry; entry = readdir(entries)) {
+        const char *extension = strrchr(entry->d_name, '.');
+        check(entry->d_name[0] == '.' || !extension || strcmp(extension, ".json") == 0, "Temporary file %s was left behind", entry->d_name);
+    }
+    if (entries) {
+        closedir(entries);
+    }
+}
+
+#pragma mark - Validation
+
+static void testValidator(void)
+{
+    const char *list = "{\"version\":\"201512011207\",\"rules\":["
+                       "{\"trigger\":{\"url-filter\":\"^https?://([^/]+\\\\.)?ads\\\\.test[/:]\",\"load-type\":[\"third-party\"]},\"action\":{\"type\":\"block\"}},"
+                       "{\"trigger\":{\"url-filter\":\"ads|banners\"},\"action\":{\"type\":\"block\"}},"
+                       "{\"trigger\":{\"url-filter\":\".*\",\"if-domain\":[\"a.test\"],\"unless-domain\":[\"b.test\"]},\"action\":{\"type\":\"block\"}},"
+                       "{\"trigger\":{\"url-filter\":\".*\"},\"action\":{\"type\":\"css-display-none\",\"selector\":\".ad\"}},"
+                       "{\"trigger\":{\"url-filter\":\".*\"},\"action\":{\"type\":\"redirect\"}},"
+                       "{\"trigger\":{\"url-filter\":\".*\",\"if-domain\":[\"*Example.com\"]},\"action\":{\"type\":\"block\"}},"
+                       "{\"trigger\":{\"url-filter\":\".*\",\"resource-type\":[\"sound\"]},\"action\":{\"type\":\"block\"}},"
+                       "{\"action\":{\"type\":\"block\"}},"
+                       "{\"trigger\":{\"url-filter\":\".*\",\"if-domain\":[\"*trusted.test\"]},\"action\":{\"type\":\"ignore-previous-rules\"}}]}";
+    char input[PATH_MAX], output[PATH_MAX];
+    pathForName(input, "list.json");
+    pathForName(output, "validated.json");
+    check(writeFile(input, list), "List was not written");
+
+    FilterListValidatorResult result;
+    FilterListMergerError error;
+    check(FilterListValidatorValidateFile(input, output, &result, &error), "Validation has failed: %s", error.message);
+    check(result.ruleCount == 9 && result.rejectedRuleCount == 6 && result.reportedRuleCount == 6, "Wrong rule counts");
+    size_t expectedIndices[] = { 1, 2, 4, 5, 6, 7 };
+    FilterListValidatorIssue expectedIssues[] = { FilterListValidatorIssueUnsupportedURLFilter, FilterListValidatorIssueConflictingConditions,
+                                                  FilterListValidatorIssueUnknownActionType, FilterListValidatorIssueInvalidDomain,
+                                                  FilterListValidatorIssueInvalidResourceType, FilterListValidatorIssueMissingTrigger };
+    for (size_t i = 0; i < result.reportedRuleCount && i < 6; i++) {
+        check(result.reportedRuleIndices[i] == expectedIndices[i] && result.reportedIssues[i] == expectedIssues[i],
+              "Rule %zu was rejected for %s", result.reportedRuleIndices[i], FilterListValidatorIssueDescription(result.reportedIssues[i]));
+    }
+
+    char *validated = readFile(output, NULL);
+    check(validated && ruleCountOfFile(output) == 3 && strstr(validated, "\"version\":\"201512011207\"") &&
+              strstr(validated, "\".ad\"") && strstr(validated, "*trusted.test") && !strstr(validated, "redirect"),
+          "Valid rules or header were not kept");
+    free(validated);
+
+    // Lists without rejected rules are not written again.
+    check(rename(output, input) == 0, "List was not moved");
+    check(FilterListValidatorValidateFile(input, output, &result, &error) && result.rejectedRuleCount == 0 && !fileExists(output),
+          "Valid list was written");
+}
+
+#pragma mark - Composing
+
+static void testComposer(void)
+{
+    char first[PATH_MAX], second[PATH_MAX], output[PATH_MAX];
+    pathForName(first, "first.json");
+    pathForName(second, "second.json");
+    pathForName(output, "composed.json");
+    check(writeFile(first, "[{\"trigger\":{\"url-filter\":\"ads\",\"resource-type\":[\"image\",\"script\"]},\"action\":{\"type\":\"block\"}},"
+                           "{\"trigger\":{\"url-filter\":\".*\",\"if-domain\":[\"*site1.org\"]},\"action\":{\"type\":\"ignore-previous-rules\"}},"
+                           "{\"trigger\":{\"url-filter\":\"banner\"},\"action\":{\"type\":\"block\"}}]"),
+          "List was not written");
+    // The duplicate of the first rule differs in the order of keys and in escaping.
+    check(writeFile(second, "{\"version\":\"201810170000\",\"rules\":["
+                            "{\"trigger\":{\"url-filter\":\"tracker\"},\"action\":{\"type\":\"block\"}},"
+                            "{\"trigger\":{\"url-filter\":\".*\",\"if-domain\":[\"*site2.org\"]},\"action\":{\"type\":\"ignore-previous-rules\"}},"
+                            "{\"action\":{\"type\":\"ignore-previous-rules\"},\"trigger\":{\"if-domain\":[\"*site1.org\"],\"url-filter\":\".*\"}},"
+                            "{\"action\":{\"type\":\"block\"},\"trigger\":{\"resource-type\":[\"image\",\"script\"],\"url-filter\":\"\\u0061ds\"}}]}"),
+          "List was not written");
+
+    const char *inputPaths[] = { first, second };
+    FilterListComposerResult result;
+    FilterListMergerError error;
+    check(FilterListComposerComposeFiles(inputPaths, 2, output, &result, &error), "Composing has failed: %s", error.message);
+    check(result.inputRuleCount == 7 && result.ruleCount == 5 && result.exceptionCount == 2 && result.duplicateCount == 2, "Wrong rule counts");
+
+    char *composed = readFile(output, NULL);
+    const char *expected =
+        "{\"rules\":["
+        "{\"trigger\":{\"url-filter\":\"ads\",\"resource-type\":[\"image\",\"script\"]},\"action\":{\"type\":\"block\"}},"
+        "{\"trigger\":{\"url-filter\":\"banner\"},\"action\":{\"type\":\"block\"}},"
+        "{\"trigger\":{\"url-filter\":\"tracker\"},\"action\":{\"type\":\"block\"}},"
+        "{\"trigger\":{\"url-filter\":\".*\",\"if-domain\":[\"*site1.org\"]},\"action\":{\"type\":\"ignore-previous-rules\"}},"
+        "{\"trigger\":{\"url-filter\":\".*\",\"if-domain\":[\"*site2.org\"]},\"action\":{\"type\":\"ignore-previous-rules\"}}],"
+        "\"version\":\"201810170000\"}\n";
+    check(composed && strcmp(composed, expected) == 0, "Rules are not deduplicated or exceptions are not last: %s", composed);
+    free(composed);
+
+    // The overlay only holds what the base does not have, composing both restores the list.
+    char overlay[PATH_MAX], restored[PATH_MAX];
+    pathForName(overlay, "overlay.json");
+    pathForName(restored, "restored.json");
+    check(FilterListComposerWriteOverlay(first, second, overlay, &result, &error), "Overlay was not written: %s", error.message);
+    check(result.ruleCount == 2 && result.exceptionCount == 1 && result.duplicateCount == 2, "Overlay does not only hold the difference");
+    const char *overlayPaths[] = { first, overlay };
+    check(FilterListComposerComposeFiles(overlayPaths, 2, restored, &result, &error), "Composing has failed: %s", error.message);
+    char *restoredList = readFile(restored, NULL);
+    check(restoredList && strcmp(restoredList, expected) == 0, "Base and overlay do not compose to the list");
+    free(restoredList);
+
+    // Compiled base and overlay merge to the rules of the composed list, in the same order.
+    char firstCompiled[PATH_MAX], overlayCompiled[PATH_MAX], fromCompiled[PATH_MAX], fromJSON[PATH_MAX];
+    pathForName(firstCompiled, "first.json." CompiledFilterListPathExtension);
+    pathForName(overlayCompiled, "overlay.json." CompiledFilterListPathExtension);
+    pathForName(fromCompiled, "compiled.json");
+    pathForName(fromJSON, "json.json");
+    check(CompiledFilterListCompileFile(first, firstCompiled, &error) && CompiledFilterListCompileFile(overlay, overlayCompiled, &error),
+          "Compiling has failed: %s", error.message);
+    const char *compiledPaths[] = { firstCompiled, overlayCompiled };
+    FilterListMergerOptions options = FilterListMergerDefaultOptions;
+    options.copyRulesVerbatim = false;
+    FilterListMergerResult compiledResult, jsonResult;
+    check(FilterListMergerMergeCompiledFiles(compiledPaths, overlayPaths, 2, fromCompiled, NULL, 0, &options, &compiledResult, &error),
+          "Merging has failed: %s", error.message);
+    check(FilterListMergerMergeFiles(restored, fromJSON, NULL, 0, &options, &jsonResult, &error), "Merging has failed: %s", error.message);
+    check(compiledResult.ruleCount == 5 && jsonResult.ruleCount == 5, "Wrong number of merged rules");
+    char *compiledRules = readFile(fromCompiled, NULL);
+    char *jsonRules = readFile(fromJSON, NULL);
+    if (compiledRules && jsonRules) {
+        removeWhitespace(compiledRules);
+        removeWhitespace(jsonRules);
+    }
+    check(compiledRules && jsonRules && strcmp(compiledRules, jsonRules) == 0, "Compiled lists merge differently: %s", compiledRules);
+    free(compiledRules);
+    free(jsonRules);
+
+    // An outdated overlay is not merged from its compiled form.
+    check(writeFile(overlay, "[]") && !FilterListMergerMergeCompiledFiles(compiledPaths, overlayPaths, 2, fromCompiled, NULL, 0, NULL, NULL, &error),
+          "Outdated compiled overlay should not be merged");
+
+    check(writeFile(second, "[1]") && !FilterListComposerComposeFiles(inputPaths, 2, output, &result, &error) &&
+              error.status == FilterListMergerStatusParseError && !fileExists(output),
+          "List with a scalar rule was composed");
+}
+
+#pragma mark - Conversion
+
+static void testConverter(void)
+{
+    const char *text = "[Adblock Plus 2.0]\n"
+                       "! Version: 201810170000\n"
+                       "! Expires: 4 days (update frequency)\n"
+                       "\n"
+                       "##.ad-banner\n"
+                       "Example.com,other.test##div[id=\"ad\"]\n"
+                       "@@||ads.test/allowed/*$image\n"
+                       "||ads.test^\n"
+                       "||tracker.test^$third-party,script,domain=~b.test\n"
+                       "/banner/*/ad.gif|\r\n"
+                       "@@||trusted.test^$document\n"
+                       "example.com#@#.ad-banner\n"
+                       "/^regex$/\n"
+                       "||ads.test^$csp=script-src 'none'\n"
+                       "a.test,b.test##.sponsor\n"
+                       "b.test#@#.sponsor\n"
+                       "##.lifted\n"
+                       "#@#.lifted\n"
+                       "@@||news.test^$elemhide\n"
+                       "@@||shop.test^$generichide\n"
+                       "~c.test#@#.ad-banner\n";
+    char input[PATH_MAX], output[PATH_MAX];
+    pathForName(input, "list.txt");
+    pathForName(output, "converted.json");
+    check(writeFile(input, text), "List was not written");
+
+    FilterListConverterResult result;
+    FilterListMergerError error;
+    check(FilterListConverterIsFilterText(input), "List was not recognized");
+    check(FilterListConverterConvertFile(input, output, NULL, &result, &error), "Conversion has failed: %s", error.message);
+    check(result.ruleCount == 10 && result.exceptionCount == 4 && result.hidingExceptionCount == 3 && result.unsupportedFilterCount == 3,
+          "Wrong rule counts");
+
+    char *converted = readFile(output, NULL);
+    check(converted && strstr(converted, "\"version\":\"201810170000\"") && strstr(converted, "\"expires\":\"4 days (update frequency)\""),
+          "Header was not kept");
+    check(converted && strstr(converted, "\"if-domain\":[\"*example.com\",\"*other.test\"]") &&
+              strstr(converted, "\"url-filter\":\"/banner/.*/ad\\\\.gif$\""),
+          "Rules were not converted: %s", converted);
+
+    // Hiding exceptions are folded into the rules of their selector.
+    check(converted && strstr(converted, "\"unless-domain\":[\"*example.com\"]},\"action\":{\"type\":\"css-display-none\",\"selector\":\".ad-banner\"") &&
+              strstr(converted, "\"if-domain\":[\"*a.test\"]},\"action\":{\"type\":\"css-display-none\",\"selector\":\".sponsor\"") &&
+              !strstr(converted, ".lifted"),
+          "Hiding exceptions were not folded: %s", converted);
+
+    // Page exceptions for element hiding only follow the hiding rules they lift.
+    const char *genericHiding = converted ? strstr(converted, ".ad-banner") : NULL;
+    const char *generichide = converted ? strstr(converted, "*shop.test") : NULL;
+    const char *hiding = converted ? strstr(converted, ".sponsor") : NULL;
+    const char *elemhide = converted ? strstr(converted, "*news.test") : NULL;
+    const char *blocking = converted ? strstr(converted, "\"type\":\"block\"") : NULL;
+    const char *document = converted ? strstr(converted, "*trusted.test") : NULL;
+    check(genericHiding && generichide && hiding && elemhide && blocking && document && genericHiding < generichide &&
+              generichide < hiding && hiding < elemhide && elemhide < blocking && blocking < document,
+          "Sections are not in order: %s", converted);
+    free(converted);
+
+    // WebKit accepts all converted rules.
+    FilterListValidatorResult validatorResult;
+    check(FilterListValidatorValidateFile(output, NULL, &validatorResult, &error) && validatorResult.ruleCount == 10 &&
+              validatorResult.rejectedRuleCount == 0,
+          "Converted rules are not valid");
+
+    // The output does not depend on the number of threads.
+    char list[PATH_MAX];
+    pathForName(list, "large.txt");
+    FILE *file = fopen(list, "wb");
+    check(file, "List was not written");
+    if (!file) {
+        return;
+    }
+    fputs("[Adblock Plus 2.0]\n", file);
+    for (size_t i = 0; i < 20000; i++) {
+        fprintf(file, i % 10 == 0 ? "@@||host%zu.test^$script\n" : (i % 2 ? "##.ad-%zu\n" : "||host%zu.test^$third-party\n"), i);
+    }
+    // An exception in the last batch lifts a rule of the first.
+    fputs("host.test#@#.ad-1\n", file);
+    fclose(file);
+    char *expected = NULL;
+    for (size_t threadCount = 1; threadCount <= 8; threadCount *= 2) {
+        FilterListConverterOptions options = { 64 * 1024, threadCount };
+        check(FilterListConverterConvertFile(list, output, &options, &result, &error), "Conversion has failed: %s", error.message);
+        check(result.ruleCount == 20000 && result.exceptionCount == 2000 && result.hidingExceptionCount == 1, "Wrong rule counts");
+        char *bytes = readFile(output, NULL);
+        check(bytes && strstr(bytes, "\"unless-domain\":[\"*host.test\"]},\"action\":{\"type\":\"css-display-none\",\"selector\":\".ad-1\""),
+              "Hiding exception was not folded");
+        check(bytes && (!expected || strcmp(bytes, expected) == 0), "Output of %zu threads differs", threadCount);
+        if (expected) {
+            free(bytes);
+        } else {
+            expected = bytes;
+        }
+    }
+    free(expected);
+}
+
+static void testDecompressor(void)
+{
+    const char *compressed = FixtureDirectory "/easylist_content_blocker_v2_short.json.gz";
+    const char *original = FixtureDirectory "/easylist_content_blocker_v2_short.json";
+    char output[PATH_MAX];
+    pathForName(output, "inflated.json");
+
+    FilterListMergerError error;
+    check(FilterListDecompressorIsCompressed(compressed) && !FilterListDecompressorIsCompressed(original), "Compression was not detected");
+    check(FilterListDecompressorInflateFile(compressed, output, &error), "Inflating has failed: %s", error.message);
+    size_t inflatedLength, originalLength;
+    char *inflated = readFile(output, &inflatedLength);
+    char *expected = readFile(original, &originalLength);
+    check(inflated && expected && inflatedLength == originalLength && memcmp(inflated, expected, originalLength) == 0,
+          "Inflated list differs");
+    free(inflated);
+    free(expected);
+
+    check(!FilterListDecompressorInflateFile(original, output, &error), "Uncompressed list was inflated");
+}
+
+#pragma mark - Hostnames
+
+static void testHostnameNormalizer(void)
+{
+    char *corpus = readFile(FixtureDirectory "/hostnames.txt", NULL);
+    check(corpus, "Corpus is missing");
+    size_t pairCount = 0;
+    char *line = corpus;
+    while (line && *line) {
+        char *end = strchr(line, '\n');
+        if (end) {
+            *end = 0;
+        }
+        char *tab = strchr(line, '\t');
+        if (*line && *line != '#') {
+            check(tab, "Corpus line is malformed: %s", line);
+        }
+        if (*line && *line != '#' && tab) {
+            char output[256];
+            *tab = 0;
+            size_t length = HostnameNormalizerNormalize(line, strlen(line), output, sizeof(output));
+            check(length == strlen(tab + 1) && strcmp(output, tab + 1) == 0, "%s was normalized to %s instead of %s", line, output, tab + 1);
+            pairCount++;
+        }
+        line = end ? end + 1 : NULL;
+    }
+    check(pairCount > 0, "Corpus is empty");
+    free(corpus);
+
+    // Labels longer than the label buffer are written directly, also in lower case.
+    char upper[HostnameNormalizerMaxLabelLength + 9], lower[HostnameNormalizerMaxLabelLength + 9], normalized[128];
+    memset(upper, 'A', HostnameNormalizerMaxLabelLength + 4);
+    strcpy(upper + HostnameNormalizerMaxLabelLength + 4, ".COM");
+    for (size_t i = 0; i < sizeof(upper); i++) {
+        lower[i] = upper[i] >= 'A' && upper[i] <= 'Z' ? (char)(upper[i] + 'a' - 'A') : upper[i];
+    }
+    HostnameNormalizerNormalize(upper, strlen(upper), normalized, sizeof(normalized));
+    check(strcmp(normalized, lower) == 0, "Long label was not lowercased: %s", normalized);
+
+    // Truncated like snprintf.
+    char output[8];
+    check(HostnameNormalizerNormalize("www.example.com", 15, output, sizeof(output)) == 11 && strcmp(output, "example") == 0,
+          "Result was not truncated");
+    char escaped[64];
+    const char *special = "[|(){^$*+?.<>[]";
+    check(HostnameNormalizerEscape("a.b.c.d", 7, escaped, sizeof(escaped)) == 10 && strcmp(escaped, "a\\.b\\.c\\.d") == 0,
+          "Hostname is not escaped");
+    check(HostnameNormalizerEscape(special, strlen(special), escaped, sizeof(escaped)) == 2 * strlen(special),
+          "Special characters are not escaped");
+}
+
+#pragma mark - Allocation
+
+static void testAllocator(void)
+{
+    FilterListAllocator *allocator = FilterListAllocatorCreate(64 * 1024);
+    yajl_alloc_funcs *functions = FilterListAllocatorGetFunctions(allocator);
+
+    void *blocks[100];
+    for (size_t i = 0; i < 100; i++) {
+        blocks[i] = functions->malloc(functions->ctx, 24);
+        check(blocks[i], "Allocation has failed");
+        memset(blocks[i], (int)i, 24);
+    }
+    for (size_t i = 0; i < 100; i += 2) {
+        functions->free(functions->ctx, blocks[i]);
+    }
+    for (size_t i = 0; i < 100; i += 2) {
+        blocks[i] = functions->malloc(functions->ctx, 24);
+    }
+    blocks[1] = functions->realloc(functions->ctx, blocks[1], 4096);
+    check(blocks[1] && ((uint8_t *)blocks[1])[23] == 1, "Reallocation lost the contents");
+
+    FilterListAllocatorStatistics statistics = FilterListAllocatorGetStatistics(allocator);
+    check(statistics.allocationCount == 150 && statistics.freeCount == 50 && statistics.reallocationCount == 1, "Calls were not counted");
+    check(statistics.reusedBlockCount == 50, "Freed blocks were not reused: %zu", statistics.reusedBlockCount);
+    check(statistics.currentBytes > 0 && statistics.currentBytes <= statistics.peakBytes && !statistics.limitExceeded,
+          "Statistics are wrong");
+
+    void *large = functions->malloc(functions->ctx, 128 * 1024);
+    check(large && FilterListAllocatorIsLimitExceeded(allocator), "Limit was not reported");
+
+    // Like yajl, free the blocks allocated individually, pooled blocks are freed with the allocator.
+    functions->free(functions->ctx, large);
+    functions->free(functions->ctx, blocks[1]);
+    FilterListAllocatorFree(allocator);
+}
+
+#pragma mark -
+
+typedef struct
+{
+    const char *name;
+    void (*function)(void);
+} Test;
+
+static const Test tests[] = {
+    { "Allocator", testAllocator },
+    { "Merger", testMerger },
+    { "MergerCopiesRulesVerbatim", testMergerCopiesRulesVerbatim },
+    { "CompiledFilterList", testCompiledFilterList },
+    { "Sharder", testSharder },
+    { "Validator", testValidator },
+    { "Composer", testComposer },
+    { "Converter", testConverter },
+    { "Decompressor", testDecompressor },
+    { "HostnameNormalizer", testHostnameNormalizer }
+};
+
+static bool runTest(const Test *test)
+{
+    const char *temporary = getenv("TMPDIR");
+    snprintf(directory, sizeof(directory), "%s/FilterListEngineTests.XXXXXX", temporary && *temporary ? temporary : "/tmp");
+    if (!mkdtemp(directory)) {
+        fprintf(stderr, "%s: temporary directory was not created\n", test->name);
+        return false;
+    }
+
+    int failuresBefore = failureCount;
+    test->function();
+    printf("%s: %s\n", test->name, failureCount == failuresBefore ? "passed" : "failed");
+
+    char command[PATH_MAX + 16];
+    snprintf(command, sizeof(command), "rm -rf '%s'", directory);
+    if (system(command) != 0) {
+        fprintf(stderr, "%s was not removed\n", directory);
+    }
+    return failureCount == failuresBefore;
+}
+
+int main(int argc, char **argv)
+{
+    size_t testCount = sizeof(tests) / sizeof(tests[0]);
+    bool result = true;
+    if (argc < 2) {
+        for (size_t i = 0; i < testCount; i++) {
+            result = runTest(&tests[i]) && result;
+        }
+        return result ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    for (int i = 1; i < argc; i++) {
+        size_t j = 0;
+        while (j < testCount && strcmp(tests[j].name, argv[i]) != 0) {
+            j++;
+        }
+        if (j == testCount) {
+            fprintf(stderr, "Unknown test %s\n", argv[i]);
+            return EXIT_FAILURE;
+        }
+        result = runTest(&tests[j]) && result;
+    }
+    return result ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,119 @@
+/*
+ * This file is part of Adblock Plus <https://adblockplus.org/>,
+ * Copyright (C) 2006-present eyeo GmbH
+ *
+ * Adblock Plus is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * Adblock Plus is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Adblock Plus.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+@testable import libadblockplus_ios
+import XCTest
+
+class ContentBlockerRuleEvaluatorTests: XCTestCase {
+    /// Test the actions applying to requests, including exceptions and trigger conditions.
+    func testEvaluation() {
+        let rules = [
+            "{\"trigger\": {\"url-filter\": \"^https?://\"}, \"action\": {\"type\": \"css-display-none\", \"selector\": \".ad\"}}",
+            "{\"trigger\": {\"url-filter\": \"/banner[0-9]+\\\\.gif\"}, \"action\": {\"type\": \"block\"}}",
+            "{\"trigger\": {\"url-filter\": \"tracker\", \"load-type\": [\"third-party\"], \"resource-type\": [\"script\"]}, " +
+                "\"action\": {\"type\": \"block\"}}",
+            "{\"trigger\": {\"url-filter\": \"CaseOnly\", \"url-filter-is-case-sensitive\": true}, \"action\": {\"type\": \"block-cookies\"}}",
+            "{\"trigger\": {\"url-filter\": \".*\", \"if-domain\": [\"*trusted.test\"]}, \"action\": {\"type\": \"ignore-previous-rules\"}}",
+            "{\"trigger\": {\"url-filter\": \"ads|banners\"}, \"action\": {\"type\": \"block\"}}",
+            "{\"trigger\": {\"url-filter\": \"a{2}\"}, \"action\": {\"type\": \"block\"}}",
+            "{\"trigger\": {\"url-filter\": \"\\\\d+\"}, \"action\": {\"type\": \"block\"}}",
+            "{\"trigger\": {\"url-filter\": \".*\", \"if-domain\": [\"a.test\"], \"unless-domain\": [\"b.test\"]}, " +
+                "\"action\": {\"type\": \"block\"}}",
+            "{\"trigger\": {\"url-filter\": \"x\"}, \"action\": {\"type\": \"redirect\"}}"
+        ]
+        guard let evaluator = try? ContentBlockerRuleEvaluator(data: Data(("[" + rules.joined(separator: ",") + "]").utf8)) else {
+            XCTFail("Rules could not be read")
+            return
+        }
+        XCTAssert(evaluator.ruleCount == rules.count, "Rule count is wrong")
+        XCTAssert(evaluator.invalidRuleIndices == [5, 6, 7, 8, 9], "Invalid rules are wrong: \(evaluator.invalidRuleIndices)")
+
+        func action(_ url: String,
+                    _ documentHost: String,
+                    _ resourceType: String) -> String {
+            return evaluator.evaluate(ContentBlockerRequest(url: url,
+                                                            documentHost: documentHost,
+                                                            resourceType: resourceType)).actionType
+        }
+        XCTAssert(action("https://news.test/img/BANNER12.gif", "news.test", "image") == "block", "Banner was not blocked")
+        XCTAssert(action("https://news.test/img/banner.gif", "news.test", "image") == "css-display-none", "Banner without number was blocked")
+        XCTAssert(action("https://cdn.tracker.test/t.js", "news.test", "script") == "block", "Third-party script was not blocked")
+        XCTAssert(action("https://cdn.tracker.test/t.js", "cdn.tracker.test", "script") != "block", "First-party script was blocked")
+        XCTAssert(action("https://cdn.tracker.test/t.png", "news.test", "image") != "block", "Image was blocked by a script rule")
+        XCTAssert(action("https://news.test/CaseOnly", "news.test", "raw") == "block-cookies", "Case sensitive rule did not match")
+        XCTAssert(action("https://news.test/caseonly", "news.test", "raw") == "css-display-none", "Case sensitive rule matched")
+        XCTAssert(action("https://news.test/banner1.gif", "www.trusted.test", "image") == "none", "Exception did not apply")
+
+        let evaluation = evaluator.evaluate(ContentBlockerRequest(url: "https://news.test/banner1.gif",
+                                                                  documentHost: "news.test",
+                                                                  resourceType: "image"))
+        XCTAssert(evaluation.ruleIndices == [0, 1] && evaluation.hiddenSelectors == [".ad"], "Matched rules are wrong")
+    }
+
+    /// Test the short v2 list with a request corpus.
+    func testCorpusEvaluation() {
+        let testingBundle = Bundle(for: type(of: self))
+        guard let path = testingBundle.path(forResource: "v2 easylist short",
+                                            ofType: "json"),
+            let evaluator = try? ContentBlockerRuleEvaluator(url: URL(fileURLWithPath: path))
+        else {
+            XCTFail("V2 filter list missing")
+            return
+        }
+        let corpus = [
+            "https://nosvideo.com/watch\tputlocker.is\tpopup",
+            "https://nosvideo.com/watch\tputlocker.is\timage",
+            "https://sharesix.com/\twww.putlocker.is\tpopup",
+            "ftp://example.com/\texample.com\tdocument"
+        ]
+        let requests = corpus.compactMap { ContentBlockerRequest(line: $0) }
+        XCTAssert(requests.count == corpus.count, "Corpus lines were not parsed")
+        let report = evaluator.evaluate(requests)
+        XCTAssert(report.evaluations.map { $0.actionType } == ["none", "css-display-none", "none", "none"],
+                  "Actions are wrong: \(report.evaluations.map { $0.actionType })")
+        XCTAssert(report.actionCounts["none"] == 3, "Action counts are wrong")
+    }
+
+    /// Print the throughput with thousands of blocking rules.
+    func testEvaluationBenchmark() {
+        let ruleCount = 5000
+        var rules = [String]()
+        for index in 0..<ruleCount {
+            rules.append("{\"trigger\": {\"url-filter\": \"^https?://([^/]+\\\\.)?adhost\(index)\\\\.test/\"}, \"action\": {\"type\": \"block\"}}")
+        }
+        rules.append("{\"trigger\": {\"url-filter\": \".*\", \"if-domain\": [\"*trusted.test\"]}, \"action\": {\"type\": \"ignore-previous-rules\"}}")
+        guard let evaluator = try? ContentBlockerRuleEvaluator(data: Data(("[" + rules.joined(separator: ",") + "]").utf8)) else {
+            XCTFail("Rules could not be read")
+            return
+        }
+        var requests = [ContentBlockerRequest]()
+        for index in 0..<2000 {
+            let host = index % 4 == 0 ? "cdn.adhost\(index).test" : "static\(index).example.test"
+            requests.append(ContentBlockerRequest(url: "https://\(host)/path/\(index).js",
+                                                  documentHost: index % 8 == 0 ? "www.trusted.test" : "news.test",
+                                                  resourceType: "script"))
+        }
+        let report = evaluator.evaluate(requests)
+        XCTAssert(report.actionCounts["block"] == 250, "Blocked count is wrong: \(report.actionCounts)")
+        evaluator.usesLiteralIndex = false
+        let scanReport = evaluator.evaluate(requests)
+        XCTAssert(scanReport.actionCounts == report.actionCounts, "Results without literal index differ")
+        print("Rule evaluation: \(ruleCount) rules, \(requests.count) requests, " +
+              "\(Int(report.requestsPerSecond)) requests per second, " +
+              "\(Int(scanReport.requestsPerSecond)) without literal index")
+    }
+}
@@ -0,0 +1,113 @@
+/*
+ * This file is part of Adblock Plus <https://adblockplus.org/>,
+ * Copyright (C) 2006-present eyeo GmbH
+ *
+ * Adblock Plus is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * Adblock Plus is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Adblock Plus.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+@testable import libadblockplus_ios
+import XCTest
+
+class FilterListOptimizerTests: XCTestCase {
+    /// Test merging the hiding rules of the short v2 list.
+    func testOptimizingV2FilterList() {
+        let testingBundle = Bundle(for: type(of: self))
+        guard let path = testingBundle.path(forResource: "v2 easylist short",
+                                            ofType: "json"),
+            let data = try? Data(contentsOf: URL(fileURLWithPath: path))
+        else {
+            XCTFail("V2 filter list missing")
+            return
+        }
+        guard let optimized = optimize(data) else { return }
+        let (result, output) = optimized
+        XCTAssert(result.inputRuleCount == 7 && result.outputRuleCount == 5,
+                  "Wrong rule counts \(result)")
+        XCTAssert(result.removedRuleCount == 2, "Wrong removed rule count")
+
+        let rules = readRules(output)
+        XCTAssert(rules.first?.action?.selector == "#A9AdsMiddleBoxTop, #A9AdsOutOfStockWidgetTop, #A9AdsServicesWidgetTop",
+                  "Selectors are not merged")
+        XCTAssert(rules.dropFirst().filter { $0.action?.type == "ignore-previous-rules" }.count == 4,
+                  "Exceptions are missing")
+
+        let json = (try? JSONSerialization.jsonObject(with: output)) as? [String: Any]
+        XCTAssert(json?["version"] as? String == "201512011207", "Version is missing")
+        XCTAssert(json?["expires"] as? String == "4 days easylist", "Expires is missing")
+        XCTAssert((json?["sources"] as? [Any])?.count == 1, "Sources are missing")
+    }
+
+    /// Test that rules are not merged across ignore-previous-rules and that groups are limited.
+    func testOptimizingKeepsExceptionOrder() {
+        func hiding(_ selector: String, _ filter: String = "^https?://") -> String {
+            return "{\"trigger\": {\"url-filter\": \"\(filter)\"}, \"action\": {\"type\": \"css-display-none\", \"selector\": \"\(selector)\"}}"
+        }
+        let exception = "{\"trigger\": {\"url-filter\": \".*\", \"if-domain\": [\"*example.com\"]}, \"action\": {\"type\": \"ignore-previous-rules\"}}"
+        let block = "{\"trigger\": {\"url-filter\": \"ads\"}, \"action\": {\"type\": \"block\"}}"
+        let input = "[" + [hiding(".a"), block, hiding(".b", "^http://"), hiding(".c"), hiding(".d"),
+                           exception, hiding(".e"), hiding(".f")].joined(separator: ",") + "]"
+
+        guard let optimized = optimize(Data(input.utf8),
+                                       maximumSelectorCount: 2) else { return }
+        let (result, output) = optimized
+        let rules = readRules(output)
+        XCTAssert(result.removedRuleCount == 2, "Wrong removed rule count \(result)")
+        let summary = rules.map { $0.action?.selector ?? $0.action?.type ?? "" }
+        XCTAssert(summary == ["block", ".a, .c", ".d", ".b", "ignore-previous-rules", ".e, .f"],
+                  "Wrong rules \(summary)")
+    }
+
+    /// Test that rules with keys unknown to the model are neither merged nor changed and that
+    /// rules the model cannot decode are copied and counted.
+    func testOptimizingKeepsUnmodelledRules() {
+        let topURL = "{\"trigger\":{\"url-filter\":\".*\",\"if-top-url\":[\"example.com\"]},"
+            + "\"action\":{\"type\":\"css-display-none\",\"selector\":\".a\"}}"
+        let hiding = "{\"trigger\":{\"url-filter\":\".*\"},\"action\":{\"type\":\"css-display-none\",\"selector\":\".b\"}}"
+        let undecodable = "{\"trigger\":{\"url-filter\":\"ads\",\"resource-type\":[\"fetch\"]},\"action\":{\"type\":\"block\"}}"
+        let input = "[" + [topURL, hiding, undecodable, hiding.replacingOccurrences(of: ".b", with: ".c")].joined(separator: ",") + "]"
+
+        guard let optimized = optimize(Data(input.utf8)) else { return }
+        let (result, output) = optimized
+        let text = String(decoding: output, as: UTF8.self)
+        XCTAssert(result.inputRuleCount == 4 && result.outputRuleCount == 3 && result.undecodableRuleCount == 1,
+                  "Wrong rule counts \(result)")
+        XCTAssert(text.contains(topURL), "Rule with an unknown key was changed")
+        XCTAssert(text.contains(undecodable), "Undecodable rule was changed")
+        XCTAssert(text.contains("\".b, .c\""), "Selectors are not merged")
+    }
+
+    // ------------------------------------------------------------
+    // MARK: - Private -
+    // ------------------------------------------------------------
+
+    private func optimize(_ data: Data,
+                          maximumSelectorCount: Int = FilterListOptimizer.defaultMaximumSelectorCount)
+        -> (FilterListOptimizationResult, Data)? {
+        var output = Data()
+        let optimizer = FilterListOptimizer(maximumSelectorCount: maximumSelectorCount)
+        do {
+            let result = try optimizer.optimize(reader: FilterListRuleReader(data: data),
+                                                write: { output.append($0) })
+            return (result, output)
+        } catch let error {
+            XCTFail("Optimizing failed with error: \(error)")
+            return nil
+        }
+    }
+
+    private func readRules(_ data: Data) -> [BlockingRule] {
+        var rules = [BlockingRule]()
+        XCTAssertNoThrow(try FilterListRuleReader(data: data).forEachRule { rules.append($0) })
+        return rules
+    }
+}
@@ -0,0 +1,126 @@
+/*
+ * This file is part of Adblock Plus <https://adblockplus.org/>,
+ * Copyright (C) 2006-present eyeo GmbH
+ *
+ * Adblock Plus is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * Adblock Plus is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Adblock Plus.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+@testable import libadblockplus_ios
+import XCTest
+
+/// Test lookups and write back of the filter list registry.
+class FilterListRegistryTests: XCTestCase {
+    let timeout = 10.0
+    let benchmarkListCount = 1000
+    var stored = FilterListRegistry.LegacyFilterLists()
+    var registry: FilterListRegistry!
+
+    override func setUp() {
+        super.setUp()
+        stored = [:]
+        for index in 0..<3 {
+            stored["list\(index)"] = ["url": "https://filterlists.test/list\(index).json",
+                                      "fileName": "list\(index).json",
+                                      "taskIdentifier": index + 10]
+        }
+        registry = FilterListRegistry(source: { [unowned self] in
+            return self.stored
+        }, writeBack: { [unowned self] lists in
+            self.stored = lists
+        })
+    }
+
+    /// Test lookups by name, task identifier and source after an update.
+    func testLookups() {
+        XCTAssert(registry.filterList(named: "list1")?.source == "https://filterlists.test/list1.json", "Lookup by name failed")
+        XCTAssert(registry.filterList(forTaskIdentifier: 11)?.name == "list1", "Lookup by task identifier failed")
+        XCTAssert(registry.filterList(forSource: "https://filterlists.test/list2.json")?.name == "list2",
+                  "Lookup by source failed")
+
+        registry.update(named: "list1") { $0.taskIdentifier = 42 }
+        XCTAssert(registry.filterList(forTaskIdentifier: 11) == nil, "Old task identifier was kept")
+        XCTAssert(registry.filterList(forTaskIdentifier: 42)?.name == "list1", "New task identifier was not indexed")
+        XCTAssert(!registry.update(named: "missing", { $0.updating = true }), "Missing list was updated")
+
+        registry.remove(named: "list2")
+        XCTAssert(registry.filterList(forSource: "https://filterlists.test/list2.json") == nil, "Removed list was found")
+        XCTAssert(registry.filterLists.count == 2, "List count is wrong")
+        XCTAssert(registry.decodeCount == 1, "Lists were decoded more than once")
+    }
+
+    /// Test that changes are written back once and that external changes keep pending changes.
+    func testWriteBack() {
+        for index in 0..<10 {
+            registry.update(named: "list0") { $0.downloadCount = index }
+        }
+        XCTAssert(stored["list0"]?["downloadCount"] == nil, "Changes were written back immediately")
+        pass()
+        XCTAssert(registry.writeBackCount == 1, "Changes were not written back together")
+        XCTAssert(stored["list0"]?["downloadCount"] as? Int == 9, "Change was not written back")
+
+        registry.update(named: "list1") { $0.updating = true }
+        stored["list3"] = ["url": "https://filterlists.test/list3.json"]
+        registry.sourceDidChange()
+        XCTAssert(registry.filterList(named: "list3") != nil, "External change was not read")
+        XCTAssert(registry.filterList(named: "list1")?.updating == true, "Pending change was lost")
+        pass()
+        XCTAssert(stored["list1"]?["updating"] as? Bool == true && stored["list3"] != nil, "Written lists are wrong")
+    }
+
+    /// Compare the time of task identifier lookups through the registry with decoding and scanning
+    /// all lists, as the download delegate did. Results are printed to the test log.
+    func testLookupBenchmark() {
+        stored = [:]
+        for index in 0..<benchmarkListCount {
+            stored["list\(index)"] = ["url": "https://filterlists.test/list\(index).json",
+                                      "taskIdentifier": index]
+        }
+        registry.sourceDidChange()
+
+        let lookups = 200
+        let scanStart = Date()
+        for lookup in 0..<lookups {
+            var found: FilterListName?
+            for (name, dictionary) in stored {
+                if let list = FilterList(named: name, fromDictionary: dictionary),
+                   list.taskIdentifier == lookup {
+                    found = list.name
+                }
+            }
+            XCTAssert(found != nil, "Scan failed")
+        }
+        let scanSeconds = Date().timeIntervalSince(scanStart)
+
+        let indexedStart = Date()
+        for lookup in 0..<lookups {
+            XCTAssert(registry.filterList(forTaskIdentifier: lookup) != nil, "Lookup failed")
+        }
+        let indexedSeconds = Date().timeIntervalSince(indexedStart)
+        print("FilterListRegistry: \(benchmarkListCount) lists, \(lookups) lookups, "
+            + "scan \(scanSeconds) s, indexed \(indexedSeconds) s")
+    }
+
+    // ------------------------------------------------------------
+    // MARK: - Private -
+    // ------------------------------------------------------------
+
+    /// Let the main queue run the scheduled write back.
+    private func pass() {
+        let expect = expectation(description: "Main queue")
+        DispatchQueue.main.async {
+            expect.fulfill()
+        }
+        wait(for: [expect],
+             timeout: timeout)
+    }
+}
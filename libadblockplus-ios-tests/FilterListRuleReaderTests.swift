@@ -0,0 +1,194 @@
+/*
+ * This file is part of Adblock Plus <https://adblockplus.org/>,
+ * Copyright (C) 2006-present eyeo GmbH
+ *
+ * Adblock Plus is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * Adblock Plus is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Adblock Plus.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+@testable import libadblockplus_ios
+import XCTest
+
+class FilterListRuleReaderTests: XCTestCase {
+    /// Expected number of test rules.
+    let testingRuleCount = 7
+    /// Number of rules in the generated benchmark list.
+    let benchmarkRuleCount = 100_000
+    var v1FileURL: URL!
+    var v2FileURL: URL!
+
+    override func setUp() {
+        super.setUp()
+        let testingBundle = Bundle(for: type(of: self))
+        guard let v1path = testingBundle.path(forResource: "v1 easylist short",
+                                              ofType: "json"),
+            let v2path = testingBundle.path(forResource: "v2 easylist short",
+                                            ofType: "json")
+        else {
+            XCTFail("Filter lists missing")
+            return
+        }
+        v1FileURL = URL(fileURLWithPath: v1path)
+        v2FileURL = URL(fileURLWithPath: v2path)
+    }
+
+    /// Test that both list versions yield the rules in order, independent of the buffer size.
+    func testReadingRules() {
+        for url in [v1FileURL, v2FileURL] {
+            for bufferLength in [1, 7, 256, FilterListRuleReader.defaultBufferLength] {
+                do {
+                    let reader = try FilterListRuleReader(url: url!,
+                                                          bufferLength: bufferLength)
+                    var rules = [BlockingRule]()
+                    try reader.forEachRule { rules.append($0) }
+                    XCTAssert(rules.count == testingRuleCount,
+                              "Wrong rule count for buffer length \(bufferLength)")
+                    XCTAssert(reader.ruleCount == testingRuleCount,
+                              "Wrong reader rule count")
+                    XCTAssert(rules.first?.action?.type == "css-display-none",
+                              "Wrong first rule")
+                    XCTAssert(try reader.next() == nil,
+                              "Reader should be exhausted")
+                } catch let error {
+                    XCTFail("Reading failed with error: \(error)")
+                }
+            }
+        }
+    }
+
+    /// Test that malformed lists are rejected.
+    func testReadingInvalidLists() {
+        let inputs = ["",
+                      "{\"version\": \"1\"}",
+                      "[{\"trigger\": {\"url-filter\": \".*\"}, \"action\": {\"type\": \"block\"}}",
+                      "]"]
+        for input in inputs {
+            let reader = FilterListRuleReader(data: input.data(using: .utf8)!)
+            XCTAssertThrowsError(try reader.forEachRule { _ in },
+                                 "List should be rejected: \(input)")
+        }
+    }
+
+    /// Test that rules nested in other keys and strings containing brackets are handled.
+    func testReadingTrickyList() {
+        let input = """
+        {"sources": [{"rules": [{"a": 1}]}], "comment": "\\"rules\\": [{",
+         "rules": [{"trigger": {"url-filter": "[{\\"]"}, "action": {"type": "block"}},
+                   {"trigger": {"url-filter": "x"}},
+                   {"action": {"type": "block"}, "trigger": {"url-filter": "}]"}}]}
+        """
+        let reader = FilterListRuleReader(data: input.data(using: .utf8)!,
+                                          bufferLength: 3)
+        var filters = [String]()
+        XCTAssertNoThrow(try reader.forEachRule { filters.append($0.trigger?.urlFilter ?? "") })
+        XCTAssert(filters == ["[{\"]", "}]"], "Wrong rules: \(filters)")
+    }
+
+    /// Compare time and peak resident memory of the streaming reader and JSONDecoder on a large
+    /// generated list. The reader has to stay well below both the decoder and the size of the list,
+    /// the measurements are printed to the test log and attached to the test.
+    func testReaderBenchmark() {
+        guard let url = try? generateFilterList(ruleCount: benchmarkRuleCount),
+            let listBytes = (try? FileManager.default.attributesOfItem(atPath: url.path))?[.size] as? UInt64
+        else {
+            XCTFail("List could not be generated")
+            return
+        }
+        defer { try? FileManager.default.removeItem(at: url) }
+
+        var streamedCount = 0
+        let streamed = measurePeak {
+            guard let reader = try? FilterListRuleReader(url: url) else { return }
+            try? reader.forEachRule { _ in streamedCount += 1 }
+        }
+        var decodedCount = 0
+        let decoded = measurePeak {
+            guard let data = try? Data(contentsOf: url, options: .uncached) else { return }
+            let list = try? JSONDecoder().decode(V1FilterList.self, from: data)
+            decodedCount = list?.rules.count ?? 0
+        }
+
+        XCTAssert(streamedCount == benchmarkRuleCount && decodedCount == benchmarkRuleCount,
+                  "Wrong rule counts \(streamedCount) \(decodedCount)")
+        let report = "FilterListRuleReader: \(benchmarkRuleCount) rules, \(listBytes >> 10) KiB, "
+            + "stream \(streamed.seconds) s / \(streamed.peakBytes >> 10) KiB peak, "
+            + "JSONDecoder \(decoded.seconds) s / \(decoded.peakBytes >> 10) KiB peak"
+        print(report)
+        let attachment = XCTAttachment(string: report)
+        attachment.lifetime = .keepAlways
+        add(attachment)
+        XCTAssert(streamed.peakBytes < decoded.peakBytes,
+                  "Streaming needs more memory than decoding the whole list")
+        XCTAssert(streamed.peakBytes < listBytes,
+                  "Memory of the reader grows with the list")
+    }
+
+    // ------------------------------------------------------------
+    // MARK: - Private -
+    // ------------------------------------------------------------
+
+    /// Write a v1 list with the given number of distinct rules to a temporary file.
+    private func generateFilterList(ruleCount: Int) throws -> URL {
+        let url = URL(fileURLWithPath: NSTemporaryDirectory())
+            .appendingPathComponent("benchmark-\(ruleCount).json")
+        FileManager.default.createFile(atPath: url.path, contents: nil)
+        let handle = try FileHandle(forWritingTo: url)
+        defer { handle.closeFile() }
+        handle.write("[".data(using: .utf8)!)
+        for index in 0..<ruleCount {
+            let rule = "\(index == 0 ? "" : ",")"
+                + "{\"trigger\":{\"url-filter\":\"^https?://([^/]+\\\\.)?ads\(index)\\\\.example\","
+                + "\"resource-type\":[\"image\",\"script\"],\"unless-domain\":[\"*site\(index).example\"]},"
+                + "\"action\":{\"type\":\"block\"}}"
+            handle.write(rule.data(using: .utf8)!)
+        }
+        handle.write("]".data(using: .utf8)!)
+        return url
+    }
+
+    /// Run a block while sampling the resident size of the process.
+    /// - Returns: Elapsed time and the peak resident size increase over the start of the block.
+    private func measurePeak(_ block: () -> Void) -> (seconds: TimeInterval, peakBytes: UInt64) {
+        let baseline = residentSize()
+        var peak = baseline
+        let lock = NSLock()
+        let timer = DispatchSource.makeTimerSource(queue: DispatchQueue.global(qos: .userInitiated))
+        timer.schedule(deadline: .now(), repeating: .milliseconds(1))
+        timer.setEventHandler {
+            let size = self.residentSize()
+            lock.lock()
+            peak = max(peak, size)
+            lock.unlock()
+        }
+        timer.resume()
+        let start = Date()
+        autoreleasepool { block() }
+        let seconds = Date().timeIntervalSince(start)
+        timer.cancel()
+        lock.lock()
+        peak = max(peak, residentSize())
+        let result = peak - baseline
+        lock.unlock()
+        return (seconds, result)
+    }
+
+    private func residentSize() -> UInt64 {
+        var info = mach_task_basic_info()
+        var count = mach_msg_type_number_t(MemoryLayout<mach_task_basic_info>.size / MemoryLayout<natural_t>.size)
+        let result = withUnsafeMutablePointer(to: &info) {
+            $0.withMemoryRebound(to: integer_t.self, capacity: Int(count)) {
+                task_info(mach_task_self_, task_flavor_t(MACH_TASK_BASIC_INFO), $0, &count)
+            }
+        }
+        return result == KERN_SUCCESS ? info.resident_size : 0
+    }
+}
@@ -0,0 +1,123 @@
+/*
+ * This file is part of Adblock Plus <https://adblockplus.org/>,
+ * Copyright (C) 2006-present eyeo GmbH
+ *
+ * Adblock Plus is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * Adblock Plus is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Adblock Plus.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+@testable import libadblockplus_ios
+import XCTest
+
+class URLFilterLiteralIndexTests: XCTestCase {
+    /// Test that the candidates are the rules whose literal occurs in the URL and the fallback set.
+    func testCandidates() {
+        var generator = SplitMix(seed: 7)
+        let alphabet = Array("abc./".utf8)
+        func randomBytes(_ maximumCount: Int) -> [UInt8] {
+            return (0..<generator.next(maximumCount + 1)).map { _ in alphabet[generator.next(alphabet.count)] }
+        }
+        for _ in 0..<200 {
+            let literals = (0..<(1 + generator.next(40))).map { _ in randomBytes(5) }
+            let index = URLFilterLiteralIndex(literals: literals)
+            for _ in 0..<20 {
+                let url = randomBytes(30)
+                var expected = [Int32]()
+                for (rule, literal) in literals.enumerated() where literal.isEmpty || contains(url, literal) {
+                    expected.append(Int32(rule))
+                }
+                XCTAssert(index.candidates(in: url) == expected, "Candidates are wrong for \(literals) in \(url)")
+            }
+        }
+
+        let index = URLFilterLiteralIndex(literals: [Array("Banner".utf8), [], Array("/ads/".utf8)])
+        XCTAssert(index.candidates(in: Array("http://x.test/ads/banner.gif".utf8)) == [0, 1, 2], "Lower case literal was not found")
+        XCTAssert(index.candidates(in: Array("http://x.test/".utf8)) == [1], "Fallback set is wrong")
+    }
+
+    /// Print build time, size and lookup throughput for synthetic lists of 50k to 200k rules,
+    /// compared to searching every literal in every URL.
+    func testIndexBenchmark() {
+        var generator = SplitMix(seed: 1)
+        var urls = [[UInt8]]()
+        for index in 0..<2000 {
+            let host = generator.next(4) == 0 ? "cdn.adhost\(generator.next(200_000)).test" : "www.site\(index).example"
+            let path = generator.next(3) == 0 ? "/ads/banner\(generator.next(200_000))_300x250.gif" : "/article/\(index).html"
+            urls.append(Array("https://\(host)\(path)?utm_source=feed&id=\(index)".utf8))
+        }
+        for ruleCount in [50_000, 100_000, 200_000] {
+            let literals = syntheticLiterals(count: ruleCount, generator: &generator)
+            var start = Date()
+            let index = URLFilterLiteralIndex(literals: literals)
+            let buildTime = Date().timeIntervalSince(start)
+
+            start = Date()
+            var candidateCount = 0
+            for url in urls {
+                candidateCount += index.candidates(in: url).count
+            }
+            let lookupTime = Date().timeIntervalSince(start)
+
+            // Every literal in a sample of the URLs.
+            let sample = urls.prefix(20)
+            start = Date()
+            var scanCount = 0
+            for url in sample {
+                for literal in literals where literal.isEmpty || contains(url, literal) {
+                    scanCount += 1
+                }
+            }
+            let scanTime = Date().timeIntervalSince(start) * Double(urls.count) / Double(sample.count)
+
+            print("Literal index: \(ruleCount) rules, \(index.nodeCount) nodes, \(index.fallback.count) fallback rules, " +
+                  "built in \(String(format: "%.0f", buildTime * 1000)) ms, " +
+                  "\(Int(Double(urls.count) / lookupTime)) URLs per second " +
+                  "(\(Int(Double(urls.count) / scanTime)) without index), " +
+                  "\(String(format: "%.1f", Double(candidateCount) / Double(urls.count))) candidates per URL")
+            XCTAssert(candidateCount >= urls.count * index.fallback.count, "Fallback rules are missing")
+        }
+    }
+
+    // ------------------------------------------------------------
+    // MARK: - Private -
+    // ------------------------------------------------------------
+
+    /// Literals as found in EasyList derived url-filters: hosts, paths, query parameters and a
+    /// few rules without any literal.
+    private func syntheticLiterals(count: Int,
+                                   generator: inout SplitMix) -> [[UInt8]] {
+        return (0..<count).map { index -> [UInt8] in
+            switch generator.next(50) {
+            case 0:
+                return []
+            case 1..<25:
+                return Array("adhost\(index).test/".utf8)
+            case 25..<40:
+                return Array("/ads/banner\(index)_".utf8)
+            default:
+                return Array("&ad_slot=\(index)&".utf8)
+            }
+        }
+    }
+
+    private func contains(_ haystack: [UInt8],
+                          _ needle: [UInt8]) -> Bool {
+        let lowercaseNeedle = needle.map { $0 >= 65 && $0 <= 90 ? $0 + 32 : $0 }
+            .prefix(URLFilterLiteralIndex.maximumLiteralLength)
+        guard haystack.count >= lowercaseNeedle.count else { return false }
+        for start in 0...(haystack.count - lowercaseNeedle.count)
+            where haystack[start..<(start + lowercaseNeedle.count)].elementsEqual(lowercaseNeedle) {
+            return true
+        }
+        return false
+    }
+}
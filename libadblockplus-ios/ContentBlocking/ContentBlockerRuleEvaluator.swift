@@ -0,0 +1,501 @@
+/*
+ * This file is part of Adblock Plus <https://adblockplus.org/>,
+ * Copyright (C) 2006-present eyeo GmbH
+ *
+ * Adblock Plus is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * Adblock Plus is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Adblock Plus.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+import Foundation
+
+/// A resource load to evaluate a rule list against.
+public struct ContentBlockerRequest {
+    public var url: String
+    /// Host of the main document the resource is loaded for.
+    public var documentHost: String
+    /// WebKit resource type, like image or script. Unknown types are treated as raw.
+    public var resourceType: String
+
+    public init(url: String,
+                documentHost: String,
+                resourceType: String) {
+        self.url = url
+        self.documentHost = documentHost
+        self.resourceType = resourceType
+    }
+
+    /// - Parameter line: "<url>\t<document host>\t<resource type>", as in request corpora.
+    public init?(line: String) {
+        let fields = line.components(separatedBy: "\t")
+        guard fields.count == 3 else { return nil }
+        self.init(url: fields[0],
+                  documentHost: fields[1],
+                  resourceType: fields[2])
+    }
+}
+
+/// The outcome of a request, after ignore-previous-rules rules were applied.
+public struct ContentBlockerEvaluation {
+    /// Indices of the rules whose actions apply, in list order.
+    public var ruleIndices = [Int]()
+    public var blocks = false
+    public var blocksCookies = false
+    public var makesHTTPS = false
+    public var hiddenSelectors = [String]()
+
+    /// The action WebKit performs for the load: block, block-cookies, make-https,
+    /// css-display-none or none.
+    public var actionType: String {
+        if blocks {
+            return ContentBlockerRuleEvaluator.ActionType.block.rawValue
+        }
+        if blocksCookies {
+            return ContentBlockerRuleEvaluator.ActionType.blockCookies.rawValue
+        }
+        if makesHTTPS {
+            return ContentBlockerRuleEvaluator.ActionType.makeHTTPS.rawValue
+        }
+        if !hiddenSelectors.isEmpty {
+            return ContentBlockerRuleEvaluator.ActionType.cssDisplayNone.rawValue
+        }
+        return "none"
+    }
+}
+
+/// Evaluations of a request corpus.
+public struct ContentBlockerEvaluationReport {
+    public var evaluations = [ContentBlockerEvaluation]()
+    /// Number of requests by action type.
+    public var actionCounts = [String: Int]()
+    public var duration: TimeInterval = 0
+
+    public var requestsPerSecond: Double {
+        return duration > 0 ? Double(evaluations.count) / duration : 0
+    }
+}
+
+/// Evaluates a WebKit content blocker rule list without WebKit, to check what a list does to
+/// recorded requests and how fast it can be matched.
+///
+/// Rules are compiled once. The url-filter subset WebKit accepts is translated to
+/// NSRegularExpression; rules WebKit would reject are skipped and listed in invalidRuleIndices.
+/// A literal that every match of a url-filter contains is extracted from each rule, a
+/// URLFilterLiteralIndex of them selects the rules whose literal occurs in the URL of a request.
+/// For those and for the rules without a literal, resource type, load type and domain
+/// conditions are checked before the expression runs.
+///
+/// load-type compares the last two labels of the hosts, there is no public suffix list.
+public final class ContentBlockerRuleEvaluator {
+    enum ActionType: String {
+        case block
+        case blockCookies = "block-cookies"
+        case cssDisplayNone = "css-display-none"
+        case ignorePreviousRules = "ignore-previous-rules"
+        case makeHTTPS = "make-https"
+    }
+
+    /// Number of rules in the list, including invalid ones.
+    public private(set) var ruleCount = 0
+    /// Indices of the rules WebKit would not accept.
+    public private(set) var invalidRuleIndices = [Int]()
+
+    /// Rules without a literal, matched against every request.
+    public var fallbackRuleCount: Int {
+        return literalIndex.fallback.count
+    }
+
+    /// Disabled to measure matching every rule against every request.
+    var usesLiteralIndex = true
+
+    private var rules = [CompiledRule]()
+    private var literalIndex: URLFilterLiteralIndex!
+
+    /// - Throws: ABPFilterListError.invalidData if the list cannot be read.
+    public init(reader: FilterListRuleReader) throws {
+        try reader.forEachRule { rule in
+            if let compiled = CompiledRule(rule, index: ruleCount) {
+                rules.append(compiled)
+            } else {
+                invalidRuleIndices.append(ruleCount)
+            }
+            ruleCount += 1
+        }
+        literalIndex = URLFilterLiteralIndex(literals: rules.map { $0.literal })
+    }
+
+    /// - Parameter url: File URL of a v1 or v2 list.
+    public convenience init(url: URL) throws {
+        try self.init(reader: FilterListRuleReader(url: url))
+    }
+
+    public convenience init(data: Data) throws {
+        try self.init(reader: FilterListRuleReader(data: data))
+    }
+
+    public func evaluate(_ request: ContentBlockerRequest) -> ContentBlockerEvaluation {
+        let load = Load(request)
+        var matched = [CompiledRule]()
+        func apply(_ rule: CompiledRule) {
+            if rule.actionType == .ignorePreviousRules {
+                matched.removeAll(keepingCapacity: true)
+            } else {
+                matched.append(rule)
+            }
+        }
+        if usesLiteralIndex {
+            for position in literalIndex.candidates(in: load.lowercaseURLBytes) {
+                let rule = rules[Int(position)]
+                if rule.matches(load) {
+                    apply(rule)
+                }
+            }
+        } else {
+            for rule in rules where rule.literalOccurs(in: load) && rule.matches(load) {
+                apply(rule)
+            }
+        }
+
+        var evaluation = ContentBlockerEvaluation()
+        for rule in matched {
+            evaluation.ruleIndices.append(rule.index)
+            switch rule.actionType {
+            case .block:
+                evaluation.blocks = true
+            case .blockCookies:
+                evaluation.blocksCookies = true
+            case .makeHTTPS:
+                evaluation.makesHTTPS = true
+            case .cssDisplayNone:
+                evaluation.hiddenSelectors.append(rule.selector ?? "")
+            case .ignorePreviousRules:
+                break
+            }
+        }
+        return evaluation
+    }
+
+    /// Evaluate requests and measure the throughput.
+    public func evaluate(_ requests: [ContentBlockerRequest]) -> ContentBlockerEvaluationReport {
+        var report = ContentBlockerEvaluationReport()
+        report.evaluations.reserveCapacity(requests.count)
+        let start = Date()
+        for request in requests {
+            report.evaluations.append(evaluate(request))
+        }
+        report.duration = Date().timeIntervalSince(start)
+        for evaluation in report.evaluations {
+            report.actionCounts[evaluation.actionType, default: 0] += 1
+        }
+        return report
+    }
+}
+
+/// A request prepared for matching against all rules.
+private struct Load {
+    let url: String
+    let urlLength: Int
+    let urlBytes: [UInt8]
+    let lowercaseURLBytes: [UInt8]
+    let resourceType: UInt16
+    let loadType: UInt8
+    /// Document host followed by its parent domains.
+    let documentDomains: [String]
+
+    init(_ request: ContentBlockerRequest) {
+        url = request.url
+        urlLength = request.url.utf16.count
+        urlBytes = Array(request.url.utf8)
+        lowercaseURLBytes = urlBytes.map(lowercaseASCII)
+        resourceType = resourceTypeMask([request.resourceType])
+
+        let documentHost = request.documentHost.lowercased()
+        var domains = [documentHost]
+        var remainder = Substring(documentHost)
+        while let dot = remainder.index(of: ".") {
+            remainder = remainder[remainder.index(after: dot)...]
+            domains.append(String(remainder))
+        }
+        documentDomains = domains
+
+        let host = URLComponents(string: request.url)?.host?.lowercased() ?? ""
+        loadType = site(of: host) == site(of: documentHost) ? firstPartyLoad : thirdPartyLoad
+    }
+}
+
+private let firstPartyLoad: UInt8 = 1
+private let thirdPartyLoad: UInt8 = 2
+
+private func lowercaseASCII(_ byte: UInt8) -> UInt8 {
+    return byte >= 65 && byte <= 90 ? byte + 32 : byte
+}
+
+private func site(of host: String) -> Substring {
+    let labels = host.split(separator: ".")
+    guard labels.count > 2 else { return Substring(host) }
+    let start = labels[labels.count - 2].startIndex
+    return host[start...]
+}
+
+private func resourceTypeMask(_ types: [String]) -> UInt16 {
+    var mask: UInt16 = 0
+    for type in types {
+        let resourceType = TriggerResourceType(rawValue: type) ?? .raw
+        switch resourceType {
+        case .document: mask |= 1 << 0
+        case .image: mask |= 1 << 1
+        case .styleSheet: mask |= 1 << 2
+        case .script: mask |= 1 << 3
+        case .font: mask |= 1 << 4
+        case .raw: mask |= 1 << 5
+        case .svgDocument: mask |= 1 << 6
+        case .media: mask |= 1 << 7
+        case .popup: mask |= 1 << 8
+        }
+    }
+    return mask
+}
+
+/// A rule with its trigger translated for matching.
+private struct CompiledRule {
+    let index: Int
+    let actionType: ContentBlockerRuleEvaluator.ActionType
+    let selector: String?
+    /// Nil if every URL matches.
+    let expression: NSRegularExpression?
+    let isCaseSensitive: Bool
+    /// Every URL matching the expression contains this literal.
+    let literal: [UInt8]
+    let lowercaseLiteral: [UInt8]
+    let resourceTypes: UInt16
+    let loadTypes: UInt8
+    let exactDomains: Set<String>
+    let wildcardDomains: Set<String>
+    /// True for if-domain, false for unless-domain.
+    let domainsAreRequired: Bool
+    let hasDomains: Bool
+
+    init?(_ rule: BlockingRule,
+          index: Int) {
+        guard let trigger = rule.trigger,
+            let typeName = rule.action?.type,
+            let actionType = ContentBlockerRuleEvaluator.ActionType(rawValue: typeName),
+            let urlFilter = trigger.urlFilter,
+            !urlFilter.isEmpty,
+            trigger.ifDomain == nil || trigger.unlessDomain == nil,
+            actionType != .cssDisplayNone || rule.action?.selector != nil
+        else {
+            return nil
+        }
+        self.index = index
+        self.actionType = actionType
+        selector = rule.action?.selector
+        isCaseSensitive = trigger.urlFilterIsCaseSensitive ?? false
+
+        guard let analysis = CompiledRule.analyze(urlFilter) else { return nil }
+        if analysis.matchesEverything {
+            expression = nil
+        } else {
+            guard let compiled = try? NSRegularExpression(pattern: urlFilter,
+                                                          options: isCaseSensitive ? [] : [.caseInsensitive])
+            else {
+                return nil
+            }
+            expression = compiled
+        }
+        literal = Array(analysis.literal.utf8)
+        lowercaseLiteral = literal.map(lowercaseASCII)
+
+        resourceTypes = trigger.resourceType.map { types in resourceTypeMask(types.map { $0.rawValue }) } ?? UInt16.max
+        var loadTypes: UInt8 = 0
+        for loadType in trigger.loadType ?? ["first-party", "third-party"] {
+            switch loadType {
+            case "first-party":
+                loadTypes |= firstPartyLoad
+            case "third-party":
+                loadTypes |= thirdPartyLoad
+            default:
+                return nil
+            }
+        }
+        self.loadTypes = loadTypes
+
+        let domains = trigger.ifDomain ?? trigger.unlessDomain
+        if let uwDomains = domains, uwDomains.isEmpty {
+            return nil
+        }
+        hasDomains = domains != nil
+        domainsAreRequired = trigger.ifDomain != nil
+        var exact = Set<String>()
+        var wildcard = Set<String>()
+        for domain in domains ?? [] {
+            if domain.hasPrefix("*") {
+                wildcard.insert(String(domain.dropFirst()).lowercased())
+            } else {
+                exact.insert(domain.lowercased())
+            }
+        }
+        exactDomains = exact
+        wildcardDomains = wildcard
+    }
+
+    /// The literal index finds literals in lower case, only case sensitive rules need this
+    /// check after it.
+    func literalOccurs(in load: Load) -> Bool {
+        if literal.isEmpty {
+            return true
+        }
+        return isCaseSensitive ? contains(load.urlBytes, literal) : contains(load.lowercaseURLBytes, lowercaseLiteral)
+    }
+
+    /// Conditions other than the literal, and the literal of case sensitive rules.
+    func matches(_ load: Load) -> Bool {
+        guard resourceTypes & load.resourceType != 0,
+            loadTypes & load.loadType != 0
+        else {
+            return false
+        }
+        if hasDomains {
+            var inDomains = exactDomains.contains(load.documentDomains[0])
+            if !inDomains && !wildcardDomains.isEmpty {
+                inDomains = load.documentDomains.contains { wildcardDomains.contains($0) }
+            }
+            if inDomains != domainsAreRequired {
+                return false
+            }
+        }
+        if isCaseSensitive && !literal.isEmpty && !contains(load.urlBytes, literal) {
+            return false
+        }
+        guard let uwExpression = expression else { return true }
+        return uwExpression.firstMatch(in: load.url,
+                                       options: [],
+                                       range: NSRange(location: 0, length: load.urlLength)) != nil
+    }
+
+    private func contains(_ haystack: [UInt8],
+                          _ needle: [UInt8]) -> Bool {
+        let first = needle[0]
+        let last = haystack.count - needle.count
+        if last < 0 {
+            return false
+        }
+        var start = 0
+        while start <= last {
+            if haystack[start] == first {
+                var offset = 1
+                while offset < needle.count && haystack[start + offset] == needle[offset] {
+                    offset += 1
+                }
+                if offset == needle.count {
+                    return true
+                }
+            }
+            start += 1
+        }
+        return false
+    }
+
+    /// Check a url-filter against the subset of regular expressions WebKit supports: ASCII only,
+    /// no disjunction, counted repetition, backreferences or character class escapes, ^ and $
+    /// only at the ends.
+    /// - Returns: The longest literal outside of groups and optional parts, and whether the
+    ///   filter matches every URL. Nil if WebKit rejects the filter.
+    private static func analyze(_ urlFilter: String) -> (literal: String, matchesEverything: Bool)? {
+        let characters = Array(urlFilter.unicodeScalars)
+        var longest = ""
+        var current = ""
+        var depth = 0
+        var inBrackets = false
+        var index = 0
+
+        func endLiteral(dropLast: Bool) {
+            if dropLast && !current.isEmpty {
+                current.removeLast()
+            }
+            if current.count > longest.count {
+                longest = current
+            }
+            current = ""
+        }
+
+        while index < characters.count {
+            let character = characters[index]
+            guard character.isASCII else { return nil }
+            let next: Unicode.Scalar? = index + 1 < characters.count ? characters[index + 1] : nil
+            let isQuantified = next == "?" || next == "*"
+            switch character {
+            case "\\":
+                guard let escaped = next, escaped.isASCII,
+                    !CharacterSet.alphanumerics.contains(escaped)
+                else {
+                    return nil
+                }
+                if !inBrackets && depth == 0 {
+                    let quantifier: Unicode.Scalar? = index + 2 < characters.count ? characters[index + 2] : nil
+                    current.unicodeScalars.append(escaped)
+                    if quantifier == "?" || quantifier == "*" {
+                        endLiteral(dropLast: true)
+                    }
+                }
+                index += 1
+            case "[":
+                if inBrackets {
+                    return nil
+                }
+                inBrackets = true
+                endLiteral(dropLast: false)
+            case "]":
+                inBrackets = false
+            case "(":
+                if !inBrackets {
+                    depth += 1
+                    endLiteral(dropLast: false)
+                }
+            case ")":
+                if !inBrackets {
+                    depth -= 1
+                    if depth < 0 {
+                        return nil
+                    }
+                }
+            case "|", "{", "}":
+                if !inBrackets {
+                    return nil
+                }
+            case "^":
+                if !inBrackets && index > 0 {
+                    return nil
+                }
+            case "$":
+                if !inBrackets && index != characters.count - 1 {
+                    return nil
+                }
+            case ".", "*", "+", "?":
+                // Characters followed by ? or * were already removed from the literal.
+                if !inBrackets {
+                    endLiteral(dropLast: false)
+                }
+            default:
+                if !inBrackets && depth == 0 {
+                    current.unicodeScalars.append(character)
+                    if isQuantified {
+                        endLiteral(dropLast: true)
+                    }
+                }
+            }
+            index += 1
+        }
+        guard depth == 0 && !inBrackets else { return nil }
+        endLiteral(dropLast: false)
+        return (longest, urlFilter == ".*" || urlFilter == "^.*" || urlFilter == ".*$")
+    }
+}
@@ -0,0 +1,151 @@
+/*
+ * This file is part of Adblock Plus <https://adblockplus.org/>,
+ * Copyright (C) 2006-present eyeo GmbH
+ *
+ * Adblock Plus is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * Adblock Plus is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Adblock Plus.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+import RxCocoa
+import RxSwift
+
+/// Coalesces content blocker reloads. Reloads requested within a time window are performed once
+/// and every requester receives the result. At most one reload runs at a time and at most one
+/// more is queued, requests arriving meanwhile join the queued one. Every content blocker has one
+/// scheduler, see SafariContentBlocker.reloadScheduler(for:).
+///
+/// Requests and completions are handled on the main thread.
+public final class ContentBlockerReloadScheduler {
+    /// Reloads the content blocker with the identifier and calls the closure with its result on
+    /// any thread. The closure has to be called exactly once.
+    public typealias Reloader = (ContentBlockerIdentifier, @escaping (Error?) -> Void) -> Void
+
+    /// Reload statistics. Once idle, requested == coalesced + executed.
+    public struct Counters {
+        /// Calls of requestReload(completion:).
+        public var requested = 0
+        /// Requests that joined an already queued reload.
+        public var coalesced = 0
+        /// Reloads that were performed.
+        public var executed = 0
+    }
+
+    /// Default time to wait for further requests.
+    public static let defaultWindow: TimeInterval = 0.3
+
+    public private(set) var counters = Counters()
+
+    /// Time to wait for further requests before a queued reload starts.
+    public var window: TimeInterval
+
+    /// True when a reload is requested while idle, false when the last one ends.
+    public let reloading = BehaviorRelay<Bool>(value: false)
+
+    /// Identifier of the content blocker.
+    public let identifier: ContentBlockerIdentifier
+
+    /// Performs the actual reload.
+    public var reloader: Reloader
+
+    /// Runs right before every reload, after coalescing. The extension reads the stored settings,
+    /// pending changes have to be committed here.
+    public var willReload: (() -> Void)?
+
+    /// True while a reload is running or queued.
+    public var isReloading: Bool {
+        return running || queued != nil
+    }
+
+    private let scheduler: SchedulerType
+    private var running = false
+    /// Completions of the queued reload, nil if no reload is queued.
+    private var queued: [((Error?) -> Void)?]?
+    private let windowDisposable = SerialDisposable()
+
+    /// - Parameters:
+    ///   - identifier: Identifier of the content blocker.
+    ///   - window: Time to wait for further requests.
+    ///   - scheduler: Scheduler for the window.
+    ///   - reloader: Performs the actual reload.
+    public init(identifier: ContentBlockerIdentifier,
+                window: TimeInterval = ContentBlockerReloadScheduler.defaultWindow,
+                scheduler: SchedulerType = MainScheduler.instance,
+                reloader: @escaping Reloader) {
+        self.identifier = identifier
+        self.window = window
+        self.scheduler = scheduler
+        self.reloader = reloader
+    }
+
+    deinit {
+        windowDisposable.dispose()
+    }
+
+    /// Request a reload.
+    /// - Parameter completion: Closure receiving the result of the reload that covers this request.
+    public func requestReload(completion: ((Error?) -> Void)?) {
+        counters.requested += 1
+        if queued != nil {
+            counters.coalesced += 1
+            queued?.append(completion)
+            return
+        }
+        let wasReloading = isReloading
+        queued = [completion]
+        if !wasReloading {
+            reloading.accept(true)
+        }
+        // A running reload starts the window for the queued one when it ends.
+        if !running {
+            startWindow()
+        }
+    }
+
+    // ------------------------------------------------------------
+    // MARK: - Private -
+    // ------------------------------------------------------------
+
+    private func startWindow() {
+        windowDisposable.disposable = Observable<Int>.timer(window,
+                                                            scheduler: scheduler)
+            .subscribe(onNext: { [weak self] _ in
+                self?.runQueued()
+            })
+    }
+
+    private func runQueued() {
+        guard !running, let completions = queued else { return }
+        queued = nil
+        running = true
+        counters.executed += 1
+        willReload?()
+        reloader(identifier) { [weak self] error in
+            DispatchQueue.main.async {
+                self?.finish(completions,
+                             error: error)
+            }
+        }
+    }
+
+    private func finish(_ completions: [((Error?) -> Void)?],
+                        error: Error?) {
+        running = false
+        if queued != nil {
+            startWindow()
+        } else {
+            reloading.accept(false)
+        }
+        for completion in completions {
+            completion?(error)
+        }
+    }
+}
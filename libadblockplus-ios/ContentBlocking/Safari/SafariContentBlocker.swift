@@ -34,18 +34,63 @@ public class SafariContentBlocker: NSObject {
     private var reloadingSetter: ((Bool) -> Void)!
     /// Legacy setter.
     private var performingActivityTestSetter: ((Bool) -> Void)!
-    /// Bag for reload operations.
-    private var reloadBag: DisposeBag! = DisposeBag()
+    /// Coalesces reloads requested in quick succession. Shared by all instances reloading the
+    /// same content blocker, its reloader and its willReload hook apply to all of them.
+    public private(set) var reloadScheduler: ContentBlockerReloadScheduler!
+    private let bag = DisposeBag()
+    /// Schedulers shared by all instances, one per content blocker identifier.
+    private static var reloadSchedulers = [ContentBlockerIdentifier: ContentBlockerReloadScheduler]()
 
     /// Helps maintain compatibility with legacy implementation. The legacy setters will
     /// eventually be removed and the behavior relays will be the exclusive means of state
     /// observation.
     @objc
-    public init(reloadingSetter: @escaping (Bool) -> Void,
+    public convenience init(reloadingSetter: @escaping (Bool) -> Void,
+                            performingActivityTestSetter: @escaping (Bool) -> Void) {
+        let scheduler: ContentBlockerReloadScheduler
+        if let cbID = Config().contentBlockerIdentifier() {
+            scheduler = SafariContentBlocker.reloadScheduler(for: cbID)
+        } else {
+            scheduler = ContentBlockerReloadScheduler(identifier: "") { _, completion in
+                completion(ABPContentBlockerError.invalidIdentifier)
+            }
+        }
+        self.init(reloadScheduler: scheduler,
+                  reloadingSetter: reloadingSetter,
+                  performingActivityTestSetter: performingActivityTestSetter)
+    }
+
+    /// - Parameter reloadScheduler: Scheduler performing the reloads, tests pass their own.
+    public init(reloadScheduler: ContentBlockerReloadScheduler,
+                reloadingSetter: @escaping (Bool) -> Void,
                 performingActivityTestSetter: @escaping (Bool) -> Void) {
         disableReloading = false
         self.reloadingSetter = reloadingSetter
         self.performingActivityTestSetter = performingActivityTestSetter
+        self.reloadScheduler = reloadScheduler
+        super.init()
+        reloading.accept(reloadScheduler.reloading.value)
+        reloadScheduler.reloading
+            .skip(1)
+            .subscribe(onNext: { [weak self] reloading in
+                self?.reloadingSetter?(reloading)
+                self?.reloading.accept(reloading)
+            }).disposed(by: bag)
+    }
+
+    /// Returns the scheduler of a content blocker, it is made on first use. By default it reloads
+    /// through SFContentBlockerManager.
+    /// - Parameter identifier: Unique ID string for the content blocker.
+    public static func reloadScheduler(for identifier: ContentBlockerIdentifier) -> ContentBlockerReloadScheduler {
+        if let scheduler = reloadSchedulers[identifier] {
+            return scheduler
+        }
+        let scheduler = ContentBlockerReloadScheduler(identifier: identifier) { identifier, completion in
+            SFContentBlockerManager.reloadContentBlocker(withIdentifier: identifier,
+                                                         completionHandler: completion)
+        }
+        reloadSchedulers[identifier] = scheduler
+        return scheduler
     }
 
     /// Start a completion closure, then reload the content blocker.
@@ -57,47 +102,16 @@ public class SafariContentBlocker: NSObject {
         reloadContentBlocker(completion: nil)
     }
 
-    /// Reload the content blocker, then run a completion closure.
+    /// Reload the content blocker, then run a completion closure. Reloads requested in quick
+    /// succession are performed once, see ContentBlockerReloadScheduler.
     /// - parameter completion: Escaping closure to run after reload.
     @objc
     public func reloadContentBlocker(completion: ((Error?) -> Void)?) {
         guard disableReloading == false else { return }
 
-        // Dispose all current reloads before doing another. This comes before property changes to
-        // isolate KVO observer interactions.
-        reloadBag = DisposeBag()
-
-        reloadingSetter?(true)
-        reloading.accept(true)
         performingActivityTestSetter?(false)
         performingActivityTest.accept(false)
-        contentBlockerReload(completion: completion)
-            .subscribe()
-            .disposed(by: reloadBag)
-    }
-
-    /// This is the base function for reloading the content blocker. A ContentBlockerManager
-    /// performs the actual reload. Errors in reloading are currently not handled.
-    /// - parameter completion: Escaping closure to run after reload even if an error occurred.
-    /// - returns: An Observable.
-    private func contentBlockerReload(completion: ((Error?) -> Void)?) -> Observable<Void> {
-        return Observable.create { observer in
-            guard let cbID = Config().contentBlockerIdentifier() else {
-                observer.onError(ABPContentBlockerError.invalidIdentifier)
-                return Disposables.create()
-            }
-            SFContentBlockerManager.reloadContentBlocker(withIdentifier: cbID) { error in
-                self.reloadingSetter?(false)
-                self.reloading.accept(false)
-                if completion != nil {
-                    completion!(error)
-                    observer.onCompleted()
-                } else {
-                    observer.onCompleted()
-                }
-            }
-            return Disposables.create()
-        }.observeOn(MainScheduler.asyncInstance)
+        reloadScheduler.requestReload(completion: completion)
     }
 
     // ------------------------------------------------------------
@@ -0,0 +1,245 @@
+/*
+ * This file is part of Adblock Plus <https://adblockplus.org/>,
+ * Copyright (C) 2006-present eyeo GmbH
+ *
+ * Adblock Plus is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * Adblock Plus is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Adblock Plus.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+import Foundation
+
+/// Finds the rules whose required url-filter literal occurs in a URL, with one pass over the URL.
+///
+/// The literals are kept in an Aho-Corasick automaton. Children of a node are stored as a sibling
+/// list, only the root has a transition table, which keeps lists of 200k rules in a few MB.
+/// Literals are matched in lower case; callers check the exact literal of case sensitive rules
+/// themselves. Rules without a literal form the fallback set and are candidates for every URL.
+///
+/// A search reuses buffers of the index, an index must not be searched on several threads at once.
+final class URLFilterLiteralIndex {
+    /// Longer literals are cut, any part of a required literal is required as well.
+    static let maximumLiteralLength = 16
+
+    private static let root: Int32 = 0
+    private static let none: Int32 = -1
+
+    /// Number of rules, including the fallback set.
+    let ruleCount: Int
+    /// Rules without a literal, ascending.
+    let fallback: [Int32]
+
+    var nodeCount: Int {
+        return bytes.count
+    }
+
+    // Trie nodes, by node number.
+    private var bytes = [UInt8]()
+    private var firstChild = [Int32]()
+    private var nextSibling = [Int32]()
+    private var failure = [Int32]()
+    /// First rule of the node in ruleOfOutput, or none.
+    private var firstOutput = [Int32]()
+    /// Nearest node on the failure path with rules, or none.
+    private var outputLink = [Int32]()
+    private var rootTransitions = [Int32](repeating: URLFilterLiteralIndex.root,
+                                          count: 256)
+    // Rules ending at a node, as linked lists.
+    private var ruleOfOutput = [Int32]()
+    private var nextOutput = [Int32]()
+
+    // Search buffers.
+    private var seen: [UInt32]
+    private var searchStamp: UInt32 = 0
+    private var found = [Int32]()
+
+    /// - Parameter literals: Required literal of every rule, in rule order, empty if the rule has
+    ///   none.
+    init(literals: [[UInt8]]) {
+        ruleCount = literals.count
+        seen = [UInt32](repeating: 0, count: literals.count)
+        var fallback = [Int32]()
+        var entries = [(literal: ArraySlice<UInt8>, rule: Int32)]()
+        for (rule, literal) in literals.enumerated() {
+            if literal.isEmpty {
+                fallback.append(Int32(rule))
+                continue
+            }
+            let lowercase = literal.prefix(URLFilterLiteralIndex.maximumLiteralLength).map(URLFilterLiteralIndex.lowercase)
+            entries.append((ArraySlice(lowercase), Int32(rule)))
+        }
+        self.fallback = fallback
+
+        entries.sort { $0.literal.lexicographicallyPrecedes($1.literal) }
+        addNode(0)
+        var lastChildren = [URLFilterLiteralIndex.none]
+        for entry in entries {
+            insert(entry.literal,
+                   rule: entry.rule,
+                   lastChildren: &lastChildren)
+        }
+        buildFailureLinks()
+    }
+
+    /// - Parameter lowercaseURL: Bytes of the URL in lower case.
+    /// - Returns: Rules whose literal occurs in the URL and the fallback set, ascending.
+    func candidates(in lowercaseURL: [UInt8]) -> [Int32] {
+        searchStamp = searchStamp &+ 1
+        if searchStamp == 0 {
+            // Stamps wrapped around, old marks must not be taken as current ones.
+            for index in seen.indices {
+                seen[index] = 0
+            }
+            searchStamp = 1
+        }
+        found.removeAll(keepingCapacity: true)
+
+        var node = URLFilterLiteralIndex.root
+        for byte in lowercaseURL {
+            node = transition(from: node,
+                              byte: byte)
+            var output = firstOutput[Int(node)] != URLFilterLiteralIndex.none ? node : outputLink[Int(node)]
+            while output != URLFilterLiteralIndex.none {
+                var entry = firstOutput[Int(output)]
+                while entry != URLFilterLiteralIndex.none {
+                    let rule = ruleOfOutput[Int(entry)]
+                    if seen[Int(rule)] != searchStamp {
+                        seen[Int(rule)] = searchStamp
+                        found.append(rule)
+                    }
+                    entry = nextOutput[Int(entry)]
+                }
+                output = outputLink[Int(output)]
+            }
+        }
+        if found.isEmpty {
+            return fallback
+        }
+        found.sort()
+        return merge(found, fallback)
+    }
+
+    // ------------------------------------------------------------
+    // MARK: - Private -
+    // ------------------------------------------------------------
+
+    private static func lowercase(_ byte: UInt8) -> UInt8 {
+        return byte >= 65 && byte <= 90 ? byte + 32 : byte
+    }
+
+    @discardableResult
+    private func addNode(_ byte: UInt8) -> Int32 {
+        bytes.append(byte)
+        firstChild.append(URLFilterLiteralIndex.none)
+        nextSibling.append(URLFilterLiteralIndex.none)
+        failure.append(URLFilterLiteralIndex.root)
+        firstOutput.append(URLFilterLiteralIndex.none)
+        outputLink.append(URLFilterLiteralIndex.none)
+        return Int32(bytes.count - 1)
+    }
+
+    private func child(of node: Int32,
+                       byte: UInt8) -> Int32 {
+        var child = firstChild[Int(node)]
+        while child != URLFilterLiteralIndex.none && bytes[Int(child)] != byte {
+            child = nextSibling[Int(child)]
+        }
+        return child
+    }
+
+    /// Literals are inserted in ascending order. A literal can then only share the last child
+    /// of a node, and new children are appended after it.
+    private func insert(_ literal: ArraySlice<UInt8>,
+                        rule: Int32,
+                        lastChildren: inout [Int32]) {
+        var node = URLFilterLiteralIndex.root
+        for byte in literal {
+            let last = lastChildren[Int(node)]
+            if last != URLFilterLiteralIndex.none && bytes[Int(last)] == byte {
+                node = last
+                continue
+            }
+            let next = addNode(byte)
+            lastChildren.append(URLFilterLiteralIndex.none)
+            if last == URLFilterLiteralIndex.none {
+                firstChild[Int(node)] = next
+            } else {
+                nextSibling[Int(last)] = next
+            }
+            lastChildren[Int(node)] = next
+            node = next
+        }
+        ruleOfOutput.append(rule)
+        nextOutput.append(firstOutput[Int(node)])
+        firstOutput[Int(node)] = Int32(ruleOfOutput.count - 1)
+    }
+
+    private func transition(from node: Int32,
+                            byte: UInt8) -> Int32 {
+        var state = node
+        while state != URLFilterLiteralIndex.root {
+            let next = child(of: state, byte: byte)
+            if next != URLFilterLiteralIndex.none {
+                return next
+            }
+            state = failure[Int(state)]
+        }
+        return rootTransitions[Int(byte)]
+    }
+
+    /// Breadth first, the failure links of shallower nodes are complete when a node is reached.
+    private func buildFailureLinks() {
+        var queue = [Int32]()
+        var child = firstChild[Int(URLFilterLiteralIndex.root)]
+        while child != URLFilterLiteralIndex.none {
+            rootTransitions[Int(bytes[Int(child)])] = child
+            queue.append(child)
+            child = nextSibling[Int(child)]
+        }
+        var head = 0
+        while head < queue.count {
+            let node = queue[head]
+            head += 1
+            var next = firstChild[Int(node)]
+            while next != URLFilterLiteralIndex.none {
+                let target = transition(from: failure[Int(node)],
+                                        byte: bytes[Int(next)])
+                failure[Int(next)] = target
+                outputLink[Int(next)] = firstOutput[Int(target)] != URLFilterLiteralIndex.none ? target : outputLink[Int(target)]
+                queue.append(next)
+                next = nextSibling[Int(next)]
+            }
+        }
+    }
+
+    private func merge(_ left: [Int32],
+                       _ right: [Int32]) -> [Int32] {
+        if right.isEmpty {
+            return left
+        }
+        var result = [Int32]()
+        result.reserveCapacity(left.count + right.count)
+        var leftIndex = 0
+        var rightIndex = 0
+        while leftIndex < left.count && rightIndex < right.count {
+            if left[leftIndex] < right[rightIndex] {
+                result.append(left[leftIndex])
+                leftIndex += 1
+            } else {
+                result.append(right[rightIndex])
+                rightIndex += 1
+            }
+        }
+        result += left[leftIndex...]
+        result += right[rightIndex...]
+        return result
+    }
+}
@@ -27,8 +27,10 @@ public enum ABPDownloadTaskError: Error {
 
 /// Error cases for filter list processing.
 /// - invalidData: Data could not be read from the list.
+/// - diffNotApplicable: A diff does not match the stored list or its result fails verification.
 public enum ABPFilterListError: Error {
     case invalidData
+    case diffNotApplicable
 }
 
 /// Error cases for managing device tokens.
@@ -40,6 +42,8 @@ public enum ABPDeviceTokenSaveError: Error {
 
 /// Error cases for managing content blocking.
 /// - invalidIdentifier: Invalid ID.
+/// - reloaderUnavailable: The object performing the reload no longer exists.
 public enum ABPContentBlockerError: Error {
     case invalidIdentifier
+    case reloaderUnavailable
 }
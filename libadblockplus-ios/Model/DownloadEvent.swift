@@ -22,6 +22,12 @@ public struct DownloadEvent {
     public var totalBytesWritten: Int64?
     public var error: Error?
     public var errorWritten: Bool?
+    /// Set if a diff could not be applied and the complete list has to be downloaded instead.
+    public var needsFullDownload: Bool?
+    /// Set if the server reported that the stored list is current.
+    public var notModified: Bool?
+    /// Monotonic time in nanoseconds when the task was resumed, used for tracing.
+    public var resumeTime: UInt64?
 
     public init(filterListName: FilterListName?,
                 didFinishDownloading: Bool?,
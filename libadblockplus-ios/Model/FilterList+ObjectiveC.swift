@@ -39,7 +39,10 @@ extension FilterList {
         version = uwDict["version"] as? String
         self.downloadCount = uwDict["downloadCount"] as? Int
         rules = nil
-        ruleCount = nil
+        ruleCount = uwDict["ruleCount"] as? Int
+        entityTag = uwDict["entityTag"] as? String
+        lastModified = uwDict["lastModified"] as? String
+        overlayBaseName = uwDict["overlayBaseName"] as? String
     }
 
     /// - Returns: A dictionary suitable for use with Objective-C.
@@ -57,6 +60,10 @@ extension FilterList {
         dict["userTriggered"] = userTriggered
         dict["version"] = version
         dict["downloadCount"] = downloadCount
+        dict["ruleCount"] = ruleCount
+        dict["entityTag"] = entityTag
+        dict["lastModified"] = lastModified
+        dict["overlayBaseName"] = overlayBaseName
         return dict
     }
 }
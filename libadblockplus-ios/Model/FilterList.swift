@@ -59,6 +59,16 @@ public struct FilterList {
     /// Count of rules in the filter list.
     public var ruleCount: Int?
 
+    /// ETag of the last downloaded list, sent as If-None-Match.
+    public var entityTag: String?
+
+    /// Last-Modified of the last downloaded list, sent as If-Modified-Since.
+    public var lastModified: String?
+
+    /// Name of the list whose rules are left out of the stored list, nil if the list is stored
+    /// completely. The stored list is only usable composed with that list.
+    public var overlayBaseName: String?
+
     public init() {
         // Intentionally empty
     }
@@ -30,8 +30,11 @@ public struct FilterListDownloadData {
     public var queryItems: [URLQueryItem]!
 
     /// Construct a filter list download data struct.
-    /// - Parameter filterList: The local filter list corresponding to the download data.
-    public init(with filterList: FilterList) {
+    /// - Parameters:
+    ///   - filterList: The local filter list corresponding to the download data.
+    ///   - acceptingDiff: Ask for a diff against the version of the stored list, if it is known.
+    public init(with filterList: FilterList,
+                acceptingDiff: Bool = false) {
         queryItems = [URLQueryItem(name: "addonName",
                                    value: addonName),
             URLQueryItem(name: "addonVersion",
@@ -48,6 +51,10 @@ public struct FilterListDownloadData {
                          value: filterList.lastVersion),
             URLQueryItem(name: "downloadCount",
                          value: downloadCountString(for: filterList))]
+        if acceptingDiff, let version = filterList.version {
+            queryItems.append(URLQueryItem(name: "diff",
+                                           value: version))
+        }
     }
 }
 
@@ -0,0 +1,262 @@
+/*
+ * This file is part of Adblock Plus <https://adblockplus.org/>,
+ * Copyright (C) 2006-present eyeo GmbH
+ *
+ * Adblock Plus is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * Adblock Plus is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Adblock Plus.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+import Foundation
+
+/// Decoded filter lists indexed by name, download task identifier and source URL.
+///
+/// The lists are decoded from their legacy dictionary form once. Lookups and updates are
+/// constant time and happen in memory. Changes are written back together on the main queue, the
+/// legacy form is only encoded once per batch.
+///
+/// All functions may be called from any thread.
+public final class FilterListRegistry {
+    /// Filter lists in the legacy dictionary form, keyed by name.
+    public typealias LegacyFilterLists = [FilterListName: [String: Any]]
+
+    /// Number of times the lists were decoded from the legacy form.
+    public private(set) var decodeCount = 0
+
+    /// Number of times the lists were written back.
+    public private(set) var writeBackCount = 0
+
+    /// Decoded filter lists, in no particular order.
+    public var filterLists: [FilterList] {
+        return locked { Array(listsByName.values) }
+    }
+
+    private let source: () -> LegacyFilterLists
+    private let writeBack: (LegacyFilterLists) -> Void
+    private let lock = NSRecursiveLock()
+    private var loaded = false
+    private var listsByName = [FilterListName: FilterList]()
+    private var namesByTaskIdentifier = [Int: FilterListName]()
+    private var namesBySource = [String: FilterListName]()
+    /// Names of lists changed or removed since the last write back.
+    private var changedNames = Set<FilterListName>()
+    private var writeBackScheduled = false
+    private var writingBack = false
+
+    /// - Parameters:
+    ///   - source: Returns the stored lists in the legacy form.
+    ///   - writeBack: Stores the lists in the legacy form, called on the main queue.
+    public init(source: @escaping () -> LegacyFilterLists,
+                writeBack: @escaping (LegacyFilterLists) -> Void) {
+        self.source = source
+        self.writeBack = writeBack
+    }
+
+    /// - Parameter name: Filter list name.
+    /// - Returns: The filter list with the name if it exists.
+    public func filterList(named name: FilterListName?) -> FilterList? {
+        guard let uwName = name else { return nil }
+        return locked { listsByName[uwName] }
+    }
+
+    /// - Parameter taskIdentifier: Identifier of a download task.
+    /// - Returns: The filter list being downloaded by the task if it exists.
+    public func filterList(forTaskIdentifier taskIdentifier: Int) -> FilterList? {
+        return locked {
+            guard let name = namesByTaskIdentifier[taskIdentifier] else { return nil }
+            return listsByName[name]
+        }
+    }
+
+    /// - Parameter source: Download location as a URL string.
+    /// - Returns: The filter list downloaded from the location if it exists.
+    public func filterList(forSource source: String?) -> FilterList? {
+        guard let uwSource = source else { return nil }
+        return locked {
+            guard let name = namesBySource[uwSource] else { return nil }
+            return listsByName[name]
+        }
+    }
+
+    /// Replace an existing filter list with the same name.
+    /// - Parameter filterList: The new filter list.
+    /// - Returns: True if the list was replaced.
+    @discardableResult
+    public func replace(_ filterList: FilterList) -> Bool {
+        guard let name = filterList.name else { return false }
+        return locked {
+            guard listsByName[name] != nil else { return false }
+            store(filterList,
+                  named: name)
+            return true
+        }
+    }
+
+    /// Change an existing filter list in place.
+    /// - Parameters:
+    ///   - name: Filter list name.
+    ///   - change: Applied to the stored list.
+    /// - Returns: True if the list exists.
+    @discardableResult
+    public func update(named name: FilterListName,
+                       _ change: (inout FilterList) -> Void) -> Bool {
+        return locked {
+            guard var list = listsByName[name] else { return false }
+            change(&list)
+            list.name = name
+            store(list,
+                  named: name)
+            return true
+        }
+    }
+
+    /// Replace all filter lists. Lists without a name are dropped.
+    /// - Parameter filterLists: The new filter lists.
+    public func replaceAll(_ filterLists: [FilterList]) {
+        locked {
+            let oldNames = Set(listsByName.keys)
+            listsByName = [:]
+            namesByTaskIdentifier = [:]
+            namesBySource = [:]
+            changedNames.formUnion(oldNames)
+            for list in filterLists {
+                if let name = list.name {
+                    store(list,
+                          named: name)
+                }
+            }
+            scheduleWriteBack()
+        }
+    }
+
+    /// Remove a filter list.
+    /// - Parameter name: Filter list name.
+    public func remove(named name: FilterListName) {
+        locked {
+            guard let list = listsByName.removeValue(forKey: name) else { return }
+            unindex(list)
+            changedNames.insert(name)
+            scheduleWriteBack()
+        }
+    }
+
+    /// Called when the stored lists were changed by someone else. They are decoded again, changes
+    /// not written back yet are kept.
+    public func sourceDidChange() {
+        lock.lock()
+        defer { lock.unlock() }
+        // Nothing to do if the lists were not decoded yet or the change is the own write back.
+        guard loaded && !writingBack else { return }
+        let pending = changedNames.map { ($0, listsByName[$0]) }
+        load()
+        for (name, list) in pending {
+            if let uwList = list {
+                store(uwList,
+                      named: name)
+            } else if let removed = listsByName.removeValue(forKey: name) {
+                unindex(removed)
+            }
+        }
+    }
+
+    /// Write the changes back now. Must be called on the main queue.
+    public func flush() {
+        let lists: LegacyFilterLists? = locked {
+            writeBackScheduled = false
+            guard !changedNames.isEmpty else { return nil }
+            changedNames = []
+            var converted = LegacyFilterLists()
+            for (name, list) in listsByName {
+                converted[name] = list.toDictionary()
+            }
+            return converted
+        }
+        guard let uwLists = lists else { return }
+        locked { writingBack = true }
+        writeBack(uwLists)
+        locked {
+            writingBack = false
+            writeBackCount += 1
+        }
+    }
+
+    // ------------------------------------------------------------
+    // MARK: - Private -
+    // ------------------------------------------------------------
+
+    private func locked<T>(_ body: () -> T) -> T {
+        lock.lock()
+        defer { lock.unlock() }
+        if !loaded {
+            load()
+        }
+        return body()
+    }
+
+    /// Decode the stored lists. Called with the lock held.
+    private func load() {
+        loaded = true
+        decodeCount += 1
+        listsByName = [:]
+        namesByTaskIdentifier = [:]
+        namesBySource = [:]
+        for (name, dictionary) in source() {
+            if let list = FilterList(named: name,
+                                     fromDictionary: dictionary) {
+                index(list,
+                      named: name)
+                listsByName[name] = list
+            }
+        }
+    }
+
+    /// Called with the lock held.
+    private func store(_ filterList: FilterList,
+                       named name: FilterListName) {
+        if let old = listsByName[name] {
+            unindex(old)
+        }
+        listsByName[name] = filterList
+        index(filterList,
+              named: name)
+        changedNames.insert(name)
+        scheduleWriteBack()
+    }
+
+    private func index(_ filterList: FilterList,
+                       named name: FilterListName) {
+        if let taskIdentifier = filterList.taskIdentifier {
+            namesByTaskIdentifier[taskIdentifier] = name
+        }
+        if let source = filterList.source {
+            namesBySource[source] = name
+        }
+    }
+
+    private func unindex(_ filterList: FilterList) {
+        if let taskIdentifier = filterList.taskIdentifier, namesByTaskIdentifier[taskIdentifier] == filterList.name {
+            namesByTaskIdentifier[taskIdentifier] = nil
+        }
+        if let source = filterList.source, namesBySource[source] == filterList.name {
+            namesBySource[source] = nil
+        }
+    }
+
+    private func scheduleWriteBack() {
+        if writeBackScheduled {
+            return
+        }
+        writeBackScheduled = true
+        DispatchQueue.main.async { [weak self] in
+            self?.flush()
+        }
+    }
+}
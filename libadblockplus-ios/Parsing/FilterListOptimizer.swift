@@ -0,0 +1,274 @@
+/*
+ * This file is part of Adblock Plus <https://adblockplus.org/>,
+ * Copyright (C) 2006-present eyeo GmbH
+ *
+ * Adblock Plus is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * Adblock Plus is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Adblock Plus.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+import Foundation
+
+/// Rule counts before and after optimizing a filter list.
+public struct FilterListOptimizationResult {
+    public var inputRuleCount = 0
+    public var outputRuleCount = 0
+    /// Number of rules the model cannot decode. They are copied unchanged.
+    public var undecodableRuleCount = 0
+
+    /// Number of rules that were folded into other rules.
+    public var removedRuleCount: Int {
+        return inputRuleCount - outputRuleCount
+    }
+}
+
+/// Merges css-display-none rules sharing the same trigger into rules with comma separated
+/// selector lists.
+///
+/// An ignore-previous-rules rule only affects the rules before it, so rules are never merged
+/// across one. Within the rules between two of them the order does not change what is blocked,
+/// which allows the merged rules to be written where a group is full or a segment ends.
+///
+/// Merged rules are encoded from the model, so only rules whose keys are all known to it are
+/// merged. Every other rule is copied byte for byte.
+public struct FilterListOptimizer {
+    /// Default number of selectors joined into one rule.
+    public static let defaultMaximumSelectorCount = 100
+
+    private static let hidingActionType = "css-display-none"
+    private static let ignorePreviousRulesActionType = "ignore-previous-rules"
+
+    /// Upper limit for the number of selectors in a merged rule.
+    public var maximumSelectorCount: Int
+
+    public init(maximumSelectorCount: Int = FilterListOptimizer.defaultMaximumSelectorCount) {
+        self.maximumSelectorCount = max(maximumSelectorCount, 1)
+    }
+
+    /// Optimize a v1 or v2 filter list. A v2 list keeps its top level values.
+    /// - Parameters:
+    ///   - input: File URL of the list.
+    ///   - output: File URL the optimized list is written to.
+    /// - Returns: Rule counts of the input and the output.
+    /// - Throws: ABPFilterListError if the list cannot be read or written.
+    public func optimize(from input: URL,
+                         to output: URL) throws -> FilterListOptimizationResult {
+        let reader = try FilterListRuleReader(url: input)
+        guard let stream = OutputStream(url: output,
+                                        append: false)
+        else {
+            throw ABPFilterListError.invalidData
+        }
+        stream.open()
+        defer { stream.close() }
+        let writer = BufferedWriter(stream: stream)
+        let result = try optimize(reader: reader,
+                                  write: writer.write)
+        try writer.flush()
+        return result
+    }
+
+    /// Optimize the rules of a reader, writing the JSON of the resulting list in pieces.
+    func optimize(reader: FilterListRuleReader,
+                  write: @escaping (Data) throws -> Void) throws -> FilterListOptimizationResult {
+        var result = FilterListOptimizationResult()
+        let encoder = JSONEncoder()
+        let decoder = JSONDecoder()
+        var first = true
+
+        func emit(_ data: Data) throws {
+            try write(first ? Data() : FilterListOptimizer.comma)
+            try write(data)
+            first = false
+            result.outputRuleCount += 1
+        }
+
+        // Selectors of the current segment, by trigger, in order of first appearance.
+        var groupIndices = [Trigger: Int]()
+        var groups = [(trigger: Trigger, selectors: [String])]()
+
+        func emitGroup(_ trigger: Trigger, _ selectors: [String]) throws {
+            var action = Action()
+            action.type = FilterListOptimizer.hidingActionType
+            action.selector = selectors.joined(separator: ", ")
+            try emit(try encoder.encode(BlockingRule(action: action,
+                                                     trigger: trigger)))
+        }
+
+        func flushGroups() throws {
+            for group in groups where !group.selectors.isEmpty {
+                try emitGroup(group.trigger, group.selectors)
+            }
+            groups.removeAll(keepingCapacity: true)
+            groupIndices.removeAll(keepingCapacity: true)
+        }
+
+        // The reader knows the layout of the list after the first rule.
+        let firstRule = try reader.nextRuleData()
+        var writtenHeaderCount = 0
+        if reader.isVersion2 {
+            try write(Data("{".utf8))
+            for entry in reader.header {
+                try writeHeaderEntry(entry, write: write)
+                try write(FilterListOptimizer.comma)
+            }
+            writtenHeaderCount = reader.header.count
+            try write(Data("\"rules\":[".utf8))
+        } else {
+            try write(Data("[".utf8))
+        }
+
+        var next = firstRule
+        while let data = next {
+            result.inputRuleCount += 1
+            // JSONDecoder goes through JSONSerialization, see FilterListRuleReader.
+            let decoded = autoreleasepool {
+                try? decoder.decode(ModelledRule.self,
+                                    from: data)
+            }
+            let rule = decoded?.rule
+            if decoded?.isModelled == true,
+                let trigger = rule?.trigger,
+                let selector = rule?.action?.selector,
+                rule?.action?.type == FilterListOptimizer.hidingActionType {
+                let index: Int
+                if let existing = groupIndices[trigger] {
+                    index = existing
+                } else {
+                    index = groups.count
+                    groupIndices[trigger] = index
+                    groups.append((trigger: trigger, selectors: []))
+                }
+                groups[index].selectors.append(selector)
+                if groups[index].selectors.count >= maximumSelectorCount {
+                    try emitGroup(trigger, groups[index].selectors)
+                    groups[index].selectors.removeAll(keepingCapacity: true)
+                }
+            } else {
+                let type = decoded == nil ? FilterListOptimizer.actionType(of: data) : rule?.action?.type
+                if decoded == nil {
+                    result.undecodableRuleCount += 1
+                }
+                // A rule of unknown type might be an exception, nothing is moved across it.
+                if type == nil || type == FilterListOptimizer.ignorePreviousRulesActionType {
+                    try flushGroups()
+                }
+                try emit(data)
+            }
+            next = try reader.nextRuleData()
+        }
+        try flushGroups()
+
+        if reader.isVersion2 {
+            try write(Data("]".utf8))
+            for entry in reader.header[writtenHeaderCount...] {
+                try write(FilterListOptimizer.comma)
+                try writeHeaderEntry(entry, write: write)
+            }
+            try write(Data("}".utf8))
+        } else {
+            try write(Data("]".utf8))
+        }
+        return result
+    }
+
+    // ------------------------------------------------------------
+    // MARK: - Private -
+    // ------------------------------------------------------------
+
+    private static let comma = Data(",".utf8)
+
+    /// Action type of a rule the model cannot decode.
+    private static func actionType(of data: Data) -> String? {
+        return autoreleasepool {
+            let json = (try? JSONSerialization.jsonObject(with: data)) as? [String: Any]
+            return (json?["action"] as? [String: Any])?["type"] as? String
+        }
+    }
+
+    private func writeHeaderEntry(_ entry: (key: String, value: Data),
+                                  write: (Data) throws -> Void) throws {
+        try write(try JSONEncoder().encode([entry.key]).dropFirst().dropLast())
+        try write(Data(":".utf8))
+        try write(entry.value)
+    }
+}
+
+/// A rule and whether all of its keys are known to the model, so that encoding it loses nothing.
+private struct ModelledRule: Decodable {
+    private struct Key: CodingKey {
+        var stringValue: String
+        var intValue: Int? { return nil }
+
+        init?(stringValue: String) {
+            self.stringValue = stringValue
+        }
+
+        init?(intValue: Int) {
+            return nil
+        }
+    }
+
+    private static let actionKeys: Set<String> = ["selector", "type"]
+
+    let rule: BlockingRule
+    let isModelled: Bool
+
+    init(from decoder: Decoder) throws {
+        rule = try BlockingRule(from: decoder)
+        let container = try decoder.container(keyedBy: Key.self)
+        var modelled = !container.allKeys.contains { BlockingRule.CodingKeys(stringValue: $0.stringValue) == nil }
+        if modelled, let key = Key(stringValue: BlockingRule.CodingKeys.trigger.stringValue), container.contains(key) {
+            let trigger = try container.nestedContainer(keyedBy: Key.self,
+                                                        forKey: key)
+            modelled = !trigger.allKeys.contains { Trigger.CodingKeys(stringValue: $0.stringValue) == nil }
+        }
+        if modelled, let key = Key(stringValue: BlockingRule.CodingKeys.action.stringValue), container.contains(key) {
+            let action = try container.nestedContainer(keyedBy: Key.self,
+                                                       forKey: key)
+            modelled = !action.allKeys.contains { !ModelledRule.actionKeys.contains($0.stringValue) }
+        }
+        isModelled = modelled
+    }
+}
+
+/// Collects small writes and passes them to an output stream in large blocks.
+private final class BufferedWriter {
+    private let stream: OutputStream
+    private var buffer = Data()
+    private let bufferLength = 64 * 1024
+
+    init(stream: OutputStream) {
+        self.stream = stream
+        buffer.reserveCapacity(bufferLength)
+    }
+
+    func write(_ data: Data) throws {
+        buffer.append(data)
+        if buffer.count >= bufferLength {
+            try flush()
+        }
+    }
+
+    func flush() throws {
+        var offset = 0
+        while offset < buffer.count {
+            let written = buffer.withUnsafeBytes { (bytes: UnsafePointer<UInt8>) -> Int in
+                stream.write(bytes + offset, maxLength: buffer.count - offset)
+            }
+            if written <= 0 {
+                throw ABPFilterListError.invalidData
+            }
+            offset += written
+        }
+        buffer.removeAll(keepingCapacity: true)
+    }
+}
@@ -0,0 +1,332 @@
+/*
+ * This file is part of Adblock Plus <https://adblockplus.org/>,
+ * Copyright (C) 2006-present eyeo GmbH
+ *
+ * Adblock Plus is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * Adblock Plus is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Adblock Plus.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+import Foundation
+
+/// Reads the rules of a v1 or v2 filter list one at a time.
+///
+/// Only the bytes of the current rule are held in memory. A structural scan locates each rule
+/// object, which is then decoded on its own into a `BlockingRule`, so memory use depends on the
+/// size of the largest rule rather than on the size of the list. Like `V1FilterList`, rules
+/// without a trigger or an action are skipped.
+public final class FilterListRuleReader {
+    /// Default size of the chunks read from the input stream.
+    public static let defaultBufferLength = 64 * 1024
+
+    /// Keys of the v2 top level object are short, values of longer keys are not kept.
+    private static let maximumKeyLength = 64
+    private static let rulesKey = Array("rules".utf8)
+
+    private let stream: InputStream
+    private var buffer: [UInt8]
+    private var bufferCount = 0
+    private var position = 0
+    private var finished = false
+
+    // Scanner state.
+    private var depth = 0
+    private var inString = false
+    private var escaped = false
+    /// Nesting level of the rule objects, 0 until the rules array is found.
+    private var rulesDepth = 0
+    private var rulesClosed = false
+    private var key = [UInt8]()
+    private var keyTruncated = false
+    private var valueKey = [UInt8]()
+    private var headerValue = [UInt8]()
+    private var inHeaderValue = false
+
+    /// Bytes of the rule currently being scanned.
+    private var rule = [UInt8]()
+    private var inRule = false
+    private let decoder = JSONDecoder()
+
+    /// Number of rules returned so far.
+    public private(set) var ruleCount = 0
+
+    /// True if the list is a v2 object rather than a v1 array.
+    public private(set) var isVersion2 = false
+
+    /// Top level values of a v2 list other than the rules, as raw JSON in document order. Values
+    /// following the rules array are only available after all rules have been read.
+    public private(set) var header = [(key: String, value: Data)]()
+
+    /// - Parameters:
+    ///   - stream: Unopened stream with a v1 or v2 filter list.
+    ///   - bufferLength: Size of the chunks read from the stream.
+    public init(stream: InputStream,
+                bufferLength: Int = FilterListRuleReader.defaultBufferLength) {
+        self.stream = stream
+        buffer = [UInt8](repeating: 0, count: max(bufferLength, 1))
+        stream.open()
+    }
+
+    /// - Parameters:
+    ///   - url: File URL of a v1 or v2 filter list.
+    ///   - bufferLength: Size of the chunks read from the file.
+    /// - Throws: ABPFilterListError if the file cannot be opened.
+    public convenience init(url: URL,
+                            bufferLength: Int = FilterListRuleReader.defaultBufferLength) throws {
+        guard let stream = InputStream(url: url) else { throw ABPFilterListError.invalidData }
+        self.init(stream: stream,
+                  bufferLength: bufferLength)
+    }
+
+    /// - Parameters:
+    ///   - data: Bytes of a v1 or v2 filter list.
+    ///   - bufferLength: Size of the chunks scanned at once.
+    public convenience init(data: Data,
+                            bufferLength: Int = FilterListRuleReader.defaultBufferLength) {
+        self.init(stream: InputStream(data: data),
+                  bufferLength: bufferLength)
+    }
+
+    deinit {
+        stream.close()
+    }
+
+    /// - Returns: The next rule or nil when the list has been read completely.
+    /// - Throws: ABPFilterListError if the list cannot be read or is not well formed.
+    public func next() throws -> BlockingRule? {
+        while try scanNextRule() {
+            if let decoded = decodeRule() {
+                ruleCount += 1
+                return decoded
+            }
+        }
+        return nil
+    }
+
+    /// Unlike `next()`, rules without a trigger or an action are returned as well.
+    /// - Returns: The JSON of the next rule as found in the list or nil when the list has been
+    ///   read completely.
+    /// - Throws: ABPFilterListError if the list cannot be read or is not well formed.
+    public func nextRuleData() throws -> Data? {
+        guard try scanNextRule() else { return nil }
+        ruleCount += 1
+        return Data(rule)
+    }
+
+    /// Call the given closure for every remaining rule.
+    /// - Parameter body: Closure receiving each rule.
+    /// - Throws: ABPFilterListError or an error thrown by the closure.
+    public func forEachRule(_ body: (BlockingRule) throws -> Void) throws {
+        while let rule = try next() {
+            try body(rule)
+        }
+    }
+
+    // ------------------------------------------------------------
+    // MARK: - Private -
+    // ------------------------------------------------------------
+
+    /// - Returns: True if the bytes of a rule are available, false at the end of the list.
+    private func scanNextRule() throws -> Bool {
+        while !finished {
+            if position == bufferCount {
+                try fill()
+                continue
+            }
+            if try scan() {
+                return true
+            }
+        }
+        return false
+    }
+
+    private func fill() throws {
+        let read = buffer.withUnsafeMutableBufferPointer { pointer -> Int in
+            guard let base = pointer.baseAddress else { return -1 }
+            return stream.read(base, maxLength: pointer.count)
+        }
+        if read < 0 {
+            throw ABPFilterListError.invalidData
+        }
+        if read == 0 {
+            finished = true
+            // The document has to be complete and has to contain rules.
+            if depth != 0 || inString || rulesDepth == 0 {
+                throw ABPFilterListError.invalidData
+            }
+            return
+        }
+        bufferCount = read
+        position = 0
+    }
+
+    /// Scan the buffered bytes until a rule is complete or the buffer is exhausted.
+    /// - Returns: True if a rule is complete, false if more input is needed.
+    private func scan() throws -> Bool {
+        var completed = false
+        var index = position
+        try buffer.withUnsafeBufferPointer { bytes in
+            if inRule {
+                // Continue a rule started in the previous buffer.
+                scanRule(bytes, &index, &completed)
+            }
+            while index < bufferCount && !completed {
+                let byte = bytes[index]
+                index += 1
+                if inHeaderValue && (inString || depth > 1 || (byte != 0x2C && byte != 0x7D)) {
+                    appendHeaderByte(byte)
+                }
+                if inString {
+                    if escaped {
+                        escaped = false
+                    } else if byte == 0x5C { // \
+                        escaped = true
+                    } else if byte == 0x22 { // "
+                        inString = false
+                    } else if depth == 1 {
+                        appendKeyByte(byte)
+                    }
+                    continue
+                }
+                switch byte {
+                case 0x22: // "
+                    inString = true
+                    if depth == 1 {
+                        key.removeAll(keepingCapacity: true)
+                        keyTruncated = false
+                    }
+                case 0x3A: // :
+                    if depth == 1 && !keyTruncated {
+                        valueKey = key
+                        if valueKey != FilterListRuleReader.rulesKey {
+                            inHeaderValue = true
+                            headerValue.removeAll(keepingCapacity: true)
+                        }
+                    }
+                case 0x2C: // ,
+                    if depth == 1 {
+                        finishHeaderValue()
+                        valueKey.removeAll(keepingCapacity: true)
+                    }
+                case 0x7B where rulesDepth > 0 && depth == rulesDepth && !rulesClosed: // {
+                    inRule = true
+                    rule.removeAll(keepingCapacity: true)
+                    rule.append(byte)
+                    depth += 1
+                    scanRule(bytes, &index, &completed)
+                case 0x7B, 0x5B: // { [
+                    depth += 1
+                    if depth == 1 && byte == 0x7B {
+                        isVersion2 = true
+                    } else if depth == 1 && byte == 0x5B {
+                        // v1 list, the document is the rules array.
+                        rulesDepth = 1
+                    } else if depth == 2 && byte == 0x5B && rulesDepth == 0 && valueKey == FilterListRuleReader.rulesKey {
+                        // v2 list, rules are the value of the top level "rules" key.
+                        rulesDepth = 2
+                    }
+                case 0x7D, 0x5D: // } ]
+                    if depth == 0 {
+                        throw ABPFilterListError.invalidData
+                    }
+                    if depth == rulesDepth {
+                        rulesClosed = true
+                    }
+                    if depth == 1 {
+                        finishHeaderValue()
+                    }
+                    depth -= 1
+                default:
+                    break
+                }
+            }
+        }
+        position = index
+        return completed
+    }
+
+    /// Copy the bytes of the current rule until it is closed or the buffer ends.
+    private func scanRule(_ bytes: UnsafeBufferPointer<UInt8>,
+                          _ index: inout Int,
+                          _ completed: inout Bool) {
+        let start = index
+        while index < bufferCount {
+            let byte = bytes[index]
+            index += 1
+            if inString {
+                if escaped {
+                    escaped = false
+                } else if byte == 0x5C {
+                    escaped = true
+                } else if byte == 0x22 {
+                    inString = false
+                }
+                continue
+            }
+            switch byte {
+            case 0x22:
+                inString = true
+            case 0x7B, 0x5B:
+                depth += 1
+            case 0x7D, 0x5D:
+                depth -= 1
+                if depth == rulesDepth {
+                    rule.append(contentsOf: bytes[start ..< index])
+                    inRule = false
+                    completed = true
+                    return
+                }
+            default:
+                break
+            }
+        }
+        rule.append(contentsOf: bytes[start ..< index])
+    }
+
+    private func appendKeyByte(_ byte: UInt8) {
+        if key.count < FilterListRuleReader.maximumKeyLength {
+            key.append(byte)
+        } else {
+            keyTruncated = true
+        }
+    }
+
+    private func appendHeaderByte(_ byte: UInt8) {
+        // Skip whitespace between the colon and the value.
+        if headerValue.isEmpty && (byte == 0x20 || byte == 0x0A || byte == 0x0D || byte == 0x09) {
+            return
+        }
+        headerValue.append(byte)
+    }
+
+    private func finishHeaderValue() {
+        if inHeaderValue {
+            header.append((key: String(decoding: valueKey, as: UTF8.self),
+                           value: Data(headerValue)))
+            inHeaderValue = false
+        }
+    }
+
+    private func decodeRule() -> BlockingRule? {
+        // JSONDecoder goes through JSONSerialization, whose objects would otherwise stay in the
+        // caller's autorelease pool until all rules are read.
+        let decoded = autoreleasepool {
+            try? decoder.decode(BlockingRule.self,
+                                from: Data(rule))
+        }
+        guard let uwDecoded = decoded,
+            uwDecoded.trigger != nil && uwDecoded.action != nil
+        else {
+            return nil
+        }
+        return uwDecoded
+    }
+}
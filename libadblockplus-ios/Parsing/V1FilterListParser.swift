@@ -29,7 +29,7 @@ enum TriggerResourceType: String, Codable {
     case popup
 }
 
-struct Trigger: Decodable {
+struct Trigger: Codable {
     var ifDomain: [String]?
     var loadType: [String]?
     var resourceType: [TriggerResourceType]?
@@ -48,15 +48,49 @@ struct Trigger: Decodable {
     }
 }
 
-struct Action: Decodable {
+/// Triggers are equal if all of their keys are equal. Used to group rules sharing a trigger.
+extension Trigger: Hashable {
+    static func == (lhs: Trigger, rhs: Trigger) -> Bool {
+        return equalArrays(lhs.ifDomain, rhs.ifDomain)
+            && equalArrays(lhs.loadType, rhs.loadType)
+            && equalArrays(lhs.resourceType, rhs.resourceType)
+            && equalArrays(lhs.unlessDomain, rhs.unlessDomain)
+            && lhs.urlFilter == rhs.urlFilter
+            && lhs.urlFilterIsCaseSensitive == rhs.urlFilterIsCaseSensitive
+    }
+
+    var hashValue: Int {
+        var hash = urlFilter?.hashValue ?? 0
+        for domain in ifDomain ?? [] {
+            hash = hash &* 31 &+ domain.hashValue
+        }
+        for domain in unlessDomain ?? [] {
+            hash = hash &* 31 &+ domain.hashValue
+        }
+        return hash &* 31 &+ (resourceType?.count ?? -1)
+    }
+
+    private static func equalArrays<T: Equatable>(_ lhs: [T]?, _ rhs: [T]?) -> Bool {
+        switch (lhs, rhs) {
+        case let (left?, right?):
+            return left == right
+        case (nil, nil):
+            return true
+        default:
+            return false
+        }
+    }
+}
+
+struct Action: Codable {
     // Keys here are intended to be comprehensive for WebKit content-blocking actions.
     var selector: String?
     var type: String?
 }
 
 /// A filter list WebKit content blocking rule.
-/// Used for decoding individual rules.
-public struct BlockingRule: Decodable {
+/// Used for decoding and encoding individual rules.
+public struct BlockingRule: Codable {
     var action: Action?
     var trigger: Trigger?
 